@@ -274,7 +274,12 @@ bool ValidateAccumulatorCheckpoint(const CBlock& block, CBlockIndex* pindex, Acc
     return true;
 }
 
-bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError)
+/**
+ * Where the witness of coin starts: the block whose checkpoint it is initialized from (0 if the
+ * chain is not there yet), the height of its mint, the first block accumulated and the value of
+ * that checkpoint (0 if unknown).
+ */
+static bool GetWitnessStart(const PublicCoin& coin, uint256& hashBlockCheckpoint, int& nHeightMintAdded, int& nAccStartHeight, CBigNum& bnAccValue)
 {
     uint256 txid;
     if (!zerocoinDB->ReadCoinMint(coin.getValue(), txid)) {
@@ -289,10 +294,17 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
         return false;
     }
 
-    int nHeightMintAdded= mapBlockIndex[hashBlock]->nHeight;
+    BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) {
+        LogPrint("zero","%s mint is not in the active chain\n", __func__);
+        return false;
+    }
+
+    nHeightMintAdded = mi->second->nHeight;
     uint256 nCheckpointBeforeMint = 0;
     CBlockIndex* pindex = chainActive[nHeightMintAdded];
     int nChanges = 0;
+    hashBlockCheckpoint = 0;
 
     //find the checksum when this was added to the accumulator officially, which will be two checksum changes later
     //reminder that checksums are generated when the block height is a multiple of 10
@@ -308,6 +320,7 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
 
             if (nChanges == 1) {
                 nCheckpointBeforeMint = pindex->nAccumulatorCheckpoint;
+                hashBlockCheckpoint = pindex->GetBlockHash();
                 break;
             }
         }
@@ -315,7 +328,7 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     }
 
     //the height to start accumulating coins to add to witness
-    int nAccStartHeight = nHeightMintAdded - (nHeightMintAdded % 10);
+    nAccStartHeight = nHeightMintAdded - (nHeightMintAdded % 10);
 
     //PIVX: If the checkpoint is from the recalculated checkpoint period, then adjust it
     /*int nHeight_LastGoodCheckpoint = Params().Zerocoin_Block_LastGoodCheckpoint();
@@ -327,40 +340,233 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
     }*/
 
     //Get the accumulator that is right before the cluster of blocks containing our mint was added to the accumulator
-    CBigNum bnAccValue = 0;
-    if (GetAccumulatorValueFromDB(nCheckpointBeforeMint, coin.getDenomination(), bnAccValue)) {
-        if (bnAccValue > 0) {
-            accumulator.setValue(bnAccValue);
-            witness.resetValue(accumulator, coin);
+    bnAccValue = 0;
+    if (!GetAccumulatorValueFromDB(nCheckpointBeforeMint, coin.getDenomination(), bnAccValue))
+        bnAccValue = 0;
+
+    return true;
+}
+
+/** Whether the witness counts pindex as a block on which a new accumulator checkpoint was added */
+static bool IsWitnessCheckpointChange(const CBlockIndex* pindex, int nAccStartHeight)
+{
+    return pindex->nHeight != nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint;
+}
+
+/** The pubcoins of the block at pindex that go into the witness of coin */
+static bool GetWitnessValuesFromBlock(const CBlockIndex* pindex, const PublicCoin& coin, int nHeightMintAdded, std::vector<CBigNum>& vValues)
+{
+    //grab mints from this block
+    CBlock block;
+    if(!ReadBlockFromDisk(block, pindex)) {
+        LogPrintf("%s: failed to read block from disk while adding pubcoins to witness\n", __func__);
+        return false;
+    }
+
+    list<PublicCoin> listPubcoins;
+    if(!BlockToPubcoinList(block, listPubcoins)) {
+        LogPrintf("%s: failed to get zerocoin mintlist from block %d\n", __func__, pindex->nHeight);
+        return false;
+    }
+
+    for (const PublicCoin& pubcoin : listPubcoins) {
+        if (pubcoin.getDenomination() != coin.getDenomination())
+            continue;
+
+        if (pindex->nHeight == nHeightMintAdded && pubcoin.getValue() == coin.getValue())
+            continue;
+
+        vValues.push_back(pubcoin.getValue());
+    }
+    return true;
+}
+
+/**
+ * Undo whatever a reorganisation invalidated in cache, going back to the last state that only
+ * depends on blocks still in the active chain. False if it has to be built again from the mint.
+ */
+static bool RewindAccumulatorWitnessCache(CAccumulatorWitnessCache& cache)
+{
+    if (cache.IsNull())
+        return false;
+
+    BlockMap::iterator mi = mapBlockIndex.find(cache.hashBlockCheckpoint);
+    if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+        return false;
+
+    mi = mapBlockIndex.find(cache.hashBlockLast);
+    if (mi == mapBlockIndex.end())
+        return false;
+
+    const CBlockIndex* pindexFork = chainActive.FindFork(mi->second);
+    if (!pindexFork)
+        return false;
+    if (cache.state.nHeight <= pindexFork->nHeight + 1)
+        return true;
+
+    // A checkpoint state is dropped along with the block on which its checkpoint change was seen,
+    // as that block is processed again from the state itself
+    while (!cache.vCheckpointStates.empty() && cache.vCheckpointStates.back().nHeight > pindexFork->nHeight + 1)
+        cache.vCheckpointStates.pop_back();
+    if (cache.vCheckpointStates.empty())
+        return false;
+
+    cache.state = cache.vCheckpointStates.back();
+    cache.nCheckpointsAdded = cache.vCheckpointStates.size() - 1;
+    cache.vCheckpointStates.pop_back();
+    cache.hashBlockLast = chainActive[cache.state.nHeight - 1]->GetBlockHash();
+    return true;
+}
+
+/**
+ * Bring the cached witness of coin to WITNESS_CACHE_DEPTH blocks below the tip, rewinding it first
+ * if the chain was reorganised. Requires cs_main. Returns true if cache changed and should be written.
+ */
+bool UpdateAccumulatorWitnessCache(const PublicCoin& coin, CAccumulatorWitnessCache& cache)
+{
+    int nHeightTarget = chainActive.Height() - WITNESS_CACHE_DEPTH;
+    bool fChanged = false;
+
+    CAccumulatorWitnessCache cacheBefore = cache;
+    if (!RewindAccumulatorWitnessCache(cache)) {
+        fChanged = !cache.IsNull();
+        cache.SetNull();
+
+        uint256 hashBlockCheckpoint;
+        int nHeightMintAdded, nAccStartHeight;
+        CBigNum bnAccValue;
+        if (!GetWitnessStart(coin, hashBlockCheckpoint, nHeightMintAdded, nAccStartHeight, bnAccValue))
+            return fChanged;
+
+        // not deep enough in the chain yet
+        if (hashBlockCheckpoint == 0 || nAccStartHeight >= nHeightTarget)
+            return fChanged;
+
+        cache.hashBlockCheckpoint = hashBlockCheckpoint;
+        cache.nHeightMintAdded = nHeightMintAdded;
+        cache.nAccStartHeight = nAccStartHeight;
+        cache.state.nHeight = nAccStartHeight;
+        if (bnAccValue > 0)
+            cache.state.bnWitness = bnAccValue;
+        else
+            cache.state.bnWitness = Accumulator(Params().Zerocoin_Params(), coin.getDenomination()).getValue();
+        cache.hashBlockLast = chainActive[nAccStartHeight - 1]->GetBlockHash();
+        fChanged = true;
+    } else if (cache.state.nHeight != cacheBefore.state.nHeight) {
+        fChanged = true;
+    }
+
+    Accumulator accWitness(Params().Zerocoin_Params(), coin.getDenomination());
+    accWitness.setValue(cache.state.bnWitness);
+    AccumulatorWitness witness(Params().Zerocoin_Params(), accWitness, coin);
+
+    int nBlockReads = 0;
+    while (cache.state.nHeight < nHeightTarget && nBlockReads < WITNESS_CACHE_MAX_BLOCK_READS) {
+        CBlockIndex* pindex = chainActive[cache.state.nHeight];
+
+        std::vector<CBigNum> vValues;
+        if (pindex->MintedDenomination(coin.getDenomination())) {
+            if (!GetWitnessValuesFromBlock(pindex, coin, cache.nHeightMintAdded, vValues))
+                break;
+            ++nBlockReads;
         }
+
+        if (IsWitnessCheckpointChange(pindex, cache.nAccStartHeight) && ++cache.nCheckpointsAdded < ZEROCOIN_SECURITY_LEVEL_MAX) {
+            CAccumulatorWitnessState stateCheckpoint = cache.state;
+            stateCheckpoint.bnWitness = witness.getValue();
+            cache.vCheckpointStates.push_back(stateCheckpoint);
+        }
+
+        for (const CBigNum& bnValue : vValues)
+            witness.addRawValue(bnValue);
+        cache.state.nMintsAdded += vValues.size();
+        cache.state.nHeight++;
+        fChanged = true;
+    }
+
+    cache.state.bnWitness = witness.getValue();
+    cache.hashBlockLast = chainActive[cache.state.nHeight - 1]->GetBlockHash();
+    return fChanged;
+}
+
+/**
+ * Whether a cache whose state is at nHeight, with hashBlockLast below it, has nothing to add on the
+ * active chain, so UpdateAccumulatorWitnessCache would leave it as it is. Requires cs_main.
+ */
+bool IsAccumulatorWitnessCacheCurrent(int nHeight, const uint256& hashBlockLast)
+{
+    if (nHeight < 1 || nHeight < chainActive.Height() - WITNESS_CACHE_DEPTH || nHeight > chainActive.Height() + 1)
+        return false;
+    return chainActive[nHeight - 1]->GetBlockHash() == hashBlockLast;
+}
+
+bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator, AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, string& strError, const CAccumulatorWitnessCache* pcache)
+{
+    uint256 hashBlockCheckpoint;
+    int nHeightMintAdded, nAccStartHeight;
+    CBigNum bnAccValue = 0;
+    if (!GetWitnessStart(coin, hashBlockCheckpoint, nHeightMintAdded, nAccStartHeight, bnAccValue))
+        return false;
+
+    if (bnAccValue > 0) {
+        accumulator.setValue(bnAccValue);
+        witness.resetValue(accumulator, coin);
     }
 
     //security level: this is an important prevention of tracing the coins via timing. Security level represents how many checkpoints
     //of accumulated coins are added *beyond* the checkpoint that the mint being spent was added too. If each spend added the exact same
     //amounts of checkpoints after the mint was accumulated, then you could know the range of blocks that the mint originated from.
-    if (nSecurityLevel < 100) {
+    if (nSecurityLevel < ZEROCOIN_SECURITY_LEVEL_MAX) {
         //add some randomness to the user's selection so that it is not always the same
         nSecurityLevel += CBigNum::randBignum(10).getint();
 
         //security level 100 represents adding all available coins that have been accumulated - user did not select this
-        if (nSecurityLevel >= 100)
-            nSecurityLevel = 99;
+        if (nSecurityLevel >= ZEROCOIN_SECURITY_LEVEL_MAX)
+            nSecurityLevel = ZEROCOIN_SECURITY_LEVEL_MAX - 1;
     }
 
-    //add the pubcoins (zerocoinmints that have been published to the chain) up to the next checksum starting from the block
-    pindex = chainActive[nAccStartHeight];
     int nChainHeight = chainActive.Height();
     int nHeightStop = nChainHeight % 10;
     nHeightStop = nChainHeight - nHeightStop - 20; // at least two checkpoints deep
+
+    //skip the blocks already in the cached witness, from the furthest cached state that is before this spend stops accumulating
+    CAccumulatorWitnessState stateStart;
+    stateStart.nHeight = nAccStartHeight;
     int nCheckpointsAdded = 0;
-    nMintsAdded = 0;
+    if (pcache && hashBlockCheckpoint != 0 && pcache->hashBlockCheckpoint == hashBlockCheckpoint) {
+        CAccumulatorWitnessCache cache = *pcache;
+        if (RewindAccumulatorWitnessCache(cache)) {
+            for (unsigned int i = 0; i < cache.vCheckpointStates.size(); i++) {
+                const CAccumulatorWitnessState& stateCheckpoint = cache.vCheckpointStates[i];
+                if (stateCheckpoint.nHeight > nHeightStop || (nSecurityLevel != ZEROCOIN_SECURITY_LEVEL_MAX && (int)i >= nSecurityLevel))
+                    break;
+                stateStart = stateCheckpoint;
+                nCheckpointsAdded = i;
+            }
+            if (cache.state.nHeight <= nHeightStop && cache.state.nHeight > stateStart.nHeight &&
+                (nSecurityLevel == ZEROCOIN_SECURITY_LEVEL_MAX || cache.nCheckpointsAdded < nSecurityLevel)) {
+                stateStart = cache.state;
+                nCheckpointsAdded = cache.nCheckpointsAdded;
+            }
+        }
+    }
+    if (stateStart.nHeight != nAccStartHeight) {
+        Accumulator accWitness = accumulator;
+        accWitness.setValue(stateStart.bnWitness);
+        witness.resetValue(accWitness, coin);
+        LogPrint("zero","%s : resuming witness from cached block %d\n", __func__, stateStart.nHeight);
+    }
+
+    //add the pubcoins (zerocoinmints that have been published to the chain) up to the next checksum starting from the block
+    CBlockIndex* pindex = chainActive[stateStart.nHeight];
+    nMintsAdded = stateStart.nMintsAdded;
     while (pindex->nHeight < nHeightStop + 1) {
-        if (pindex->nHeight != nAccStartHeight && pindex->pprev->nAccumulatorCheckpoint != pindex->nAccumulatorCheckpoint)
+        if (IsWitnessCheckpointChange(pindex, nAccStartHeight))
             ++nCheckpointsAdded;
 
         //if a new checkpoint was generated on this block, and we have added the specified amount of checkpointed accumulators,
         //then initialize the accumulator at this point and break
-        if ((pindex->nHeight >= nHeightStop || (nSecurityLevel != 100 && nCheckpointsAdded >= nSecurityLevel))) {
+        if ((pindex->nHeight >= nHeightStop || (nSecurityLevel != ZEROCOIN_SECURITY_LEVEL_MAX && nCheckpointsAdded >= nSecurityLevel))) {
             uint32_t nChecksum = ParseChecksum(chainActive[pindex->nHeight + 10]->nAccumulatorCheckpoint, coin.getDenomination());
             CBigNum bnAccValue = 0;
             if (!zerocoinDB->ReadAccumulatorValue(nChecksum, bnAccValue)) {
@@ -373,28 +579,13 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
 
         // if this block contains mints of the denomination that is being spent, then add them to the witness
         if (pindex->MintedDenomination(coin.getDenomination())) {
-            //grab mints from this block
-            CBlock block;
-            if(!ReadBlockFromDisk(block, pindex)) {
-                LogPrintf("%s: failed to read block from disk while adding pubcoins to witness\n", __func__);
-                return false;
-            }
-
-            list<PublicCoin> listPubcoins;
-            if(!BlockToPubcoinList(block, listPubcoins)) {
-                LogPrintf("%s: failed to get zerocoin mintlist from block %n\n", __func__, pindex->nHeight);
+            std::vector<CBigNum> vValues;
+            if (!GetWitnessValuesFromBlock(pindex, coin, nHeightMintAdded, vValues))
                 return false;
-            }
 
             //add the mints to the witness
-            for (const PublicCoin pubcoin : listPubcoins) {
-                if (pubcoin.getDenomination() != coin.getDenomination())
-                    continue;
-
-                if (pindex->nHeight == nHeightMintAdded && pubcoin.getValue() == coin.getValue())
-                    continue;
-
-                witness.addRawValue(pubcoin.getValue());
+            for (const CBigNum& bnValue : vValues) {
+                witness.addRawValue(bnValue);
                 ++nMintsAdded;
             }
         }
@@ -410,10 +601,10 @@ bool GenerateAccumulatorWitness(const PublicCoin &coin, Accumulator& accumulator
 
     // calculate how many mints of this denomination existed in the accumulator we initialized
     int nZerocoinStartHeight = GetZerocoinStartHeight();
-    pindex = chainActive[nZerocoinStartHeight];
-    while (pindex->nHeight < nAccStartHeight) {
-        nMintsAdded += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), coin.getDenomination());
-        pindex = chainActive[pindex->nHeight + 1];
+    if (nAccStartHeight > nZerocoinStartHeight) {
+        nMintsAdded += chainActive[nAccStartHeight - 1]->GetZerocoinMintCount(coin.getDenomination());
+        if (nZerocoinStartHeight > 0)
+            nMintsAdded -= chainActive[nZerocoinStartHeight - 1]->GetZerocoinMintCount(coin.getDenomination());
     }
 
     LogPrint("zero","%s : %d mints added to witness\n", __func__, nMintsAdded);
@@ -11,9 +11,92 @@
 #include "primitives/zerocoin.h"
 #include "accumulatormap.h"
 #include "chain.h"
+#include "serialize.h"
 #include "uint256.h"
 
-bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError);
+/** Security levels below this take the witness up to a given number of checkpoints; this one takes it as far as possible */
+static const int ZEROCOIN_SECURITY_LEVEL_MAX = 100;
+/** Blocks below the tip that a cached witness is kept at, so it is never past where a spend stops accumulating */
+static const int WITNESS_CACHE_DEPTH = 30;
+/** Blocks with mints read from disk by one UpdateAccumulatorWitnessCache call, so catching up never stalls cs_main for long */
+static const int WITNESS_CACHE_MAX_BLOCK_READS = 500;
+
+/** A witness part way through the chain: the mints of every block below nHeight have been added */
+class CAccumulatorWitnessState
+{
+public:
+    int nHeight;
+    CBigNum bnWitness;
+    int nMintsAdded;
+
+    CAccumulatorWitnessState() : nHeight(0), bnWitness(0), nMintsAdded(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nHeight);
+        READWRITE(bnWitness);
+        READWRITE(nMintsAdded);
+    }
+};
+
+/**
+ * Witness of a wallet mint, advanced a block at a time as the chain grows
+ * (see UpdateAccumulatorWitnessCache) so that a spend only has to add the
+ * last few blocks. The state where each of the first checkpoint changes was
+ * reached is kept as well, for spends below ZEROCOIN_SECURITY_LEVEL_MAX.
+ */
+class CAccumulatorWitnessCache
+{
+public:
+    uint256 hashBlockCheckpoint;
+    int nHeightMintAdded;
+    int nAccStartHeight;
+    CAccumulatorWitnessState state;
+    int nCheckpointsAdded;
+    //! block state.nHeight - 1, to find where a reorganisation left the cache
+    uint256 hashBlockLast;
+    //! element k - 1 is the state just before the block on which the k-th checkpoint change was seen
+    std::vector<CAccumulatorWitnessState> vCheckpointStates;
+
+    CAccumulatorWitnessCache()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        hashBlockCheckpoint = 0;
+        nHeightMintAdded = 0;
+        nAccStartHeight = 0;
+        state = CAccumulatorWitnessState();
+        nCheckpointsAdded = 0;
+        hashBlockLast = 0;
+        vCheckpointStates.clear();
+    }
+
+    bool IsNull() const { return hashBlockCheckpoint == 0; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(hashBlockCheckpoint);
+        READWRITE(nHeightMintAdded);
+        READWRITE(nAccStartHeight);
+        READWRITE(state);
+        READWRITE(nCheckpointsAdded);
+        READWRITE(hashBlockLast);
+        READWRITE(vCheckpointStates);
+    }
+};
+
+bool GenerateAccumulatorWitness(const libzerocoin::PublicCoin &coin, libzerocoin::Accumulator& accumulator, libzerocoin::AccumulatorWitness& witness, int nSecurityLevel, int& nMintsAdded, std::string& strError, const CAccumulatorWitnessCache* pcache = NULL);
+bool UpdateAccumulatorWitnessCache(const libzerocoin::PublicCoin& coin, CAccumulatorWitnessCache& cache);
+bool IsAccumulatorWitnessCacheCurrent(int nHeight, const uint256& hashBlockLast);
 bool GetAccumulatorValueFromDB(uint256 nCheckpoint, libzerocoin::CoinDenomination denom, CBigNum& bnAccValue);
 bool GetAccumulatorValueFromChecksum(uint32_t nChecksum, bool fMemoryOnly, CBigNum& bnAccValue);
 void AddAccumulatorChecksum(const uint32_t nChecksum, const CBigNum &bnValue, bool fMemoryOnly);
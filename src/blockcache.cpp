@@ -0,0 +1,99 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "primitives/block.h"
+#include "streams.h"
+#include "version.h"
+
+CBlockMessageCache::CBlockMessageCache(size_t nMaxBytesIn) : nBytes(0), nMaxBytes(nMaxBytesIn), nHits(0), nMisses(0)
+{
+}
+
+void CBlockMessageCache::Trim()
+{
+    while (nBytes > nMaxBytes && !listBlocks.empty()) {
+        nBytes -= listBlocks.back().second->size();
+        mapBlocks.erase(listBlocks.back().first);
+        listBlocks.pop_back();
+    }
+}
+
+bool CBlockMessageCache::Get(const uint256& hash, CSharedNetMsg& msg)
+{
+    LOCK(cs);
+    std::map<uint256, lru_list::iterator>::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end()) {
+        nMisses++;
+        return false;
+    }
+    nHits++;
+    listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+    msg = it->second->second;
+    return true;
+}
+
+void CBlockMessageCache::Insert(const uint256& hash, const CSharedNetMsg& msg)
+{
+    LOCK(cs);
+    if (msg->size() > nMaxBytes || mapBlocks.count(hash))
+        return;
+    listBlocks.push_front(std::make_pair(hash, msg));
+    mapBlocks[hash] = listBlocks.begin();
+    nBytes += msg->size();
+    Trim();
+}
+
+void CBlockMessageCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    LOCK(cs);
+    nMaxBytes = nMaxBytesIn;
+    Trim();
+}
+
+void CBlockMessageCache::Clear()
+{
+    LOCK(cs);
+    listBlocks.clear();
+    mapBlocks.clear();
+    nBytes = 0;
+}
+
+size_t CBlockMessageCache::GetTotalBytes() const
+{
+    LOCK(cs);
+    return nBytes;
+}
+
+size_t CBlockMessageCache::size() const
+{
+    LOCK(cs);
+    return mapBlocks.size();
+}
+
+uint64_t CBlockMessageCache::GetHits() const
+{
+    LOCK(cs);
+    return nHits;
+}
+
+uint64_t CBlockMessageCache::GetMisses() const
+{
+    LOCK(cs);
+    return nMisses;
+}
+
+bool GetBlockFromMessage(CBlock& block, const CSharedNetMsg& msg)
+{
+    if (!msg || msg->size() <= CMessageHeader::HEADER_SIZE)
+        return false;
+    try {
+        CDataStream ss(msg->begin() + CMessageHeader::HEADER_SIZE, msg->end(), SER_NETWORK, PROTOCOL_VERSION);
+        ss >> block;
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "net.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+
+class CBlock;
+
+//! Default for -blockservecache, in MiB
+static const int64_t DEFAULT_BLOCK_SERVE_CACHE_SIZE = 32;
+
+/**
+ * Recently served blocks, as the serialized "block" message they are sent to peers in: the message header,
+ * then the block exactly as it is stored on disk. Bounded by the total size of the messages, the least
+ * recently used one is dropped first. Blocks never change, so nothing needs invalidating.
+ */
+class CBlockMessageCache
+{
+private:
+    typedef std::list<std::pair<uint256, CSharedNetMsg> > lru_list;
+
+    mutable CCriticalSection cs;
+    //! Most recently used first
+    lru_list listBlocks;
+    std::map<uint256, lru_list::iterator> mapBlocks;
+    size_t nBytes;
+    size_t nMaxBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    void Trim();
+
+public:
+    explicit CBlockMessageCache(size_t nMaxBytesIn);
+
+    bool Get(const uint256& hash, CSharedNetMsg& msg);
+    void Insert(const uint256& hash, const CSharedNetMsg& msg);
+    void SetMaxBytes(size_t nMaxBytesIn);
+    void Clear();
+
+    size_t GetTotalBytes() const;
+    size_t size() const;
+    uint64_t GetHits() const;
+    uint64_t GetMisses() const;
+};
+
+/** Deserialize the block in a "block" message */
+bool GetBlockFromMessage(CBlock& block, const CSharedNetMsg& msg);
+
+#endif // BITCOIN_BLOCKCACHE_H
@@ -0,0 +1,112 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockdownload.h"
+
+#include "chain.h"
+#include "main.h"
+#include "serialize.h"
+#include "version.h"
+
+#include <algorithm>
+
+int64_t UpdateBlockTimeAvg(int64_t nBlockTimeAvg, int64_t nSample)
+{
+    nSample = std::max<int64_t>(1, nSample);
+    return nBlockTimeAvg == 0 ? nSample : (7 * nBlockTimeAvg + nSample) / 8;
+}
+
+int GetBlocksInFlightLimit(int64_t nBlockTimeAvg)
+{
+    if (nBlockTimeAvg == 0)
+        return DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nLimit = 1000000LL * BLOCKS_IN_TRANSIT_SECONDS / nBlockTimeAvg;
+    return std::max<int64_t>(MIN_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(MAX_BLOCKS_IN_TRANSIT_PER_PEER, nLimit));
+}
+
+int64_t GetBlockStallingTimeout(int nBlocksInFlight, int64_t nBlockTimeAvg)
+{
+    int64_t nTimeout = 2 * nBlocksInFlight * nBlockTimeAvg;
+    return std::max<int64_t>(1000000LL * BLOCK_STALLING_TIMEOUT, std::min<int64_t>(1000000LL * MAX_BLOCK_STALLING_TIMEOUT, nTimeout));
+}
+
+bool IsBlockDownloadStalled(int64_t nStallingSince, int64_t nNow, int nBlocksInFlight, int64_t nBlockTimeAvg)
+{
+    return nStallingSince && nStallingSince < nNow - GetBlockStallingTimeout(nBlocksInFlight, nBlockTimeAvg);
+}
+
+int GetBlockDownloadWindow(const std::vector<int64_t>& vBlockTimeAvg)
+{
+    // In thousandths of a block per second, so slow peers still count
+    int64_t nRate = 0;
+    for (std::vector<int64_t>::const_iterator it = vBlockTimeAvg.begin(); it != vBlockTimeAvg.end(); it++) {
+        if (*it > 0)
+            nRate += 1000000000LL / *it;
+    }
+    int64_t nWindow = nRate * BLOCK_DOWNLOAD_WINDOW_SECONDS / 1000;
+    return std::max<int64_t>(BLOCK_DOWNLOAD_WINDOW, std::min<int64_t>(MAX_BLOCK_DOWNLOAD_WINDOW, nWindow));
+}
+
+CPendingBlocks::CPendingBlocks(size_t nMaxSizeIn, int64_t nExpiryIn) : nSize(0), nMaxSize(nMaxSizeIn), nExpiry(nExpiryIn)
+{
+}
+
+void CPendingBlocks::Erase(entry_iterator it)
+{
+    std::pair<std::multimap<const CBlockIndex*, const CBlockIndex*>::iterator, std::multimap<const CBlockIndex*, const CBlockIndex*>::iterator> range = mapByPrev.equal_range(it->first->pprev);
+    for (; range.first != range.second; range.first++) {
+        if (range.first->second == it->first) {
+            mapByPrev.erase(range.first);
+            break;
+        }
+    }
+    nSize -= ::GetSerializeSize(it->second.block, SER_NETWORK, PROTOCOL_VERSION);
+    mapBlocks.erase(it);
+}
+
+bool CPendingBlocks::Add(CBlockIndex* pindex, const CBlock& block, NodeId nodeid, int64_t nNow)
+{
+    if (mapBlocks.count(pindex))
+        return false;
+
+    size_t nBlockSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    while (nSize + nBlockSize > nMaxSize && !mapBlocks.empty()) {
+        entry_iterator itEvict = mapBlocks.begin();
+        for (entry_iterator it = mapBlocks.begin(); it != mapBlocks.end(); it++) {
+            if (it->second.nTime < nNow - nExpiry) {
+                itEvict = it;
+                break;
+            }
+            if (it->first->nHeight > itEvict->first->nHeight)
+                itEvict = it;
+        }
+        if (itEvict->first->nHeight < pindex->nHeight && itEvict->second.nTime >= nNow - nExpiry)
+            return false;
+        Erase(itEvict);
+    }
+    if (nSize + nBlockSize > nMaxSize)
+        return false;
+
+    CEntry& entry = mapBlocks[pindex];
+    entry.pindex = pindex;
+    entry.block = block;
+    entry.nodeid = nodeid;
+    entry.nTime = nNow;
+    mapByPrev.insert(std::make_pair(pindex->pprev, pindex));
+    nSize += nBlockSize;
+    return true;
+}
+
+void CPendingBlocks::TakeChildren(const CBlockIndex* pindexPrev, std::vector<CEntry>& vChildren)
+{
+    std::pair<std::multimap<const CBlockIndex*, const CBlockIndex*>::iterator, std::multimap<const CBlockIndex*, const CBlockIndex*>::iterator> range = mapByPrev.equal_range(pindexPrev);
+    std::vector<const CBlockIndex*> vIndexes;
+    for (; range.first != range.second; range.first++)
+        vIndexes.push_back(range.first->second);
+    for (std::vector<const CBlockIndex*>::iterator it = vIndexes.begin(); it != vIndexes.end(); it++) {
+        entry_iterator itEntry = mapBlocks.find(*it);
+        vChildren.push_back(itEntry->second);
+        Erase(itEntry);
+    }
+}
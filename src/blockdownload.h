@@ -0,0 +1,75 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKDOWNLOAD_H
+#define BITCOIN_BLOCKDOWNLOAD_H
+
+#include "net.h"
+#include "primitives/block.h"
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+class CBlockIndex;
+
+/** Moving average of a peer's microseconds per block, with a new sample; 0 means not measured yet. */
+int64_t UpdateBlockTimeAvg(int64_t nBlockTimeAvg, int64_t nSample);
+/** Number of blocks a peer may have in flight: what it delivers in BLOCKS_IN_TRANSIT_SECONDS. */
+int GetBlocksInFlightLimit(int64_t nBlockTimeAvg);
+/** Microseconds a peer may stall the download window: twice what its blocks in flight should take, so one
+ *  with a deep queue is not dropped for being busy, and a slow one does not hold the others up for long. */
+int64_t GetBlockStallingTimeout(int nBlocksInFlight, int64_t nBlockTimeAvg);
+/** Whether a peer that has been stalling the download window since nStallingSince (0 if not) is to be dropped. */
+bool IsBlockDownloadStalled(int64_t nStallingSince, int64_t nNow, int nBlocksInFlight, int64_t nBlockTimeAvg);
+/** Size of the download window, from the combined throughput of all peers, given as their microseconds per block. */
+int GetBlockDownloadWindow(const std::vector<int64_t>& vBlockTimeAvg);
+
+/**
+ * Blocks that arrived before their parent. Blocks are accepted in order, so
+ * these wait until the one before them is in. Bounded by the serialized size
+ * of the blocks: when full, expired blocks go first, then those furthest
+ * ahead, which are downloaded again once they fit.
+ *
+ * Not thread safe; main.cpp keeps one under cs_main.
+ */
+class CPendingBlocks
+{
+public:
+    struct CEntry {
+        CBlockIndex* pindex;
+        CBlock block;
+        //! Peer that sent it
+        NodeId nodeid;
+        //! Time of arrival in seconds
+        int64_t nTime;
+    };
+
+    CPendingBlocks(size_t nMaxSizeIn, int64_t nExpiryIn);
+
+    /** Keep a block; false if it is already kept or there is no room for it */
+    bool Add(CBlockIndex* pindex, const CBlock& block, NodeId nodeid, int64_t nNow);
+    bool Contains(const CBlockIndex* pindex) const { return mapBlocks.count(pindex) > 0; }
+    /** Remove the blocks whose parent is pindexPrev, and append them to vChildren */
+    void TakeChildren(const CBlockIndex* pindexPrev, std::vector<CEntry>& vChildren);
+
+    /** Whether only blocks that can be accepted right away are worth fetching */
+    bool IsFull() const { return nSize >= nMaxSize; }
+    size_t GetSize() const { return nSize; }
+    size_t size() const { return mapBlocks.size(); }
+
+private:
+    typedef std::map<const CBlockIndex*, CEntry>::iterator entry_iterator;
+
+    std::map<const CBlockIndex*, CEntry> mapBlocks;
+    std::multimap<const CBlockIndex*, const CBlockIndex*> mapByPrev;
+    //! Serialized size of the blocks kept
+    size_t nSize;
+    size_t nMaxSize;
+    int64_t nExpiry;
+
+    void Erase(entry_iterator it);
+};
+
+#endif // BITCOIN_BLOCKDOWNLOAD_H
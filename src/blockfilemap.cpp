@@ -0,0 +1,112 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "main.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::CMappedFile() : pdata(NULL), nSize(0)
+{
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    if (pdata)
+        munmap((void*)pdata, nSize);
+#endif
+}
+
+bool CMappedFile::Open(const boost::filesystem::path& path)
+{
+#ifndef WIN32
+    if (pdata)
+        return false;
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid without the descriptor
+    close(fd);
+    if (p == MAP_FAILED)
+        return false;
+    pdata = (const char*)p;
+    nSize = st.st_size;
+    return true;
+#else
+    return false;
+#endif
+}
+
+CBlockFileMap::CBlockFileMap() : nFirstOpenFile(0), fEnabled(false)
+{
+}
+
+CMappedFileRef CBlockFileMap::Get(const CDiskBlockPos& pos, const char* prefix, unsigned int nMinSize)
+{
+    if (!fEnabled || pos.IsNull() || pos.nFile >= nFirstOpenFile)
+        return CMappedFileRef();
+    uint64_t nEnd = (uint64_t)pos.nPos + nMinSize;
+    file_key key(prefix, pos.nFile);
+
+    LOCK(cs);
+    std::map<file_key, lru_list::iterator>::iterator it = mapFiles.find(key);
+    if (it != mapFiles.end()) {
+        if (it->second->second->size() >= nEnd) {
+            listFiles.splice(listFiles.begin(), listFiles, it->second);
+            return listFiles.front().second;
+        }
+        // Undo data may have been added to the file since it was mapped
+        listFiles.erase(it->second);
+        mapFiles.erase(it);
+    }
+
+    boost::shared_ptr<CMappedFile> pfile(new CMappedFile());
+    if (!pfile->Open(GetBlockPosFilename(pos, prefix)) || pfile->size() < nEnd)
+        return CMappedFileRef();
+    listFiles.push_front(std::make_pair(key, pfile));
+    mapFiles[key] = listFiles.begin();
+    while (listFiles.size() > MAX_MAPPED_BLOCK_FILES) {
+        mapFiles.erase(listFiles.back().first);
+        listFiles.pop_back();
+    }
+    return pfile;
+}
+
+void CBlockFileMap::SetLastBlockFile(int nFile)
+{
+    // Going back, as on -reindex, earlier files may change again
+    if (nFile < nFirstOpenFile)
+        Clear();
+    nFirstOpenFile = nFile;
+}
+
+void CBlockFileMap::SetEnabled(bool fEnabledIn)
+{
+#ifndef WIN32
+    // Mapping whole block files needs a 64 bit address space
+    fEnabled = fEnabledIn && sizeof(void*) >= 8;
+#endif
+    if (!fEnabled)
+        Clear();
+}
+
+void CBlockFileMap::Clear()
+{
+    LOCK(cs);
+    listFiles.clear();
+    mapFiles.clear();
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+struct CDiskBlockPos;
+
+//! Default for -mmapblockfiles
+static const bool DEFAULT_MMAP_BLOCK_FILES = true;
+//! Most block and undo files kept mapped at once
+static const unsigned int MAX_MAPPED_BLOCK_FILES = 256;
+
+/** A whole file mapped read-only into memory */
+class CMappedFile
+{
+private:
+    // Disallow copies
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+    const char* pdata;
+    size_t nSize;
+
+public:
+    CMappedFile();
+    ~CMappedFile();
+
+    /** Map the file as it is now; false if it is empty or can't be mapped */
+    bool Open(const boost::filesystem::path& path);
+
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+};
+
+typedef boost::shared_ptr<const CMappedFile> CMappedFileRef;
+
+/**
+ * Mappings of the blk and rev files that blocks are no longer written to, so that reading a block or its
+ * undo data is a page cache hit instead of an open, seek and read. Files of the block file being written
+ * are never mapped, as it is preallocated and truncated. Undo data can still be appended to older rev
+ * files, so a read past the end of a mapping maps the file again. Readers hold on to the mapping they
+ * use, and it is unmapped when the last of them drops it.
+ */
+class CBlockFileMap
+{
+private:
+    typedef std::pair<std::string, int> file_key;
+    typedef std::list<std::pair<file_key, CMappedFileRef> > lru_list;
+
+    CCriticalSection cs;
+    //! Most recently used first
+    lru_list listFiles;
+    std::map<file_key, lru_list::iterator> mapFiles;
+    //! Files below this number are no longer written to
+    std::atomic<int> nFirstOpenFile;
+    std::atomic<bool> fEnabled;
+
+public:
+    CBlockFileMap();
+
+    /**
+     * A mapping of the blk or rev file of pos holding at least nMinSize bytes from pos.nPos on, or NULL
+     * if there is none and the file has to be read instead.
+     */
+    CMappedFileRef Get(const CDiskBlockPos& pos, const char* prefix, unsigned int nMinSize);
+
+    /** Tell which block file is written to now; files before it may be mapped */
+    void SetLastBlockFile(int nFile);
+    void SetEnabled(bool fEnabledIn);
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
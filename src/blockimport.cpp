@@ -0,0 +1,238 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <fcntl.h>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+
+CBlockImporter::CBlockImporter(int nThreadsIn) : nNextRead(0), nNextCheck(0), nNextConnect(0), nBytesInFlight(0), fReadDone(false), fStop(false)
+{
+    nThreads = nThreadsIn > 0 ? nThreadsIn : (int)boost::thread::hardware_concurrency();
+    nThreads = std::max(1, std::min(nThreads, MAX_BLOCK_IMPORT_THREADS));
+}
+
+void CBlockImporter::Reader(FILE* fileIn)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fileno(fileIn), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof()) {
+            int64_t nStart = GetTimeMicros();
+            int64_t nWait = 0;
+
+            blkdat.SetPos(nRewind);
+            nRewind++;         // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[MESSAGE_START_SIZE];
+                blkdat.FindByte(Params().MessageStart()[0]);
+                nRewind = blkdat.GetPos() + 1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                int64_t nWaitStart = GetTimeMicros();
+                while (!fStop && (nNextRead >= nNextConnect + vSlots.size() ||
+                                     (nBytesInFlight > 0 && nBytesInFlight + nSize > BLOCK_IMPORT_MAX_BYTES)))
+                    condReader.wait(lock);
+                if (fStop)
+                    break;
+                nWait = GetTimeMicros() - nWaitStart;
+            }
+
+            // The slot belongs to the reader until nNextRead moves past it
+            CSlot& slot = vSlots[nNextRead % vSlots.size()];
+            try {
+                // read block
+                uint64_t nBlockPos = blkdat.GetPos();
+                blkdat.SetLimit(nBlockPos + nSize);
+                slot.vchData.resize(nSize);
+                blkdat.read(&slot.vchData[0], nSize);
+                slot.nPos = nBlockPos;
+                slot.nSize = nSize;
+                nRewind = blkdat.GetPos();
+            } catch (const std::exception& e) {
+                LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+                continue;
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                slot.state = SLOT_READ;
+                nNextRead++;
+                nBytesInFlight += nSize;
+            }
+            condWorker.notify_one();
+
+            statsRead.nBlocks++;
+            statsRead.nBytes += nSize;
+            statsRead.nBusyMicros += GetTimeMicros() - nStart - nWait;
+            statsRead.nWaitMicros += nWait;
+        }
+    } catch (const std::exception& e) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        strReadError = e.what();
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fReadDone = true;
+    }
+    condWorker.notify_all();
+    condConnect.notify_all();
+}
+
+void CBlockImporter::Worker()
+{
+    while (true) {
+        uint64_t nIndex;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            int64_t nWaitStart = GetTimeMicros();
+            while (!fStop && !fReadDone && nNextCheck >= nNextRead)
+                condWorker.wait(lock);
+            statsCheck.nWaitMicros += GetTimeMicros() - nWaitStart;
+            if (fStop || nNextCheck >= nNextRead)
+                return;
+            nIndex = nNextCheck++;
+        }
+
+        // The slot belongs to this worker until its state leaves SLOT_READ
+        int64_t nStart = GetTimeMicros();
+        CSlot& slot = vSlots[nIndex % vSlots.size()];
+        SlotState state = SLOT_PARSED;
+        try {
+            CSpanReader reader(&slot.vchData[0], &slot.vchData[0] + slot.vchData.size(), SER_DISK, CLIENT_VERSION);
+            reader >> slot.block;
+        } catch (const std::exception& e) {
+            LogPrintf("%s : Deserialize or I/O error - %s\n", __func__, e.what());
+            state = SLOT_SKIPPED;
+        }
+        // Don't keep a buffer of the largest block seen in every slot
+        std::vector<char>().swap(slot.vchData);
+
+        if (state == SLOT_PARSED && (check.empty() || check(slot.block)))
+            state = SLOT_CHECKED;
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            slot.state = state;
+            statsCheck.nBlocks++;
+            statsCheck.nBytes += slot.nSize;
+            statsCheck.nBusyMicros += GetTimeMicros() - nStart;
+        }
+        condConnect.notify_one();
+    }
+}
+
+void CBlockImporter::Stop(boost::thread_group& threads)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    condReader.notify_all();
+    condWorker.notify_all();
+    threads.join_all();
+}
+
+bool CBlockImporter::Import(FILE* fileIn, const CheckFunction& checkIn, const ConnectFunction& connect)
+{
+    check = checkIn;
+    vSlots.assign((size_t)nThreads * BLOCK_IMPORT_WINDOW_PER_THREAD, CSlot());
+    for (size_t i = 0; i < vSlots.size(); i++)
+        vSlots[i].state = SLOT_EMPTY;
+    nNextRead = 0;
+    nNextCheck = 0;
+    nNextConnect = 0;
+    nBytesInFlight = 0;
+    fReadDone = false;
+    fStop = false;
+    strReadError.clear();
+    statsRead = CBlockImportStageStats();
+    statsCheck = CBlockImportStageStats();
+    statsConnect = CBlockImportStageStats();
+
+    boost::thread_group threads;
+    threads.create_thread(boost::bind(&CBlockImporter::Reader, this, fileIn));
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&CBlockImporter::Worker, this));
+
+    bool fCompleted = true;
+    try {
+        while (true) {
+            CSlot& slot = vSlots[nNextConnect % vSlots.size()];
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                int64_t nWaitStart = GetTimeMicros();
+                while (!(nNextConnect < nNextRead && slot.state > SLOT_READ) && !(fReadDone && nNextConnect >= nNextRead))
+                    condConnect.wait(lock);
+                statsConnect.nWaitMicros += GetTimeMicros() - nWaitStart;
+                if (nNextConnect >= nNextRead)
+                    break;
+            }
+            boost::this_thread::interruption_point();
+
+            int64_t nStart = GetTimeMicros();
+            if (slot.state != SLOT_SKIPPED) {
+                statsConnect.nBlocks++;
+                statsConnect.nBytes += slot.nSize;
+                if (!connect(slot.block, slot.nPos, slot.state == SLOT_CHECKED)) {
+                    fCompleted = false;
+                    break;
+                }
+            }
+            slot.block.SetNull();
+            statsConnect.nBusyMicros += GetTimeMicros() - nStart;
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                slot.state = SLOT_EMPTY;
+                nNextConnect++;
+                nBytesInFlight -= slot.nSize;
+            }
+            condReader.notify_one();
+        }
+    } catch (...) {
+        Stop(threads);
+        throw;
+    }
+    Stop(threads);
+
+    if (!strReadError.empty())
+        throw std::runtime_error(strReadError);
+
+    // Per thread rates and waits show which stage holds the others up
+    LogPrintf("%s: read %u blocks (%.1f MB) at %.1f/s waiting %.2fs, checked at %.1f/s on each of %d threads waiting %.2fs, "
+              "connected %u at %.1f/s waiting %.2fs\n", __func__,
+        statsRead.nBlocks, statsRead.nBytes / 1048576.0, statsRead.GetBlocksPerSecond(), statsRead.nWaitMicros * 0.000001,
+        statsCheck.GetBlocksPerSecond(), nThreads, statsCheck.nWaitMicros * 0.000001,
+        statsConnect.nBlocks, statsConnect.GetBlocksPerSecond(), statsConnect.nWaitMicros * 0.000001);
+    return fCompleted;
+}
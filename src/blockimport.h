@@ -0,0 +1,128 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKIMPORT_H
+#define BITCOIN_BLOCKIMPORT_H
+
+#include "primitives/block.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+/** Maximum number of block import check threads */
+static const int MAX_BLOCK_IMPORT_THREADS = 16;
+/** Number of blocks each check thread may be ahead of the block being connected */
+static const int BLOCK_IMPORT_WINDOW_PER_THREAD = 16;
+/** Most bytes of serialized blocks read ahead of the block being connected */
+static const unsigned int BLOCK_IMPORT_MAX_BYTES = 64 * 1024 * 1024;
+
+/** Work done and time spent by one stage of a CBlockImporter */
+struct CBlockImportStageStats {
+    uint64_t nBlocks;
+    uint64_t nBytes;
+    //! Microseconds spent working, summed over the threads of the stage
+    int64_t nBusyMicros;
+    //! Microseconds spent waiting on the stage before or after it
+    int64_t nWaitMicros;
+
+    CBlockImportStageStats() : nBlocks(0), nBytes(0), nBusyMicros(0), nWaitMicros(0) {}
+
+    /** Blocks per second of one thread of the stage */
+    double GetBlocksPerSecond() const { return nBusyMicros > 0 ? nBlocks * 1000000.0 / nBusyMicros : 0; }
+};
+
+/**
+ * Imports a file of blocks as written by the block store, e.g. on -reindex,
+ * in three stages joined by a ring of slots that bounds how far the stages
+ * get ahead of each other:
+ *
+ * - a reader thread finds the blocks in the file and reads their bytes,
+ *   staying at most BLOCK_IMPORT_MAX_BYTES ahead of the connecting thread,
+ * - a pool of check threads deserializes them and runs the check function,
+ * - the calling thread hands them to the connect function in file order.
+ *
+ * The check function runs on the check threads, so it must not take cs_main;
+ * a block it cannot check without cs_main is to be failed, and is then
+ * checked in full when connected. Blocks that cannot be deserialized are
+ * logged and skipped. The connect function gets each block with its position
+ * in the file and whether the check function passed it, and returns false to
+ * stop the import.
+ *
+ * Usage:
+ *
+ * CBlockImporter importer;
+ * importer.Import(file, check, boost::bind(&Connect, _1, _2, _3));
+ */
+class CBlockImporter
+{
+public:
+    typedef boost::function<bool(const CBlock&)> CheckFunction;
+    typedef boost::function<bool(CBlock&, unsigned int, bool)> ConnectFunction;
+
+    /** nThreadsIn <= 0 uses one check thread per core */
+    explicit CBlockImporter(int nThreadsIn = 0);
+
+    /**
+     * Import the blocks of fileIn, which is closed when done. An empty check
+     * function passes every block. Returns false if the connect function
+     * stopped the import, and throws std::runtime_error if the file could not
+     * be read.
+     */
+    bool Import(FILE* fileIn, const CheckFunction& check, const ConnectFunction& connect);
+
+    const CBlockImportStageStats& GetReadStats() const { return statsRead; }
+    const CBlockImportStageStats& GetCheckStats() const { return statsCheck; }
+    const CBlockImportStageStats& GetConnectStats() const { return statsConnect; }
+    int GetThreads() const { return nThreads; }
+
+private:
+    enum SlotState {
+        SLOT_EMPTY,
+        SLOT_READ,
+        SLOT_SKIPPED,
+        SLOT_PARSED,
+        SLOT_CHECKED,
+    };
+
+    struct CSlot {
+        std::vector<char> vchData;
+        unsigned int nPos;
+        unsigned int nSize;
+        CBlock block;
+        SlotState state;
+    };
+
+    int nThreads;
+
+    //! ring buffer of the blocks between nNextConnect and nNextRead
+    std::vector<CSlot> vSlots;
+    uint64_t nNextRead;
+    uint64_t nNextCheck;
+    uint64_t nNextConnect;
+    //! Serialized size of the blocks between nNextConnect and nNextRead
+    uint64_t nBytesInFlight;
+    bool fReadDone;
+    bool fStop;
+    std::string strReadError;
+    CheckFunction check;
+
+    CBlockImportStageStats statsRead;
+    CBlockImportStageStats statsCheck;
+    CBlockImportStageStats statsConnect;
+
+    boost::mutex mutex;
+    boost::condition_variable condReader;
+    boost::condition_variable condWorker;
+    boost::condition_variable condConnect;
+
+    void Reader(FILE* fileIn);
+    void Worker();
+    void Stop(boost::thread_group& threads);
+};
+
+#endif // BITCOIN_BLOCKIMPORT_H
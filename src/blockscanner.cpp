@@ -0,0 +1,162 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockscanner.h"
+
+#include "main.h"
+#include "util.h"
+
+#include <fcntl.h>
+
+#include <boost/bind.hpp>
+
+/** Ask the kernel to start reading a block file from pos onwards */
+static void PrefetchBlockFile(const CDiskBlockPos& pos)
+{
+#ifdef POSIX_FADV_WILLNEED
+    FILE* file = OpenBlockFile(pos, true);
+    if (!file)
+        return;
+    posix_fadvise(fileno(file), pos.nPos, 0, POSIX_FADV_WILLNEED);
+    fclose(file);
+#endif
+}
+
+CBlockScanner::CBlockScanner(int nThreadsIn) : nBlocksRead(0), nBlocksMatched(0), nNextRead(0), nNextProcess(0), nLastPrefetchFile(-1), fStop(false)
+{
+    nThreads = nThreadsIn > 0 ? nThreadsIn : (int)boost::thread::hardware_concurrency();
+    nThreads = std::max(1, std::min(nThreads, MAX_BLOCK_SCANNER_THREADS));
+}
+
+void CBlockScanner::Worker()
+{
+    while (true) {
+        size_t nIndex;
+        CDiskBlockPos posPrefetch;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (!fStop && nNextRead < vRange.size() && nNextRead >= nNextProcess + vSlots.size())
+                condWorker.wait(lock);
+            if (fStop || nNextRead >= vRange.size())
+                return;
+            nIndex = nNextRead++;
+
+            if (vRange[nIndex]->nFile != nLastPrefetchFile) {
+                nLastPrefetchFile = vRange[nIndex]->nFile;
+                posPrefetch = vRange[nIndex]->GetBlockPos();
+            }
+        }
+
+        if (!posPrefetch.IsNull())
+            PrefetchBlockFile(posPrefetch);
+
+        // The slot belongs to this worker until its state leaves SLOT_PENDING
+        CSlot& slot = vSlots[nIndex % vSlots.size()];
+        bool fMatched = false;
+        if (!ReadBlockFromDisk(slot.block, vRange[nIndex]))
+            LogPrintf("%s: skipping block %s at height %d, which can't be read\n", __func__, vRange[nIndex]->GetBlockHash().ToString(), vRange[nIndex]->nHeight);
+        else
+            fMatched = match.empty() || match(slot.block, vRange[nIndex]);
+        if (!fMatched)
+            slot.block.SetNull();
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            slot.state = fMatched ? SLOT_MATCHED : SLOT_SKIPPED;
+            nBlocksRead++;
+        }
+        condProcess.notify_one();
+    }
+}
+
+bool CBlockScanner::Scan(CBlockIndex* pindexStart, CBlockIndex* pindexLast, const MatchFunction& match, const ProcessFunction& process, const ProgressFunction& progress)
+{
+    std::vector<CBlockIndex*> vBlocks;
+    {
+        LOCK(cs_main);
+        for (CBlockIndex* pindex = pindexStart; pindex; pindex = chainActive.Next(pindex)) {
+            vBlocks.push_back(pindex);
+            if (pindex == pindexLast)
+                break;
+        }
+    }
+    return Scan(vBlocks, match, process, progress);
+}
+
+bool CBlockScanner::Scan(const std::vector<CBlockIndex*>& vBlocks, const MatchFunction& matchIn, const ProcessFunction& process, const ProgressFunction& progress)
+{
+    if (vBlocks.empty())
+        return true;
+
+    vRange = vBlocks;
+    match = matchIn;
+    vSlots.assign(std::min(vRange.size(), (size_t)nThreads * BLOCK_SCANNER_WINDOW_PER_THREAD), CSlot());
+    for (size_t i = 0; i < vSlots.size(); i++)
+        vSlots[i].state = SLOT_PENDING;
+    nNextRead = 0;
+    nNextProcess = 0;
+    nLastPrefetchFile = -1;
+    fStop = false;
+
+    boost::thread_group workers;
+    for (int i = 0; i < nThreads; i++)
+        workers.create_thread(boost::bind(&CBlockScanner::Worker, this));
+
+    bool fCompleted = true;
+    try {
+        while (nNextProcess < vRange.size()) {
+            CSlot& slot = vSlots[nNextProcess % vSlots.size()];
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (slot.state == SLOT_PENDING)
+                    condProcess.wait(lock);
+            }
+
+            if (!progress.empty())
+                progress(vRange[nNextProcess]);
+
+            if (slot.state == SLOT_MATCHED) {
+                // The chain may have been reorganized since the range was taken; blocks that left
+                // it are not handed on. The process function runs under the same lock, so a block
+                // stays in the chain until it has been processed.
+                LOCK(cs_main);
+                if (!chainActive.Contains(vRange[nNextProcess])) {
+                    LogPrintf("%s: skipping block %s at height %d, which is no longer in the active chain\n", __func__, vRange[nNextProcess]->GetBlockHash().ToString(), vRange[nNextProcess]->nHeight);
+                } else {
+                    nBlocksMatched++;
+                    if (!process(slot.block, vRange[nNextProcess])) {
+                        fCompleted = false;
+                        break;
+                    }
+                }
+            }
+
+            slot.block.SetNull();
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                slot.state = SLOT_PENDING;
+                nNextProcess++;
+            }
+            condWorker.notify_all();
+        }
+    } catch (...) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+        }
+        condWorker.notify_all();
+        workers.join_all();
+        throw;
+    }
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+    }
+    condWorker.notify_all();
+    workers.join_all();
+
+    LogPrint("bench", "%s: read %d blocks, matched %d, on %d threads\n", __func__, nBlocksRead, nBlocksMatched, nThreads);
+    return fCompleted;
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKSCANNER_H
+#define BITCOIN_BLOCKSCANNER_H
+
+#include "primitives/block.h"
+
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+class CBlockIndex;
+
+/** Maximum number of block scanner worker threads */
+static const int MAX_BLOCK_SCANNER_THREADS = 16;
+/** Number of blocks each worker may read ahead of the block being processed */
+static const int BLOCK_SCANNER_WINDOW_PER_THREAD = 16;
+
+/**
+ * Reads a range of the active chain on a pool of worker threads and hands the blocks
+ * back to the caller in height order.
+ *
+ * The workers don't take cs_main. The match function runs on them, so it must not take
+ * cs_main or touch wallet state; blocks it rejects are dropped without reaching the
+ * process function. The process function runs on the calling thread, one block at a time
+ * and in height order, with cs_main held, and returns false to stop the scan. Blocks
+ * that left the active chain since the range was taken are skipped.
+ *
+ * Usage:
+ *
+ * CBlockScanner scanner;
+ * scanner.Scan(pindexStart, NULL, match, boost::bind(&Process, _1, _2));
+ */
+class CBlockScanner
+{
+public:
+    typedef boost::function<bool(const CBlock&, const CBlockIndex*)> MatchFunction;
+    typedef boost::function<bool(const CBlock&, CBlockIndex*)> ProcessFunction;
+    typedef boost::function<void(const CBlockIndex*)> ProgressFunction;
+
+    /** nThreadsIn <= 0 uses one worker per core */
+    explicit CBlockScanner(int nThreadsIn = 0);
+
+    /**
+     * Scan the active chain from pindexStart up to and including pindexLast (the tip if
+     * NULL). An empty match function accepts every block. Blocks that cannot be read are
+     * logged and skipped. The optional progress function is called on the calling thread
+     * for every block in the range, matched or not. Returns false if the process function
+     * stopped the scan.
+     */
+    bool Scan(CBlockIndex* pindexStart, CBlockIndex* pindexLast, const MatchFunction& match, const ProcessFunction& process, const ProgressFunction& progress = ProgressFunction());
+
+    /** Scan an explicit list of blocks, e.g. a range the caller already filtered under cs_main */
+    bool Scan(const std::vector<CBlockIndex*>& vBlocks, const MatchFunction& match, const ProcessFunction& process, const ProgressFunction& progress = ProgressFunction());
+
+    int GetBlocksRead() const { return nBlocksRead; }
+    int GetBlocksMatched() const { return nBlocksMatched; }
+
+private:
+    enum SlotState {
+        SLOT_PENDING,
+        SLOT_SKIPPED,
+        SLOT_MATCHED,
+    };
+
+    struct CSlot {
+        CBlock block;
+        SlotState state;
+    };
+
+    int nThreads;
+    int nBlocksRead;
+    int nBlocksMatched;
+
+    std::vector<CBlockIndex*> vRange;
+    //! ring buffer of the blocks between nNextProcess and nNextRead
+    std::vector<CSlot> vSlots;
+    size_t nNextRead;
+    size_t nNextProcess;
+    int nLastPrefetchFile;
+    bool fStop;
+    MatchFunction match;
+
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condProcess;
+
+    void Worker();
+};
+
+#endif // BITCOIN_BLOCKSCANNER_H
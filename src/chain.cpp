@@ -5,8 +5,48 @@
 
 #include "chain.h"
 
+#include <new>
+
 using namespace std;
 
+/**
+ * CBlockIndexArena implementation
+ */
+void* CBlockIndexArena::Allocate()
+{
+    if (nUsed == CHUNK_SIZE) {
+        vChunks.push_back(static_cast<CBlockIndex*>(::operator new(CHUNK_SIZE * sizeof(CBlockIndex))));
+        nUsed = 0;
+    }
+    return vChunks.back() + nUsed;
+}
+
+CBlockIndex* CBlockIndexArena::New()
+{
+    CBlockIndex* pindex = new (Allocate()) CBlockIndex();
+    nUsed++;
+    return pindex;
+}
+
+CBlockIndex* CBlockIndexArena::New(const CBlock& block)
+{
+    CBlockIndex* pindex = new (Allocate()) CBlockIndex(block);
+    nUsed++;
+    return pindex;
+}
+
+void CBlockIndexArena::Clear()
+{
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        size_t nCount = i + 1 < vChunks.size() ? CHUNK_SIZE : nUsed;
+        for (size_t j = 0; j < nCount; j++)
+            vChunks[i][j].~CBlockIndex();
+        ::operator delete(vChunks[i]);
+    }
+    vChunks.clear();
+    nUsed = CHUNK_SIZE;
+}
+
 /**
  * CChain implementation
  */
@@ -14,6 +14,9 @@
 #include "uint256.h"
 #include "util.h"
 #include "libzerocoin/Denominations.h"
+#include <algorithm>
+#include <map>
+#include <stdexcept>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -105,6 +108,62 @@ enum BlockStatus {
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 };
 
+/** Supply of each zerocoin denomination, kept in a fixed array in zerocoinDenomList order
+ * rather than a map, so that it lives inside the CBlockIndex. Serialized as the
+ * std::map it replaced.
+ */
+class CZerocoinSupply
+{
+private:
+    int64_t nSupply[libzerocoin::ZEROCOIN_DENOMINATION_COUNT];
+
+public:
+    CZerocoinSupply()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        for (unsigned int i = 0; i < libzerocoin::ZEROCOIN_DENOMINATION_COUNT; i++)
+            nSupply[i] = 0;
+    }
+
+    int64_t& at(libzerocoin::CoinDenomination denom)
+    {
+        int pos = libzerocoin::ZerocoinDenominationToIndex(denom);
+        if (pos < 0)
+            throw std::out_of_range("CZerocoinSupply::at : invalid denomination");
+        return nSupply[pos];
+    }
+
+    const int64_t& at(libzerocoin::CoinDenomination denom) const
+    {
+        return const_cast<CZerocoinSupply*>(this)->at(denom);
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        std::map<libzerocoin::CoinDenomination, int64_t> mapSupply;
+        if (!ser_action.ForRead()) {
+            for (unsigned int i = 0; i < libzerocoin::ZEROCOIN_DENOMINATION_COUNT; i++)
+                mapSupply.insert(std::make_pair(libzerocoin::zerocoinDenomList[i], nSupply[i]));
+        }
+        READWRITE(mapSupply);
+        if (ser_action.ForRead()) {
+            SetNull();
+            for (std::map<libzerocoin::CoinDenomination, int64_t>::const_iterator it = mapSupply.begin(); it != mapSupply.end(); ++it) {
+                int pos = libzerocoin::ZerocoinDenominationToIndex(it->first);
+                if (pos >= 0)
+                    nSupply[pos] = it->second;
+            }
+        }
+    }
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -113,44 +172,50 @@ enum BlockStatus {
 class CBlockIndex
 {
 public:
+    // The members used while walking the tree (GetAncestor, FindMostWorkChain) come
+    // first, so that they share a cache line.
+
     //! pointer to the hash of the block, if any. memory is owned by this CBlockIndex
     const uint256* phashBlock;
 
     //! pointer to the index of the predecessor of this block
     CBlockIndex* pprev;
 
-    //! pointer to the index of the next block
-    CBlockIndex* pnext;
-
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
-    //! Which # file this block is stored in (blk?????.dat)
-    int nFile;
-
-    //! Byte offset within blk?????.dat where this block's data is stored
-    unsigned int nDataPos;
-
-    //! Byte offset within rev?????.dat where this block's undo data is stored
-    unsigned int nUndoPos;
+    //! Verification status of this block. See enum BlockStatus
+    unsigned int nStatus;
 
     //! (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
     uint256 nChainWork;
 
-    //! Number of transactions in this block.
-    //! Note: in a potential headers-first mode, this number cannot be relied upon
-    unsigned int nTx;
+    //! pointer to the index of the next block
+    CBlockIndex* pnext;
 
     //! (memory only) Number of transactions in the chain up to and including this block.
     //! This value will be non-zero only if and only if transactions for this block and all its parents are available.
     //! Change to 64-bit type when necessary; won't happen before 2030
     unsigned int nChainTx;
 
-    //! Verification status of this block. See enum BlockStatus
-    unsigned int nStatus;
+    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
+    uint32_t nSequenceId;
+
+    //! Number of transactions in this block.
+    //! Note: in a potential headers-first mode, this number cannot be relied upon
+    unsigned int nTx;
+
+    //! Which # file this block is stored in (blk?????.dat)
+    int nFile;
+
+    //! Byte offset within blk?????.dat where this block's data is stored
+    unsigned int nDataPos;
+
+    //! Byte offset within rev?????.dat where this block's undo data is stored
+    unsigned int nUndoPos;
 
     unsigned int nFlags; // ppcoin: block index flags
     enum {
@@ -159,6 +224,14 @@ public:
         BLOCK_STAKE_MODIFIER = (1 << 2), // regenerated stake modifier
     };
 
+    //! block header
+    int nVersion;
+    unsigned int nTime;
+    unsigned int nBits;
+    unsigned int nNonce;
+    uint256 hashMerkleRoot;
+    uint256 nAccumulatorCheckpoint;
+
     // proof-of-stake specific fields
 	// hash modifier for proof-of-stake
     uint64_t nStakeModifier;
@@ -171,25 +244,18 @@ public:
     int64_t nMint;
     int64_t nMoneySupply;
 
-    //! block header
-    int nVersion;
-    uint256 hashMerkleRoot;
-    unsigned int nTime;
-    unsigned int nBits;
-    unsigned int nNonce;
-    uint256 nAccumulatorCheckpoint;
-
-    //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
-    uint32_t nSequenceId;
-    
     //! zerocoin specific fields
-    std::map<libzerocoin::CoinDenomination, int64_t> mapZerocoinSupply;
+    CZerocoinSupply mapZerocoinSupply;
     std::vector<libzerocoin::CoinDenomination> vMintDenominationsInBlock;
+
+    //! (memory only) Mints of each denomination, in zerocoinDenomList order, in the chain up to and including this block
+    int nZerocoinMintCount[libzerocoin::ZEROCOIN_DENOMINATION_COUNT];
     
     void SetNull()
     {
         phashBlock = NULL;
         pprev = NULL;
+        pnext = NULL;
         pskip = NULL;
         nHeight = 0;
         nFile = 0;
@@ -217,10 +283,10 @@ public:
         nNonce = 0;
         nAccumulatorCheckpoint = 0;
         // Start supply of each denomination with 0s
-        for (auto& denom : libzerocoin::zerocoinDenomList) {
-            mapZerocoinSupply.insert(make_pair(denom, 0));
-        }
+        mapZerocoinSupply.SetNull();
         vMintDenominationsInBlock.clear();
+        for (unsigned int i = 0; i < libzerocoin::ZEROCOIN_DENOMINATION_COUNT; i++)
+            nZerocoinMintCount[i] = 0;
     }
 
     CBlockIndex()
@@ -309,6 +375,25 @@ public:
         return std::find(vMintDenominationsInBlock.begin(), vMintDenominationsInBlock.end(), denom) != vMintDenominationsInBlock.end();
     }
 
+    //! Set nZerocoinMintCount from pprev and vMintDenominationsInBlock; pprev must already be set up
+    void BuildZerocoinMintCount()
+    {
+        for (unsigned int i = 0; i < libzerocoin::ZEROCOIN_DENOMINATION_COUNT; i++)
+            nZerocoinMintCount[i] = pprev ? pprev->nZerocoinMintCount[i] : 0;
+        for (auto& denom : vMintDenominationsInBlock) {
+            int pos = libzerocoin::ZerocoinDenominationToIndex(denom);
+            if (pos >= 0)
+                nZerocoinMintCount[pos]++;
+        }
+    }
+
+    //! Number of mints of denom in the chain up to and including this block
+    int GetZerocoinMintCount(libzerocoin::CoinDenomination denom) const
+    {
+        int pos = libzerocoin::ZerocoinDenominationToIndex(denom);
+        return pos >= 0 ? nZerocoinMintCount[pos] : 0;
+    }
+
     uint256 GetBlockHash() const
     {
         return *phashBlock;
@@ -430,16 +515,21 @@ class CDiskBlockIndex : public CBlockIndex
 public:
     uint256 hashPrev;
     uint256 hashNext;
+    //! Key to write the record under, so the header is not hashed again. Not serialized: the
+    //! database key is the block hash already, and the loader takes it from there.
+    uint256 hashBlock;
 
     CDiskBlockIndex()
     {
         hashPrev = uint256();
         hashNext = uint256();
+        hashBlock = uint256();
     }
 
-    explicit CDiskBlockIndex(CBlockIndex* pindex) : CBlockIndex(*pindex)
+    explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex)
     {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        hashBlock = pindex->GetBlockHash();
     }
 
     ADD_SERIALIZE_METHODS;
@@ -493,7 +583,6 @@ public:
             READWRITE(mapZerocoinSupply);
             READWRITE(vMintDenominationsInBlock);
         }
-
     }
 
     uint256 GetBlockHash() const
@@ -521,6 +610,38 @@ public:
     }
 };
 
+/** Storage for the block index entries. Entries are constructed in place in large
+ * chunks instead of one heap allocation each, which keeps them close together in
+ * memory and saves the per-allocation overhead. Entries are never freed one at a
+ * time; Clear destroys all of them at once. Not thread safe: callers in main.cpp
+ * hold cs_main.
+ */
+class CBlockIndexArena
+{
+private:
+    //! Entries per chunk
+    static const size_t CHUNK_SIZE = 4096;
+
+    std::vector<CBlockIndex*> vChunks;
+    //! Entries constructed in the last chunk
+    size_t nUsed;
+
+    //! Storage for one more entry, not constructed yet
+    void* Allocate();
+
+public:
+    CBlockIndexArena() : nUsed(CHUNK_SIZE) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    CBlockIndex* New();
+    CBlockIndex* New(const CBlock& block);
+
+    //! Destroy all entries and release the chunks
+    void Clear();
+
+    size_t Size() const { return vChunks.empty() ? 0 : (vChunks.size() - 1) * CHUNK_SIZE + nUsed; }
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain
 {
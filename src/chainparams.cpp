@@ -184,7 +184,7 @@ public:
         fMineBlocksOnDemand = false;
         fSkipProofOfWorkCheck = false;
         fTestnetToBeDeprecatedFieldRPC = false;
-        fHeadersFirstSyncingActive = false;
+        fHeadersFirstSyncingActive = true;
 
         nPoolMaxTransactions = 3;
 		strSporkKey = "0475d8b895b80516025a2f33d647551d9688ff16f620e0035132d29ea2fc9c7e4b2c3e80a2938f4595c60f52909d0bd8659b5cadc838425aced67081a8570b8e50";
@@ -1,4 +1,5 @@
 // Copyright (c) 2012-2014 The Bitcoin developers
+// Copyright (c) 2021 The Bitcoin 2 developers
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
@@ -6,169 +7,420 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <stdint.h>
 #include <vector>
 
-#include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+//! Maximum number of worker threads of a CCheckPool (the masters of its queues come on top)
+static const unsigned int CHECK_POOL_MAX_WORKERS = 64;
+//! Maximum number of queues sharing one CCheckPool
+static const unsigned int CHECK_POOL_MAX_QUEUES = 8;
+//! Rounds an idle worker polls the queues for, yielding in between, before it goes to sleep
+static const unsigned int DEFAULT_CHECK_POOL_SPIN = 128;
+
+/**
+ * Type independent part of a CCheckQueue, through which the threads of a
+ * CCheckPool run its checks.
+ */
+class CCheckQueueBase
+{
+public:
+    virtual ~CCheckQueueBase() {}
+
+    //! Run checks as worker nWorker (1 to CHECK_POOL_MAX_WORKERS) until none are left to take; false if there were none
+    virtual bool Work(unsigned int nWorker) = 0;
+
+    //! Whether there are checks that are not taken by any thread yet
+    virtual bool HasWork() = 0;
+};
+
+/**
+ * A set of worker threads shared by several check queues, so that script
+ * checks, zerocoin spend checks and deferred signature checks are run by the
+ * same threads.
+ *
+ * Workers out of work poll the queues for a while before they sleep, as
+ * checks arrive in quick bursts while a block is connected. Queues only take
+ * the pool's mutex to wake sleeping workers.
+ *
+ * Queues register themselves on construction and must outlive the threads
+ * running Thread().
+ */
+class CCheckPool
+{
+private:
+    //! Protects sleeping and waking up workers
+    boost::mutex mutex;
+
+    //! Workers out of work sleep on this
+    boost::condition_variable condWorker;
+
+    std::atomic<CCheckQueueBase*> vQueues[CHECK_POOL_MAX_QUEUES];
+    std::atomic<unsigned int> nQueues;
+
+    //! Number of threads that entered Thread(), which is also the id of the last one
+    std::atomic<unsigned int> nWorkers;
+
+    //! Number of workers sleeping on condWorker
+    std::atomic<unsigned int> nSleeping;
+
+    std::atomic<bool> fQuit;
+    unsigned int nSpin;
+
+    bool AnyWork()
+    {
+        unsigned int n = nQueues.load();
+        for (unsigned int i = 0; i < n; i++) {
+            if (vQueues[i].load()->HasWork())
+                return true;
+        }
+        return false;
+    }
+
+public:
+    CCheckPool(unsigned int nSpinIn = DEFAULT_CHECK_POOL_SPIN) : nQueues(0), nWorkers(0), nSleeping(0), fQuit(false), nSpin(nSpinIn)
+    {
+        for (unsigned int i = 0; i < CHECK_POOL_MAX_QUEUES; i++)
+            vQueues[i].store(NULL);
+    }
+
+    void Register(CCheckQueueBase* pqueue)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        unsigned int n = nQueues.load();
+        assert(n < CHECK_POOL_MAX_QUEUES);
+        vQueues[n].store(pqueue);
+        nQueues.store(n + 1);
+    }
+
+    //! Number of worker threads, not counting the masters
+    unsigned int GetWorkerCount() const
+    {
+        return std::min(nWorkers.load(std::memory_order_relaxed), CHECK_POOL_MAX_WORKERS);
+    }
+
+    //! Wake sleeping workers, after checks were made available to them
+    void Notify(bool fAll)
+    {
+        if (nSleeping.load() == 0)
+            return;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (fAll)
+            condWorker.notify_all();
+        else
+            condWorker.notify_one();
+    }
+
+    //! Worker thread
+    void Thread()
+    {
+        unsigned int nWorker = ++nWorkers;
+        if (nWorker > CHECK_POOL_MAX_WORKERS)
+            return;
+
+        unsigned int nIdle = 0;
+        while (!fQuit.load(std::memory_order_relaxed)) {
+            bool fWorked = false;
+            unsigned int n = nQueues.load();
+            for (unsigned int i = 0; i < n; i++) {
+                if (vQueues[i].load()->Work(nWorker))
+                    fWorked = true;
+            }
+            if (fWorked) {
+                nIdle = 0;
+                continue;
+            }
+            if (++nIdle < nSpin) {
+                boost::this_thread::yield();
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            // Queues publish checks before they look at nSleeping, so either they see us
+            // here and wait for the mutex to notify, or we see their checks
+            nSleeping++;
+            if (!AnyWork() && !fQuit.load()) {
+                try {
+                    condWorker.wait(lock);
+                } catch (const boost::thread_interrupted&) {
+                    nSleeping--;
+                    throw;
+                }
+            }
+            nSleeping--;
+            nIdle = 0;
+        }
+    }
+
+    //! Make the threads running Thread() return
+    void Stop()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fQuit.store(true);
+        condWorker.notify_all();
+    }
+};
+
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
   *
   * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
+  * onto the queue, where they are processed by the worker threads of a
+  * CCheckPool. When the master is done adding work, it temporarily joins
+  * the workers until all jobs are done.
+  *
+  * Pushing takes no lock: checks are numbered in the order they are added
+  * and published by advancing nPushed. Threads claim runs of them from
+  * nClaimed into their own deque, a range of numbers they take one at a time
+  * from the front, and which others steal half of from the back once they
+  * run out.
   */
 template <typename T>
-class CCheckQueue
+class CCheckQueue : public CCheckQueueBase
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
+    static const unsigned int SEGMENT_SIZE = 4096;
+    static const unsigned int MAX_SEGMENTS = 256;
 
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
+    /** A thread's deque: the numbers [begin, end) of checks it claimed and did not start yet, packed as (begin << 32) | end */
+    struct Deque {
+        std::atomic<uint64_t> range;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
 
-    //! Master thread blocks on this when out of work
-    boost::condition_variable condMaster;
+    CCheckPool& pool;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! Checks are stored in segments that do not move once allocated; only the master allocates them
+    T* vSegments[MAX_SEGMENTS];
+    unsigned int nSegments;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Number of checks added, claimed by a thread, and finished in this round
+    std::atomic<uint32_t> nPushed;
+    std::atomic<uint32_t> nClaimed;
+    std::atomic<uint32_t> nDone;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Deque 0 is the master's, the others belong to the workers of the pool
+    Deque vDeques[CHECK_POOL_MAX_WORKERS + 1];
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! Whether checks were added since the last Wait. Workers leave the queue alone otherwise.
+    std::atomic<bool> fActive;
 
-    /**
-     * Number of verifications that haven't completed yet.
-     * This includes elements that are not anymore in queue, but still in
-     * worker's own batches.
-     */
-    unsigned int nTodo;
+    //! Number of workers in Work(), which Wait lets finish before it resets the queue
+    std::atomic<unsigned int> nBusy;
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
 
-    //! The maximum number of elements to be processed in one batch
+    //! The maximum number of checks claimed at once
     unsigned int nBatchSize;
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
-    {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+    //! Master thread blocks on this when out of work; fMasterWaiting tells the workers to notify it
+    boost::mutex mutex;
+    boost::condition_variable condMaster;
+    std::atomic<bool> fMasterWaiting;
+
+    static uint64_t Pack(uint32_t nBegin, uint32_t nEnd) { return ((uint64_t)nBegin << 32) | nEnd; }
+    static uint32_t Begin(uint64_t range) { return (uint32_t)(range >> 32); }
+    static uint32_t End(uint64_t range) { return (uint32_t)range; }
+
+    T& Get(uint32_t n) { return vSegments[n / SEGMENT_SIZE][n % SEGMENT_SIZE]; }
+
+    //! Run check n and release what it holds, unless an earlier one failed
+    void Run(uint32_t n)
+    {
+        T check;
+        check.swap(Get(n));
+        if (fAllOk.load(std::memory_order_relaxed) && !check())
+            fAllOk.store(false, std::memory_order_relaxed);
+    }
+
+    void Finish(uint32_t nCount)
+    {
+        uint32_t nDoneNow = nDone.fetch_add(nCount) + nCount;
+        if (fMasterWaiting.load() && nDoneNow == nPushed.load()) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
+    //! Take a run of unclaimed checks into deque nWorker, which must be empty
+    bool Claim(unsigned int nWorker)
+    {
+        uint32_t nBegin = nClaimed.load();
+        while (true) {
+            uint32_t nAvailable = nPushed.load() - nBegin;
+            if (nAvailable == 0)
+                return false;
+            // Aim for increasingly smaller runs, so that all threads finish at about the same time.
+            // What is claimed too eagerly gets stolen anyway.
+            uint32_t nNow = std::max(1U, std::min(nBatchSize, nAvailable / (pool.GetWorkerCount() + 2)));
+            if (nClaimed.compare_exchange_weak(nBegin, nBegin + nNow)) {
+                vDeques[nWorker].range.store(Pack(nBegin, nBegin + nNow));
+                return true;
+            }
+        }
+    }
+
+    //! Move half of the checks of another deque to the back of deque nWorker, which must be empty
+    bool Steal(unsigned int nWorker)
+    {
+        unsigned int nDeques = pool.GetWorkerCount() + 1;
+        for (unsigned int i = 1; i < nDeques; i++) {
+            Deque& victim = vDeques[(nWorker + i) % nDeques];
+            uint64_t range = victim.range.load();
+            while (Begin(range) < End(range)) {
+                uint32_t nTake = (End(range) - Begin(range) + 1) / 2;
+                if (victim.range.compare_exchange_weak(range, Pack(Begin(range), End(range) - nTake))) {
+                    vDeques[nWorker].range.store(Pack(End(range) - nTake, End(range)));
+                    return true;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+            }
+        }
+        return false;
+    }
+
+    //! Run checks from deque nWorker, refilling it from the unclaimed and other threads' checks, until there are none
+    bool Drain(unsigned int nWorker)
+    {
+        std::atomic<uint64_t>& own = vDeques[nWorker].range;
+        bool fWorked = false;
+        while (true) {
+            uint32_t nRan = 0;
+            uint64_t range = own.load();
+            while (Begin(range) < End(range)) {
+                if (own.compare_exchange_weak(range, Pack(Begin(range) + 1, End(range)))) {
+                    Run(Begin(range));
+                    nRan++;
+                    range = own.load();
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+            if (nRan) {
+                fWorked = true;
+                Finish(nRan);
+            }
+            if (!Claim(nWorker) && !Steal(nWorker))
+                return fWorked;
+        }
     }
 
 public:
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue, run by the threads of poolIn
+    CCheckQueue(CCheckPool& poolIn, unsigned int nBatchSizeIn) : pool(poolIn), nSegments(0), nPushed(0), nClaimed(0), nDone(0), fActive(false), nBusy(0), fAllOk(true), nBatchSize(nBatchSizeIn), fMasterWaiting(false)
+    {
+        for (unsigned int i = 0; i <= CHECK_POOL_MAX_WORKERS; i++)
+            vDeques[i].range.store(0);
+        pool.Register(this);
+    }
 
-    //! Worker thread
-    void Thread()
+    bool Work(unsigned int nWorker)
     {
-        Loop();
+        if (!fActive.load(std::memory_order_relaxed))
+            return false;
+        nBusy++;
+        bool fWorked = fActive.load() && Drain(nWorker);
+        nBusy--;
+        return fWorked;
+    }
+
+    bool HasWork()
+    {
+        if (!fActive.load())
+            return false;
+        if (nClaimed.load() < nPushed.load())
+            return true;
+        unsigned int nDeques = pool.GetWorkerCount() + 1;
+        for (unsigned int i = 0; i < nDeques; i++) {
+            uint64_t range = vDeques[i].range.load();
+            if (Begin(range) < End(range))
+                return true;
+        }
+        return false;
     }
 
     //! Wait until execution finishes, and return whether all evaluations where successful.
     bool Wait()
     {
-        return Loop(true);
+        Drain(0);
+
+        // Checks taken by workers may still be running
+        for (unsigned int nSpin = 0; nDone.load() != nPushed.load(); nSpin++) {
+            if (nSpin < DEFAULT_CHECK_POOL_SPIN) {
+                boost::this_thread::yield();
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fMasterWaiting.store(true);
+            while (nDone.load() != nPushed.load())
+                condMaster.wait(lock);
+            fMasterWaiting.store(false);
+        }
+
+        // Let workers that looked at the queue leave before the next round reuses it
+        fActive.store(false);
+        while (nBusy.load() != 0)
+            boost::this_thread::yield();
+
+        bool fRet = fAllOk.load();
+        // reset the status for new work later
+        fAllOk.store(true);
+        nPushed.store(0);
+        nClaimed.store(0);
+        nDone.store(0);
+        for (unsigned int i = 0; i <= CHECK_POOL_MAX_WORKERS; i++)
+            vDeques[i].range.store(0);
+        return fRet;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        uint32_t n = nPushed.load(std::memory_order_relaxed);
+        uint32_t nAdded = 0;
+        for (typename std::vector<T>::iterator it = vChecks.begin(); it != vChecks.end(); ++it) {
+            if (n + nAdded == nSegments * SEGMENT_SIZE) {
+                if (nSegments == MAX_SEGMENTS) {
+                    // Out of room: the master runs the remaining checks itself
+                    if (fAllOk.load(std::memory_order_relaxed) && !(*it)())
+                        fAllOk.store(false, std::memory_order_relaxed);
+                    continue;
+                }
+                vSegments[nSegments++] = new T[SEGMENT_SIZE];
+            }
+            Get(n + nAdded).swap(*it);
+            nAdded++;
         }
-        nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        if (nAdded == 0)
+            return;
+
+        nPushed.store(n + nAdded);
+        fActive.store(true);
+        pool.Notify(nAdded > 1);
     }
 
     ~CCheckQueue()
     {
+        for (unsigned int i = 0; i < nSegments; i++)
+            delete[] vSegments[i];
     }
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return !fActive.load() && nPushed.load() == 0 && fAllOk.load();
     }
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -0,0 +1,45 @@
+// Copyright (c) 2015 The Bitcoin developers
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CORE_MEMUSAGE_H
+#define BITCOIN_CORE_MEMUSAGE_H
+
+#include "memusage.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+
+static inline size_t RecursiveDynamicUsage(const CScript& script)
+{
+    return memusage::DynamicUsage(*static_cast<const CScriptBase*>(&script));
+}
+
+static inline size_t RecursiveDynamicUsage(const COutPoint& out)
+{
+    return 0;
+}
+
+static inline size_t RecursiveDynamicUsage(const CTxIn& in)
+{
+    return RecursiveDynamicUsage(in.scriptSig) + RecursiveDynamicUsage(in.prevPubKey) + RecursiveDynamicUsage(in.prevout);
+}
+
+static inline size_t RecursiveDynamicUsage(const CTxOut& out)
+{
+    return RecursiveDynamicUsage(out.scriptPubKey);
+}
+
+static inline size_t RecursiveDynamicUsage(const CTransaction& tx)
+{
+    size_t mem = memusage::DynamicUsage(tx.vin) + memusage::DynamicUsage(tx.vout);
+    for (std::vector<CTxIn>::const_iterator it = tx.vin.begin(); it != tx.vin.end(); it++) {
+        mem += RecursiveDynamicUsage(*it);
+    }
+    for (std::vector<CTxOut>::const_iterator it = tx.vout.begin(); it != tx.vout.end(); it++) {
+        mem += RecursiveDynamicUsage(*it);
+    }
+    return mem;
+}
+
+#endif // BITCOIN_CORE_MEMUSAGE_H
@@ -0,0 +1,21 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_CPUFEATURES_H
+#define BITCOIN_CRYPTO_CPUFEATURES_H
+
+/** Instruction set extensions that the CPU has and the operating system allows; all false off x86. */
+struct CPUFeatures {
+    bool fSSE41;
+    bool fAES;
+    //! Only set if the operating system saves the AVX registers on context switches
+    bool fAVX;
+    bool fAVX2;
+    bool fSHANI;
+};
+
+/** Query cpuid and xgetbv, for the hashes to pick their implementations at startup */
+CPUFeatures GetCPUFeatures();
+
+#endif // BITCOIN_CRYPTO_CPUFEATURES_H
@@ -0,0 +1,159 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/quark.h"
+
+#include "crypto/cpufeatures.h"
+#include "crypto/sph_blake.h"
+#include "crypto/sph_bmw.h"
+#include "crypto/sph_groestl.h"
+#include "crypto/sph_jh.h"
+#include "crypto/sph_keccak.h"
+#include "crypto/sph_skein.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#define ENABLE_QUARK_X86 1
+namespace quark_avx2
+{
+void Hash_4way(unsigned char* out, const unsigned char* in);
+}
+#endif
+
+namespace
+{
+void Blake512(unsigned char* out, const unsigned char* in, size_t len)
+{
+    sph_blake512_context ctx;
+    sph_blake512_init(&ctx);
+    sph_blake512(&ctx, in, len);
+    sph_blake512_close(&ctx, out);
+}
+
+void Bmw512(unsigned char* out, const unsigned char* in)
+{
+    sph_bmw512_context ctx;
+    sph_bmw512_init(&ctx);
+    sph_bmw512(&ctx, in, 64);
+    sph_bmw512_close(&ctx, out);
+}
+
+void Groestl512(unsigned char* out, const unsigned char* in)
+{
+    sph_groestl512_context ctx;
+    sph_groestl512_init(&ctx);
+    sph_groestl512(&ctx, in, 64);
+    sph_groestl512_close(&ctx, out);
+}
+
+void Jh512(unsigned char* out, const unsigned char* in)
+{
+    sph_jh512_context ctx;
+    sph_jh512_init(&ctx);
+    sph_jh512(&ctx, in, 64);
+    sph_jh512_close(&ctx, out);
+}
+
+void Keccak512(unsigned char* out, const unsigned char* in)
+{
+    sph_keccak512_context ctx;
+    sph_keccak512_init(&ctx);
+    sph_keccak512(&ctx, in, 64);
+    sph_keccak512_close(&ctx, out);
+}
+
+void Skein512(unsigned char* out, const unsigned char* in)
+{
+    sph_skein512_context ctx;
+    sph_skein512_init(&ctx);
+    sph_skein512(&ctx, in, 64);
+    sph_skein512_close(&ctx, out);
+}
+
+/** Quark hash of one 80-byte input with the sph code. Three of the steps pick
+ *  one of two functions by bit 3 of the first byte of the previous hash.
+ */
+void Hash_1way(unsigned char* out, const unsigned char* in)
+{
+    unsigned char a[64], b[64];
+    Blake512(a, in, 80);
+    Bmw512(b, a);
+    if (b[0] & 8)
+        Groestl512(a, b);
+    else
+        Skein512(a, b);
+    Groestl512(b, a);
+    Jh512(a, b);
+    if (a[0] & 8)
+        Blake512(b, a, 64);
+    else
+        Bmw512(b, a);
+    Keccak512(a, b);
+    Skein512(b, a);
+    if (b[0] & 8)
+        Keccak512(a, b);
+    else
+        Jh512(a, b);
+    memcpy(out, a, 32);
+}
+
+typedef void (*TransformType)(unsigned char*, const unsigned char*);
+
+TransformType Hash_4way = NULL;
+
+/** Whether the selected implementation agrees with the portable one on a few inputs */
+bool SelfTest()
+{
+    if (!Hash_4way)
+        return true;
+
+    // Enough inputs for every combination of branches to come up
+    unsigned char in[16 * 80];
+    for (int i = 0; i < 16 * 80; i++)
+        in[i] = (unsigned char)(i * 7 + 3);
+    unsigned char expected[16 * 32], out[16 * 32];
+    for (int i = 0; i < 16; i++)
+        Hash_1way(expected + 32 * i, in + 80 * i);
+    for (int i = 0; i < 16; i += 4)
+        Hash_4way(out + 32 * i, in + 80 * i);
+    return memcmp(out, expected, sizeof(out)) == 0;
+}
+} // namespace
+
+std::string QuarkAutoDetect()
+{
+    std::string ret = "standard";
+#if defined(ENABLE_QUARK_X86)
+    CPUFeatures features = GetCPUFeatures();
+    if (features.fAVX2 && features.fAES) {
+        Hash_4way = quark_avx2::Hash_4way;
+        ret = "avx2,aes(4way)";
+    }
+#endif
+
+    if (!SelfTest()) {
+        Hash_4way = NULL;
+        ret = "standard";
+    }
+    return ret;
+}
+
+void Quark80(unsigned char* out, const unsigned char* in, size_t blocks)
+{
+    if (Hash_4way) {
+        while (blocks >= 4) {
+            Hash_4way(out, in);
+            out += 128;
+            in += 320;
+            blocks -= 4;
+        }
+    }
+    while (blocks) {
+        Hash_1way(out, in);
+        out += 32;
+        in += 80;
+        --blocks;
+    }
+}
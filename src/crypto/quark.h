@@ -0,0 +1,26 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_QUARK_H
+#define BITCOIN_CRYPTO_QUARK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+
+/** Autodetect the best available Quark implementation.
+ *  Returns the name of the implementation.
+ */
+std::string QuarkAutoDetect();
+
+/** Compute the Quark hashes of multiple 80-byte blobs, such as the headers of
+ *  version 1 to 3 blocks; the same as HashQuark, several at a time where the
+ *  CPU allows.
+ *  output:  pointer to a blocks*32 byte output buffer
+ *  input:   pointer to a blocks*80 byte input buffer
+ *  blocks:  the number of hashes to compute.
+ */
+void Quark80(unsigned char* output, const unsigned char* input, size_t blocks);
+
+#endif // BITCOIN_CRYPTO_QUARK_H
@@ -0,0 +1,738 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Quark hash of four independent 80-byte inputs, one per 64-bit lane of an
+// AVX2 register. Blake, BMW, JH, Keccak and Skein run on the four lanes at
+// once. Groestl runs one lane at a time, its S-box done with AES-NI.
+// Only called after QuarkAutoDetect found AVX2 and AES-NI.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+
+#include "crypto/common.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+#define AES_TARGET __attribute__((target("avx2,aes")))
+
+namespace
+{
+//! One 64-bit word of each of the four inputs
+typedef uint64_t v4 __attribute__((vector_size(32)));
+
+AVX2_TARGET inline v4 Set1(uint64_t x)
+{
+    v4 r = {x, x, x, x};
+    return r;
+}
+AVX2_TARGET inline v4 Rotl(v4 x, int n) { return (x << n) | (x >> (64 - n)); }
+AVX2_TARGET inline v4 Rotr(v4 x, int n) { return (x >> n) | (x << (64 - n)); }
+AVX2_TARGET inline v4 Bswap(v4 x)
+{
+    const __m256i mask = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7,
+        8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+    return (v4)_mm256_shuffle_epi8((__m256i)x, mask);
+}
+
+/** Lanes that take the first branch of a Quark step, those with bit 3 of the previous hash set */
+AVX2_TARGET inline v4 Branch(const v4* h) { return (v4)((h[0] & Set1(8)) != Set1(0)); }
+
+AVX2_TARGET inline bool Any(v4 sel) { return (sel[0] | sel[1] | sel[2] | sel[3]) != 0; }
+AVX2_TARGET inline bool All(v4 sel) { return (sel[0] & sel[1] & sel[2] & sel[3]) != 0; }
+
+/** out = sel ? a : b, lane by lane. A side that no lane selects is not read */
+AVX2_TARGET inline void Select(v4* out, v4 sel, const v4* a, const v4* b)
+{
+    for (int i = 0; i < 8; i++)
+        out[i] = All(sel) ? a[i] : !Any(sel) ? b[i] : (a[i] & sel) | (b[i] & ~sel);
+}
+
+/* Blake-512 */
+
+const uint64_t BLAKE_IV[8] = {
+    0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL, 0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+    0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL, 0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL};
+
+const uint64_t BLAKE_C[16] = {
+    0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+    0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL, 0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL,
+    0x9216D5D98979FB1BULL, 0xD1310BA698DFB5ACULL, 0x2FFD72DBD01ADFB7ULL, 0xB8E1AFED6A267E96ULL,
+    0xBA7C9045F12C7F99ULL, 0x24A19947B3916CF7ULL, 0x0801F2E2858EFC16ULL, 0x636920D871574E69ULL};
+
+const unsigned char BLAKE_SIGMA[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0}};
+
+AVX2_TARGET inline void BlakeG(v4* v, const v4* m, const unsigned char* s, int i, int a, int b, int c, int d)
+{
+    v[a] = v[a] + v[b] + (m[s[2 * i]] ^ Set1(BLAKE_C[s[2 * i + 1]]));
+    v[d] = Rotr(v[d] ^ v[a], 32);
+    v[c] = v[c] + v[d];
+    v[b] = Rotr(v[b] ^ v[c], 25);
+    v[a] = v[a] + v[b] + (m[s[2 * i + 1]] ^ Set1(BLAKE_C[s[2 * i]]));
+    v[d] = Rotr(v[d] ^ v[a], 16);
+    v[c] = v[c] + v[d];
+    v[b] = Rotr(v[b] ^ v[c], 11);
+}
+
+/** Blake-512 of a message of nWords little endian words, which fits one block with its padding */
+AVX2_TARGET void Blake512(v4* out, const v4* in, int nWords)
+{
+    const uint64_t nBits = 64 * nWords;
+    v4 m[16];
+    for (int i = 0; i < 16; i++)
+        m[i] = i < nWords ? Bswap(in[i]) : Set1(0);
+    m[nWords] = Set1(0x8000000000000000ULL);
+    m[13] = m[13] | Set1(1);
+    m[15] = Set1(nBits);
+
+    v4 v[16];
+    for (int i = 0; i < 8; i++) {
+        v[i] = Set1(BLAKE_IV[i]);
+        v[i + 8] = Set1(BLAKE_C[i]);
+    }
+    v[12] = v[12] ^ Set1(nBits);
+    v[13] = v[13] ^ Set1(nBits);
+    for (int r = 0; r < 16; r++) {
+        const unsigned char* s = BLAKE_SIGMA[r % 10];
+        BlakeG(v, m, s, 0, 0, 4, 8, 12);
+        BlakeG(v, m, s, 1, 1, 5, 9, 13);
+        BlakeG(v, m, s, 2, 2, 6, 10, 14);
+        BlakeG(v, m, s, 3, 3, 7, 11, 15);
+        BlakeG(v, m, s, 4, 0, 5, 10, 15);
+        BlakeG(v, m, s, 5, 1, 6, 11, 12);
+        BlakeG(v, m, s, 6, 2, 7, 8, 13);
+        BlakeG(v, m, s, 7, 3, 4, 9, 14);
+    }
+    for (int i = 0; i < 8; i++)
+        out[i] = Bswap(Set1(BLAKE_IV[i]) ^ v[i] ^ v[i + 8]);
+}
+
+/* Blue Midnight Wish 512 */
+
+AVX2_TARGET inline v4 BmwS(int i, v4 x)
+{
+    switch (i) {
+    case 0: return (x >> 1) ^ (x << 3) ^ Rotl(x, 4) ^ Rotl(x, 37);
+    case 1: return (x >> 1) ^ (x << 2) ^ Rotl(x, 13) ^ Rotl(x, 43);
+    case 2: return (x >> 2) ^ (x << 1) ^ Rotl(x, 19) ^ Rotl(x, 53);
+    case 3: return (x >> 2) ^ (x << 2) ^ Rotl(x, 28) ^ Rotl(x, 59);
+    case 4: return (x >> 1) ^ x;
+    default: return (x >> 2) ^ x;
+    }
+}
+
+const int BMW_R[7] = {5, 11, 27, 32, 37, 43, 53};
+
+AVX2_TARGET void BmwCompress(v4* dh, const v4* m, const v4* h)
+{
+    v4 mh[16], w[16], q[32];
+    for (int i = 0; i < 16; i++)
+        mh[i] = m[i] ^ h[i];
+    w[0] = mh[5] - mh[7] + mh[10] + mh[13] + mh[14];
+    w[1] = mh[6] - mh[8] + mh[11] + mh[14] - mh[15];
+    w[2] = mh[0] + mh[7] + mh[9] - mh[12] + mh[15];
+    w[3] = mh[0] - mh[1] + mh[8] - mh[10] + mh[13];
+    w[4] = mh[1] + mh[2] + mh[9] - mh[11] - mh[14];
+    w[5] = mh[3] - mh[2] + mh[10] - mh[12] + mh[15];
+    w[6] = mh[4] - mh[0] - mh[3] - mh[11] + mh[13];
+    w[7] = mh[1] - mh[4] - mh[5] - mh[12] - mh[14];
+    w[8] = mh[2] - mh[5] - mh[6] + mh[13] - mh[15];
+    w[9] = mh[0] - mh[3] + mh[6] - mh[7] + mh[14];
+    w[10] = mh[8] - mh[1] - mh[4] - mh[7] + mh[15];
+    w[11] = mh[8] - mh[0] - mh[2] - mh[5] + mh[9];
+    w[12] = mh[1] + mh[3] - mh[6] - mh[9] + mh[10];
+    w[13] = mh[2] + mh[4] + mh[7] + mh[10] + mh[11];
+    w[14] = mh[3] - mh[5] + mh[8] - mh[11] - mh[12];
+    w[15] = mh[12] - mh[4] - mh[6] - mh[9] + mh[13];
+    for (int i = 0; i < 16; i++)
+        q[i] = BmwS(i % 5, w[i]) + h[(i + 1) & 15];
+    for (int i = 16; i < 32; i++) {
+        int j = i - 16;
+        v4 e = (Rotl(m[j], j + 1) + Rotl(m[(j + 3) & 15], ((j + 3) & 15) + 1) -
+                   Rotl(m[(j + 10) & 15], ((j + 10) & 15) + 1) + Set1(i * 0x0555555555555555ULL)) ^
+               h[(j + 7) & 15];
+        if (i < 18) {
+            for (int k = 0; k < 16; k++)
+                e = e + BmwS((k + 1) & 3, q[j + k]);
+        } else {
+            for (int k = 0; k < 14; k += 2)
+                e = e + q[j + k] + Rotl(q[j + k + 1], BMW_R[k / 2]);
+            e = e + BmwS(4, q[i - 2]) + BmwS(5, q[i - 1]);
+        }
+        q[i] = e;
+    }
+
+    v4 xl = q[16] ^ q[17] ^ q[18] ^ q[19] ^ q[20] ^ q[21] ^ q[22] ^ q[23];
+    v4 xh = xl ^ q[24] ^ q[25] ^ q[26] ^ q[27] ^ q[28] ^ q[29] ^ q[30] ^ q[31];
+    dh[0] = ((xh << 5) ^ (q[16] >> 5) ^ m[0]) + (xl ^ q[24] ^ q[0]);
+    dh[1] = ((xh >> 7) ^ (q[17] << 8) ^ m[1]) + (xl ^ q[25] ^ q[1]);
+    dh[2] = ((xh >> 5) ^ (q[18] << 5) ^ m[2]) + (xl ^ q[26] ^ q[2]);
+    dh[3] = ((xh >> 1) ^ (q[19] << 5) ^ m[3]) + (xl ^ q[27] ^ q[3]);
+    dh[4] = ((xh >> 3) ^ q[20] ^ m[4]) + (xl ^ q[28] ^ q[4]);
+    dh[5] = ((xh << 6) ^ (q[21] >> 6) ^ m[5]) + (xl ^ q[29] ^ q[5]);
+    dh[6] = ((xh >> 4) ^ (q[22] << 6) ^ m[6]) + (xl ^ q[30] ^ q[6]);
+    dh[7] = ((xh >> 11) ^ (q[23] << 2) ^ m[7]) + (xl ^ q[31] ^ q[7]);
+    dh[8] = Rotl(dh[4], 9) + (xh ^ q[24] ^ m[8]) + ((xl << 8) ^ q[23] ^ q[8]);
+    dh[9] = Rotl(dh[5], 10) + (xh ^ q[25] ^ m[9]) + ((xl >> 6) ^ q[16] ^ q[9]);
+    dh[10] = Rotl(dh[6], 11) + (xh ^ q[26] ^ m[10]) + ((xl << 6) ^ q[17] ^ q[10]);
+    dh[11] = Rotl(dh[7], 12) + (xh ^ q[27] ^ m[11]) + ((xl << 4) ^ q[18] ^ q[11]);
+    dh[12] = Rotl(dh[0], 13) + (xh ^ q[28] ^ m[12]) + ((xl >> 3) ^ q[19] ^ q[12]);
+    dh[13] = Rotl(dh[1], 14) + (xh ^ q[29] ^ m[13]) + ((xl >> 4) ^ q[20] ^ q[13]);
+    dh[14] = Rotl(dh[2], 15) + (xh ^ q[30] ^ m[14]) + ((xl >> 7) ^ q[21] ^ q[14]);
+    dh[15] = Rotl(dh[3], 16) + (xh ^ q[31] ^ m[15]) + ((xl >> 2) ^ q[22] ^ q[15]);
+}
+
+/** BMW-512 of a 64-byte message */
+AVX2_TARGET void Bmw512(v4* out, const v4* in)
+{
+    v4 m[16], h[16], h1[16], h2[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = i < 8 ? in[i] : Set1(0);
+        h[i] = Set1(0x8081828384858687ULL + i * 0x0808080808080808ULL);
+    }
+    m[8] = Set1(0x80);
+    m[15] = Set1(512);
+    BmwCompress(h2, m, h);
+    for (int i = 0; i < 16; i++)
+        h[i] = Set1(0xaaaaaaaaaaaaaaa0ULL + i);
+    BmwCompress(h1, h2, h);
+    for (int i = 0; i < 8; i++)
+        out[i] = h1[i + 8];
+}
+
+/* Groestl-512. Each SSE register holds one row of the 8x16 byte state, which
+   makes MixBytes plain GF(2^8) arithmetic between registers and SubBytes the
+   AES S-box of aesenclast */
+
+//! pshufb masks for ShiftBytes of each row of P, then of Q, each undoing the ShiftRows of aesenclast
+const unsigned char GROESTL_SHUFFLE[16][16] __attribute__((aligned(16))) = {
+    {0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3},
+    {1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3, 0, 13, 10, 7, 4},
+    {2, 15, 12, 9, 6, 3, 0, 13, 10, 7, 4, 1, 14, 11, 8, 5},
+    {3, 0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6},
+    {4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3, 0, 13, 10, 7},
+    {5, 2, 15, 12, 9, 6, 3, 0, 13, 10, 7, 4, 1, 14, 11, 8},
+    {6, 3, 0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9},
+    {11, 8, 5, 2, 15, 12, 9, 6, 3, 0, 13, 10, 7, 4, 1, 14},
+    {1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3, 0, 13, 10, 7, 4},
+    {3, 0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6},
+    {5, 2, 15, 12, 9, 6, 3, 0, 13, 10, 7, 4, 1, 14, 11, 8},
+    {11, 8, 5, 2, 15, 12, 9, 6, 3, 0, 13, 10, 7, 4, 1, 14},
+    {0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3},
+    {2, 15, 12, 9, 6, 3, 0, 13, 10, 7, 4, 1, 14, 11, 8, 5},
+    {4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3, 0, 13, 10, 7},
+    {6, 3, 0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9}};
+
+AES_TARGET inline __m128i Xtime(__m128i x)
+{
+    __m128i hi = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(hi, _mm_set1_epi8(0x1b)));
+}
+
+/** Row i of MixBytes, from rows i .. i+7: the circulant (02 02 03 04 05 03 05 07) */
+AES_TARGET inline __m128i GroestlMixRow(__m128i a0, __m128i a1, __m128i a2, __m128i a3, __m128i a4, __m128i a5, __m128i a6, __m128i a7)
+{
+    // The rows that coefficient bit 0, 1 and 2 apply to
+    __m128i x0 = a2 ^ a4 ^ a5 ^ a6 ^ a7;
+    __m128i x1 = a0 ^ a1 ^ a2 ^ a5 ^ a7;
+    __m128i x2 = a3 ^ a4 ^ a6 ^ a7;
+    return x0 ^ Xtime(x1 ^ Xtime(x2));
+}
+
+/** ShiftBytes, SubBytes and MixBytes of a round of P or Q */
+AES_TARGET inline void GroestlRound(__m128i* a, const __m128i* shuffle)
+{
+    __m128i b0 = _mm_aesenclast_si128(_mm_shuffle_epi8(a[0], shuffle[0]), _mm_setzero_si128());
+    __m128i b1 = _mm_aesenclast_si128(_mm_shuffle_epi8(a[1], shuffle[1]), _mm_setzero_si128());
+    __m128i b2 = _mm_aesenclast_si128(_mm_shuffle_epi8(a[2], shuffle[2]), _mm_setzero_si128());
+    __m128i b3 = _mm_aesenclast_si128(_mm_shuffle_epi8(a[3], shuffle[3]), _mm_setzero_si128());
+    __m128i b4 = _mm_aesenclast_si128(_mm_shuffle_epi8(a[4], shuffle[4]), _mm_setzero_si128());
+    __m128i b5 = _mm_aesenclast_si128(_mm_shuffle_epi8(a[5], shuffle[5]), _mm_setzero_si128());
+    __m128i b6 = _mm_aesenclast_si128(_mm_shuffle_epi8(a[6], shuffle[6]), _mm_setzero_si128());
+    __m128i b7 = _mm_aesenclast_si128(_mm_shuffle_epi8(a[7], shuffle[7]), _mm_setzero_si128());
+    a[0] = GroestlMixRow(b0, b1, b2, b3, b4, b5, b6, b7);
+    a[1] = GroestlMixRow(b1, b2, b3, b4, b5, b6, b7, b0);
+    a[2] = GroestlMixRow(b2, b3, b4, b5, b6, b7, b0, b1);
+    a[3] = GroestlMixRow(b3, b4, b5, b6, b7, b0, b1, b2);
+    a[4] = GroestlMixRow(b4, b5, b6, b7, b0, b1, b2, b3);
+    a[5] = GroestlMixRow(b5, b6, b7, b0, b1, b2, b3, b4);
+    a[6] = GroestlMixRow(b6, b7, b0, b1, b2, b3, b4, b5);
+    a[7] = GroestlMixRow(b7, b0, b1, b2, b3, b4, b5, b6);
+}
+
+/** The P or Q permutation of Groestl-1024 */
+AES_TARGET void GroestlPerm(__m128i* a, bool fQ)
+{
+    const __m128i* shuffle = (const __m128i*)GROESTL_SHUFFLE[fQ ? 8 : 0];
+    const __m128i ones = _mm_set1_epi8(-1);
+    // Column j of the round constant has j in its high nibble
+    const __m128i col = _mm_set_epi8(-16, -32, -48, -64, -80, -96, -112, -128, 112, 96, 80, 64, 48, 32, 16, 0);
+    for (int r = 0; r < 14; r++) {
+        __m128i rc = col ^ _mm_set1_epi8(r);
+        if (fQ) {
+            for (int i = 0; i < 7; i++)
+                a[i] = a[i] ^ ones;
+            a[7] = a[7] ^ rc ^ ones;
+        } else {
+            a[0] = a[0] ^ rc;
+        }
+        GroestlRound(a, shuffle);
+    }
+}
+
+/** Groestl-512 of a 64-byte message, a single block with its padding */
+AES_TARGET void Groestl512Lane(unsigned char* out, const unsigned char* in)
+{
+    // Byte 8 * j + i of a block is row i of column j
+    unsigned char rows[8][16] = {};
+    for (int j = 0; j < 8; j++)
+        for (int i = 0; i < 8; i++)
+            rows[i][j] = in[8 * j + i];
+    rows[0][8] = 0x80;
+    rows[7][15] = 1;
+
+    // The initial value is the output size, 512, in the last two bytes
+    __m128i iv[8], p[8], q[8], h[8];
+    for (int i = 0; i < 8; i++) {
+        iv[i] = _mm_setzero_si128();
+        q[i] = _mm_loadu_si128((const __m128i*)rows[i]);
+    }
+    iv[6] = _mm_set_epi8(2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (int i = 0; i < 8; i++)
+        p[i] = q[i] ^ iv[i];
+    GroestlPerm(p, false);
+    GroestlPerm(q, true);
+    for (int i = 0; i < 8; i++) {
+        h[i] = p[i] ^ q[i] ^ iv[i];
+        p[i] = h[i];
+    }
+    // Output transformation, keeping the last eight columns
+    GroestlPerm(p, false);
+    for (int i = 0; i < 8; i++)
+        _mm_storeu_si128((__m128i*)rows[i], p[i] ^ h[i]);
+    for (int j = 0; j < 8; j++)
+        for (int i = 0; i < 8; i++)
+            out[8 * j + i] = rows[i][j + 8];
+}
+
+/** Groestl-512 in the lanes selected by sel; the others are left as they were */
+AVX2_TARGET void Groestl512(v4* out, const v4* in, v4 sel)
+{
+    unsigned char buf[4][64];
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < 4; j++)
+            WriteLE64(buf[j] + 8 * i, in[i][j]);
+    for (int j = 0; j < 4; j++)
+        if (sel[j])
+            Groestl512Lane(buf[j], buf[j]);
+    for (int i = 0; i < 8; i++) {
+        v4 r = {ReadLE64(buf[0] + 8 * i), ReadLE64(buf[1] + 8 * i), ReadLE64(buf[2] + 8 * i), ReadLE64(buf[3] + 8 * i)};
+        out[i] = r;
+    }
+}
+
+/* JH-512, in the little endian bitslice representation of the sph code */
+
+const uint64_t JH_C[168] = {
+    0x72d5dea2df15f867ULL, 0x7b84150ab7231557ULL, 0x81abd6904d5a87f6ULL, 0x4e9f4fc5c3d12b40ULL,
+    0xea983ae05c45fa9cULL, 0x03c5d29966b2999aULL, 0x660296b4f2bb538aULL, 0xb556141a88dba231ULL,
+    0x03a35a5c9a190edbULL, 0x403fb20a87c14410ULL, 0x1c051980849e951dULL, 0x6f33ebad5ee7cddcULL,
+    0x10ba139202bf6b41ULL, 0xdc786515f7bb27d0ULL, 0x0a2c813937aa7850ULL, 0x3f1abfd2410091d3ULL,
+    0x422d5a0df6cc7e90ULL, 0xdd629f9c92c097ceULL, 0x185ca70bc72b44acULL, 0xd1df65d663c6fc23ULL,
+    0x976e6c039ee0b81aULL, 0x2105457e446ceca8ULL, 0xeef103bb5d8e61faULL, 0xfd9697b294838197ULL,
+    0x4a8e8537db03302fULL, 0x2a678d2dfb9f6a95ULL, 0x8afe7381f8b8696cULL, 0x8ac77246c07f4214ULL,
+    0xc5f4158fbdc75ec4ULL, 0x75446fa78f11bb80ULL, 0x52de75b7aee488bcULL, 0x82b8001e98a6a3f4ULL,
+    0x8ef48f33a9a36315ULL, 0xaa5f5624d5b7f989ULL, 0xb6f1ed207c5ae0fdULL, 0x36cae95a06422c36ULL,
+    0xce2935434efe983dULL, 0x533af974739a4ba7ULL, 0xd0f51f596f4e8186ULL, 0x0e9dad81afd85a9fULL,
+    0xa7050667ee34626aULL, 0x8b0b28be6eb91727ULL, 0x47740726c680103fULL, 0xe0a07e6fc67e487bULL,
+    0x0d550aa54af8a4c0ULL, 0x91e3e79f978ef19eULL, 0x8676728150608dd4ULL, 0x7e9e5a41f3e5b062ULL,
+    0xfc9f1fec4054207aULL, 0xe3e41a00cef4c984ULL, 0x4fd794f59dfa95d8ULL, 0x552e7e1124c354a5ULL,
+    0x5bdf7228bdfe6e28ULL, 0x78f57fe20fa5c4b2ULL, 0x05897cefee49d32eULL, 0x447e9385eb28597fULL,
+    0x705f6937b324314aULL, 0x5e8628f11dd6e465ULL, 0xc71b770451b920e7ULL, 0x74fe43e823d4878aULL,
+    0x7d29e8a3927694f2ULL, 0xddcb7a099b30d9c1ULL, 0x1d1b30fb5bdc1be0ULL, 0xda24494ff29c82bfULL,
+    0xa4e7ba31b470bfffULL, 0x0d324405def8bc48ULL, 0x3baefc3253bbd339ULL, 0x459fc3c1e0298ba0ULL,
+    0xe5c905fdf7ae090fULL, 0x947034124290f134ULL, 0xa271b701e344ed95ULL, 0xe93b8e364f2f984aULL,
+    0x88401d63a06cf615ULL, 0x47c1444b8752afffULL, 0x7ebb4af1e20ac630ULL, 0x4670b6c5cc6e8ce6ULL,
+    0xa4d5a456bd4fca00ULL, 0xda9d844bc83e18aeULL, 0x7357ce453064d1adULL, 0xe8a6ce68145c2567ULL,
+    0xa3da8cf2cb0ee116ULL, 0x33e906589a94999aULL, 0x1f60b220c26f847bULL, 0xd1ceac7fa0d18518ULL,
+    0x32595ba18ddd19d3ULL, 0x509a1cc0aaa5b446ULL, 0x9f3d6367e4046bbaULL, 0xf6ca19ab0b56ee7eULL,
+    0x1fb179eaa9282174ULL, 0xe9bdf7353b3651eeULL, 0x1d57ac5a7550d376ULL, 0x3a46c2fea37d7001ULL,
+    0xf735c1af98a4d842ULL, 0x78edec209e6b6779ULL, 0x41836315ea3adba8ULL, 0xfac33b4d32832c83ULL,
+    0xa7403b1f1c2747f3ULL, 0x5940f034b72d769aULL, 0xe73e4e6cd2214ffdULL, 0xb8fd8d39dc5759efULL,
+    0x8d9b0c492b49ebdaULL, 0x5ba2d74968f3700dULL, 0x7d3baed07a8d5584ULL, 0xf5a5e9f0e4f88e65ULL,
+    0xa0b8a2f436103b53ULL, 0x0ca8079e753eec5aULL, 0x9168949256e8884fULL, 0x5bb05c55f8babc4cULL,
+    0xe3bb3b99f387947bULL, 0x75daf4d6726b1c5dULL, 0x64aeac28dc34b36dULL, 0x6c34a550b828db71ULL,
+    0xf861e2f2108d512aULL, 0xe3db643359dd75fcULL, 0x1cacbcf143ce3fa2ULL, 0x67bbd13c02e843b0ULL,
+    0x330a5bca8829a175ULL, 0x7f34194db416535cULL, 0x923b94c30e794d1eULL, 0x797475d7b6eeaf3fULL,
+    0xeaa8d4f7be1a3921ULL, 0x5cf47e094c232751ULL, 0x26a32453ba323cd2ULL, 0x44a3174a6da6d5adULL,
+    0xb51d3ea6aff2c908ULL, 0x83593d98916b3c56ULL, 0x4cf87ca17286604dULL, 0x46e23ecc086ec7f6ULL,
+    0x2f9833b3b1bc765eULL, 0x2bd666a5efc4e62aULL, 0x06f4b6e8bec1d436ULL, 0x74ee8215bcef2163ULL,
+    0xfdc14e0df453c969ULL, 0xa77d5ac406585826ULL, 0x7ec1141606e0fa16ULL, 0x7e90af3d28639d3fULL,
+    0xd2c9f2e3009bd20cULL, 0x5faace30b7d40c30ULL, 0x742a5116f2e03298ULL, 0x0deb30d8e3cef89aULL,
+    0x4bc59e7bb5f17992ULL, 0xff51e66e048668d3ULL, 0x9b234d57e6966731ULL, 0xcce6a6f3170a7505ULL,
+    0xb17681d913326cceULL, 0x3c175284f805a262ULL, 0xf42bcbb378471547ULL, 0xff46548223936a48ULL,
+    0x38df58074e5e6565ULL, 0xf2fc7c89fc86508eULL, 0x31702e44d00bca86ULL, 0xf04009a23078474eULL,
+    0x65a0ee39d1f73883ULL, 0xf75ee937e42c3abdULL, 0x2197b2260113f86fULL, 0xa344edd1ef9fdee7ULL,
+    0x8ba0df15762592d9ULL, 0x3c85f7f612dc42beULL, 0xd8a7ec7cab27b07eULL, 0x538d7ddaaa3ea8deULL,
+    0xaa25ce93bd0269d8ULL, 0x5af643fd1a7308f9ULL, 0xc05fefda174a19a5ULL, 0x974d66334cfd216aULL,
+    0x35b49831db411570ULL, 0xea1e0fbbedcd549bULL, 0x9ad063a151974072ULL, 0xf6759dbf91476fe2ULL};
+
+const uint64_t JH_IV[16] = {
+    0x6fd14b963e00aa17ULL, 0x636a2e057a15d543ULL, 0x8a225e8d0c97ef0bULL, 0xe9341259f2b3c361ULL,
+    0x891da0c1536f801eULL, 0x2aa9056bea2b6d80ULL, 0x588eccdb2075baa6ULL, 0xa90f3a76baf83bf7ULL,
+    0x0169e60541e34a69ULL, 0x46b58a8e2e6fe65aULL, 0x1047a7d0c1843c24ULL, 0x3b6e71b12d5ac199ULL,
+    0xcf57f6ec9db1f856ULL, 0xa706887c5716b156ULL, 0xe3c2fcdfe68517fbULL, 0x545a4678cc8cdd4bULL};
+
+AVX2_TARGET inline v4 JhConst(uint64_t x) { return Set1(__builtin_bswap64(x)); }
+
+AVX2_TARGET inline void JhSb(v4& x0, v4& x1, v4& x2, v4& x3, v4 c)
+{
+    x3 = ~x3;
+    x0 = x0 ^ (c & ~x2);
+    v4 tmp = c ^ (x0 & x1);
+    x0 = x0 ^ (x2 & x3);
+    x3 = x3 ^ (~x1 & x2);
+    x1 = x1 ^ (x0 & x2);
+    x2 = x2 ^ (x0 & ~x3);
+    x0 = x0 ^ (x1 | x3);
+    x3 = x3 ^ (x1 & x2);
+    x1 = x1 ^ (tmp & x0);
+    x2 = x2 ^ tmp;
+}
+
+AVX2_TARGET inline void JhLb(v4* x)
+{
+    // x0..x3 are the even words, x4..x7 the odd ones
+    x[4] = x[4] ^ x[1];
+    x[5] = x[5] ^ x[2];
+    x[6] = x[6] ^ x[3] ^ x[0];
+    x[7] = x[7] ^ x[0];
+    x[0] = x[0] ^ x[5];
+    x[1] = x[1] ^ x[6];
+    x[2] = x[2] ^ x[7] ^ x[4];
+    x[3] = x[3] ^ x[4];
+}
+
+AVX2_TARGET inline v4 JhWz(v4 x, uint64_t c, int n)
+{
+    v4 t = (x & Set1(c)) << n;
+    return ((x >> n) & Set1(c)) | t;
+}
+
+/** The JH state as the high and low halves of words 0..7 */
+struct JhState {
+    v4 h[8], l[8];
+};
+
+AVX2_TARGET void JhE8(JhState& s)
+{
+    static const uint64_t W_MASK[6] = {0x5555555555555555ULL, 0x3333333333333333ULL, 0x0F0F0F0F0F0F0F0FULL,
+        0x00FF00FF00FF00FFULL, 0x0000FFFF0000FFFFULL, 0x00000000FFFFFFFFULL};
+    for (int r = 0; r < 42; r++) {
+        JhSb(s.h[0], s.h[2], s.h[4], s.h[6], JhConst(JH_C[4 * r]));
+        JhSb(s.l[0], s.l[2], s.l[4], s.l[6], JhConst(JH_C[4 * r + 1]));
+        JhSb(s.h[1], s.h[3], s.h[5], s.h[7], JhConst(JH_C[4 * r + 2]));
+        JhSb(s.l[1], s.l[3], s.l[5], s.l[7], JhConst(JH_C[4 * r + 3]));
+        v4 xh[8] = {s.h[0], s.h[2], s.h[4], s.h[6], s.h[1], s.h[3], s.h[5], s.h[7]};
+        v4 xl[8] = {s.l[0], s.l[2], s.l[4], s.l[6], s.l[1], s.l[3], s.l[5], s.l[7]};
+        JhLb(xh);
+        JhLb(xl);
+        for (int i = 0; i < 4; i++) {
+            s.h[2 * i] = xh[i];
+            s.l[2 * i] = xl[i];
+            s.h[2 * i + 1] = xh[i + 4];
+            s.l[2 * i + 1] = xl[i + 4];
+        }
+        int ro = r % 7;
+        for (int i = 1; i < 8; i += 2) {
+            if (ro < 6) {
+                s.h[i] = JhWz(s.h[i], W_MASK[ro], 1 << ro);
+                s.l[i] = JhWz(s.l[i], W_MASK[ro], 1 << ro);
+            } else {
+                v4 t = s.h[i];
+                s.h[i] = s.l[i];
+                s.l[i] = t;
+            }
+        }
+    }
+}
+
+AVX2_TARGET void JhBlock(JhState& s, const v4* m)
+{
+    for (int i = 0; i < 4; i++) {
+        s.h[i] = s.h[i] ^ m[2 * i];
+        s.l[i] = s.l[i] ^ m[2 * i + 1];
+    }
+    JhE8(s);
+    for (int i = 0; i < 4; i++) {
+        s.h[i + 4] = s.h[i + 4] ^ m[2 * i];
+        s.l[i + 4] = s.l[i + 4] ^ m[2 * i + 1];
+    }
+}
+
+/** JH-512 of a 64-byte message */
+AVX2_TARGET void Jh512(v4* out, const v4* in)
+{
+    JhState s;
+    for (int i = 0; i < 8; i++) {
+        s.h[i] = JhConst(JH_IV[2 * i]);
+        s.l[i] = JhConst(JH_IV[2 * i + 1]);
+    }
+    JhBlock(s, in);
+    // The padding block: a single 1 bit and the message length in bits
+    v4 pad[8];
+    for (int i = 0; i < 8; i++)
+        pad[i] = Set1(0);
+    pad[0] = Set1(0x80);
+    pad[7] = Set1(__builtin_bswap64(512));
+    JhBlock(s, pad);
+    for (int i = 0; i < 4; i++) {
+        out[2 * i] = s.h[i + 4];
+        out[2 * i + 1] = s.l[i + 4];
+    }
+}
+
+/* Keccak-512 */
+
+const uint64_t KECCAK_RC[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808AULL, 0x8000000080008000ULL,
+    0x000000000000808BULL, 0x0000000080000001ULL, 0x8000000080008081ULL, 0x8000000000008009ULL,
+    0x000000000000008AULL, 0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000AULL,
+    0x000000008000808BULL, 0x800000000000008BULL, 0x8000000000008089ULL, 0x8000000000008003ULL,
+    0x8000000000008002ULL, 0x8000000000000080ULL, 0x000000000000800AULL, 0x800000008000000AULL,
+    0x8000000080008081ULL, 0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL};
+
+/** The 24 rounds of Keccak-f[1600] on the lanes in a, lane x + 5 * y at a[x + 5 * y] */
+AVX2_TARGET void KeccakF(v4* a)
+{
+    for (int r = 0; r < 24; r++) {
+        // Theta
+        v4 c0 = a[0] ^ a[5] ^ a[10] ^ a[15] ^ a[20];
+        v4 c1 = a[1] ^ a[6] ^ a[11] ^ a[16] ^ a[21];
+        v4 c2 = a[2] ^ a[7] ^ a[12] ^ a[17] ^ a[22];
+        v4 c3 = a[3] ^ a[8] ^ a[13] ^ a[18] ^ a[23];
+        v4 c4 = a[4] ^ a[9] ^ a[14] ^ a[19] ^ a[24];
+        v4 d0 = c4 ^ Rotl(c1, 1);
+        v4 d1 = c0 ^ Rotl(c2, 1);
+        v4 d2 = c1 ^ Rotl(c3, 1);
+        v4 d3 = c2 ^ Rotl(c4, 1);
+        v4 d4 = c3 ^ Rotl(c0, 1);
+        // Rho and pi: lane x + 5 * y moves to y + 5 * ((2 * x + 3 * y) % 5)
+        v4 b0 = a[0] ^ d0;
+        v4 b1 = Rotl(a[6] ^ d1, 44);
+        v4 b2 = Rotl(a[12] ^ d2, 43);
+        v4 b3 = Rotl(a[18] ^ d3, 21);
+        v4 b4 = Rotl(a[24] ^ d4, 14);
+        v4 b5 = Rotl(a[3] ^ d3, 28);
+        v4 b6 = Rotl(a[9] ^ d4, 20);
+        v4 b7 = Rotl(a[10] ^ d0, 3);
+        v4 b8 = Rotl(a[16] ^ d1, 45);
+        v4 b9 = Rotl(a[22] ^ d2, 61);
+        v4 b10 = Rotl(a[1] ^ d1, 1);
+        v4 b11 = Rotl(a[7] ^ d2, 6);
+        v4 b12 = Rotl(a[13] ^ d3, 25);
+        v4 b13 = Rotl(a[19] ^ d4, 8);
+        v4 b14 = Rotl(a[20] ^ d0, 18);
+        v4 b15 = Rotl(a[4] ^ d4, 27);
+        v4 b16 = Rotl(a[5] ^ d0, 36);
+        v4 b17 = Rotl(a[11] ^ d1, 10);
+        v4 b18 = Rotl(a[17] ^ d2, 15);
+        v4 b19 = Rotl(a[23] ^ d3, 56);
+        v4 b20 = Rotl(a[2] ^ d2, 62);
+        v4 b21 = Rotl(a[8] ^ d3, 55);
+        v4 b22 = Rotl(a[14] ^ d4, 39);
+        v4 b23 = Rotl(a[15] ^ d0, 41);
+        v4 b24 = Rotl(a[21] ^ d1, 2);
+        // Chi and iota
+        a[0] = b0 ^ (~b1 & b2) ^ Set1(KECCAK_RC[r]);
+        a[1] = b1 ^ (~b2 & b3);
+        a[2] = b2 ^ (~b3 & b4);
+        a[3] = b3 ^ (~b4 & b0);
+        a[4] = b4 ^ (~b0 & b1);
+        a[5] = b5 ^ (~b6 & b7);
+        a[6] = b6 ^ (~b7 & b8);
+        a[7] = b7 ^ (~b8 & b9);
+        a[8] = b8 ^ (~b9 & b5);
+        a[9] = b9 ^ (~b5 & b6);
+        a[10] = b10 ^ (~b11 & b12);
+        a[11] = b11 ^ (~b12 & b13);
+        a[12] = b12 ^ (~b13 & b14);
+        a[13] = b13 ^ (~b14 & b10);
+        a[14] = b14 ^ (~b10 & b11);
+        a[15] = b15 ^ (~b16 & b17);
+        a[16] = b16 ^ (~b17 & b18);
+        a[17] = b17 ^ (~b18 & b19);
+        a[18] = b18 ^ (~b19 & b15);
+        a[19] = b19 ^ (~b15 & b16);
+        a[20] = b20 ^ (~b21 & b22);
+        a[21] = b21 ^ (~b22 & b23);
+        a[22] = b22 ^ (~b23 & b24);
+        a[23] = b23 ^ (~b24 & b20);
+        a[24] = b24 ^ (~b20 & b21);
+    }
+}
+
+/** Keccak-512 of a 64-byte message, which fits the 72-byte rate with its padding */
+AVX2_TARGET void Keccak512(v4* out, const v4* in)
+{
+    v4 a[25];
+    for (int i = 0; i < 25; i++)
+        a[i] = i < 8 ? in[i] : Set1(0);
+    a[8] = Set1(0x8000000000000001ULL);
+    KeccakF(a);
+    for (int i = 0; i < 8; i++)
+        out[i] = a[i];
+}
+
+/* Skein-512-512 */
+
+const uint64_t SKEIN_IV[8] = {
+    0x4903ADFF749C51CEULL, 0x0D95DE399746DF03ULL, 0x8FD1934127C79BCEULL, 0x9A255629FF352CB1ULL,
+    0x5DB62599DF6CA7B0ULL, 0xEABE394CA9D5C3F4ULL, 0x991112C71A75B523ULL, 0xAE18A40B660FCC33ULL};
+
+//! Rotations of the four rounds after an even, and after an odd key injection
+const int SKEIN_ROT[2][4][4] = {
+    {{46, 36, 19, 37}, {33, 27, 14, 42}, {17, 49, 36, 39}, {44, 9, 54, 56}},
+    {{39, 30, 34, 24}, {13, 50, 10, 17}, {25, 29, 39, 43}, {8, 35, 56, 22}}};
+
+AVX2_TARGET inline void SkeinMix(v4& x0, v4& x1, int nRot)
+{
+    x0 = x0 + x1;
+    x1 = Rotl(x1, nRot) ^ x0;
+}
+
+/** Four rounds of Threefish-512, each mixing its own pairs of words */
+AVX2_TARGET inline void SkeinRounds(v4* p, const int (*rot)[4])
+{
+    SkeinMix(p[0], p[1], rot[0][0]);
+    SkeinMix(p[2], p[3], rot[0][1]);
+    SkeinMix(p[4], p[5], rot[0][2]);
+    SkeinMix(p[6], p[7], rot[0][3]);
+    SkeinMix(p[2], p[1], rot[1][0]);
+    SkeinMix(p[4], p[7], rot[1][1]);
+    SkeinMix(p[6], p[5], rot[1][2]);
+    SkeinMix(p[0], p[3], rot[1][3]);
+    SkeinMix(p[4], p[1], rot[2][0]);
+    SkeinMix(p[6], p[3], rot[2][1]);
+    SkeinMix(p[0], p[5], rot[2][2]);
+    SkeinMix(p[2], p[7], rot[2][3]);
+    SkeinMix(p[6], p[1], rot[3][0]);
+    SkeinMix(p[0], p[7], rot[3][1]);
+    SkeinMix(p[2], p[5], rot[3][2]);
+    SkeinMix(p[4], p[3], rot[3][3]);
+}
+
+/** Key injection s: words s .. s+7 of the extended key, the tweak words and s */
+AVX2_TARGET inline void SkeinAddKey(v4* p, const v4* k, const uint64_t* t, int s)
+{
+    p[0] = p[0] + k[s % 9];
+    p[1] = p[1] + k[(s + 1) % 9];
+    p[2] = p[2] + k[(s + 2) % 9];
+    p[3] = p[3] + k[(s + 3) % 9];
+    p[4] = p[4] + k[(s + 4) % 9];
+    p[5] = p[5] + k[(s + 5) % 9] + Set1(t[s % 3]);
+    p[6] = p[6] + k[(s + 6) % 9] + Set1(t[(s + 1) % 3]);
+    p[7] = p[7] + k[(s + 7) % 9] + Set1(s);
+}
+
+/** Threefish-512 of the block in p, with key h and tweak t0, t1 */
+AVX2_TARGET void Threefish512(v4* p, const v4* h, uint64_t t0, uint64_t t1)
+{
+    v4 k[9];
+    k[8] = Set1(0x1BD11BDAA9FC1A22ULL);
+    for (int i = 0; i < 8; i++) {
+        k[i] = h[i];
+        k[8] = k[8] ^ h[i];
+    }
+    const uint64_t t[3] = {t0, t1, t0 ^ t1};
+    v4 x[8] = {p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]};
+    for (int s = 0; s < 18; s += 2) {
+        SkeinAddKey(x, k, t, s);
+        SkeinRounds(x, SKEIN_ROT[0]);
+        SkeinAddKey(x, k, t, s + 1);
+        SkeinRounds(x, SKEIN_ROT[1]);
+    }
+    SkeinAddKey(x, k, t, 18);
+    for (int i = 0; i < 8; i++)
+        p[i] = x[i];
+}
+
+/** Skein-512-512 of a 64-byte message */
+AVX2_TARGET void Skein512(v4* out, const v4* in)
+{
+    v4 h[8], p[8];
+    for (int i = 0; i < 8; i++) {
+        h[i] = Set1(SKEIN_IV[i]);
+        p[i] = in[i];
+    }
+    // The message block: first and final, 64 bytes
+    Threefish512(p, h, 64, 0xF000000000000000ULL);
+    for (int i = 0; i < 8; i++) {
+        h[i] = in[i] ^ p[i];
+        p[i] = Set1(0);
+    }
+    // The output block: counter 0, 8 bytes
+    Threefish512(p, h, 8, 0xFF00000000000000ULL);
+    for (int i = 0; i < 8; i++)
+        out[i] = p[i];
+}
+} // namespace
+
+namespace quark_avx2
+{
+AVX2_TARGET void Hash_4way(unsigned char* out, const unsigned char* in)
+{
+    v4 m[10], a[8], b[8], c[8];
+    for (int i = 0; i < 10; i++) {
+        v4 r = {ReadLE64(in + 8 * i), ReadLE64(in + 80 + 8 * i), ReadLE64(in + 160 + 8 * i), ReadLE64(in + 240 + 8 * i)};
+        m[i] = r;
+    }
+
+    Blake512(a, m, 10);
+    Bmw512(b, a);
+
+    v4 sel = Branch(b);
+    if (Any(sel))
+        Groestl512(c, b, sel);
+    if (!All(sel))
+        Skein512(a, b);
+    Select(b, sel, c, a);
+
+    Groestl512(c, b, Set1(~0ULL));
+    Jh512(b, c);
+
+    sel = Branch(b);
+    if (Any(sel))
+        Blake512(a, b, 8);
+    if (!All(sel))
+        Bmw512(c, b);
+    Select(b, sel, a, c);
+
+    Keccak512(a, b);
+    Skein512(b, a);
+
+    sel = Branch(b);
+    if (Any(sel))
+        Keccak512(a, b);
+    if (!All(sel))
+        Jh512(c, b);
+    Select(b, sel, a, c);
+
+    for (int j = 0; j < 4; j++)
+        for (int i = 0; i < 4; i++)
+            WriteLE64(out + 32 * j + 8 * i, b[i][j]);
+}
+} // namespace quark_avx2
+
+#endif
@@ -0,0 +1,76 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA-256 transformation using the x86 SHA extensions. Only called after
+// SHA256AutoDetect found them.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1")))
+
+namespace
+{
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+/** Four rounds on the state kept as (ABEF, CDGH), with the message words of those rounds */
+SHANI_TARGET inline void QuadRound(__m128i& state0, __m128i& state1, __m128i msg, int i)
+{
+    msg = _mm_add_epi32(msg, _mm_loadu_si128((const __m128i*)&K[i]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+}
+} // namespace
+
+namespace sha256_shani
+{
+SHANI_TARGET void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // Rearrange the state from ABCD, EFGH to ABEF, CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (blocks--) {
+        __m128i save0 = state0, save1 = state1;
+        __m128i msg[4];
+        for (int i = 0; i < 4; i++) {
+            msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(chunk + 16 * i)), mask);
+            QuadRound(state0, state1, msg[i], 4 * i);
+        }
+        for (int i = 4; i < 16; i++) {
+            // W[t..t+3] from W[t-16..t-1], msg[i % 4] holding W[t-16..t-13] until replaced
+            __m128i w = _mm_sha256msg1_epu32(msg[i % 4], msg[(i + 1) % 4]);
+            w = _mm_add_epi32(w, _mm_alignr_epi8(msg[(i + 3) % 4], msg[(i + 2) % 4], 4));
+            msg[i % 4] = _mm_sha256msg2_epu32(w, msg[(i + 3) % 4]);
+            QuadRound(state0, state1, msg[i % 4], 4 * i);
+        }
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+        chunk += 64;
+    }
+
+    // And back to ABCD, EFGH
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)&s[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*)&s[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+} // namespace sha256_shani
+
+#endif
@@ -0,0 +1,189 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CUCKOOCACHE_H
+#define BITCOIN_CUCKOOCACHE_H
+
+#include "uint256.h"
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <stdint.h>
+#include <string.h>
+
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+/**
+ * Fixed-memory set of 256-bit keys for caches that are allowed to forget.
+ *
+ * Keys must already be uniformly distributed (salted hashes); their own bits select
+ * the two buckets a key may live in. A bucket holds two keys and fills exactly one
+ * 64-byte cache line, so a lookup touches at most two cache lines.
+ *
+ * Lookups take no lock. Keys are stored as relaxed atomic words, so a lookup racing
+ * an insert may see a torn key; that can only cause a miss, never a false hit.
+ * Inserts are serialized by a mutex and displace older keys cuckoo-style, dropping
+ * one once the displacement chain reaches MAX_DISPLACEMENTS. Nothing is allocated
+ * after Setup().
+ */
+class CCuckooCache
+{
+public:
+    static const unsigned int SLOTS_PER_BUCKET = 2;
+    static const unsigned int WORDS_PER_KEY = 8;
+    static const unsigned int MAX_DISPLACEMENTS = 16;
+
+private:
+    struct Bucket {
+        //! word 0 of an empty slot is 0; stored keys always have its low bit set
+        std::atomic<uint32_t> words[SLOTS_PER_BUCKET][WORDS_PER_KEY];
+    };
+
+    boost::scoped_array<unsigned char> storage;
+    Bucket* table;
+    uint32_t nBuckets;
+    unsigned int nNextVictim;
+    boost::mutex cs_insert;
+
+    static void ToWords(const uint256& key, uint32_t words[WORDS_PER_KEY])
+    {
+        memcpy(words, key.begin(), WORDS_PER_KEY * sizeof(uint32_t));
+        words[0] |= 1;
+    }
+
+    void GetBuckets(const uint32_t words[WORDS_PER_KEY], uint32_t& b1, uint32_t& b2) const
+    {
+        b1 = (uint32_t)(((uint64_t)words[1] * nBuckets) >> 32);
+        b2 = (uint32_t)(((uint64_t)words[2] * nBuckets) >> 32);
+        if (b2 == b1)
+            b2 = (b1 + 1) % nBuckets;
+    }
+
+    bool SlotMatches(const Bucket& bucket, unsigned int nSlot, const uint32_t words[WORDS_PER_KEY]) const
+    {
+        for (unsigned int i = 0; i < WORDS_PER_KEY; i++) {
+            if (bucket.words[nSlot][i].load(std::memory_order_relaxed) != words[i])
+                return false;
+        }
+        return true;
+    }
+
+    bool SlotEmpty(const Bucket& bucket, unsigned int nSlot) const
+    {
+        return bucket.words[nSlot][0].load(std::memory_order_relaxed) == 0;
+    }
+
+    void ReadSlot(const Bucket& bucket, unsigned int nSlot, uint32_t words[WORDS_PER_KEY]) const
+    {
+        for (unsigned int i = 0; i < WORDS_PER_KEY; i++)
+            words[i] = bucket.words[nSlot][i].load(std::memory_order_relaxed);
+    }
+
+    void WriteSlot(Bucket& bucket, unsigned int nSlot, const uint32_t words[WORDS_PER_KEY])
+    {
+        // Clear word 0 first so readers see the slot as empty while it is rewritten
+        bucket.words[nSlot][0].store(0, std::memory_order_relaxed);
+        for (unsigned int i = 1; i < WORDS_PER_KEY; i++)
+            bucket.words[nSlot][i].store(words[i], std::memory_order_relaxed);
+        bucket.words[nSlot][0].store(words[0], std::memory_order_release);
+    }
+
+    bool FindEmptySlot(const Bucket& bucket, unsigned int& nSlot) const
+    {
+        for (nSlot = 0; nSlot < SLOTS_PER_BUCKET; nSlot++) {
+            if (SlotEmpty(bucket, nSlot))
+                return true;
+        }
+        return false;
+    }
+
+public:
+    CCuckooCache() : table(NULL), nBuckets(0), nNextVictim(0) {}
+
+    /** Allocate about nBytes of cache-line aligned buckets, dropping all entries. Returns the number of slots. */
+    size_t Setup(size_t nBytes)
+    {
+        boost::unique_lock<boost::mutex> lock(cs_insert);
+        nBuckets = std::max((size_t)2, std::min(nBytes / sizeof(Bucket), (size_t)UINT32_MAX));
+        storage.reset(new unsigned char[nBuckets * sizeof(Bucket) + 63]);
+        table = reinterpret_cast<Bucket*>((reinterpret_cast<uintptr_t>(storage.get()) + 63) & ~(uintptr_t)63);
+        for (uint32_t b = 0; b < nBuckets; b++) {
+            Bucket* bucket = new (&table[b]) Bucket;
+            for (unsigned int s = 0; s < SLOTS_PER_BUCKET; s++) {
+                for (unsigned int i = 0; i < WORDS_PER_KEY; i++)
+                    bucket->words[s][i].store(0, std::memory_order_relaxed);
+            }
+        }
+        return (size_t)nBuckets * SLOTS_PER_BUCKET;
+    }
+
+    /** True if key is present. With fErase the entry is dropped, as it is not expected to be needed again. */
+    bool Contains(const uint256& key, bool fErase)
+    {
+        if (!table)
+            return false;
+
+        uint32_t words[WORDS_PER_KEY];
+        ToWords(key, words);
+        uint32_t b[2];
+        GetBuckets(words, b[0], b[1]);
+
+        for (unsigned int i = 0; i < 2; i++) {
+            for (unsigned int s = 0; s < SLOTS_PER_BUCKET; s++) {
+                if (SlotMatches(table[b[i]], s, words)) {
+                    if (fErase)
+                        table[b[i]].words[s][0].store(0, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void Insert(const uint256& key)
+    {
+        boost::unique_lock<boost::mutex> lock(cs_insert);
+        if (!table)
+            return;
+
+        uint32_t words[WORDS_PER_KEY];
+        ToWords(key, words);
+        uint32_t b1, b2;
+        GetBuckets(words, b1, b2);
+
+        // Already present, e.g. inserted by another script check thread
+        for (unsigned int s = 0; s < SLOTS_PER_BUCKET; s++) {
+            if (SlotMatches(table[b1], s, words) || SlotMatches(table[b2], s, words))
+                return;
+        }
+
+        uint32_t b = b1;
+        for (unsigned int n = 0; n < MAX_DISPLACEMENTS; n++) {
+            unsigned int nSlot;
+            GetBuckets(words, b1, b2);
+            if (FindEmptySlot(table[b1], nSlot)) {
+                WriteSlot(table[b1], nSlot, words);
+                return;
+            }
+            if (FindEmptySlot(table[b2], nSlot)) {
+                WriteSlot(table[b2], nSlot, words);
+                return;
+            }
+
+            // Both buckets full: take a slot from the bucket we did not just leave and
+            // move its key on to that key's other bucket
+            b = (b == b1) ? b2 : b1;
+            nSlot = nNextVictim++ % SLOTS_PER_BUCKET;
+            uint32_t victim[WORDS_PER_KEY];
+            ReadSlot(table[b], nSlot, victim);
+            WriteSlot(table[b], nSlot, words);
+            memcpy(words, victim, sizeof(victim));
+        }
+        // The last displaced key is forgotten
+    }
+};
+
+#endif // BITCOIN_CUCKOOCACHE_H
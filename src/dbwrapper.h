@@ -130,6 +130,12 @@ public:
         return piter->key().size();
     }
 
+    /** The serialized key, valid until the iterator moves */
+    const char* GetKeyData()
+    {
+        return piter->key().data();
+    }
+
     template <typename V>
     bool GetValue(V& value)
     {
@@ -147,6 +153,12 @@ public:
     {
         return piter->value().size();
     }
+
+    /** The serialized value, valid until the iterator moves */
+    const char* GetValueData()
+    {
+        return piter->value().data();
+    }
 };
 
 class CDBWrapper
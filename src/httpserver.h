@@ -112,6 +112,16 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Append to the body of the reply, so that a large reply can be built in
+     * the output buffer a part at a time. WriteReply sends it with strReply
+     * appended.
+     *
+     * @note Parts can't be taken back, so only write them once the request
+     * is known to succeed.
+     */
+    void WriteReplyPart(const char* pch, size_t nSize);
 };
 
 /** Event handler closure.
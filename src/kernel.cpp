@@ -6,10 +6,15 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
 #include "db.h"
 #include "kernel.h"
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "init.h"
 #include "script/interpreter.h"
 #include "timedata.h"
 #include "util.h"
@@ -47,6 +52,29 @@ bool stakeTargetHit(const uint256& hashProofOfStake, const int64_t& nValueIn, co
     return hashProofOfStake < (bnWeight * bnTarget);
 }
 
+void StakeKernelMidstateV3(CSHA256& midstate, const uint256& StakeModifierV2, uint64_t nStakeModifier, const COutPoint& prevout)
+{
+	unsigned char prefix[76];
+	memcpy(prefix, StakeModifierV2.begin(), 32);
+	memcpy(prefix + 32, prevout.hash.begin(), 32);
+	WriteLE64(prefix + 64, nStakeModifier);
+	WriteLE32(prefix + 72, prevout.n);
+	midstate.Write(prefix, sizeof(prefix));
+}
+
+uint256 StakeKernelHashV3(const CSHA256& midstate, unsigned int nTime)
+{
+	unsigned char time[4];
+	WriteLE32(time, nTime);
+
+	unsigned char buf[CSHA256::OUTPUT_SIZE];
+	CSHA256(midstate).Write(time, sizeof(time)).Finalize(buf);
+
+	uint256 hash;
+	CSHA256().Write(buf, sizeof(buf)).Finalize(hash.begin());
+	return hash;
+}
+
 bool CheckStakeKernelHashV3(unsigned int nBits, uint256& StakeModifierV2, uint64_t nStakeModifier, unsigned int nTimeBlockFrom, CAmount theValueIn, const COutPoint& prevout, unsigned int& nTimeTx, bool fCheck, uint256& hashProofOfStake)
 {
 	if (nTimeTx < nTimeBlockFrom) // Transaction timestamp violation
@@ -93,8 +121,8 @@ bool CheckStakeKernelHashV3(unsigned int nBits, uint256& StakeModifierV2, uint64
 		HashingStart = nStakeInterval;
 	}
 
-	CHashWriter HashStart(SER_GETHASH, 0);
-	HashStart << StakeModifierV2 << prevout.hash << nStakeModifier << prevout.n;
+	CSHA256 HashStart;
+	StakeKernelMidstateV3(HashStart, StakeModifierV2, nStakeModifier, prevout);
 
 	int MaxTime = nMaxStakingFutureDriftv3 + TimeRemainder;
 	for (int i = HashingStart; i <= MaxTime; i += nStakeInterval) //iterate the hashing
@@ -104,9 +132,7 @@ bool CheckStakeKernelHashV3(unsigned int nBits, uint256& StakeModifierV2, uint64
 		//hash this iteration
 		nTryTime = nTimeTx + i;
 
-		CHashWriter ss(HashStart);
-		ss << nTryTime;
-		hashProofOfStake = ss.GetHash();
+		hashProofOfStake = StakeKernelHashV3(HashStart, nTryTime);
 
 		// if stake hash does not meet the target then continue to next iteration
 		if (!stakeTargetHit(hashProofOfStake, theValueIn, bnTarget))
@@ -119,6 +145,101 @@ bool CheckStakeKernelHashV3(unsigned int nBits, uint256& StakeModifierV2, uint64
 	return false;
 }
 
+CStakeKernelSearch::CStakeKernelSearch(unsigned int nBitsIn, const uint256& nStakeModifierV2In, uint64_t nStakeModifierIn, int nHeightStartIn, unsigned int nPreviousBlockTimeIn) :
+	nBits(nBitsIn), nStakeModifierV2(nStakeModifierV2In), nStakeModifier(nStakeModifierIn), nHeightStart(nHeightStartIn), nPreviousBlockTime(nPreviousBlockTimeIn),
+	nTimeNow(0), nTimeTx(0), nHashingStart(0), nMaxTime(0), pvCandidates(NULL), nNextCandidate(0), fInterrupted(false)
+{
+	bnTarget.SetCompact(nBits);
+}
+
+bool CStakeKernelSearch::Interrupted() const
+{
+	return ShutdownRequested() || chainActive.Height() != nHeightStart;
+}
+
+void CStakeKernelSearch::SearchCandidate(size_t nCandidate, std::vector<CStakeKernel>& vKernels) const
+{
+	const CStakeCandidate& candidate = (*pvCandidates)[nCandidate];
+
+	// Same requirements as CheckStakeKernelHashV3, without logging every coin that fails them
+	if (nTimeNow < candidate.nTimeBlockFrom || candidate.nTimeBlockFrom + nStakeMinAge > nTimeNow || candidate.nValue < CENT)
+		return;
+
+	CSHA256 midstate;
+	StakeKernelMidstateV3(midstate, nStakeModifierV2, nStakeModifier, candidate.prevout);
+
+	for (int i = nHashingStart; i <= nMaxTime; i += nStakeInterval)
+	{
+		CStakeKernel kernel;
+		kernel.nTime = nTimeTx + i;
+		kernel.hashProofOfStake = StakeKernelHashV3(midstate, kernel.nTime);
+		if (stakeTargetHit(kernel.hashProofOfStake, candidate.nValue, bnTarget))
+		{
+			kernel.nCandidate = nCandidate;
+			vKernels.push_back(kernel);
+			return;
+		}
+	}
+}
+
+void CStakeKernelSearch::Worker()
+{
+	std::vector<CStakeKernel> vKernels;
+	while (true)
+	{
+		size_t nBegin, nEnd;
+		{
+			boost::lock_guard<boost::mutex> lock(mutex);
+			if (!fInterrupted && Interrupted()) fInterrupted = true;
+			if (fInterrupted || nNextCandidate >= pvCandidates->size()) break;
+			nBegin = nNextCandidate;
+			nEnd = std::min(nBegin + STAKE_SEARCH_BATCH, pvCandidates->size());
+			nNextCandidate = nEnd;
+		}
+
+		for (size_t i = nBegin; i < nEnd; i++)
+			SearchCandidate(i, vKernels);
+	}
+
+	boost::lock_guard<boost::mutex> lock(mutex);
+	vFound.insert(vFound.end(), vKernels.begin(), vKernels.end());
+}
+
+bool CStakeKernelSearch::Search(const std::vector<CStakeCandidate>& vCandidates, unsigned int nTimeNowIn, std::vector<CStakeKernel>& vKernels)
+{
+	// nTimeTx starts as GetTime when creating a new block, rounded to the staking interval
+	nTimeNow = nTimeNowIn;
+	int TimeRemainder = nTimeNow % nStakeInterval;
+	nTimeTx = nTimeNow - TimeRemainder;
+	nMaxTime = nMaxStakingFutureDriftv3 + TimeRemainder;
+
+	// Set the HashingStart so that we're mostly trying previously untested times
+	if (LastHashedBlockHeight != (unsigned int)nHeightStart) nHashingStart = (int64_t)nPreviousBlockTime - nTimeTx;
+	else nHashingStart = nStakeInterval;
+
+	pvCandidates = &vCandidates;
+	nNextCandidate = 0;
+	fInterrupted = false;
+	vFound.clear();
+
+	int nThreads = GetArg("-stakethreads", DEFAULT_STAKE_THREADS);
+	if (nThreads <= 0) nThreads = boost::thread::hardware_concurrency();
+	int nBatches = (vCandidates.size() + STAKE_SEARCH_BATCH - 1) / STAKE_SEARCH_BATCH;
+	nThreads = std::max(1, std::min(std::min(nThreads, MAX_STAKE_THREADS), nBatches));
+
+	// The calling thread searches too
+	boost::thread_group threads;
+	for (int i = 1; i < nThreads; i++)
+		threads.create_thread(boost::bind(&CStakeKernelSearch::Worker, this));
+	Worker();
+	threads.join_all();
+
+	std::sort(vFound.begin(), vFound.end());
+	vKernels.swap(vFound);
+	pvCandidates = NULL;
+	return !fInterrupted;
+}
+
 bool CheckStakeKernelHashV2(unsigned int nBits, uint256& StakeModifierV2, unsigned int nChainTime, unsigned int nTimeBlockFrom, CAmount theValueIn, const COutPoint& prevout, unsigned int& nTimeTx, bool fCheck, uint256& hashProofOfStake)
 {
 	if (nTimeTx < nTimeBlockFrom) // Transaction timestamp violation
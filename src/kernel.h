@@ -6,8 +6,11 @@
 #ifndef BITCOIN_KERNEL_H
 #define BITCOIN_KERNEL_H
 
+#include "crypto/sha256.h"
 #include "main.h"
 
+#include <boost/thread/mutex.hpp>
+
 
 // MODIFIER_INTERVAL: time to elapse before new modifier is computed
 static const unsigned int MODIFIER_INTERVAL = 60;
@@ -31,7 +34,75 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, const CTr
 bool CheckStakeKernelHashV2(unsigned int nBits, uint256& StakeModifierV2, unsigned int nChainTime, unsigned int nTimeBlockFrom, CAmount theValueIn, const COutPoint& prevout, unsigned int& nTimeTx, bool fCheck, uint256& hashProofOfStake);
 bool CheckStakeKernelHashV3(unsigned int nBits, uint256& StakeModifierV2, uint64_t nStakeModifier, unsigned int nTimeBlockFrom, CAmount theValueIn, const COutPoint& prevout, unsigned int& nTimeTx, bool fCheck, uint256& hashProofOfStake);
 
+// Absorb the fixed part of a v3 kernel, modifier v2 | prevout hash | modifier | prevout n,
+// into a SHA-256 midstate. This is the same byte string CHashWriter would produce.
+void StakeKernelMidstateV3(CSHA256& midstate, const uint256& StakeModifierV2, uint64_t nStakeModifier, const COutPoint& prevout);
+// Finish the double SHA-256 of a v3 kernel for one candidate time
+uint256 StakeKernelHashV3(const CSHA256& midstate, unsigned int nTime);
+
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
 bool CheckProofOfStake(const CBlock& block, CBlockIndex* pindexPrev, uint256& hashProofOfStake);
+
+// Default for -stakethreads, 0 = one per core
+static const int DEFAULT_STAKE_THREADS = 0;
+// Maximum number of kernel search threads
+static const int MAX_STAKE_THREADS = 64;
+// Number of coins a kernel search thread claims at a time
+static const unsigned int STAKE_SEARCH_BATCH = 256;
+
+// A coin offered to the kernel search
+struct CStakeCandidate {
+    COutPoint prevout;
+    CAmount nValue;
+    unsigned int nTimeBlockFrom;
+
+    CStakeCandidate(const COutPoint& prevoutIn, CAmount nValueIn, unsigned int nTimeBlockFromIn) : prevout(prevoutIn), nValue(nValueIn), nTimeBlockFrom(nTimeBlockFromIn) {}
+};
+
+// A candidate whose kernel hash met the target at nTime
+struct CStakeKernel {
+    size_t nCandidate;
+    unsigned int nTime;
+    uint256 hashProofOfStake;
+
+    bool operator<(const CStakeKernel& other) const { return nCandidate < other.nCandidate; }
+};
+
+// Runs the CheckStakeKernelHashV3 search over a whole set of coins on several threads.
+// The fixed part of each coin's kernel (modifier v2, prevout hash, modifier, prevout n)
+// is hashed once into a SHA-256 midstate, so every candidate timestamp costs a copy of
+// that state plus the tail of the double hash instead of a full re-serialization.
+class CStakeKernelSearch
+{
+public:
+    CStakeKernelSearch(unsigned int nBitsIn, const uint256& nStakeModifierV2In, uint64_t nStakeModifierIn, int nHeightStartIn, unsigned int nPreviousBlockTimeIn);
+
+    // Search every candidate at the staking times around nTimeNow. Kernels are returned
+    // in candidate order. Returns false if the tip moved or shutdown was requested.
+    bool Search(const std::vector<CStakeCandidate>& vCandidates, unsigned int nTimeNow, std::vector<CStakeKernel>& vKernels);
+
+private:
+    unsigned int nBits;
+    uint256 nStakeModifierV2;
+    uint64_t nStakeModifier;
+    int nHeightStart;
+    unsigned int nPreviousBlockTime;
+
+    uint256 bnTarget;
+    unsigned int nTimeNow;
+    unsigned int nTimeTx;
+    int nHashingStart;
+    int nMaxTime;
+
+    const std::vector<CStakeCandidate>* pvCandidates;
+    size_t nNextCandidate;
+    bool fInterrupted;
+    std::vector<CStakeKernel> vFound;
+    boost::mutex mutex;
+
+    bool Interrupted() const;
+    void SearchCandidate(size_t nCandidate, std::vector<CStakeKernel>& vKernels) const;
+    void Worker();
+};
 #endif // BITCOIN_KERNEL_H
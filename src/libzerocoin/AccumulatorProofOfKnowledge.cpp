@@ -36,9 +36,12 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 	CBigNum r_2 = CBigNum::randBignum(params->accumulatorModulus/4);
 	CBigNum r_3 = CBigNum::randBignum(params->accumulatorModulus/4);
 
-	this->C_e = g_n.pow_mod(e, params->accumulatorModulus) * h_n.pow_mod(r_1, params->accumulatorModulus);
-	this->C_u = witness.getValue() * h_n.pow_mod(r_2, params->accumulatorModulus);
-	this->C_r = g_n.pow_mod(r_2, params->accumulatorModulus) * h_n.pow_mod(r_3, params->accumulatorModulus);
+	const IntegerGroupParams& pok = params->accumulatorPoKCommitmentGroup;
+	const IntegerGroupParams& qrn = params->accumulatorQRNCommitmentGroup;
+
+	this->C_e = qrn.powG(e) * qrn.powH(r_1);
+	this->C_u = witness.getValue() * qrn.powH(r_2);
+	this->C_r = qrn.powG(r_2) * qrn.powH(r_3);
 
 	CBigNum r_alpha = CBigNum::randBignum(params->maxCoinValue * CBigNum(2).pow(params->k_prime + params->k_dprime));
 	if(!(CBigNum::randBignum(CBigNum(3)) % 2)) {
@@ -73,14 +76,15 @@ AccumulatorProofOfKnowledge::AccumulatorProofOfKnowledge(const AccumulatorAndPro
 		r_delta = 0-r_delta;
 	}
 
-	this->st_1 = (sg.pow_mod(r_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(r_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	this->st_2 = (((commitmentToCoin.getCommitmentValue() * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(r_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(r_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	this->st_3 = ((sg * commitmentToCoin.getCommitmentValue()).pow_mod(r_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(r_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	// (h_n^-1)^x is computed as h_n^-x, which the QRN tables cover
+	this->st_1 = (pok.powG(r_alpha) * pok.powH(r_phi)) % pok.modulus;
+	this->st_2 = (pok.pow_mod(commitmentToCoin.getCommitmentValue() * sg.inverse(pok.modulus), r_gamma) * pok.powH(r_psi)) % pok.modulus;
+	this->st_3 = (pok.pow_mod(sg * commitmentToCoin.getCommitmentValue(), r_sigma) * pok.powH(r_xi)) % pok.modulus;
 
-	this->t_1 = (h_n.pow_mod(r_zeta, params->accumulatorModulus) * g_n.pow_mod(r_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	this->t_2 = (h_n.pow_mod(r_eta, params->accumulatorModulus) * g_n.pow_mod(r_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	this->t_3 = (C_u.pow_mod(r_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	this->t_4 = (C_r.pow_mod(r_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(r_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(r_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	this->t_1 = (qrn.powH(r_zeta) * qrn.powG(r_epsilon)) % params->accumulatorModulus;
+	this->t_2 = (qrn.powH(r_eta) * qrn.powG(r_alpha)) % params->accumulatorModulus;
+	this->t_3 = (qrn.pow_mod(C_u, r_alpha) * qrn.powH(-r_beta)) % params->accumulatorModulus;
+	this->t_4 = (qrn.pow_mod(C_r, r_alpha) * qrn.powH(-r_delta) * qrn.powG(-r_beta)) % params->accumulatorModulus;
 
 	CHashWriter hasher(0,0);
 	hasher << *params << sg << sh << g_n << h_n << commitmentToCoin.getCommitmentValue() << C_e << C_u << C_r << st_1 << st_2 << st_3 << t_1 << t_2 << t_3 << t_4;
@@ -116,14 +120,23 @@ bool AccumulatorProofOfKnowledge:: Verify(const Accumulator& a, const CBigNum& v
 
 	CBigNum c = CBigNum(hasher.GetHash()); //this hash should be of length k_prime bits
 
-	CBigNum st_1_prime = (valueOfCommitmentToCoin.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * sg.pow_mod(s_alpha, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_phi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_2_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * ((valueOfCommitmentToCoin * sg.inverse(params->accumulatorPoKCommitmentGroup.modulus)).pow_mod(s_gamma, params->accumulatorPoKCommitmentGroup.modulus)) * sh.pow_mod(s_psi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
-	CBigNum st_3_prime = (sg.pow_mod(c, params->accumulatorPoKCommitmentGroup.modulus) * (sg * valueOfCommitmentToCoin).pow_mod(s_sigma, params->accumulatorPoKCommitmentGroup.modulus) * sh.pow_mod(s_xi, params->accumulatorPoKCommitmentGroup.modulus)) % params->accumulatorPoKCommitmentGroup.modulus;
+	const IntegerGroupParams& pok = params->accumulatorPoKCommitmentGroup;
+	const IntegerGroupParams& qrn = params->accumulatorQRNCommitmentGroup;
+
+	CBigNum st_1_prime = (pok.pow_mod(valueOfCommitmentToCoin, c) * pok.powG(s_alpha) * pok.powH(s_phi)) % pok.modulus;
+	CBigNum st_2_prime = (pok.powG(c) * pok.pow_mod(valueOfCommitmentToCoin * sg.inverse(pok.modulus), s_gamma) * pok.powH(s_psi)) % pok.modulus;
+	CBigNum st_3_prime = (pok.powG(c) * pok.pow_mod(sg * valueOfCommitmentToCoin, s_sigma) * pok.powH(s_xi)) % pok.modulus;
+
+	std::vector<CBigNum> vBases, vExps;
+	vBases.push_back(a.getValue());
+	vExps.push_back(c);
+	vBases.push_back(C_u);
+	vExps.push_back(s_alpha);
 
-	CBigNum t_1_prime = (C_r.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_zeta, params->accumulatorModulus) * g_n.pow_mod(s_epsilon, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_2_prime = (C_e.pow_mod(c, params->accumulatorModulus) * h_n.pow_mod(s_eta, params->accumulatorModulus) * g_n.pow_mod(s_alpha, params->accumulatorModulus)) % params->accumulatorModulus;
-	CBigNum t_3_prime = ((a.getValue()).pow_mod(c, params->accumulatorModulus) * C_u.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
-	CBigNum t_4_prime = (C_r.pow_mod(s_alpha, params->accumulatorModulus) * ((h_n.inverse(params->accumulatorModulus)).pow_mod(s_delta, params->accumulatorModulus)) * ((g_n.inverse(params->accumulatorModulus)).pow_mod(s_beta, params->accumulatorModulus))) % params->accumulatorModulus;
+	CBigNum t_1_prime = (qrn.pow_mod(C_r, c) * qrn.powH(s_zeta) * qrn.powG(s_epsilon)) % params->accumulatorModulus;
+	CBigNum t_2_prime = (qrn.pow_mod(C_e, c) * qrn.powH(s_eta) * qrn.powG(s_alpha)) % params->accumulatorModulus;
+	CBigNum t_3_prime = (qrn.multi_pow_mod(vBases, vExps) * qrn.powH(-s_beta)) % params->accumulatorModulus;
+	CBigNum t_4_prime = (qrn.pow_mod(C_r, s_alpha) * qrn.powH(-s_delta) * qrn.powG(-s_beta)) % params->accumulatorModulus;
 
 	bool result = false;
 
@@ -53,6 +53,23 @@ int64_t ZerocoinDenominationToInt(const CoinDenomination& denomination)
     return Value;
 }
 
+int ZerocoinDenominationToIndex(const CoinDenomination& denomination)
+{
+    switch (denomination) {
+    case CoinDenomination::ZQ_FIVECENTS: return 0;
+    case CoinDenomination::ZQ_TWENTYCENTS: return 1;
+    case CoinDenomination::ZQ_ONE: return 2;
+    case CoinDenomination::ZQ_FIVE: return 3;
+    case CoinDenomination::ZQ_TWENTY: return 4;
+    case CoinDenomination::ZQ_ONE_HUNDRED: return 5;
+    case CoinDenomination::ZQ_FIVE_HUNDRED: return 6;
+    case CoinDenomination::ZQ_TWO_THOUSAND: return 7;
+    default:
+        // Error Case
+        return -1;
+    }
+}
+
 CoinDenomination AmountToZerocoinDenomination(CAmount amount)
 {
     return IntToZerocoinDenomination(amount / CENT);
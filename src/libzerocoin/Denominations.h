@@ -30,12 +30,16 @@ enum  CoinDenomination { // In cents
 
 // Order is with the Smallest Denomination first and is important for a particular routine that this order is maintained
 const std::vector<CoinDenomination> zerocoinDenomList = {ZQ_FIVECENTS, ZQ_TWENTYCENTS, ZQ_ONE, ZQ_FIVE, ZQ_TWENTY, ZQ_ONE_HUNDRED, ZQ_FIVE_HUNDRED, ZQ_TWO_THOUSAND};
+// Number of entries in zerocoinDenomList, for fixed size per-denomination arrays
+static const unsigned int ZEROCOIN_DENOMINATION_COUNT = 8;
 // These are the max number you'd need at any one Denomination before moving to the higher denomination. Last number is 16, since it's the max number of
 // possible spends at the moment. Not used at the moment.
 //const std::vector<int> maxCoinsAtDenom   = {3, 4, 4, 3, 4, 4, 3, 16};
 
 int64_t ZerocoinDenominationToInt(const CoinDenomination& denomination);
 int64_t ZerocoinDenominationToAmount(const CoinDenomination& denomination);
+// Position of the denomination in zerocoinDenomList, -1 if it is not a valid denomination
+int ZerocoinDenominationToIndex(const CoinDenomination& denomination);
 CoinDenomination IntToZerocoinDenomination(int64_t amount);
 CoinDenomination AmountToZerocoinDenomination(int64_t amount);
 CoinDenomination AmountToClosestDenomination(int64_t nAmount, int64_t& nRemaining);
@@ -0,0 +1,205 @@
+/**
+* @file       ModularExponentiation.cpp
+*
+* @brief      Montgomery and fixed-base modular exponentiation for Zerocoin proofs.
+*
+* @copyright  Copyright 2021 The Bitcoin 2 developers
+* @license    This project is released under the MIT license.
+**/
+#include "ModularExponentiation.h"
+
+namespace libzerocoin {
+
+/** The MODEXP_WINDOW_BITS bits of e starting at bit nPos */
+static unsigned int GetWindow(const CBigNum& e, int nPos)
+{
+	unsigned int nWindow = 0;
+	for (int i = MODEXP_WINDOW_BITS - 1; i >= 0; i--) {
+		nWindow <<= 1;
+		if (BN_is_bit_set(&e, nPos + i))
+			nWindow |= 1;
+	}
+	return nWindow;
+}
+
+MontgomeryModulus::MontgomeryModulus(const CBigNum& modulusIn): modulus(modulusIn), mont(NULL) {
+	if (!BN_is_odd(&modulus))
+		return;
+
+	CAutoBN_CTX pctx;
+	mont = BN_MONT_CTX_new();
+	if (mont == NULL || !BN_MONT_CTX_set(mont, &modulus, pctx)) {
+		if (mont != NULL)
+			BN_MONT_CTX_free(mont);
+		throw bignum_error("MontgomeryModulus : BN_MONT_CTX_set failed");
+	}
+}
+
+MontgomeryModulus::~MontgomeryModulus() {
+	if (mont != NULL)
+		BN_MONT_CTX_free(mont);
+}
+
+CBigNum MontgomeryModulus::pow_mod(const CBigNum& base, const CBigNum& e) const {
+	if (mont == NULL)
+		return base.pow_mod(e, modulus);
+
+	CAutoBN_CTX pctx;
+	CBigNum ret;
+	if (e < 0) {
+		// g^-x = (g^-1)^x
+		CBigNum inv = base.inverse(modulus);
+		CBigNum posE = e * -1;
+		if (!BN_mod_exp_mont(&ret, &inv, &posE, &modulus, pctx, mont))
+			throw bignum_error("MontgomeryModulus::pow_mod : BN_mod_exp_mont failed on negative exponent");
+	} else {
+		if (!BN_mod_exp_mont(&ret, &base, &e, &modulus, pctx, mont))
+			throw bignum_error("MontgomeryModulus::pow_mod : BN_mod_exp_mont failed");
+	}
+	return ret;
+}
+
+CBigNum MontgomeryModulus::multi_pow_mod(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exps) const {
+	if (bases.size() != exps.size())
+		throw std::runtime_error("MontgomeryModulus::multi_pow_mod : bases and exponents do not match");
+
+	if (mont == NULL || bases.size() < 2) {
+		CBigNum ret = 1;
+		for (unsigned int i = 0; i < bases.size(); i++)
+			ret = ret.mul_mod(pow_mod(bases[i], exps[i]), modulus);
+		return ret;
+	}
+
+	CAutoBN_CTX pctx;
+	CBigNum one = toMont(CBigNum(1), pctx);
+
+	// Powers 0 .. MODEXP_WINDOW_SIZE-1 of every base, negative exponents turned around
+	std::vector<CBigNum> vPowers(bases.size() * MODEXP_WINDOW_SIZE);
+	std::vector<CBigNum> vExps(exps.size());
+	int nMaxBits = 0;
+	for (unsigned int i = 0; i < bases.size(); i++) {
+		CBigNum* powers = &vPowers[i * MODEXP_WINDOW_SIZE];
+		if (exps[i] < 0) {
+			powers[1] = toMont(bases[i].inverse(modulus), pctx);
+			vExps[i] = exps[i] * -1;
+		} else {
+			powers[1] = toMont(bases[i], pctx);
+			vExps[i] = exps[i];
+		}
+		powers[0] = one;
+		for (unsigned int d = 2; d < MODEXP_WINDOW_SIZE; d++)
+			mulMont(powers[d], powers[d - 1], powers[1], pctx);
+		nMaxBits = std::max(nMaxBits, BN_num_bits(&vExps[i]));
+	}
+
+	CBigNum acc = one;
+	int nTop = ((nMaxBits + MODEXP_WINDOW_BITS - 1) / MODEXP_WINDOW_BITS) * MODEXP_WINDOW_BITS;
+	for (int nPos = nTop - MODEXP_WINDOW_BITS; nPos >= 0; nPos -= MODEXP_WINDOW_BITS) {
+		if (nPos != nTop - (int)MODEXP_WINDOW_BITS) {
+			for (unsigned int i = 0; i < MODEXP_WINDOW_BITS; i++)
+				mulMont(acc, acc, acc, pctx);
+		}
+		for (unsigned int i = 0; i < bases.size(); i++) {
+			unsigned int nWindow = GetWindow(vExps[i], nPos);
+			if (nWindow)
+				mulMont(acc, acc, vPowers[i * MODEXP_WINDOW_SIZE + nWindow], pctx);
+		}
+	}
+	return fromMont(acc, pctx);
+}
+
+CBigNum MontgomeryModulus::toMont(const CBigNum& a, BN_CTX* ctx) const {
+	CBigNum reduced;
+	CBigNum ret;
+	if (!BN_nnmod(&reduced, &a, &modulus, ctx) || !BN_to_montgomery(&ret, &reduced, mont, ctx))
+		throw bignum_error("MontgomeryModulus::toMont : BN_to_montgomery failed");
+	return ret;
+}
+
+CBigNum MontgomeryModulus::fromMont(const CBigNum& a, BN_CTX* ctx) const {
+	CBigNum ret;
+	if (!BN_from_montgomery(&ret, &a, mont, ctx))
+		throw bignum_error("MontgomeryModulus::fromMont : BN_from_montgomery failed");
+	return ret;
+}
+
+void MontgomeryModulus::mulMont(CBigNum& r, const CBigNum& a, const CBigNum& b, BN_CTX* ctx) const {
+	if (!BN_mod_mul_montgomery(&r, &a, &b, mont, ctx))
+		throw bignum_error("MontgomeryModulus::mulMont : BN_mod_mul_montgomery failed");
+}
+
+FixedBaseTable::FixedBaseTable(const MontgomeryModulus& modIn, const CBigNum& baseIn, unsigned int nMaxExpBitsIn):
+	mod(modIn), base(baseIn), nMaxExpBits(0) {
+	if (!mod.isMontgomery() || nMaxExpBitsIn == 0)
+		return;
+
+	unsigned int nWindows = (nMaxExpBitsIn + MODEXP_WINDOW_BITS - 1) / MODEXP_WINDOW_BITS;
+	nMaxExpBits = nWindows * MODEXP_WINDOW_BITS;
+	table.resize(nWindows * (MODEXP_WINDOW_SIZE - 1));
+
+	CAutoBN_CTX pctx;
+	CBigNum power = mod.toMont(base, pctx);
+	for (unsigned int i = 0; i < nWindows; i++) {
+		CBigNum* row = &table[i * (MODEXP_WINDOW_SIZE - 1)];
+		row[0] = power;
+		for (unsigned int d = 1; d < MODEXP_WINDOW_SIZE - 1; d++)
+			mod.mulMont(row[d], row[d - 1], power, pctx);
+		// base^(2^(MODEXP_WINDOW_BITS * (i + 1)))
+		mod.mulMont(power, row[MODEXP_WINDOW_SIZE - 2], power, pctx);
+	}
+}
+
+CBigNum FixedBaseTable::pow_mod(const CBigNum& e) const {
+	if (table.empty() || e < 0 || (unsigned int)BN_num_bits(&e) > nMaxExpBits)
+		return mod.pow_mod(base, e);
+
+	CAutoBN_CTX pctx;
+	CBigNum acc = mod.toMont(CBigNum(1), pctx);
+	unsigned int nWindows = (BN_num_bits(&e) + MODEXP_WINDOW_BITS - 1) / MODEXP_WINDOW_BITS;
+	for (unsigned int i = 0; i < nWindows; i++) {
+		unsigned int nWindow = GetWindow(e, i * MODEXP_WINDOW_BITS);
+		if (nWindow)
+			mod.mulMont(acc, acc, table[i * (MODEXP_WINDOW_SIZE - 1) + nWindow - 1], pctx);
+	}
+	return mod.fromMont(acc, pctx);
+}
+
+/** Whether g and h are known to lie in the subgroup of order groupOrder */
+static bool HasOrder(const CBigNum& modulus, const CBigNum& g, const CBigNum& h, const CBigNum& groupOrder)
+{
+	if (groupOrder <= CBigNum(0) || modulus <= CBigNum(1))
+		return false;
+	return g.pow_mod(groupOrder, modulus).isOne() && h.pow_mod(groupOrder, modulus).isOne();
+}
+
+/** Inverse of a generator of the hidden order group; unused (empty tables) if the order is known */
+static CBigNum InverseOrOne(const CBigNum& a, const CBigNum& modulus, bool fKnownOrder)
+{
+	return fKnownOrder ? CBigNum(1) : a.inverse(modulus);
+}
+
+GroupExponentiation::GroupExponentiation(const CBigNum& modulusIn, const CBigNum& g, const CBigNum& h,
+        const CBigNum& groupOrderIn, unsigned int nMaxExpBits):
+	mod(modulusIn),
+	groupOrder(groupOrderIn),
+	fKnownOrder(HasOrder(modulusIn, g, h, groupOrderIn)),
+	gTable(mod, g, fKnownOrder ? groupOrder.bitSize() : nMaxExpBits),
+	hTable(mod, h, fKnownOrder ? groupOrder.bitSize() : nMaxExpBits),
+	gInvTable(mod, InverseOrOne(g, modulusIn, fKnownOrder), fKnownOrder ? 0 : nMaxExpBits),
+	hInvTable(mod, InverseOrOne(h, modulusIn, fKnownOrder), fKnownOrder ? 0 : nMaxExpBits) {
+}
+
+CBigNum GroupExponentiation::pow(const FixedBaseTable& table, const FixedBaseTable& invTable, const CBigNum& e) const {
+	if (fKnownOrder) {
+		// The generators have order groupOrder, so this gives the same result for any e
+		CBigNum reduced = e % groupOrder;
+		if (reduced < 0)
+			reduced += groupOrder;
+		return table.pow_mod(reduced);
+	}
+	if (e < 0)
+		return invTable.pow_mod(e * -1);
+	return table.pow_mod(e);
+}
+
+} /* namespace libzerocoin */
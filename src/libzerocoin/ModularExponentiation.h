@@ -0,0 +1,114 @@
+/**
+* @file       ModularExponentiation.h
+*
+* @brief      Montgomery and fixed-base modular exponentiation for Zerocoin proofs.
+*
+* @copyright  Copyright 2021 The Bitcoin 2 developers
+* @license    This project is released under the MIT license.
+**/
+#ifndef MODULAREXPONENTIATION_H_
+#define MODULAREXPONENTIATION_H_
+
+#include "bignum.h"
+
+#include <vector>
+
+namespace libzerocoin {
+
+/** Window width, in exponent bits, of the precomputed and multi-exponentiation tables */
+static const unsigned int MODEXP_WINDOW_BITS = 4;
+static const unsigned int MODEXP_WINDOW_SIZE = 1 << MODEXP_WINDOW_BITS;
+
+/**
+ * An odd modulus with its OpenSSL Montgomery context, built once and shared by
+ * every exponentiation modulo it. Results are identical to CBigNum::pow_mod,
+ * including for negative exponents. Even moduli fall back to CBigNum::pow_mod.
+ *
+ * Read-only after construction, so it may be used from several threads.
+ */
+class MontgomeryModulus {
+public:
+	explicit MontgomeryModulus(const CBigNum& modulusIn);
+	~MontgomeryModulus();
+
+	const CBigNum& getModulus() const { return modulus; }
+
+	/** base^e mod modulus */
+	CBigNum pow_mod(const CBigNum& base, const CBigNum& e) const;
+
+	/**
+	 * Product of bases[i]^exps[i] mod modulus. The squarings are shared
+	 * between all bases, so this is cheaper than separate pow_mod calls.
+	 */
+	CBigNum multi_pow_mod(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exps) const;
+
+	bool isMontgomery() const { return mont != NULL; }
+
+	/** Conversions and multiplication in Montgomery form, for FixedBaseTable */
+	CBigNum toMont(const CBigNum& a, BN_CTX* ctx) const;
+	CBigNum fromMont(const CBigNum& a, BN_CTX* ctx) const;
+	void mulMont(CBigNum& r, const CBigNum& a, const CBigNum& b, BN_CTX* ctx) const;
+
+private:
+	CBigNum modulus;
+	BN_MONT_CTX* mont;
+
+	MontgomeryModulus(const MontgomeryModulus&);
+	MontgomeryModulus& operator=(const MontgomeryModulus&);
+};
+
+/**
+ * Powers base^(d * 2^(MODEXP_WINDOW_BITS * i)) of a fixed base, so that raising it
+ * to an exponent of up to nMaxExpBits bits takes one multiplication per exponent
+ * window and no squarings. Larger or negative exponents use the plain Montgomery
+ * exponentiation.
+ */
+class FixedBaseTable {
+public:
+	FixedBaseTable(const MontgomeryModulus& modIn, const CBigNum& baseIn, unsigned int nMaxExpBitsIn);
+
+	/** base^e mod modulus */
+	CBigNum pow_mod(const CBigNum& e) const;
+
+	const CBigNum& getBase() const { return base; }
+
+private:
+	const MontgomeryModulus& mod;
+	CBigNum base;
+	unsigned int nMaxExpBits;
+	//! entry (i * (MODEXP_WINDOW_SIZE - 1) + d - 1) is base^(d * 2^(MODEXP_WINDOW_BITS * i)) in Montgomery form
+	std::vector<CBigNum> table;
+};
+
+/**
+ * Exponentiation engine for the two generators of an IntegerGroupParams.
+ *
+ * If the group order is known, exponents of g and h are reduced modulo it
+ * first, so every exponent fits the tables. Otherwise (the hidden order QR_N
+ * group) tables of g^-1 and h^-1 are kept as well for negative exponents.
+ */
+class GroupExponentiation {
+public:
+	GroupExponentiation(const CBigNum& modulusIn, const CBigNum& g, const CBigNum& h,
+	                    const CBigNum& groupOrderIn, unsigned int nMaxExpBits);
+
+	CBigNum powG(const CBigNum& e) const { return pow(gTable, gInvTable, e); }
+	CBigNum powH(const CBigNum& e) const { return pow(hTable, hInvTable, e); }
+
+	const MontgomeryModulus& getModulus() const { return mod; }
+
+private:
+	MontgomeryModulus mod;
+	CBigNum groupOrder;
+	bool fKnownOrder;
+	FixedBaseTable gTable;
+	FixedBaseTable hTable;
+	FixedBaseTable gInvTable;
+	FixedBaseTable hInvTable;
+
+	CBigNum pow(const FixedBaseTable& table, const FixedBaseTable& invTable, const CBigNum& e) const;
+};
+
+} /* namespace libzerocoin */
+
+#endif /* MODULAREXPONENTIATION_H_ */
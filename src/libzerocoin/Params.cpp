@@ -13,8 +13,20 @@
 #include "Params.h"
 #include "ParamGeneration.h"
 
+#include <assert.h>
+
 namespace libzerocoin {
 
+/**
+ * The modulus to exponentiate in without tables. The accumulator QRN group
+ * leaves its own at 0 and gets the accumulator modulus through precompute:
+ * setting it would change the serialized params, which every proof hashes.
+ */
+static const CBigNum& FallbackModulus(const IntegerGroupParams& group) {
+	assert(group.modulus > CBigNum(0));
+	return group.modulus;
+}
+
 ZerocoinParams::ZerocoinParams(CBigNum N, uint32_t securityLevel) {
 	this->zkp_hash_len = securityLevel;
 	this->zkp_iterations = securityLevel;
@@ -25,6 +37,16 @@ ZerocoinParams::ZerocoinParams(CBigNum N, uint32_t securityLevel) {
 	// Generate the parameters
 	CalculateParams(*this, N, ZEROCOIN_PROTOCOL_VERSION, securityLevel);
 
+	// Build the exponentiation tables for the proofs once. The QRN group order
+	// is hidden, so its tables cover the largest proof responses: an accumulator
+	// sized value times a hash sized challenge times a committed coin value.
+	this->coinCommitmentGroup.precompute(this->coinCommitmentGroup.modulus, 0);
+	this->serialNumberSoKCommitmentGroup.precompute(this->serialNumberSoKCommitmentGroup.modulus, 0);
+	this->accumulatorParams.accumulatorPoKCommitmentGroup.precompute(this->accumulatorParams.accumulatorPoKCommitmentGroup.modulus, 0);
+	this->accumulatorParams.accumulatorQRNCommitmentGroup.precompute(this->accumulatorParams.accumulatorModulus,
+	        this->accumulatorParams.accumulatorModulus.bitSize() + this->accumulatorParams.maxCoinValue.bitSize() +
+	        HASH_OUTPUT_BITS + this->accumulatorParams.k_prime + this->accumulatorParams.k_dprime + 2);
+
 	this->accumulatorParams.initialized = true;
 	this->initialized = true;
 }
@@ -41,7 +63,40 @@ CBigNum IntegerGroupParams::randomElement() const {
 	// The generator of the group raised
 	// to a random number less than the order of the group
 	// provides us with a uniformly distributed random number.
-	return this->g.pow_mod(CBigNum::randBignum(this->groupOrder),this->modulus);
+	return powG(CBigNum::randBignum(this->groupOrder));
+}
+
+void IntegerGroupParams::precompute(const CBigNum& n, uint32_t nMaxExpBits) {
+	this->exp.reset(new GroupExponentiation(n, this->g, this->h, this->groupOrder, nMaxExpBits));
+}
+
+CBigNum IntegerGroupParams::powG(const CBigNum& e) const {
+	if (!this->exp)
+		return this->g.pow_mod(e, FallbackModulus(*this));
+	return this->exp->powG(e);
+}
+
+CBigNum IntegerGroupParams::powH(const CBigNum& e) const {
+	if (!this->exp)
+		return this->h.pow_mod(e, FallbackModulus(*this));
+	return this->exp->powH(e);
+}
+
+CBigNum IntegerGroupParams::pow_mod(const CBigNum& base, const CBigNum& e) const {
+	if (!this->exp)
+		return base.pow_mod(e, FallbackModulus(*this));
+	return this->exp->getModulus().pow_mod(base, e);
+}
+
+CBigNum IntegerGroupParams::multi_pow_mod(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exps) const {
+	if (!this->exp) {
+		const CBigNum& modulus = FallbackModulus(*this);
+		CBigNum ret = 1;
+		for (unsigned int i = 0; i < bases.size() && i < exps.size(); i++)
+			ret = ret.mul_mod(bases[i].pow_mod(exps[i], modulus), modulus);
+		return ret;
+	}
+	return this->exp->getModulus().multi_pow_mod(bases, exps);
 }
 
 } /* namespace libzerocoin */
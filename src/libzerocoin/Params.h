@@ -14,8 +14,11 @@
 #define PARAMS_H_
 
 #include "bignum.h"
+#include "ModularExponentiation.h"
 #include "ZerocoinDefines.h"
 
+#include <boost/shared_ptr.hpp>
+
 namespace libzerocoin {
 
 class IntegerGroupParams {
@@ -55,6 +58,23 @@ public:
 	 */
 	CBigNum groupOrder;
 
+	/**
+	 * Builds the Montgomery context and the fixed-base tables for g and h.
+	 * @param n            the modulus to exponentiate in, which for the
+	 *                     accumulator QRN group is the accumulator modulus
+	 * @param nMaxExpBits  largest exponent size to build tables for, if the
+	 *                     group order is not known
+	 */
+	void precompute(const CBigNum& n, uint32_t nMaxExpBits);
+
+	/** g^e and h^e, from the precomputed tables if there are any */
+	CBigNum powG(const CBigNum& e) const;
+	CBigNum powH(const CBigNum& e) const;
+
+	/** base^e and the product of bases[i]^exps[i] for other bases, in the same modulus */
+	CBigNum pow_mod(const CBigNum& base, const CBigNum& e) const;
+	CBigNum multi_pow_mod(const std::vector<CBigNum>& bases, const std::vector<CBigNum>& exps) const;
+
 	ADD_SERIALIZE_METHODS;
   template <typename Stream, typename Operation>  inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
 		    READWRITE(initialized);
@@ -63,6 +83,10 @@ public:
 		    READWRITE(modulus);
 		    READWRITE(groupOrder);
 	}	
+
+private:
+	//! Not serialized; shared between copies as it is never modified
+	boost::shared_ptr<const GroupExponentiation> exp;
 };
 
 class AccumulatorAndProofParams {
@@ -47,11 +47,6 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
 		throw std::runtime_error("Groups are not structured correctly.");
 	}
 
-	CBigNum a = params->coinCommitmentGroup.g;
-	CBigNum b = params->coinCommitmentGroup.h;
-	CBigNum g = params->serialNumberSoKCommitmentGroup.g;
-	CBigNum h = params->serialNumberSoKCommitmentGroup.h;
-
 	CHashWriter hasher(0,0);
 	hasher << *params << commitmentToCoin.getCommitmentValue() << coin.getSerialNumber() << msghash;
 
@@ -102,7 +97,7 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
 		} else {
 			s_notprime[i]       = r[i] - coin.getRandomness();
 			sprime[i]           = v_expanded[i] - (commitmentToCoin.getRandomness() *
-			                              b.pow_mod(r[i] - coin.getRandomness(), params->serialNumberSoKCommitmentGroup.groupOrder));
+			                              params->coinCommitmentGroup.powH(r[i] - coin.getRandomness()));
 		}
 	}
 }
@@ -110,24 +105,16 @@ SerialNumberSignatureOfKnowledge::SerialNumberSignatureOfKnowledge(const
 inline CBigNum SerialNumberSignatureOfKnowledge::challengeCalculation(const CBigNum& a_exp,const CBigNum& b_exp,
         const CBigNum& h_exp) const {
 
-	CBigNum a = params->coinCommitmentGroup.g;
-	CBigNum b = params->coinCommitmentGroup.h;
-	CBigNum g = params->serialNumberSoKCommitmentGroup.g;
-	CBigNum h = params->serialNumberSoKCommitmentGroup.h;
-
-	CBigNum exponent = (a.pow_mod(a_exp, params->serialNumberSoKCommitmentGroup.groupOrder)
-	                   * b.pow_mod(b_exp, params->serialNumberSoKCommitmentGroup.groupOrder)) % params->serialNumberSoKCommitmentGroup.groupOrder;
+	// a and b are the generators of coinCommitmentGroup, whose modulus is the order
+	// of serialNumberSoKCommitmentGroup, so all four are fixed-base exponentiations
+	CBigNum exponent = (params->coinCommitmentGroup.powG(a_exp)
+	                   * params->coinCommitmentGroup.powH(b_exp)) % params->serialNumberSoKCommitmentGroup.groupOrder;
 
-	return (g.pow_mod(exponent, params->serialNumberSoKCommitmentGroup.modulus) * h.pow_mod(h_exp, params->serialNumberSoKCommitmentGroup.modulus)) % params->serialNumberSoKCommitmentGroup.modulus;
+	return (params->serialNumberSoKCommitmentGroup.powG(exponent) * params->serialNumberSoKCommitmentGroup.powH(h_exp)) % params->serialNumberSoKCommitmentGroup.modulus;
 }
 
 bool SerialNumberSignatureOfKnowledge::Verify(const CBigNum& coinSerialNumber, const CBigNum& valueOfCommitmentToCoin,
         const uint256 msghash) const {
-	CBigNum a = params->coinCommitmentGroup.g;
-	CBigNum b = params->coinCommitmentGroup.h;
-	CBigNum g = params->serialNumberSoKCommitmentGroup.g;
-	CBigNum h = params->serialNumberSoKCommitmentGroup.h;
-
 	CBigNum zero = CBigNum(0);
 	// Check that the serial is within range and the commitment is under the correct group
 	if (coinSerialNumber < zero || coinSerialNumber > CBigNum(2).pow(256))
@@ -149,9 +136,9 @@ bool SerialNumberSignatureOfKnowledge::Verify(const CBigNum& coinSerialNumber, c
 		if(challenge_bit) {
 			tprime[i] = challengeCalculation(coinSerialNumber, s_notprime[i], SeedTo1024(sprime[i].getuint256()));
 		} else {
-			CBigNum exp = b.pow_mod(s_notprime[i], params->serialNumberSoKCommitmentGroup.groupOrder);
-			tprime[i] = ((valueOfCommitmentToCoin.pow_mod(exp, params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus) *
-			             (h.pow_mod(sprime[i], params->serialNumberSoKCommitmentGroup.modulus) % params->serialNumberSoKCommitmentGroup.modulus)) %
+			CBigNum exp = params->coinCommitmentGroup.powH(s_notprime[i]);
+			tprime[i] = (params->serialNumberSoKCommitmentGroup.pow_mod(valueOfCommitmentToCoin, exp) *
+			             params->serialNumberSoKCommitmentGroup.powH(sprime[i])) %
 			            params->serialNumberSoKCommitmentGroup.modulus;
 		}
 	}
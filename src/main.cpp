@@ -11,9 +11,14 @@
 #include "accumulators.h"
 #include "addrman.h"
 #include "alert.h"
+#include "blockdownload.h"
+#include "blockimport.h"
+#include "blockscanner.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "crypto/common.h"
+#include "cuckoocache.h"
 #include "init.h"
 #include "kernel.h"
 #include "masternode-payments.h"
@@ -22,6 +27,8 @@
 #include "net.h"
 #include "obfuscation.h"
 #include "pow.h"
+#include "random.h"
+#include "script/sigbatch.h"
 #include "spork.h"
 #include "sporkdb.h"
 #include "swifttx.h"
@@ -41,6 +48,7 @@
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
@@ -65,6 +73,8 @@ using namespace libzerocoin;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+//! Owns the entries of mapBlockIndex
+static CBlockIndexArena blockIndexArena;
 
 CChain chainActive;
 CBlockIndex* pindexBestHeader = NULL;
@@ -72,16 +82,18 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+bool fSignatureBatch = false;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
 bool fAddressIndex = false;
 bool fTimestampIndex = false;
 bool fSpentIndex = false;
+bool fSnapshotIndex = false;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 bool fVerifyingBlocks = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 bool fAlerts = DEFAULT_ALERTS;
 
 const int StakingProtocol2Height = 654929; // TODO: Get rid of SPORK_13_STAKING_PROTOCOL_2 completely and use this instead.
@@ -98,6 +110,8 @@ int64_t nReserveBalance = 0;
 CFeeRate minRelayTxFee = CFeeRate(MINRELAYFEE);
 
 CTxMemPool mempool(::minRelayTxFee);
+CBlockMessageCache blockMessageCache(DEFAULT_BLOCK_SERVE_CACHE_SIZE << 20);
+CBlockFileMap blockFileMap;
 
 struct COrphanTx {
     CTransaction tx;
@@ -181,6 +195,9 @@ struct QueuedBlock {
 };
 map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
+/** Blocks that arrived before their parent, waiting to be accepted in order. Protected by cs_main. */
+CPendingBlocks pendingBlocks(MAX_PENDING_BLOCKS_SIZE, PENDING_BLOCK_EXPIRY);
+
 /** Number of blocks in flight with validated headers. */
 int nQueuedValidatedHeaders = 0;
 
@@ -312,8 +329,16 @@ struct CNodeState {
     int64_t nStallingSince;
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
+    //! Moving average of the microseconds this peer takes per block we asked for, or 0 before the first.
+    int64_t nBlockTimeAvg;
+    //! When this peer last delivered a block we asked for (in microseconds), or 0.
+    int64_t nLastBlockTime;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! First headers of the forks this peer started that we have no blocks for yet.
+    std::vector<CBlockIndex*> vHeaderForks;
+    //! Whether headers from this peer stopped at MAX_HEADERS_LOOKAHEAD, to be asked for again later.
+    bool fHeadersPaused;
 
 	CNodeBlocks nodeBlocks;
 
@@ -328,7 +353,10 @@ struct CNodeState {
         fSyncStarted = false;
         nStallingSince = 0;
         nBlocksInFlight = 0;
+        nBlockTimeAvg = 0;
+        nLastBlockTime = 0;
         fPreferredDownload = false;
+        fHeadersPaused = false;
     }
 };
 
@@ -395,11 +423,17 @@ void FinalizeNode(NodeId nodeid)
 }
 
 // Requires cs_main.
-void MarkBlockAsReceived(const uint256& hash)
+void MarkBlockAsReceived(const uint256& hash, bool fDelivered = true)
 {
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
     if (itInFlight != mapBlocksInFlight.end()) {
         CNodeState* state = State(itInFlight->second.first);
+        if (fDelivered) {
+            // Time since the request, or since the block before it if it was queued behind that one
+            int64_t nNow = GetTimeMicros();
+            state->nBlockTimeAvg = UpdateBlockTimeAvg(state->nBlockTimeAvg, nNow - std::max(itInFlight->second.second->nTime, state->nLastBlockTime));
+            state->nLastBlockTime = nNow;
+        }
         nQueuedValidatedHeaders -= itInFlight->second.second->fValidatedHeaders;
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
@@ -415,7 +449,7 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, CBlockIndex* pindex
     assert(state != NULL);
 
     // Make sure it's not listed somewhere already.
-    MarkBlockAsReceived(hash);
+    MarkBlockAsReceived(hash, false);
 
     QueuedBlock newentry = {hash, pindex, GetTimeMicros(), nQueuedValidatedHeaders, pindex != NULL};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
@@ -479,6 +513,16 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb)
     return pa;
 }
 
+/** Size of the download window, from the combined throughput of all peers. */
+int GetPeersBlockDownloadWindow()
+{
+    std::vector<int64_t> vBlockTimeAvg;
+    vBlockTimeAvg.reserve(mapNodeState.size());
+    for (map<NodeId, CNodeState>::const_iterator it = mapNodeState.begin(); it != mapNodeState.end(); it++)
+        vBlockTimeAvg.push_back(it->second.nBlockTimeAvg);
+    return GetBlockDownloadWindow(vBlockTimeAvg);
+}
+
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
  *  at most count entries. */
 void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller)
@@ -512,10 +556,12 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
 
     std::vector<CBlockIndex*> vToFetch;
     CBlockIndex* pindexWalk = state->pindexLastCommonBlock;
-    // Never fetch further than the best block we know the peer has, or more than BLOCK_DOWNLOAD_WINDOW + 1 beyond the last
+    // Never fetch further than the best block we know the peer has, or more than the download window + 1 beyond the last
     // linked block we have in common with this peer. The +1 is so we can detect stalling, namely if we would be able to
     // download that next block if the window were 1 larger.
-    int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
+    int nWindowEnd = state->pindexLastCommonBlock->nHeight + GetPeersBlockDownloadWindow();
+    // Once the blocks waiting for their parent fill their memory, only fetch what can be accepted right away
+    bool fPendingFull = pendingBlocks.IsFull();
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
     while (pindexWalk->nHeight < nMaxHeight) {
@@ -541,6 +587,8 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             if (pindex->nStatus & BLOCK_HAVE_DATA) {
                 if (pindex->nChainTx)
                     state->pindexLastCommonBlock = pindex;
+            } else if (pendingBlocks.Contains(pindex)) {
+                // Downloaded, and waiting for its parent.
             } else if (mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
                 // The block is not already downloaded, and not yet in flight.
                 if (pindex->nHeight > nWindowEnd) {
@@ -551,6 +599,8 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     }
                     return;
                 }
+                if (fPendingFull && !(pindex->pprev->nStatus & BLOCK_HAVE_DATA))
+                    continue;
                 vBlocks.push_back(pindex);
                 if (vBlocks.size() == count) {
                     return;
@@ -1009,6 +1059,40 @@ int GetZerocoinStartHeight()
     return Params().Zerocoin_StartHeight();
 }
 
+/** True if the block mints any of the given pubcoin values; runs on the block scanner workers */
+static bool BlockHasMissingMint(const CBlock& block, const CBlockIndex* pindex, const std::set<CBigNum>& setMissingValues)
+{
+    list<CZerocoinMint> vMints;
+    if (!BlockToZerocoinMintList(block, vMints))
+        return false;
+
+    for (const CZerocoinMint& mint : vMints) {
+        if (setMissingValues.count(mint.GetValue()))
+            return true;
+    }
+    return false;
+}
+
+static bool FindMissingMintsInBlock(const CBlock& block, CBlockIndex* pindex, const vector<CZerocoinMint>& vMissingMints, vector<CZerocoinMint>& vMintsToUpdate)
+{
+    list<CZerocoinMint> vMints;
+    if (!BlockToZerocoinMintList(block, vMints))
+        return true;
+
+    // search the blocks mints to see if it contains the mint that is requesting meta data updates
+    for (CZerocoinMint mintBlockChain : vMints) {
+        for (CZerocoinMint mintMissing : vMissingMints) {
+            if (mintMissing.GetValue() == mintBlockChain.GetValue()) {
+                LogPrintf("%s FOUND %s in block %d\n", __func__, mintMissing.GetValue().GetHex(), pindex->nHeight);
+                mintMissing.SetHeight(pindex->nHeight);
+                mintMissing.SetTxHash(mintBlockChain.GetTxHash());
+                vMintsToUpdate.push_back(mintMissing);
+            }
+        }
+    }
+    return true;
+}
+
 void FindMints(vector<CZerocoinMint> vMintsToFind, vector<CZerocoinMint>& vMintsToUpdate, vector<CZerocoinMint>& vMissingMints, bool fExtendedSearch)
 {
     // see which mints are in our public zerocoin database. The mint should be here if it exists, unless
@@ -1078,34 +1162,23 @@ void FindMints(vector<CZerocoinMint> vMintsToFind, vector<CZerocoinMint>& vMints
         // search the blockchain for the meta data on our missing mints
         int nZerocoinStartHeight = GetZerocoinStartHeight();
 
-        for (int i = nZerocoinStartHeight; i < chainActive.Height(); i++) {
-
-            if(i % 1000 == 0)
-                LogPrintf("%s : scanned %d blocks\n", __func__, i - nZerocoinStartHeight);
-
-            if(chainActive[i]->vMintDenominationsInBlock.empty())
-                continue;
-
-            CBlock block;
-            if(!ReadBlockFromDisk(block, chainActive[i]))
-                continue;
-
-            list<CZerocoinMint> vMints;
-            if(!BlockToZerocoinMintList(block, vMints))
-                continue;
-
-            // search the blocks mints to see if it contains the mint that is requesting meta data updates
-            for (CZerocoinMint mintBlockChain : vMints) {
-                for (CZerocoinMint mintMissing : vMissingMints) {
-                    if (mintMissing.GetValue() == mintBlockChain.GetValue()) {
-                        LogPrintf("%s FOUND %s in block %d\n", __func__, mintMissing.GetValue().GetHex(), i);
-                        mintMissing.SetHeight(i);
-                        mintMissing.SetTxHash(mintBlockChain.GetTxHash());
-                        vMintsToUpdate.push_back(mintMissing);
-                    }
-                }
+        std::vector<CBlockIndex*> vBlocks;
+        {
+            LOCK(cs_main);
+            for (int i = nZerocoinStartHeight; i < chainActive.Height(); i++) {
+                if (!chainActive[i]->vMintDenominationsInBlock.empty())
+                    vBlocks.push_back(chainActive[i]);
             }
         }
+
+        std::set<CBigNum> setMissingValues;
+        for (const CZerocoinMint& mintMissing : vMissingMints)
+            setMissingValues.insert(mintMissing.GetValue());
+
+        CBlockScanner scanner;
+        scanner.Scan(vBlocks, boost::bind(&BlockHasMissingMint, _1, _2, boost::cref(setMissingValues)),
+            boost::bind(&FindMissingMintsInBlock, _1, _2, boost::cref(vMissingMints), boost::ref(vMintsToUpdate)));
+        LogPrintf("%s : scanned %d blocks\n", __func__, scanner.GetBlocksRead());
     }
 
     //remove any missing mints that were found
@@ -1337,7 +1410,65 @@ bool ContextualCheckCoinSpend(const CoinSpend& spend, CBlockIndex* pindex, const
     return true;
 }
 
-bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidationState& state)
+namespace {
+
+/**
+ * Valid zerocoin spend proofs, so that a spend verified when it entered the
+ * mempool is not verified again when its block is checked. Entries are salted
+ * hashes of the spend and of the accumulator value it was verified against.
+ */
+class CZerocoinSpendCache
+{
+private:
+    //! Salt for the entries, so that nobody can craft colliding ones
+    uint256 nonce;
+    CCuckooCache setValid;
+
+public:
+    CZerocoinSpendCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+        setValid.Setup(ZEROCOIN_SPEND_CACHE_SIZE);
+    }
+
+    uint256 GetEntry(const CTxIn& txin, const CBigNum& bnAccumulatorValue) const
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << nonce << txin.scriptSig << bnAccumulatorValue;
+        return ss.GetHash();
+    }
+
+    bool Get(const uint256& entry)
+    {
+        return setValid.Contains(entry, false);
+    }
+
+    void Set(const uint256& entry)
+    {
+        setValid.Insert(entry);
+    }
+};
+
+CZerocoinSpendCache zerocoinSpendCache;
+
+} // anon namespace
+
+bool CZerocoinSpendCheck::operator()()
+{
+    try {
+        CoinSpend spend = TxInToZerocoinSpend(*ptxin);
+        Accumulator accumulator(Params().Zerocoin_Params(), spend.getDenomination(), bnAccumulatorValue);
+        if (!spend.Verify(accumulator))
+            return false;
+    } catch (const std::exception& e) {
+        return error("%s : %s", __func__, e.what());
+    }
+
+    zerocoinSpendCache.Set(hashEntry);
+    return true;
+}
+
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks)
 {
     //max needed non-mint outputs should be 2 - one for redemption address and a possible 2nd for change
     if (tx.vout.size() > 2) {
@@ -1390,11 +1521,19 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
             if(!zerocoinDB->ReadAccumulatorValue(newSpend.getAccumulatorChecksum(), bnAccumulatorValue))
                 return state.DoS(100, error("Zerocoinspend could not find accumulator associated with checksum"));
 
-            Accumulator accumulator(Params().Zerocoin_Params(), newSpend.getDenomination(), bnAccumulatorValue);
-
-            //Check that the coin is on the accumulator
-            if(!newSpend.Verify(accumulator))
-                return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+            //Check that the coin is on the accumulator, unless that was already done
+            uint256 hashEntry = zerocoinSpendCache.GetEntry(txin, bnAccumulatorValue);
+            if (!zerocoinSpendCache.Get(hashEntry)) {
+                if (pvZerocoinChecks) {
+                    //verified later, together with the other spends of the block
+                    pvZerocoinChecks->push_back(CZerocoinSpendCheck(txin, bnAccumulatorValue, hashEntry));
+                } else {
+                    Accumulator accumulator(Params().Zerocoin_Params(), newSpend.getDenomination(), bnAccumulatorValue);
+                    if(!newSpend.Verify(accumulator))
+                        return state.DoS(100, error("CheckZerocoinSpend(): zerocoin spend did not verify"));
+                    zerocoinSpendCache.Set(hashEntry);
+                }
+            }
         }
 
         if (serials.count(newSpend.getCoinSerialNumber()))
@@ -1427,7 +1566,7 @@ bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidatio
     return fValidated;
 }
 
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state)
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks)
 {
     // Basic checks that don't depend on any context
     if (tx.vin.empty())
@@ -1503,7 +1642,7 @@ bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationS
 				LOCK(cs_main);
 				fVerifySignature = !IsInitialBlockDownload() && (GetTime() - chainActive.Tip()->GetBlockTime() < (60*60*24));
 			}
-			if (!CheckZerocoinSpend(tx, fVerifySignature, state))
+			if (!CheckZerocoinSpend(tx, fVerifySignature, state, pvZerocoinChecks))
                 return state.DoS(100, error("CheckTransaction() : invalid zerocoin spend"));
         }
     }
@@ -1571,7 +1710,21 @@ bool CheckFinalTx(const CTransaction& tx, int flags)
     return IsFinalTx(tx, nBlockHeight, nBlockTime);
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx,  bool* pfMissingInputs, bool fRejectInsaneFee)
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    int expired = pool.Expire(GetTime() - age);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit);
+}
+
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool* pfMissingInputs, bool fRejectInsaneFee, bool fOverrideMempoolLimit)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, pfMissingInputs, GetTime(), fRejectInsaneFee, fOverrideMempoolLimit);
+}
+
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee, bool fOverrideMempoolLimit)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1721,7 +1874,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         if (!tx.HasZerocoinSpendInputs())
             view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height());
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height());
         unsigned int nSize = entry.GetTxSize();
 
 		LogPrint("masternode", "%s: Don't accept it if it can't get into a block\n", __func__);
@@ -1734,6 +1887,13 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient fee");
         }
 
+        // Once the pool has been full, what it last evicted sets a higher bar
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (!tx.HasZerocoinSpendInputs() && mempoolRejectFee > 0 && nFees < mempoolRejectFee) {
+            return state.DoS(0, error("AcceptToMemoryPool : mempool min fee not met %s, %d < %d", hash.ToString(), nFees, mempoolRejectFee),
+                REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+        }
+
         if (fRejectInsaneFee && nFees > ::minRelayTxFee.GetFee(nSize) * 10000)
             return error("AcceptToMemoryPool: : insane fees %s, %d > %d",
                 hash.ToString(),
@@ -1758,8 +1918,26 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+            return state.DoS(0, error("AcceptToMemoryPool : %s %s", errString, hash.ToString()), REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+
         // Store transaction in memory
-        pool.addUnchecked(hash, entry);
+        pool.addUnchecked(hash, entry, setAncestors);
+
+        // Trim the pool, which may evict the transaction just added
+        if (!fOverrideMempoolLimit) {
+            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            if (!pool.exists(hash))
+                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+        }
 
         // Add memory address index
         if (fAddressIndex) {
@@ -1988,46 +2166,312 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
     return true;
 }
 
-/////////////
-bool HasTX(int a, int n, const string &theAddress, bool QuickScan)
+/** Format of mempool.dat: the version, the prioritisation deltas, then every transaction with its entry time */
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Transactions accepted from mempool.dat per acquisition of cs_main */
+static const unsigned int MEMPOOL_LOAD_BATCH_SIZE = 100;
+
+bool LoadMempool()
 {
-	int c = n - a;
-	CBlockIndex* pindex = chainActive[a];
-	CBlockIndex* pindex2 = chainActive[n];
-	int aPercent = c / 100;
-	if (aPercent < 10) aPercent = 10;
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / "mempool.dat").string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMicros();
+    int64_t nNow = GetTime();
+    int nAccepted = 0, nFailed = 0, nExpired = 0;
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("%s: unknown mempool file version %u\n", __func__, nVersion);
+            return false;
+        }
+
+        // Deltas come first, so that the fee checks see them
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); ++it)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        uint64_t nRemaining;
+        file >> nRemaining;
+        std::vector<std::pair<CTransaction, int64_t> > vBatch;
+        while (nRemaining > 0) {
+            // Read a batch without cs_main, then validate it while holding it
+            vBatch.clear();
+            while (nRemaining > 0 && vBatch.size() < MEMPOOL_LOAD_BATCH_SIZE) {
+                vBatch.push_back(std::make_pair(CTransaction(), 0));
+                file >> vBatch.back().first >> vBatch.back().second;
+                nRemaining--;
+            }
+
+            boost::this_thread::interruption_point();
+            LOCK(cs_main);
+            if (ShutdownRequested())
+                return false;
+            for (std::vector<std::pair<CTransaction, int64_t> >::const_iterator it = vBatch.begin(); it != vBatch.end(); ++it) {
+                if (it->second + nExpiryTimeout <= nNow) {
+                    nExpired++;
+                    continue;
+                }
+                CValidationState state;
+                if (AcceptToMemoryPoolWithTime(mempool, state, it->first, NULL, it->second))
+                    nAccepted++;
+                else
+                    nFailed++;
+            }
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired in %.2fs\n", nAccepted, nFailed, nExpired, (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMicros();
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<CTxMemPoolEntry> vEntries;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        mempool.queryEntries(vEntries);
+    }
+    int64_t nCopied = GetTimeMicros();
+
+    try {
+        boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+        FILE* filestr = fopen(pathTmp.string().c_str(), "wb");
+        if (!filestr)
+            return error("%s: failed to open %s", __func__, pathTmp.string());
+
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        file << MEMPOOL_DUMP_VERSION;
+        file << mapDeltas;
+        file << (uint64_t)vEntries.size();
+        BOOST_FOREACH (const CTxMemPoolEntry& entry, vEntries)
+            file << entry.GetTx() << entry.GetTime();
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+            return error("%s: failed to rename %s", __func__, pathTmp.string());
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Dumped %u mempool transactions: %.3fs to copy, %.3fs to write\n", vEntries.size(), (nCopied - nStart) * 0.000001, (GetTimeMicros() - nCopied) * 0.000001);
+    return true;
+}
+
+/** Map a destination to its snapshot index key, the same (type, hash) pair used by the address index */
+static bool GetSnapshotIndexKey(const CTxDestination& dest, CAddressIndexIteratorKey& key)
+{
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        key = CAddressIndexIteratorKey(1, *keyID);
+        return true;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        key = CAddressIndexIteratorKey(2, *scriptID);
+        return true;
+    }
+    return false;
+}
+
+/** Collect the snapshot index keys of every destination paid by the outputs of a block */
+static void GetSnapshotIndexKeys(const CBlock& block, std::vector<CAddressIndexIteratorKey>& vKeys)
+{
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH (const CTxOut& txout, tx.vout) {
+            txnouttype type;
+            vector<CTxDestination> addresses;
+            int nRequired;
+
+            if (!ExtractDestinations(txout.scriptPubKey, type, addresses, nRequired)) continue;
+
+            BOOST_FOREACH (const CTxDestination& addr, addresses) {
+                CAddressIndexIteratorKey key;
+                if (GetSnapshotIndexKey(addr, key))
+                    vKeys.push_back(key);
+            }
+        }
+    }
+}
+
+/**
+ * Record (or, when disconnecting, forget) the first post-fork payment to any snapshot address
+ * in a block at or after the fork height.
+ */
+static bool UpdateSnapshotIndex(const CBlock& block, int nHeight, bool fConnect)
+{
+    std::vector<CAddressIndexIteratorKey> vKeys;
+    GetSnapshotIndexKeys(block, vKeys);
+
+    std::vector<std::pair<CAddressIndexIteratorKey, int> > vUpdate;
+    BOOST_FOREACH (const CAddressIndexIteratorKey& key, vKeys) {
+        int nHeightSeen;
+        if (!pblocktree->ReadSnapshotIndex(key, nHeightSeen))
+            continue; // not a snapshot address
+        if (fConnect && nHeightSeen == 0)
+            vUpdate.push_back(make_pair(key, nHeight));
+        else if (!fConnect && nHeightSeen == nHeight)
+            vUpdate.push_back(make_pair(key, 0));
+    }
+
+    return vUpdate.empty() || pblocktree->WriteSnapshotIndex(vUpdate);
+}
+
+void ThreadSnapshotIndex()
+{
+    RenameThread("btc2-snapshotidx");
+
+    const int nForkHeight = Params().Zerocoin_StartHeight();
+
+    // Wait until the snapshot range is on disk and no import is running
+    while (true) {
+        {
+            LOCK(cs_main);
+            if (fSnapshotIndex)
+                return;
+            if (!fImporting && !fReindex && chainActive.Height() >= nForkHeight)
+                break;
+        }
+        MilliSleep(1000);
+        boost::this_thread::interruption_point();
+    }
 
-	for (int i = a; i < n; i++)
+    LogPrintf("%s: building snapshot index...\n", __func__);
+    int64_t nStart = GetTimeMillis();
+
+    // Drop anything left behind by an interrupted build
+    if (!pblocktree->EraseSnapshotIndex()) {
+        LogPrintf("%s: failed to erase snapshot index\n", __func__);
+        return;
+    }
+
+    // Every address paid in the snapshot range
+    for (int nHeight = SNAPSHOT_FIRST_HEIGHT; nHeight < nForkHeight; nHeight++) {
+        boost::this_thread::interruption_point();
+
+        CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            pindex = chainActive[nHeight];
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex)) {
+            LogPrintf("%s: failed to read block %d\n", __func__, nHeight);
+            return;
+        }
+
+        std::vector<CAddressIndexIteratorKey> vKeys;
+        GetSnapshotIndexKeys(block, vKeys);
+
+        std::vector<std::pair<CAddressIndexIteratorKey, int> > vWrite;
+        vWrite.reserve(vKeys.size());
+        BOOST_FOREACH (const CAddressIndexIteratorKey& key, vKeys)
+            vWrite.push_back(make_pair(key, 0));
+        if (!pblocktree->WriteSnapshotIndex(vWrite)) {
+            LogPrintf("%s: failed to write snapshot index\n", __func__);
+            return;
+        }
+    }
+
+    // Replay the chain since the fork. The last step runs under cs_main so that no
+    // block is connected between the end of the scan and ConnectBlock taking over.
+    CBlockIndex* pindexLast = NULL;
+    for (int nHeight = nForkHeight;; nHeight++) {
+        boost::this_thread::interruption_point();
+
+        CBlockIndex* pindex;
+        {
+            LOCK(cs_main);
+            if (pindexLast && !chainActive.Contains(pindexLast)) {
+                LogPrintf("%s: chain reorganized during build, will retry on next start\n", __func__);
+                return;
+            }
+            pindex = chainActive[nHeight];
+            if (pindex == NULL) {
+                pblocktree->WriteFlag("snapshotindex", true);
+                fSnapshotIndex = true;
+                break;
+            }
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex) || !UpdateSnapshotIndex(block, nHeight, true)) {
+            LogPrintf("%s: failed to index block %d\n", __func__, nHeight);
+            return;
+        }
+        pindexLast = pindex;
+    }
+
+    LogPrintf("%s: snapshot index built in %dms\n", __func__, GetTimeMillis() - nStart);
+}
+
+/** True if any output of the block pays theAddress; runs on the block scanner workers */
+static bool BlockPaysAddress(const CBlock& block, const CBlockIndex* pindex, const string& theAddress)
+{
+	BOOST_FOREACH(const CTransaction& tx, block.vtx)
 	{
-		if (!QuickScan && i % aPercent == 0)
-		{
-			double percentage = double(i - a) / (double)c * 100.0;
-			pwalletMain->ShowProgress(_("Scanning..."), percentage);
-		}
-		CBlock block;
-		ReadBlockFromDisk(block, pindex);
-		BOOST_FOREACH(CTransaction& tx, block.vtx)
+		for (unsigned int i = 0; i < tx.vout.size(); i++)
 		{
-			if (!tx.vout.empty())
-			{
-				for (unsigned int i = 0; i < tx.vout.size(); i++)
-				{
-					const CTxOut& txout = tx.vout[i];
-					txnouttype type;
-					vector<CTxDestination> addresses;
-					int nRequired;
+			const CTxOut& txout = tx.vout[i];
+			txnouttype type;
+			vector<CTxDestination> addresses;
+			int nRequired;
 
-					if (!ExtractDestinations(txout.scriptPubKey, type, addresses, nRequired)) continue;
+			if (!ExtractDestinations(txout.scriptPubKey, type, addresses, nRequired)) continue;
 
-					BOOST_FOREACH(const CTxDestination& addr, addresses) { if (CBitcoinAddress(addr).ToString() == theAddress) { return true; } }
-				}
-			}
+			BOOST_FOREACH(const CTxDestination& addr, addresses) { if (CBitcoinAddress(addr).ToString() == theAddress) { return true; } }
 		}
+	}
+	return false;
+}
+
+static bool HasTXFound(const CBlock& block, CBlockIndex* pindex, bool& fFound)
+{
+	fFound = true;
+	return false; // stop at the first block paying the address
+}
 
-		pindex = chainActive.Next(pindex);
+static void HasTXProgress(const CBlockIndex* pindex, int a, int c, int aPercent)
+{
+	if (pindex->nHeight % aPercent == 0)
+	{
+		double percentage = double(pindex->nHeight - a) / (double)c * 100.0;
+		pwalletMain->ShowProgress(_("Scanning..."), percentage);
 	}
+}
 
-	return false;
+/////////////
+bool HasTX(int a, int n, const string &theAddress, bool QuickScan)
+{
+	int c = n - a;
+	int aPercent = c / 100;
+	if (aPercent < 10) aPercent = 10;
+	if (c <= 0) return false;
+
+	bool fFound = false;
+	CBlockScanner scanner;
+	scanner.Scan(chainActive[a], chainActive[n - 1], boost::bind(&BlockPaysAddress, _1, _2, boost::cref(theAddress)),
+		boost::bind(&HasTXFound, _1, _2, boost::ref(fFound)),
+		QuickScan ? CBlockScanner::ProgressFunction() : boost::bind(&HasTXProgress, _1, a, c, aPercent));
+
+	return fFound;
+}
+bool IsSnapshotAddressUnpaid(int nHeightSeen, int nTipHeight)
+{
+	return nHeightSeen == 0 || nHeightSeen >= nTipHeight;
 }
 ///////////
 int ScanTX(const string &theAddress, bool QuickScan)
@@ -2039,7 +2483,17 @@ int ScanTX(const string &theAddress, bool QuickScan)
 		LOCK2(cs_main, pwalletMain->cs_wallet);
 		if (n > chainActive.Height()) return -1;
 
-		if (HasTX(102, n, theAddress, QuickScan))
+		// Answer from the snapshot index once it has been built instead of reading the blocks
+		if (fSnapshotIndex) {
+			CAddressIndexIteratorKey key;
+			int nHeightSeen = 0;
+			if (!GetSnapshotIndexKey(CBitcoinAddress(theAddress).Get(), key) || !pblocktree->ReadSnapshotIndex(key, nHeightSeen))
+				return 0;
+			if (chainActive.Height() < 628729 || QuickScan) return -1;
+			return IsSnapshotAddressUnpaid(nHeightSeen, chainActive.Height()) ? 1 : 0;
+		}
+
+		if (HasTX(SNAPSHOT_FIRST_HEIGHT, n, theAddress, QuickScan))
 		{
 			if (chainActive.Height() < 628729 || QuickScan) returnvalue = -1;
 			else
@@ -2146,20 +2600,58 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos)
     return true;
 }
 
+/**
+ * Find the record at pos in a mapped blk or rev file: the nSize bytes at pbegin, as told by the magic and
+ * size before them, and then nExtra more bytes. pfile keeps the memory mapped. False if the file isn't
+ * mapped or the record doesn't look right there, its size above nMaxSize or past the end of the mapping
+ * included, in which case it should be read from the file, which reports the error.
+ */
+static bool GetMappedRecord(const CDiskBlockPos& pos, const char* prefix, unsigned int nMaxSize, unsigned int nExtra, CMappedFileRef& pfile, const char*& pbegin, unsigned int& nSize)
+{
+    static const unsigned int nPrefixSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nPrefixSize)
+        return false;
+    pfile = blockFileMap.Get(pos, prefix, 0);
+    if (!pfile || pos.nPos > pfile->size())
+        return false;
+    const char* p = pfile->data() + pos.nPos;
+    if (memcmp(p - nPrefixSize, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return false;
+    // The size is read from the file, so bound it before anything is read from the mapping past pos
+    nSize = ReadLE32((const unsigned char*)p - sizeof(unsigned int));
+    if (nSize == 0 || nSize > nMaxSize || (uint64_t)pos.nPos + nSize + nExtra > pfile->size())
+        return false;
+    pbegin = p;
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+    CMappedFileRef pfile;
+    const char* pbegin;
+    unsigned int nSize;
+    if (GetMappedRecord(pos, "blk", MAX_BLOCK_SIZE_CURRENT, 0, pfile, pbegin, nSize)) {
+        // Read block from the mapped file
+        try {
+            CSpanReader reader(pbegin, pbegin + nSize, SER_DISK, CLIENT_VERSION);
+            reader >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk : OpenBlockFile failed");
 
-    // Read block
-    try {
-        filein >> block;
-    } catch (std::exception& e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        // Read block
+        try {
+            filein >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Check the header
@@ -2182,6 +2674,75 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadRawBlockFromDisk(CDataStream& ssBlock, const CDiskBlockPos& pos)
+{
+    CMappedFileRef pfile;
+    const char* pbegin;
+    unsigned int nSize;
+    if (GetMappedRecord(pos, "blk", MAX_BLOCK_SIZE_CURRENT, 0, pfile, pbegin, nSize) && nSize >= 80) {
+        ssBlock.resize(nSize);
+        memcpy(&ssBlock[0], pbegin, nSize);
+        return true;
+    }
+
+    // The block is preceded by the network magic and its size
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s : Invalid block position %d:%u", __func__, pos.nFile, pos.nPos);
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - MESSAGE_START_SIZE - sizeof(unsigned int));
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s : OpenBlockFile failed", __func__);
+
+    try {
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        unsigned int nSize;
+        filein >> FLATDATA(pchMessageStart) >> nSize;
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+            return error("%s : No block at %d:%u", __func__, pos.nFile, pos.nPos);
+        if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
+            return error("%s : Invalid block size %u at %d:%u", __func__, nSize, pos.nFile, pos.nPos);
+        ssBlock.resize(nSize);
+        filein.read(&ssBlock[0], nSize);
+    } catch (std::exception& e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool GetBlockMessage(CSharedNetMsg& msg, const CBlockIndex* pindex)
+{
+    uint256 hash = pindex->GetBlockHash();
+    if (blockMessageCache.Get(hash, msg))
+        return true;
+
+    // The block's bytes, straight from a mapped block file if it is in one
+    CMappedFileRef pfile;
+    const char* pbegin;
+    unsigned int nSize;
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    if (!GetMappedRecord(pindex->GetBlockPos(), "blk", MAX_BLOCK_SIZE_CURRENT, 0, pfile, pbegin, nSize)) {
+        if (!ReadRawBlockFromDisk(ssBlock, pindex->GetBlockPos()))
+            return false;
+        pbegin = &ssBlock[0];
+        nSize = ssBlock.size();
+    }
+
+    // Check that these are the bytes of the block asked for, from its header alone
+    CBlockHeader header;
+    try {
+        CSpanReader reader(pbegin, pbegin + nSize, SER_NETWORK, PROTOCOL_VERSION);
+        reader >> header;
+    } catch (std::exception& e) {
+        return error("%s : Deserialize error - %s", __func__, e.what());
+    }
+    if (header.GetHash() != hash)
+        return error("%s : block %s on disk doesn't match index %s", __func__, header.GetHash().ToString(), hash.ToString());
+
+    msg = MakeNetMessage("block", pbegin, pbegin + nSize);
+    blockMessageCache.Insert(hash, msg);
+    return true;
+}
+
 
 double ConvertBitsToDouble(unsigned int nBits)
 {
@@ -2372,6 +2933,18 @@ void Misbehaving(NodeId pnode, int howmuch)
         LogPrintf("Misbehaving: %s (%d -> %d)\n", state->name, state->nMisbehavior - howmuch, state->nMisbehavior);
 }
 
+/** Punish the peers that announced a chain through this header, for a fault of the header itself.
+ *  They checked it like we did, so they knew; faults found with local state are the sender's alone. */
+// Requires cs_main.
+void static MisbehavingAnnouncers(const CBlockIndex* pindex, int howmuch)
+{
+    for (map<NodeId, CNodeState>::iterator it = mapNodeState.begin(); it != mapNodeState.end(); it++) {
+        const CBlockIndex* pindexBest = it->second.pindexBestKnownBlock;
+        if (pindexBest && pindexBest->GetAncestor(pindex->nHeight) == pindex)
+            Misbehaving(it->first, howmuch);
+    }
+}
+
 void static InvalidChainFound(CBlockIndex* pindexNew)
 {
     if (!pindexBestInvalid || pindexNew->nChainWork > pindexBestInvalid->nChainWork)
@@ -2407,6 +2980,36 @@ void static InvalidBlockFound(CBlockIndex* pindex, const CValidationState& state
     }
 }
 
+/** Mark a block we may only have the header of as invalid, along with everything built on it. */
+// Requires cs_main.
+void static InvalidHeaderFound(CBlockIndex* pindex)
+{
+    pindex->nStatus |= BLOCK_FAILED_VALID;
+    setDirtyBlockIndex.insert(pindex);
+    setBlockIndexCandidates.erase(pindex);
+
+    bool fBestHeaderFailed = pindexBestHeader && pindexBestHeader->GetAncestor(pindex->nHeight) == pindex;
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
+        CBlockIndex* pindexWalk = it->second;
+        if (pindexWalk != pindex && pindexWalk->nHeight > pindex->nHeight && pindexWalk->GetAncestor(pindex->nHeight) == pindex) {
+            pindexWalk->nStatus |= BLOCK_FAILED_CHILD;
+            setDirtyBlockIndex.insert(pindexWalk);
+            setBlockIndexCandidates.erase(pindexWalk);
+        }
+    }
+
+    // Headers are no longer fetched through it, nor blocks downloaded towards it
+    if (fBestHeaderFailed) {
+        pindexBestHeader = chainActive.Tip();
+        for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
+            if (it->second->IsValid(BLOCK_VALID_TREE) && CBlockIndexWorkComparator()(pindexBestHeader, it->second))
+                pindexBestHeader = it->second;
+        }
+    }
+
+    InvalidChainFound(pindex);
+}
+
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight)
 {
     // mark inputs spent
@@ -2426,6 +3029,12 @@ void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCach
 bool CScriptCheck::operator()()
 {
     const CScript& scriptSig = ptxTo->vin[nIn].scriptSig;
+    // Signatures missing from the cache are taken as valid and verified with the rest of the block;
+    // a script that fails that way is run again here with every signature checked
+    if (pbatch && (nFlags & SCRIPT_VERIFY_DERSIG)) {
+        if (VerifyScript(scriptSig, scriptPubKey, nFlags, BatchingTransactionSignatureChecker(ptxTo, nIn, pbatch, nBatchOwner, cacheStore), &error))
+            return true;
+    }
     if (!VerifyScript(scriptSig, scriptPubKey, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, cacheStore), &error)) {
         return ::error("CScriptCheck(): %s:%d VerifySignature failed: %s", ptxTo->GetHash().ToString(), nIn, ScriptErrorString(error));
     }
@@ -2735,6 +3344,10 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         }
     }
 
+    if (fSnapshotIndex && pindex->nHeight >= Params().Zerocoin_StartHeight())
+        if (!UpdateSnapshotIndex(block, pindex->nHeight, false))
+            return AbortNode("Failed to write snapshot index");
+
     return fClean;
 }
 
@@ -2752,23 +3365,143 @@ void static FlushBlockFile(bool fFinalize = false)
         fclose(fileOld);
     }
 
-    fileOld = OpenUndoFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
-        FileCommit(fileOld);
-        fclose(fileOld);
+    fileOld = OpenUndoFile(posOld);
+    if (fileOld) {
+        if (fFinalize)
+            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
+        FileCommit(fileOld);
+        fclose(fileOld);
+    }
+}
+
+bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
+
+//! Worker threads shared by the script, spend proof and deferred signature check queues
+static CCheckPool checkpool;
+
+static CCheckQueue<CScriptCheck> scriptcheckqueue(checkpool, 128);
+
+//! Spend proofs take milliseconds each, so workers take them one at a time
+static CCheckQueue<CZerocoinSpendCheck> zerocoincheckqueue(checkpool, 1);
+//! CheckBlock may run on several threads, but the queue serves one master at a time
+static boost::mutex cs_zerocoincheckqueue;
+
+static CCheckQueue<CSignatureBatchCheck> sigbatchqueue(checkpool, 4);
+//! Signatures deferred by the scripts of the block being connected; cs_main
+static CSignatureBatch sigbatch;
+
+/** Compare the hashes of a run of block index entries with those of their headers */
+static bool CheckBlockIndexHashes(CBlockIndex* const* ppindexBegin, CBlockIndex* const* ppindexEnd)
+{
+    // Entries that were only referred to as a parent have no header
+    std::vector<const CBlockIndex*> vIndex;
+    std::vector<CBlockHeader> vHeaders;
+    for (CBlockIndex* const* ppindex = ppindexBegin; ppindex != ppindexEnd; ppindex++) {
+        if ((*ppindex)->nTime != 0) {
+            vIndex.push_back(*ppindex);
+            vHeaders.push_back((*ppindex)->GetBlockHeader());
+        }
+    }
+    std::vector<uint256> vHashes;
+    GetBlockHeaderHashes(vHeaders, vHashes);
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        if (vHashes[i] != vIndex[i]->GetBlockHash())
+            return error("%s : block index entry %s does not match its header", __func__, vIndex[i]->GetBlockHash().ToString());
+    }
+    return true;
+}
+
+//! Block index entries hashed between checks for shutdown
+static const unsigned int BLOCK_INDEX_HASH_CHECK_SIZE = 1000;
+
+void ThreadScriptCheck()
+{
+    RenameThread("bitcoin2-scriptch");
+    checkpool.Thread();
+}
+
+void ThreadCheckBlockIndexHashes()
+{
+    RenameThread("bitcoin2-checkidx");
+    // On its own thread rather than the check pool, which connecting blocks needs meanwhile
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    int64_t nStart = GetTimeMillis();
+
+    // Entries are never removed from mapBlockIndex while the node runs, and their header fields do not change
+    std::vector<CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        vIndex.reserve(mapBlockIndex.size());
+        BOOST_FOREACH (const PAIRTYPE(const uint256, CBlockIndex*) & item, mapBlockIndex)
+            vIndex.push_back(item.second);
+    }
+    if (vIndex.empty())
+        return;
+
+    for (size_t i = 0; i < vIndex.size(); i += BLOCK_INDEX_HASH_CHECK_SIZE) {
+        // Stop early on shutdown, the index entries are about to go away
+        if (ShutdownRequested())
+            return;
+        if (!CheckBlockIndexHashes(&vIndex[i], &vIndex[0] + std::min(vIndex.size(), i + BLOCK_INDEX_HASH_CHECK_SIZE))) {
+            AbortNode("Block index hash check failed", _("Corrupted block database detected.\nPlease restart with -reindex to rebuild the block database."));
+            return;
+        }
     }
+    LogPrintf("%s : checked %u block index hashes in %dms\n", __func__, vIndex.size(), GetTimeMillis() - nStart);
 }
 
-bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
-
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+/**
+ * Verify the signatures the scripts of a block deferred, spread over the signature check threads,
+ * then run again with every signature checked the scripts that had one fail. Requires cs_main.
+ */
+static bool VerifySignatureBatch(const CBlock& block, const CBlockUndo& blockundo, unsigned int flags, bool cacheStore)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    uint32_t nEntries = sigbatch.size();
+    if (nEntries > 0) {
+        uint32_t nChunk = GetSignatureBatchChunkSize(nEntries, nScriptCheckThreads);
+        std::vector<CSignatureBatchCheck> vChecks;
+        vChecks.reserve((nEntries + nChunk - 1) / nChunk);
+        for (uint32_t nBegin = 0; nBegin < nEntries; nBegin += nChunk)
+            vChecks.push_back(CSignatureBatchCheck(&sigbatch, nBegin, std::min(nBegin + nChunk, nEntries)));
+
+        CCheckQueueControl<CSignatureBatchCheck> control(&sigbatchqueue);
+        control.Add(vChecks);
+        control.Wait();
+    }
+
+    std::vector<uint32_t> vFailed;
+    sigbatch.GetFailedOwners(vFailed);
+    BOOST_FOREACH (uint32_t nOwner, vFailed) {
+        const std::pair<uint32_t, uint32_t>& owner = sigbatch.GetOwner(nOwner);
+        const CTransaction& tx = block.vtx[owner.first];
+        const CScript& scriptPubKey = blockundo.vtxundo[owner.first - 1].vprevout[owner.second].txout.scriptPubKey;
+        ScriptError serror;
+        if (!VerifyScript(tx.vin[owner.second].scriptSig, scriptPubKey, flags, CachingTransactionSignatureChecker(&tx, owner.second, cacheStore), &serror))
+            return error("%s : %s:%d VerifySignature failed: %s", __func__, tx.GetHash().ToString(), owner.second, ScriptErrorString(serror));
+    }
+
+    int64_t nTime = GetTimeMicros() - nTimeStart;
+    LogPrint("bench", "    - Verify %u deferred signatures: %.2fms (%.0f sigops/s), %u scripts checked again\n",
+        nEntries, 0.001 * nTime, nTime > 0 ? 1000000.0 * nEntries / nTime : 0.0, vFailed.size());
+    return true;
+}
 
-void ThreadScriptCheck()
+/** Verify the spend proofs a block deferred, on the zerocoin check threads if there are several */
+static bool VerifyZerocoinSpendChecks(std::vector<CZerocoinSpendCheck>& vChecks)
 {
-    RenameThread("bitcoin2-scriptch");
-    scriptcheckqueue.Thread();
+    if (vChecks.size() == 1 || nScriptCheckThreads <= 1) {
+        BOOST_FOREACH (CZerocoinSpendCheck& check, vChecks) {
+            if (!check())
+                return false;
+        }
+        return true;
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs_zerocoincheckqueue);
+    CCheckQueueControl<CZerocoinSpendCheck> control(&zerocoincheckqueue);
+    control.Add(vChecks);
+    return control.Wait();
 }
 
 /*void RecalculateZBTC2Minted()
@@ -2967,6 +3700,7 @@ bool UpdateZBTC2Supply(const CBlock& block, CBlockIndex* pindex)
             pindex->vMintDenominationsInBlock.push_back(m.GetDenomination());
             pindex->mapZerocoinSupply.at(denom)++;
         }
+        pindex->BuildZerocoinMintCount();
 
         for (auto& denom : listSpends) {
             pindex->mapZerocoinSupply.at(denom)--;
@@ -3045,6 +3779,19 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
+    // With script check threads, signature verification is pulled out of the scripts
+    // and done for the whole block at once, see VerifySignatureBatch
+    unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG;
+    bool fBatchSignatures = fScriptChecks && nScriptCheckThreads && fSignatureBatch;
+    if (fBatchSignatures) {
+        uint32_t nBatchInputs = 0;
+        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+            if (!tx.IsCoinBase() && !tx.HasZerocoinSpendInputs())
+                nBatchInputs += tx.vin.size();
+        }
+        sigbatch.Start(nBatchInputs * SIGNATURE_BATCH_ENTRIES_PER_INPUT);
+    }
+
 	LogPrint("masternode", "%s - CAmount nFees = 0;.\n", __func__);
 
     //int64_t nTimeStart = GetTimeMicros();
@@ -3171,10 +3918,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             nValueIn += view.GetValueIn(tx);
 
             std::vector<CScriptCheck> vChecks;
-            unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG;
 
-            if (!CheckInputs(tx, state, view, fScriptChecks, flags, false, nScriptCheckThreads ? &vChecks : NULL))
+            // A block only being checked keeps the signatures it finds cached, it is connected for real later
+            if (!CheckInputs(tx, state, view, fScriptChecks, flags, fJustCheck, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
+            if (fBatchSignatures) {
+                BOOST_FOREACH (CScriptCheck& check, vChecks)
+                    check.SetSignatureBatch(&sigbatch, sigbatch.AddOwner(i, check.GetInputIndex()));
+            }
             control.Add(vChecks);
         }
 
@@ -3266,6 +4017,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (!control.Wait())
         return state.DoS(100, false);
+    if (fBatchSignatures && !VerifySignatureBatch(block, blockundo, flags, fJustCheck))
+        return state.DoS(100, false);
     //int64_t nTime2 = GetTimeMicros();
     //nTimeVerify += nTime2 - nTimeStart;
     //LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs - 1), nTimeVerify * 0.000001);
@@ -3332,6 +4085,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             return AbortNode("Failed to write timestamp index");
     }
 
+    if (fSnapshotIndex && pindex->nHeight >= Params().Zerocoin_StartHeight())
+        if (!UpdateSnapshotIndex(block, pindex->nHeight, true))
+            return AbortNode("Failed to write snapshot index");
+
     // add this block to the view's block chain
 	LogPrint("masternode", "%s - view.SetBestBlock(\n", __func__);
     view.SetBestBlock(pindex->GetBlockHash());
@@ -3370,7 +4127,7 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
     static int64_t nLastWrite = 0;
     try {
         if ((mode == FLUSH_STATE_ALWAYS) ||
-            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+            ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage) ||
             (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
@@ -3381,26 +4138,27 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
                 return state.Error("out of disk space");
             // First make sure all block and undo data is flushed to disk.
             FlushBlockFile();
-            // Then update all block file information (which may refer to block and undo files).
-            bool fileschanged = false;
-            for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end();) {
-                if (!pblocktree->WriteBlockFileInfo(*it, vinfoBlockFile[*it])) {
-                    return state.Abort("Failed to write to block index");
-                }
-                fileschanged = true;
-                setDirtyFileInfo.erase(it++);
+            // Then update all block file information (which may refer to block and undo files),
+            // and the block index, in one synced batch.
+            int64_t nStart = GetTimeMicros();
+            std::vector<std::pair<int, const CBlockFileInfo*> > vFiles;
+            vFiles.reserve(setDirtyFileInfo.size());
+            for (set<int>::iterator it = setDirtyFileInfo.begin(); it != setDirtyFileInfo.end(); it++) {
+                vFiles.push_back(make_pair(*it, &vinfoBlockFile[*it]));
             }
-            if (fileschanged && !pblocktree->WriteLastBlockFile(nLastBlockFile)) {
-                return state.Abort("Failed to write to block index");
+            std::vector<const CBlockIndex*> vBlocks;
+            vBlocks.reserve(setDirtyBlockIndex.size());
+            for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); it++) {
+                vBlocks.push_back(*it);
             }
-            for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end();) {
-                if (!pblocktree->WriteBlockIndex(CDiskBlockIndex(*it))) {
-                    return state.Abort("Failed to write to block index");
-                }
-                setDirtyBlockIndex.erase(it++);
+            if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
+                return state.Abort("Failed to write to block index");
             }
-            pblocktree->Sync();
+            setDirtyFileInfo.clear();
+            setDirtyBlockIndex.clear();
+            LogPrint("bench", "- Write block index: %.2fms (%u files, %u blocks)\n", (GetTimeMicros() - nStart) * 0.001, vFiles.size(), vBlocks.size());
             // Finally flush the chainstate (which may refer to block index entries).
+            // With -asyncflush this only hands the entries over to the writer thread.
             if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
             // Update best block in wallet (so we can detect restored wallets).
@@ -3433,10 +4191,10 @@ void static UpdateTip(CBlockIndex* pindexNew)
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long)chainActive.Tip()->nChainTx,
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-        Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int)pcoinsTip->GetCacheSize());
+        Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int)pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -3486,13 +4244,21 @@ bool static DisconnectTip(CValidationState& state)
     if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
         return false;
     // Resurrect mempool transactions from the disconnected block.
+    // The pool is trimmed once the reorganization is done, see ActivateBestChainStep.
+    std::vector<uint256> vHashUpdate;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
         // ignore validation errors in resurrected transactions
         list<CTransaction> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, NULL))
+        if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, NULL, false, true)) {
             mempool.remove(tx, removed, true);
+        } else if (mempool.exists(tx.GetHash())) {
+            vHashUpdate.push_back(tx.GetHash());
+        }
     }
+    // Transactions already in the pool may spend the resurrected ones, which
+    // were added without knowing about their in-mempool descendants.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
     mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
@@ -3759,10 +4525,14 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
     const CBlockIndex* pindexFork = chainActive.FindFork(pindexMostWork);
 
     // Disconnect active blocks which are no longer in the best chain.
+    bool fBlocksDisconnected = false;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
         if (!DisconnectTip(state))
             return false;
+        fBlocksDisconnected = true;
     }
+    if (fBlocksDisconnected)
+        LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
 
     // Build list of new blocks to connect.
     std::vector<CBlockIndex*> vpindexToConnect;
@@ -3989,8 +4759,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.New(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -4032,16 +4801,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
             
         }*/
 
-        // ppcoin: compute stake modifier
-  		if (pindexNew->nHeight < StakingProtocol2Height)
-  		{
-  			uint64_t nStakeModifier = 0;
-  			bool fGeneratedStakeModifier = false;
-  			if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
-  				LogPrintf("AddToBlockIndex() : ComputeNextStakeModifier() failed \n");
-  			pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
-  		}
-  		else pindexNew->nStakeModifierV2 = ComputeStakeModifierV2(pindexNew->pprev, block.vtx[1].vin[0].prevout.hash);
+        // The stake modifier is computed by AcceptBlock, as headers arrive without the coinstake
     }
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
@@ -4057,6 +4817,25 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
     return pindexNew;
 }
 
+/** Compute the stake modifier of a block. This needs its coinstake and the modifiers and stake flags of
+ *  its parents, so it is done once the block itself is accepted, which happens in order. */
+void ComputeBlockStakeModifier(CBlockIndex* pindexNew, const CBlock& block)
+{
+    if (pindexNew->pprev == NULL)
+        return;
+
+    // ppcoin: compute stake modifier
+    if (pindexNew->nHeight < StakingProtocol2Height) {
+        uint64_t nStakeModifier = 0;
+        bool fGeneratedStakeModifier = false;
+        if (!ComputeNextStakeModifier(pindexNew->pprev, nStakeModifier, fGeneratedStakeModifier))
+            LogPrintf("ComputeBlockStakeModifier() : ComputeNextStakeModifier() failed \n");
+        pindexNew->SetStakeModifier(nStakeModifier, fGeneratedStakeModifier);
+    } else
+        pindexNew->nStakeModifierV2 = ComputeStakeModifierV2(pindexNew->pprev, block.vtx[1].vin[0].prevout.hash);
+    setDirtyBlockIndex.insert(pindexNew);
+}
+
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 bool ReceivedBlockTransactions(const CBlock& block, CValidationState& state, CBlockIndex* pindexNew, const CDiskBlockPos& pos)
 {
@@ -4128,6 +4907,7 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
     }
 
     nLastBlockFile = nFile;
+    blockFileMap.SetLastBlockFile(nLastBlockFile);
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
     if (fKnown)
         vinfoBlockFile[nFile].nSize = std::max(pos.nPos + nAddSize, vinfoBlockFile[nFile].nSize);
@@ -4196,7 +4976,89 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig)
+/**
+ * The checks of a proof-of-stake block that depend on the height it gets from its parent or the
+ * tip. Part of CheckBlock, but run on its own when the rest of CheckBlock was done without cs_main.
+ */
+static bool CheckBlockStakeContext(const CBlock& block, CValidationState& state)
+{
+	int64_t BiggerTime = GetAdjustedTime();
+	if (GetTime() > BiggerTime) BiggerTime = GetTime();
+
+	LogPrint("masternode", "%s - if (block.IsProofOfStake()).\n", __func__);
+	LOCK(cs_main);
+	CBlockIndex* pindexPrev = chainActive.Tip();
+	int nHeight = 0;
+	if (pindexPrev != NULL)
+	{
+		if (pindexPrev->GetBlockHash() == block.hashPrevBlock) {
+			nHeight = pindexPrev->nHeight + 1;
+		}
+		else { //out of order
+			BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
+			if (mi != mapBlockIndex.end() && (*mi).second)
+				nHeight = (*mi).second->nHeight + 1;
+		}
+
+		// Bitcoin 2
+		LogPrint("masternode", "%s - if (nHeight (= %d) >= StakingProtocol2Height.\n", __func__, nHeight);
+
+		if (nHeight >= StakingProtocol2Height && block.GetBlockTime() % nStakeInterval != 0)
+			return state.DoS(100, error("CheckBlock(): block timestamp invalid:%d", block.GetBlockTime()), REJECT_INVALID, "time-invalid");
+
+		if (nHeight >= REWARDFORK_BLOCK)
+		{
+			if(block.GetBlockTime() > (BiggerTime + nMaxStakingFutureDriftv3))
+			return state.DoS(10, error("CheckBlock(): block timestamp too far in the future: %d", block.GetBlockTime()), REJECT_INVALID, "time-too-new");
+		}
+		// It is entirely possible that we don't have enough data and this could fail
+		// (i.e. the block could indeed be valid). Store the block for later consideration
+		// but issue an initial reject message.
+		// The case also exists that the sending peer could not have enough data to see
+		// that this block is invalid, so don't issue an outright ban.
+		LogPrint("masternode", "%s - if (nHeight != 0 && !IsInitialBlockDownload()\n", __func__);
+		if (nHeight > 1300 && !IsInitialBlockDownload()) {
+			LogPrint("masternode", "%s - if (!IsBlockPayeeValid(block, nHeight)) {\n", __func__);
+			if (!IsBlockPayeeValid(block, nHeight)) {
+				mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
+				return state.DoS(0, error("CheckBlock() : Couldn't find masternode payment"),
+						REJECT_INVALID, "bad-cb-payee");
+			}
+		} else {
+			if (fDebug)
+				LogPrintf("CheckBlock(): Masternode payment check skipped on sync - skipping IsBlockPayeeValid()\n");
+		}
+	}
+	return true;
+}
+
+/** Reject a block with a transaction that conflicts with a complete swiftTX lock */
+static bool CheckBlockTransactionLocks(const CBlock& block, CValidationState& state)
+{
+	LogPrint("masternode", "%s - swiftTX transaction scanning.\n", __func__);
+    // ----------- swiftTX transaction scanning -----------
+    if (IsSporkActive(SPORK_3_SWIFTTX_BLOCK_FILTERING)) {
+        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+            if (!tx.IsCoinBase()) {
+                //only reject blocks when it's based on complete consensus
+                BOOST_FOREACH (const CTxIn& in, tx.vin) {
+                    if (mapLockedInputs.count(in.prevout)) {
+                        if (mapLockedInputs[in.prevout] != tx.GetHash()) {
+                            mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
+                            LogPrintf("CheckBlock() : found conflicting transaction with transaction lock %s %s\n", mapLockedInputs[in.prevout].ToString(), tx.GetHash().ToString());
+                            return state.DoS(0, error("CheckBlock() : found conflicting transaction with transaction lock"),
+                                REJECT_INVALID, "conflicting-tx-ix");
+                        }
+                    }
+                }
+            }
+        }
+    }
+	else LogPrint("debug", "%s: skipping swiftTX locking checks.\n", __func__);
+    return true;
+}
+
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bool fCheckMerkleRoot, bool fCheckSig, bool fCheckStakeContext)
 {
     // These are checks that are independent of context.
     // Check that the header is valid (particularly PoW).  This is mostly
@@ -4262,82 +5124,21 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
                 return state.DoS(100, error("CheckBlock() : more than one coinstake"));
     }
 
-	LogPrint("masternode", "%s - swiftTX transaction scanning.\n", __func__);
-    // ----------- swiftTX transaction scanning -----------
-    if (IsSporkActive(SPORK_3_SWIFTTX_BLOCK_FILTERING)) {
-        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
-            if (!tx.IsCoinBase()) {
-                //only reject blocks when it's based on complete consensus
-                BOOST_FOREACH (const CTxIn& in, tx.vin) {
-                    if (mapLockedInputs.count(in.prevout)) {
-                        if (mapLockedInputs[in.prevout] != tx.GetHash()) {
-                            mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
-                            LogPrintf("CheckBlock() : found conflicting transaction with transaction lock %s %s\n", mapLockedInputs[in.prevout].ToString(), tx.GetHash().ToString());
-                            return state.DoS(0, error("CheckBlock() : found conflicting transaction with transaction lock"),
-                                REJECT_INVALID, "conflicting-tx-ix");
-                        }
-                    }
-                }
-            }
-        }
-    }
-	else LogPrint("debug", "%s: skipping swiftTX locking checks.\n", __func__);
-
-    if (block.IsProofOfStake())
-	{
-		LogPrint("masternode", "%s - if (block.IsProofOfStake()).\n", __func__);
-		LOCK(cs_main);
-		CBlockIndex* pindexPrev = chainActive.Tip();
-		int nHeight = 0;
-		if (pindexPrev != NULL)
-		{
-			if (pindexPrev->GetBlockHash() == block.hashPrevBlock) {
-				nHeight = pindexPrev->nHeight + 1;
-			}
-			else { //out of order
-				BlockMap::iterator mi = mapBlockIndex.find(block.hashPrevBlock);
-				if (mi != mapBlockIndex.end() && (*mi).second)
-					nHeight = (*mi).second->nHeight + 1;
-			}
-
-			// Bitcoin 2
-			LogPrint("masternode", "%s - if (nHeight (= %d) >= StakingProtocol2Height.\n", __func__, nHeight);
-
-			if (nHeight >= StakingProtocol2Height && block.GetBlockTime() % nStakeInterval != 0)
-				return state.DoS(100, error("CheckBlock(): block timestamp invalid:%d", block.GetBlockTime()), REJECT_INVALID, "time-invalid");
+    // The swiftTX locks are shared state; the import check threads leave them to the in order connect, under cs_main
+    if (fCheckStakeContext && !CheckBlockTransactionLocks(block, state))
+        return false;
 
-			if (nHeight >= REWARDFORK_BLOCK)
-			{
-				if(block.GetBlockTime() > (BiggerTime + nMaxStakingFutureDriftv3))
-				return state.DoS(10, error("CheckBlock(): block timestamp too far in the future: %d", block.GetBlockTime()), REJECT_INVALID, "time-too-new");
-			}
-			// It is entirely possible that we don't have enough data and this could fail
-			// (i.e. the block could indeed be valid). Store the block for later consideration
-			// but issue an initial reject message.
-			// The case also exists that the sending peer could not have enough data to see
-			// that this block is invalid, so don't issue an outright ban.
-			LogPrint("masternode", "%s - if (nHeight != 0 && !IsInitialBlockDownload()\n", __func__);
-			if (nHeight > 1300 && !IsInitialBlockDownload()) {
-				LogPrint("masternode", "%s - if (!IsBlockPayeeValid(block, nHeight)) {\n", __func__);
-				if (!IsBlockPayeeValid(block, nHeight)) {
-					mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
-					return state.DoS(0, error("CheckBlock() : Couldn't find masternode payment"),
-							REJECT_INVALID, "bad-cb-payee");
-				}
-			} else {
-				if (fDebug)
-					LogPrintf("CheckBlock(): Masternode payment check skipped on sync - skipping IsBlockPayeeValid()\n");
-			}
-		}
-    }
+    if (block.IsProofOfStake() && fCheckStakeContext && !CheckBlockStakeContext(block, state))
+        return false;
 	LogPrint("masternode", "%s - Check transactions.\n", __func__);
     // Check transactions
     bool fZerocoinActive = block.GetBlockTime() > Params().Zerocoin_StartTime();
 
     vector<CBigNum> vBlockSerials;
+    vector<CZerocoinSpendCheck> vZerocoinChecks;
     for (const CTransaction& tx : block.vtx) {
 		LogPrint("masternode", "%s - Check tx: %s.\n", __func__, tx.ToString());
-        if (!CheckTransaction(tx, fZerocoinActive, state))
+        if (!CheckTransaction(tx, fZerocoinActive, state, &vZerocoinChecks))
             return error("CheckBlock() : CheckTransaction failed");
 
         // double check that there are no double spent zBTC2 spends in this block
@@ -4355,6 +5156,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         }
     }
 
+    if (!vZerocoinChecks.empty() && !VerifyZerocoinSpendChecks(vZerocoinChecks))
+        return state.DoS(100, error("CheckBlock() : zerocoin spend did not verify"));
+
 	LogPrint("masternode", "%s - transactions fine.\n", __func__);
     unsigned int nSigOps = 0;
     BOOST_FOREACH (const CTransaction& tx, block.vtx) {
@@ -4402,6 +5206,38 @@ bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
     return true;
 }
 
+bool CheckBlockHeaderWork(const CBlockHeader& block, CValidationState& state, CBlockIndex* const pindexPrev)
+{
+    int nHeight = pindexPrev->nHeight + 1;
+    bool fProofOfStake = nHeight > Params().LAST_POW_BLOCK();
+
+    int64_t BiggerTime = GetAdjustedTime();
+    if (GetTime() > BiggerTime) BiggerTime = GetTime();
+    if (block.GetBlockTime() > BiggerTime + (fProofOfStake ? nMaxStakingFutureDrift : 7200))
+        return state.DoS(10, error("%s : block timestamp too far in the future", __func__), REJECT_INVALID, "time-too-new");
+
+    unsigned int nBitsRequired = GetNextWorkRequired(pindexPrev);
+    if (!fProofOfStake) {
+        if (!CheckProofOfWork(block.GetHash(), block.nBits))
+            return state.DoS(50, error("%s : proof of work failed at %d", __func__, nHeight), REJECT_INVALID, "high-hash");
+        if (nHeight <= 68589) {
+            double n1 = ConvertBitsToDouble(block.nBits);
+            double n2 = ConvertBitsToDouble(nBitsRequired);
+            if (abs(n1 - n2) > n1 * 0.5)
+                return state.DoS(100, error("%s : incorrect proof of work (DGW pre-fork) at %d", __func__, nHeight), REJECT_INVALID, "bad-diffbits");
+            return true;
+        }
+    }
+
+    // Proof of stake headers claim the difficulty the chain requires. Their kernel needs the coinstake
+    // and the stake modifier of the parent, so CheckWork verifies it when the block itself arrives, and
+    // the headers handler limits how many such headers a peer can have us take on trust.
+    if (block.nBits != nBitsRequired)
+        return state.DoS(100, error("%s : incorrect difficulty at %d", __func__, nHeight), REJECT_INVALID, "bad-diffbits");
+
+    return true;
+}
+
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex* const pindexPrev)
 {
     uint256 hash = block.GetHash();
@@ -4525,7 +5361,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex, bool fCheckWork)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -4575,6 +5411,9 @@ bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex
 
     }
 
+    if (fCheckWork && pindexPrev && !CheckBlockHeaderWork(block, state, pindexPrev))
+        return false;
+
     if (!ContextualCheckBlockHeader(block, state, pindexPrev))
         return false;
 
@@ -4621,8 +5460,17 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
     }
 	
 	LogPrint("masternode", "%s - Checking Work.\n", __func__);
-    if (block.GetHash() != Params().HashGenesisBlock() && !CheckWork(block, pindexPrev)) // this makes all the Proof of Stake checks too.
-        return state.DoS(100, false);
+    if (block.GetHash() != Params().HashGenesisBlock() && !CheckWork(block, pindexPrev)) { // this makes all the Proof of Stake checks too.
+        BlockMap::iterator mi = mapBlockIndex.find(block.GetHash());
+        if (mi != mapBlockIndex.end()) {
+            // A wrong difficulty follows from the headers alone. The stake kernel also depends on the
+            // stake input and the clock, so only the sender of the block answers for that one.
+            if (!block.IsProofOfStake() || block.nBits != GetNextWorkRequired(pindexPrev))
+                MisbehavingAnnouncers(mi->second, 100);
+            InvalidHeaderFound(mi->second);
+        }
+        return state.DoS(100, false, REJECT_INVALID, "bad-work");
+    }
 	LogPrint("masternode", "%s - CheckWork done.\n", __func__);
 
     if (!AcceptBlockHeader(block, state, &pindex))
@@ -4644,6 +5492,8 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
         return false;
     }
 
+    ComputeBlockStakeModifier(pindex, block);
+
     int nHeight = pindex->nHeight;
 
 	if(block.IsProofOfStake())
@@ -4848,7 +5698,13 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp)
+/** Whether blocks are downloaded from this peer headers first, or by walking its inventory */
+bool static IsHeadersFirstPeer(const CNode* pnode)
+{
+    return Params().HeadersFirstSyncingActive() && pnode->nVersion >= HEADERS_FIRST_VERSION;
+}
+
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp, bool fAlreadyChecked)
 {
 	LogPrint("masternode", "%s - From: %s. Block Time %d. Hash: %s.\n", __func__, pfrom != NULL ? pfrom->addr.ToStringIP() : "myself", pblock->GetBlockTime(), pblock->GetHash().ToString());
 
@@ -4858,7 +5714,9 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
         //  check if the prev block is one of our previous blocks, if not then request sync and return false
         BlockMap::iterator mi = mapBlockIndex.find(pblock->hashPrevBlock);
         if (mi == mapBlockIndex.end()) {
-            pfrom->PushMessage("getblocks", chainActive.GetLocator(), uint256(0));
+            // Headers first peers are asked for the headers by the block handler instead
+            if (!IsHeadersFirstPeer(pfrom))
+                pfrom->PushMessage("getblocks", chainActive.GetLocator(), uint256(0));
 			LogPrint("masternode", "ProcessNewBlock - The peer's block previous to this block is not one of our previous blocks. That node is on a different or longer chain. chainActive.Height(): %d. nChainWork: %s\n", chainActive.Height(), chainActive.Tip()->nChainWork.ToString());
             return false;
         }
@@ -4866,12 +5724,16 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
 
 	// Preliminary checks
 	int64_t nStartTime = GetTimeMillis();
-	bool checked = CheckBlock(*pblock, state);
+	bool checked = fAlreadyChecked ? (!pblock->IsProofOfStake() || CheckBlockStakeContext(*pblock, state)) : CheckBlock(*pblock, state);
+	if (checked && fAlreadyChecked) {
+		LOCK(cs_main);
+		checked = CheckBlockTransactionLocks(*pblock, state);
+	}
 
 	LogPrint("masternode", "%s - CheckBlockSignature.\n", __func__);
 
 	// NovaCoin: check proof-of-stake block signature
-	if (!pblock->CheckBlockSignature())
+	if (!fAlreadyChecked && !pblock->CheckBlockSignature())
 		return error("ProcessNewBlock() : bad proof-of-stake block signature");
 
     {
@@ -5050,9 +5912,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.New();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
     //mark as PoS seen. unused
@@ -5070,16 +5930,19 @@ bool static LoadBlockIndexDB(string& strError)
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    for (const PAIRTYPE(uint256, CBlockIndex*) & item : mapBlockIndex) {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH (const PAIRTYPE(int, CBlockIndex*) & item, vSortedByHeight) {
-        CBlockIndex* pindex = item.second;
+    // Calculate nChainWork, parents first. Heights are dense, so count them instead of sorting.
+    int nMaxHeight = 0;
+    for (const PAIRTYPE(uint256, CBlockIndex*) & item : mapBlockIndex)
+        nMaxHeight = std::max(nMaxHeight, item.second->nHeight);
+    vector<unsigned int> vHeightStart(nMaxHeight + 2, 0);
+    for (const PAIRTYPE(uint256, CBlockIndex*) & item : mapBlockIndex)
+        vHeightStart[item.second->nHeight + 1]++;
+    for (int nHeight = 0; nHeight <= nMaxHeight; nHeight++)
+        vHeightStart[nHeight + 1] += vHeightStart[nHeight];
+    vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+    for (const PAIRTYPE(uint256, CBlockIndex*) & item : mapBlockIndex)
+        vSortedByHeight[vHeightStart[item.second->nHeight]++] = item.second;
+    BOOST_FOREACH (CBlockIndex* pindex, vSortedByHeight) {
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         if (pindex->nStatus & BLOCK_HAVE_DATA) {
             if (pindex->pprev) {
@@ -5099,12 +5962,14 @@ bool static LoadBlockIndexDB(string& strError)
             pindexBestInvalid = pindex;
         if (pindex->pprev)
             pindex->BuildSkip();
+        pindex->BuildZerocoinMintCount();
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
+    blockFileMap.SetLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
     for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
@@ -5161,6 +6026,14 @@ bool static LoadBlockIndexDB(string& strError)
     pblocktree->ReadFlag("spentindex", fSpentIndex);
     LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
 
+    // Check whether the snapshot index has been built; a disabled one is no longer maintained
+    pblocktree->ReadFlag("snapshotindex", fSnapshotIndex);
+    if (fSnapshotIndex && !GetBoolArg("-snapshotindex", DEFAULT_SNAPSHOTINDEX)) {
+        pblocktree->WriteFlag("snapshotindex", false);
+        fSnapshotIndex = false;
+    }
+    LogPrintf("%s: snapshot index %s\n", __func__, fSnapshotIndex ? "enabled" : "disabled");
+
     // If this is written true before the next client init, then we know the shutdown process failed
     pblocktree->WriteFlag("shutdown", false);
 
@@ -5230,7 +6103,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -5344,98 +6217,87 @@ bool InitBlockIndex()
 }
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+// Map of disk positions for blocks with unknown parent (only used for reindex)
+static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+
+/**
+ * Checks of an imported block that CBlockImporter runs ahead on its check threads, without cs_main.
+ * Checking a zerocoin spend takes cs_main, so blocks with one are left to the connecting thread.
+ */
+static bool CheckImportedBlock(const CBlock& block)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    if (block.GetBlockTime() > Params().Zerocoin_StartTime()) {
+        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+            if (tx.HasZerocoinSpendInputs())
+                return false;
+        }
+    }
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE_CURRENT, MAX_BLOCK_SIZE_CURRENT + 8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+    CValidationState state;
+    return CheckBlock(block, state, true, true, true, false) && block.CheckBlockSignature();
+}
 
-            blkdat.SetPos(nRewind);
-            nRewind++;         // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos() + 1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE_CURRENT)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                        block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
-                }
+/** Connect an imported block in file order, returning false on an error that stops the import */
+static bool ConnectImportedBlock(CBlock& block, unsigned int nPos, bool fChecked, CDiskBlockPos* dbp, int& nLoaded)
+{
+    if (dbp)
+        dbp->nPos = nPos;
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, dbp))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+    // detect out of order blocks, and store them for later
+    uint256 hash = block.GetHash();
+    if (hash != Params().HashGenesisBlock() && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+            block.hashPrevBlock.ToString());
+        if (dbp)
+            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        return true;
+    }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second)) {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                    }
+    // process in case the block isn't known yet
+    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+        CValidationState state;
+        if (ProcessNewBlock(state, NULL, &block, dbp, fChecked))
+            nLoaded++;
+        if (state.IsError())
+            return false;
+    } else if (hash != Params().HashGenesisBlock() && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+        LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+    }
+
+    // Recursively process earlier encountered successors of this block
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        uint256 head = queue.front();
+        queue.pop_front();
+        std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
+        while (range.first != range.second) {
+            std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
+            if (ReadBlockFromDisk(block, it->second)) {
+                LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
+                    head.ToString());
+                CValidationState dummy;
+                if (ProcessNewBlock(dummy, NULL, &block, &it->second)) {
+                    nLoaded++;
+                    queue.push_back(block.GetHash());
                 }
-            } catch (std::exception& e) {
-                LogPrintf("%s : Deserialize or I/O error - %s", __func__, e.what());
             }
+            range.first++;
+            mapBlocksUnknownParent.erase(it);
         }
+    }
+    return true;
+}
+
+bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp)
+{
+    int64_t nStart = GetTimeMillis();
+
+    int nLoaded = 0;
+    try {
+        // Blocks are read, deserialized and checked on other threads, and connected here in file order
+        CBlockImporter importer;
+        importer.Import(fileIn, CheckImportedBlock, boost::bind(&ConnectImportedBlock, _1, _2, _3, dbp, boost::ref(nLoaded)));
     } catch (std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
     }
@@ -5685,6 +6547,64 @@ bool static AlreadyHave(const CInv& inv)
 }
 
 
+/** Whether a peer may start another fork of headers. Forks whose first block arrived, or that fell
+ *  behind the reorganization limit, no longer count. */
+// Requires cs_main.
+bool static CanStartHeaderFork(CNodeState* state)
+{
+    int nMinHeight = chainActive.Height() - GetArg("-maxreorg", Params().MaxReorganizationDepth());
+    std::vector<CBlockIndex*>::iterator it = state->vHeaderForks.begin();
+    while (it != state->vHeaderForks.end()) {
+        if (((*it)->nStatus & (BLOCK_HAVE_DATA | BLOCK_FAILED_MASK)) || (*it)->nHeight < nMinHeight)
+            it = state->vHeaderForks.erase(it);
+        else
+            it++;
+    }
+    return state->vHeaderForks.size() < MAX_HEADER_FORKS_PER_PEER;
+}
+
+/** Accept the blocks that were waiting for the one with this hash, and in turn those waiting for them */
+void static ProcessPendingBlocks(const uint256& hash)
+{
+    std::deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        std::vector<CPendingBlocks::CEntry> vReady;
+        {
+            LOCK(cs_main);
+            BlockMap::iterator mi = mapBlockIndex.find(queue.front());
+            queue.pop_front();
+            if (mi == mapBlockIndex.end())
+                continue;
+            CBlockIndex* pindexPrev = mi->second;
+            std::vector<CPendingBlocks::CEntry> vChildren;
+            pendingBlocks.TakeChildren(pindexPrev, vChildren);
+            BOOST_FOREACH (CPendingBlocks::CEntry& pending, vChildren) {
+                // Children of a block that was not accepted are dropped, and downloaded again if still wanted
+                if (pindexPrev->nStatus & BLOCK_HAVE_DATA) {
+                    // Failures found when connecting it are held against its sender too
+                    mapBlockSource[pending.pindex->GetBlockHash()] = pending.nodeid;
+                    vReady.push_back(pending);
+                } else
+                    queue.push_back(pending.pindex->GetBlockHash());
+            }
+        }
+
+        BOOST_FOREACH (CPendingBlocks::CEntry& pending, vReady) {
+            // CheckBlock passed when it was kept; the checks that need its parent are done now
+            CValidationState state;
+            ProcessNewBlock(state, NULL, &pending.block, NULL, true);
+            int nDoS;
+            if (state.IsInvalid(nDoS) && nDoS > 0) {
+                LOCK(cs_main);
+                if (State(pending.nodeid))
+                    Misbehaving(pending.nodeid, nDoS);
+            }
+            queue.push_back(pending.block.GetHash());
+        }
+    }
+}
+
 void static ProcessGetData(CNode* pfrom)
 {
     std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
@@ -5722,14 +6642,17 @@ void static ProcessGetData(CNode* pfrom)
                 }
                 // Don't send not-validated blocks
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
+                    // Send block as stored on disk, or from the cache of recently sent ones
+                    CSharedNetMsg msgBlock;
+                    if (!GetBlockMessage(msgBlock, (*mi).second))
                         assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                        pfrom->PushSharedMessage(msgBlock);
                     else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!GetBlockFromMessage(block, msgBlock))
+                            assert(!"cannot deserialize block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -5765,9 +6688,9 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSharedNetMsg>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushSharedMessage((*mi).second);
                         pushed = true;
                     }
                 }
@@ -5775,10 +6698,9 @@ void static ProcessGetData(CNode* pfrom)
                 if (!pushed && inv.type == MSG_TX) {
                     CTransaction tx;
                     if (mempool.lookup(inv.hash, tx)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << tx;
-                        pfrom->PushMessage("tx", ss);
+                        CSharedNetMsg msg = MakeNetMessage("tx", tx);
+                        AddRelayMessage(inv, msg);
+                        pfrom->PushSharedMessage(msg);
                         pushed = true;
                     }
                 }
@@ -5821,10 +6743,10 @@ void static ProcessGetData(CNode* pfrom)
 
                 if (!pushed && inv.type == MSG_MASTERNODE_ANNOUNCE) {
                     if (mnodeman.mapSeenMasternodeBroadcast.count(inv.hash)) {
-                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-                        ss.reserve(1000);
-                        ss << mnodeman.mapSeenMasternodeBroadcast[inv.hash];
-                        pfrom->PushMessage("mnb", ss);
+                        // Every peer we relayed it to will ask for it, so serialize it only once
+                        CSharedNetMsg msg = MakeNetMessage("mnb", mnodeman.mapSeenMasternodeBroadcast[inv.hash]);
+                        AddRelayMessage(inv, msg);
+                        pfrom->PushSharedMessage(msg);
                         pushed = true;
                     }
                 }
@@ -6117,9 +7039,15 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             if (inv.type == MSG_BLOCK) {
                 UpdateBlockAvailability(pfrom->GetId(), inv.hash);
                 if (!fAlreadyHave && !fImporting && !fReindex && !mapBlocksInFlight.count(inv.hash)) {
-                    // Add this to the list of blocks to request
-                    vToFetch.push_back(inv);
-                    LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    if (IsHeadersFirstPeer(pfrom)) {
+                        // Get the headers up to it first; the block download picks it up from there.
+                        pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), inv.hash);
+                        LogPrint("net", "getheaders (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    } else {
+                        // Add this to the list of blocks to request
+                        vToFetch.push_back(inv);
+                        LogPrint("net", "getblocks (%d) %s to peer=%d\n", pindexBestHeader->nHeight, inv.hash.ToString(), pfrom->id);
+                    }
                 }
             }
 
@@ -6156,7 +7084,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "getblocks" || strCommand == "getheaders") {
+    else if (strCommand == "getblocks" || (strCommand == "getheaders" && !IsHeadersFirstPeer(pfrom))) {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -6188,7 +7116,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     }
 
 
-    else if (strCommand == "headers" && Params().HeadersFirstSyncingActive()) {
+    else if (strCommand == "getheaders") {
         CBlockLocator locator;
         uint256 hashStop;
         vRecv >> locator >> hashStop;
@@ -6406,7 +7334,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // Nothing interesting. Stop asking this peer for more headers.
             return true;
         }
+        CNodeState* nodestate = State(pfrom->GetId());
+        nodestate->fHeadersPaused = false;
         CBlockIndex* pindexLast = NULL;
+        bool fStopped = false;
         BOOST_FOREACH (const CBlockHeader& header, headers) {
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
@@ -6414,10 +7345,31 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 return error("non-continuous headers sequence");
             }
 
-            /*TODO: this has a CBlock cast on it so that it will compile. There should be a solution for this
-             * before headers are reimplemented on mainnet
-             */
-            if (!AcceptBlockHeader((CBlock)header, state, &pindexLast)) {
+            // A new header has its stake checked only once its block arrives, so it has to extend the
+            // active or the best header chain, not too far ahead, and a peer only gets a few forks open.
+            bool fNewFork = false;
+            BlockMap::iterator miPrev = mapBlockIndex.find(header.hashPrevBlock);
+            if (!mapBlockIndex.count(header.GetHash()) && miPrev != mapBlockIndex.end()) {
+                CBlockIndex* pindexPrev = miPrev->second;
+                if (pindexPrev->nHeight >= chainActive.Height() + (int)MAX_HEADERS_LOOKAHEAD) {
+                    // The rest is asked for again once the blocks caught up.
+                    nodestate->fHeadersPaused = true;
+                    fStopped = true;
+                    break;
+                }
+                if (pindexPrev != pindexLast && !chainActive.Contains(pindexPrev) && pindexBestHeader->GetAncestor(pindexPrev->nHeight) != pindexPrev) {
+                    LogPrint("net", "ignoring headers from %s extending neither the active nor the best header chain, peer=%d\n", header.GetHash().ToString(), pfrom->id);
+                    fStopped = true;
+                    break;
+                }
+                fNewFork = pindexPrev != pindexLast && pindexPrev != chainActive.Tip() && pindexPrev != pindexBestHeader;
+                if (fNewFork && !CanStartHeaderFork(nodestate)) {
+                    Misbehaving(pfrom->GetId(), 20);
+                    return error("too many header forks from peer=%d", pfrom->id);
+                }
+            }
+
+            if (!AcceptBlockHeader(CBlock(header), state, &pindexLast, true)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6425,13 +7377,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     std::string strError = "invalid header received " + header.GetHash().ToString();
                     return error(strError.c_str());
                 }
-            }
+            } else if (fNewFork)
+                nodestate->vHeaderForks.push_back(pindexLast);
         }
 
         if (pindexLast)
             UpdateBlockAvailability(pfrom->GetId(), pindexLast->GetBlockHash());
 
-        if (nCount == MAX_HEADERS_RESULTS && pindexLast) {
+        if (nCount == MAX_HEADERS_RESULTS && pindexLast && !fStopped) {
             // Headers message had its maximum size; the peer may have more headers.
             // TODO: optimize: if pindexLast is an ancestor of chainActive.Tip or pindexBestHeader, continue
             // from there instead.
@@ -6452,7 +7405,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         //sometimes we will be sent their most recent block and its not the one we want, in that case tell where we are
         if (!mapBlockIndex.count(block.hashPrevBlock)) {
-            if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
+            if (IsHeadersFirstPeer(pfrom)) {
+                LOCK(cs_main);
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), hashBlock);
+            } else if (find(pfrom->vBlockRequested.begin(), pfrom->vBlockRequested.end(), hashBlock) != pfrom->vBlockRequested.end()) {
                 //we already asked for this block, so lets work backwards and ask for the previous block
                 pfrom->PushMessage("getblocks", chainActive.GetLocator(), block.hashPrevBlock);
                 pfrom->vBlockRequested.push_back(block.hashPrevBlock);
@@ -6467,9 +7423,42 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             pfrom->AddInventoryKnown(inv);
 
             CValidationState state;
-            if (!mapBlockIndex.count(block.GetHash()))
+            bool fProcess, fPending = false;
+            {
+                LOCK(cs_main);
+                BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+                // Headers that came first are in the index already, but still need their block
+                fProcess = mi == mapBlockIndex.end() || !(mi->second->nStatus & BLOCK_HAVE_DATA);
+                if (fProcess && !(mapBlockIndex[block.hashPrevBlock]->nStatus & BLOCK_HAVE_DATA)) {
+                    // Arrived before its parent. Blocks are accepted in order, so it waits for that one, if we
+                    // asked this peer for it and it passes the checks that don't need its parent.
+                    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hashBlock);
+                    CBlockIndex* pindex = NULL;
+                    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != pfrom->GetId())
+                        LogPrint("net", "ignoring unrequested block %s before its parent, peer=%d\n", hashBlock.ToString(), pfrom->id);
+                    else if (!CheckBlock(block, state, true, true, true, false))
+                        MarkBlockAsReceived(hashBlock);
+                    else if (!block.CheckBlockSignature()) {
+                        MarkBlockAsReceived(hashBlock);
+                        state.DoS(100, error("%s : bad proof-of-stake block signature", __func__), REJECT_INVALID, "bad-blk-sig");
+                    } else if (AcceptBlockHeader(block, state, &pindex, true)) {
+                        MarkBlockAsReceived(hashBlock);
+                        pendingBlocks.Add(pindex, block, pfrom->GetId(), GetTime());
+                    }
+                    fPending = true;
+                }
+            }
+            if (fPending) {
+                int nDoS;
+                if (state.IsInvalid(nDoS) && nDoS > 0) {
+                    LOCK(cs_main);
+                    Misbehaving(pfrom->GetId(), nDoS);
+                }
+            }
+            else if (fProcess)
 			{
                 ProcessNewBlock(state, pfrom, &block);
+                ProcessPendingBlocks(hashBlock);
                 int nDoS;
                 if(state.IsInvalid(nDoS)) {
 					LogPrint("masternode", "Rejected a block: %s peer=%d\n", state.GetRejectReason(), pfrom->id);
@@ -6945,13 +7934,23 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             if (nSyncStarted == 0 || pindexBestHeader->GetBlockTime() > GetAdjustedTime() - 6 * 60 * 60) { // NOTE: was "close to today" and 24h in Bitcoin
                 state.fSyncStarted = true;
                 nSyncStarted++;
-                //CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
-                //LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
-                //pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
-                pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
+                if (IsHeadersFirstPeer(pto)) {
+                    CBlockIndex *pindexStart = pindexBestHeader->pprev ? pindexBestHeader->pprev : pindexBestHeader;
+                    LogPrint("net", "initial getheaders (%d) to peer=%d (startheight:%d)\n", pindexStart->nHeight, pto->id, pto->nStartingHeight);
+                    pto->PushMessage("getheaders", chainActive.GetLocator(pindexStart), uint256(0));
+                } else
+                    pto->PushMessage("getblocks", chainActive.GetLocator(chainActive.Tip()), uint256(0));
             }
         }
 
+        // Headers that stopped at the lookahead are asked for again once the blocks caught up
+        if (state.fHeadersPaused && state.pindexBestKnownBlock &&
+            state.pindexBestKnownBlock->nHeight < chainActive.Height() + (int)MAX_HEADERS_LOOKAHEAD / 2) {
+            state.fHeadersPaused = false;
+            LogPrint("net", "resume getheaders (%d) to peer=%d\n", state.pindexBestKnownBlock->nHeight, pto->id);
+            pto->PushMessage("getheaders", chainActive.GetLocator(state.pindexBestKnownBlock), uint256(0));
+        }
+
         // Resend wallet transactions that haven't gotten in a block yet
         // Except during reindex, importing and IBD, when old wallet
         // transactions become unconfirmed and spams other nodes.
@@ -7004,10 +8003,11 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 
         // Detect whether we're stalling
         int64_t nNow = GetTimeMicros();
-        if (!pto->fDisconnect && state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+        if (!pto->fDisconnect && IsBlockDownloadStalled(state.nStallingSince, nNow, state.nBlocksInFlight, state.nBlockTimeAvg)) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
-            // should only happen during initial block download.
+            // should only happen during initial block download. How long we wait depends on how fast the peer
+            // has been delivering, so a slow peer can't hold up the faster ones.
             LogPrintf("Peer=%d is stalling block download, disconnecting\n", pto->id);
             pto->fDisconnect = true;
         }
@@ -7025,10 +8025,11 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nBlocksInFlightLimit = GetBlocksInFlightLimit(state.nBlockTimeAvg);
+        if (!pto->fDisconnect && !pto->fClient && fFetch && state.nBlocksInFlight < nBlocksInFlightLimit) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            FindNextBlocksToDownload(pto->GetId(), nBlocksInFlightLimit - state.nBlocksInFlight, vToDownload, staller);
             BOOST_FOREACH (CBlockIndex* pindex, vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), pindex);
@@ -7095,6 +8096,30 @@ bool CBlockUndo::WriteToDisk(CDiskBlockPos& pos, const uint256& hashBlock)
 
 bool CBlockUndo::ReadFromDisk(const CDiskBlockPos& pos, const uint256& hashBlock)
 {
+    CMappedFileRef pfile;
+    const char* pbegin;
+    unsigned int nSize;
+    if (GetMappedRecord(pos, "rev", MAX_SIZE, sizeof(uint256), pfile, pbegin, nSize)) {
+        uint256 hashChecksum;
+        const char* pend;
+        try {
+            CSpanReader reader(pbegin, pbegin + nSize + sizeof(uint256), SER_DISK, CLIENT_VERSION);
+            reader >> *this;
+            pend = reader.data();
+            reader >> hashChecksum;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize error - %s", __func__, e.what());
+        }
+
+        // Verify checksum, over the bytes that were read instead of serializing them again
+        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+        hasher << hashBlock;
+        hasher.write(pbegin, pend - pbegin);
+        if (hashChecksum != hasher.GetHash())
+            return error("CBlockUndo::ReadFromDisk : Checksum mismatch");
+        return true;
+    }
+
     // Open history file to read
     CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
@@ -7132,10 +8157,8 @@ public:
     ~CMainCleanup()
     {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
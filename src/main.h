@@ -14,6 +14,8 @@
 #endif
 
 #include "amount.h"
+#include "blockcache.h"
+#include "blockfilemap.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "coins.h"
@@ -51,6 +53,8 @@ class CSporkDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
+class CSignatureBatch;
+class CZerocoinSpendCheck;
 class CValidationInterface;
 class CValidationState;
 
@@ -79,6 +83,20 @@ static const unsigned int MAX_TX_SIGOPS_CURRENT = MAX_BLOCK_SIGOPS_CURRENT / 2;
 static const unsigned int MAX_TX_SIGOPS_LEGACY = MAX_BLOCK_SIGOPS_LEGACY / 2;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 10000;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -93,18 +111,42 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
-static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 44; // was 16 in PIVX but that's annoyingly slower.
-/** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
+/** Default for -checkblockindexhashes, hashing the headers of the block index again after startup */
+static const bool DEFAULT_CHECK_BLOCK_INDEX_HASHES = true;
+/** Memory for remembering verified zerocoin spend proofs, in bytes */
+static const unsigned int ZEROCOIN_SPEND_CACHE_SIZE = 1 << 20;
+/** Number of blocks that can be requested at any given time from a single peer, before its throughput is measured. */
+static const int DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds on the number of blocks in flight from a single peer, however slow or fast it is. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 256;
+/** Seconds of a peer's measured throughput it is given requests for. */
+static const unsigned int BLOCKS_IN_TRANSIT_SECONDS = 4;
+/** Timeout in seconds during which a peer must stall block download progress before being disconnected.
+ *  Peers with many blocks in flight get as long as they take to deliver those, up to the maximum. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
+static const unsigned int MAX_BLOCK_STALLING_TIMEOUT = 16;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached their tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
- *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
+ *  harder). The window grows with the combined throughput of all peers, from BLOCK_DOWNLOAD_WINDOW
+ *  up to MAX_BLOCK_DOWNLOAD_WINDOW, to cover BLOCK_DOWNLOAD_WINDOW_SECONDS of downloading. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+static const unsigned int MAX_BLOCK_DOWNLOAD_WINDOW = 8192;
+static const unsigned int BLOCK_DOWNLOAD_WINDOW_SECONDS = 30;
+/** How far ahead of the active chain new headers are taken. A proof of stake header can't be checked
+ *  without its block, so headers only run as far ahead as the block download can follow. */
+static const unsigned int MAX_HEADERS_LOOKAHEAD = 2 * MAX_BLOCK_DOWNLOAD_WINDOW;
+/** Number of forks of headers without blocks a peer may have open at a time. */
+static const unsigned int MAX_HEADER_FORKS_PER_PEER = 8;
+/** Memory for blocks that arrived before their parent, in bytes. Blocks are accepted in order,
+ *  so these wait until the blocks before them are in. */
+static const unsigned int MAX_PENDING_BLOCKS_SIZE = 32 * 1000 * 1000;
+/** Seconds a block waits for its parent before it is dropped, and downloaded again later if still needed. */
+static const unsigned int PENDING_BLOCK_EXPIRY = 20 * 60;
 /** Time to wait (in seconds) between writing blockchain state to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 3600;
 /** Maximum length of reject messages. */
@@ -112,6 +154,9 @@ static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 static const bool DEFAULT_ADDRESSINDEX = false;
 static const bool DEFAULT_TIMESTAMPINDEX = false;
 static const bool DEFAULT_SPENTINDEX = false;
+static const bool DEFAULT_SNAPSHOTINDEX = true;
+/** First block of the airdrop snapshot range; the range ends at the zerocoin start height */
+static const int SNAPSHOT_FIRST_HEIGHT = 102;
 
 /** Enable bloom filter */
  static const bool DEFAULT_PEERBLOOMFILTERS = true;
@@ -140,10 +185,14 @@ struct BlockHasher {
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
+extern CBlockMessageCache blockMessageCache;
+extern CBlockFileMap blockFileMap;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
+extern int64_t nLastBlockAssemblyTime;
+extern bool fLastBlockTemplateReused;
 extern const std::string strMessageMagic;
 extern int64_t nTimeBestReceived;
 extern CWaitableCriticalSection csBestBlock;
@@ -151,10 +200,13 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern bool fSignatureBatch;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fSnapshotIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 extern bool fVerifyingBlocks;
@@ -199,9 +251,10 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
  * @param[in]   pfrom   The node which we are receiving the block from; it is added to mapBlockSource and may be penalised if the block is invalid.
  * @param[in]   pblock  The block we want to process.
  * @param[out]  dbp     If pblock is stored to disk (or already there), this will be set to its location.
+ * @param[in]   fAlreadyChecked  pblock passed CheckBlock without fCheckStakeContext and its signature was checked.
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp = NULL);
+bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDiskBlockPos* dbp = NULL, bool fAlreadyChecked = false);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -229,8 +282,10 @@ bool ProcessMessages(CNode* pfrom);
  * @param[in]   fSendTrickle    When true send the trickled data, otherwise trickle the data until true.
  */
 bool SendMessages(CNode* pto, bool fSendTrickle);
-/** Run an instance of the script checking thread */
+/** Run an instance of the script checking thread, which also checks spend proofs and deferred signatures */
 void ThreadScriptCheck();
+/** Compare the block index hashes, which are loaded as stored, with those of the headers */
+void ThreadCheckBlockIndexHashes();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -245,6 +300,13 @@ bool GetTransaction(const uint256& hash, CTransaction& tx, uint256& hashBlock, b
 
 bool HasTX(int theFirstBlock, int theLastBlock, const string &theAddress, bool QuickScan = false);
 int ScanTX(const string& theAddress, bool QuickScan = false);
+/**
+ * Whether a snapshot address the snapshot index has first seen paid again at nHeightSeen (0 if never)
+ * still counts as unpaid. Like the HasTX scan since the fork, this leaves out the tip at nTipHeight.
+ */
+bool IsSnapshotAddressUnpaid(int nHeightSeen, int nTipHeight);
+/** Build the snapshot address index used by ScanTX in the background */
+void ThreadSnapshotIndex();
 
 /** Find the best known block, and make it the tip of the block chain */
 bool DisconnectBlocksAndReprocess(int blocks);
@@ -270,7 +332,19 @@ void FlushStateToDisk();
 
 
 /** (try to) add transaction to memory pool **/
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool* pfMissingInputs, bool fRejectInsaneFee = false);
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool* pfMissingInputs, bool fRejectInsaneFee = false, bool fOverrideMempoolLimit = false);
+
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectInsaneFee = false, bool fOverrideMempoolLimit = false);
+
+/** Expire old transactions from the pool, then evict the lowest fee rate packages until it takes at most limit bytes */
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age);
+
+/** Dump the mempool, with entry times and prioritisation deltas, to mempool.dat */
+bool DumpMempool();
+
+/** Accept the transactions of mempool.dat again, in batches that hold cs_main only briefly */
+bool LoadMempool();
 
 bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool* pfMissingInputs, bool fRejectInsaneFee = false);
 
@@ -651,9 +725,9 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
 void UpdateCoins(const CTransaction& tx, CValidationState& state, CCoinsViewCache& inputs, CTxUndo& txundo, int nHeight);
 
 /** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state);
+bool CheckTransaction(const CTransaction& tx, bool fZerocoinActive, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = NULL);
 bool CheckZerocoinMint(const uint256& txHash, const CTxOut& txout, CValidationState& state, bool fCheckOnly = false);
-bool CheckZerocoinSpend(const CTransaction tx, bool fVerifySignature, CValidationState& state);
+bool CheckZerocoinSpend(const CTransaction& tx, bool fVerifySignature, CValidationState& state, std::vector<CZerocoinSpendCheck>* pvZerocoinChecks = NULL);
 bool ContextualCheckCoinSpend(const libzerocoin::CoinSpend& spend, CBlockIndex* pindex, const uint256& txid);
 libzerocoin::CoinSpend TxInToZerocoinSpend(const CTxIn& txin);
 bool TxOutToPublicCoin(const CTxOut txout, libzerocoin::PublicCoin& pubCoin, CValidationState& state);
@@ -725,11 +799,14 @@ private:
     unsigned int nFlags;
     bool cacheStore;
     ScriptError error;
+    //! if set, signatures are deferred to this block's batch (see BatchingTransactionSignatureChecker)
+    CSignatureBatch* pbatch;
+    uint32_t nBatchOwner;
 
 public:
-    CScriptCheck() : ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+    CScriptCheck() : ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), pbatch(NULL), nBatchOwner(0) {}
     CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) : scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-                                                                                                                                ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
+                                                                                                                                ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), pbatch(NULL), nBatchOwner(0) {}
 
     bool operator()();
 
@@ -741,11 +818,45 @@ public:
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
+        std::swap(pbatch, check.pbatch);
+        std::swap(nBatchOwner, check.nBatchOwner);
     }
 
+    void SetSignatureBatch(CSignatureBatch* pbatchIn, uint32_t nBatchOwnerIn)
+    {
+        pbatch = pbatchIn;
+        nBatchOwner = nBatchOwnerIn;
+    }
+
+    unsigned int GetInputIndex() const { return nIn; }
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the proof verification of one zerocoin spend
+ * Note that this stores a reference to the spending input
+ */
+class CZerocoinSpendCheck
+{
+private:
+    const CTxIn* ptxin;
+    CBigNum bnAccumulatorValue;
+    uint256 hashEntry;
+
+public:
+    CZerocoinSpendCheck() : ptxin(0) {}
+    CZerocoinSpendCheck(const CTxIn& txinIn, const CBigNum& bnAccumulatorValueIn, const uint256& hashEntryIn) : ptxin(&txinIn), bnAccumulatorValue(bnAccumulatorValueIn), hashEntry(hashEntryIn) {}
+
+    bool operator()();
+
+    void swap(CZerocoinSpendCheck& check)
+    {
+        std::swap(ptxin, check.ptxin);
+        BN_swap(&bnAccumulatorValue, &check.bnAccumulatorValue);
+        std::swap(hashEntry, check.hashEntry);
+    }
+};
+
 bool GetTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &hashes);
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(uint160 addressHash, int type,
@@ -758,6 +869,10 @@ bool GetAddressUnspent(uint160 addressHash, int type,
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read a block's bytes as they are stored, without deserializing them */
+bool ReadRawBlockFromDisk(CDataStream& ssBlock, const CDiskBlockPos& pos);
+/** A block with data as the "block" network message, from blockMessageCache or else from disk */
+bool GetBlockMessage(CSharedNetMsg& msg, const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -776,8 +891,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
-bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
+bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true, bool fCheckStakeContext = true);
 bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev);
+/** The part of CheckWork that a header allows on its own; the stake kernel is checked with the block */
+bool CheckBlockHeaderWork(const CBlockHeader& block, CValidationState& state, CBlockIndex* const pindexPrev);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex* pindexPrev);
@@ -788,7 +905,7 @@ bool TestBlockValidity(CValidationState& state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is provided, the file is known to already reside on disk */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** pindex, CDiskBlockPos* dbp = NULL, bool fAlreadyCheckedBlock = false);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex = NULL);
+bool AcceptBlockHeader(const CBlock& block, CValidationState& state, CBlockIndex** ppindex = NULL, bool fCheckWork = false);
 
 
 class CBlockFileInfo
@@ -17,6 +17,7 @@
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "timedata.h"
+#include "txmempool.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #ifdef ENABLE_WALLET
@@ -28,7 +29,6 @@
 #include "spork.h"
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 unsigned int LastHashedBlockHeight = 0, LastHashedBlockTime = 0;
@@ -38,52 +38,190 @@ unsigned int LastHashedBlockHeight = 0, LastHashedBlockTime = 0;
 // Bitcoin2Miner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+int64_t nLastBlockAssemblyTime = 0;
+bool fLastBlockTemplateReused = false;
+
+static CBlockTemplateSelection lastSelection; // protected by cs_main
+
+/** Heap order of transactions whose parents are all in the block, best fee rate on top */
+class CompareTxIterByMiningScore
 {
 public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
     {
+        return CompareTxMemPoolEntryByScore()(*b, *a);
     }
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+/** Add a mempool transaction to the selection if it fits and is valid on top of view, which it updates */
+static bool AddToSelection(const CTxMemPoolEntry& entry, CBlockTemplateSelection& selection, CCoinsViewCache& view, std::vector<CBigNum>& vBlockSerials, int nHeight, bool fPrintPriority)
 {
-    bool byFee;
+    const CTransaction& tx = entry.GetTx();
+    if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
+        return false;
+    if (GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins())
+        return false;
+
+    // Size limits
+    unsigned int nTxSize = entry.GetTxSize();
+    if (selection.nBlockSize + nTxSize >= selection.nBlockMaxSize)
+        return false;
+
+    // Legacy limits on sigOps:
+    unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
+    unsigned int nTxSigOps = GetLegacySigOpCount(tx);
+    if (selection.nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+        return false;
+
+    // Skip free and too low fee transactions
+    CFeeRate ActualMinRelayTxFee(MINRELAYFEE - 1); // -1 to help mitigate rounding errors.
+    CFeeRate feeRate(entry.GetModifiedFee(), nTxSize);
+    if (!tx.HasZerocoinSpendInputs() && (feeRate < ActualMinRelayTxFee))
+        return false;
+
+    if (!view.HaveInputs(tx))
+        return false;
+
+    // double check that there are no double spent zBTC2 spends in this block or tx
+    vector<CBigNum> vTxSerials;
+    if (tx.HasZerocoinSpendInputs()) {
+        int nHeightTx = 0;
+        if (IsTransactionInChain(tx.GetHash(), nHeightTx))
+            return false;
+
+        for (const CTxIn txIn : tx.vin) {
+            if (txIn.IsZerocoinSpend()) {
+                libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
+                if (!spend.HasValidSerial(Params().Zerocoin_Params()))
+                    return false;
+                if (count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()))
+                    return false;
+                if (count(vTxSerials.begin(), vTxSerials.end(), spend.getCoinSerialNumber()))
+                    return false;
+                vTxSerials.emplace_back(spend.getCoinSerialNumber());
+            }
+        }
+    }
 
-public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) {}
+    CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
-    {
-        if (byFee) {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
+    nTxSigOps += GetP2SHSigOpCount(tx, view);
+    if (selection.nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
+        return false;
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, NULL, Params().Zerocoin_StartHeight()))
+        return false;
+
+    CTxUndo txundo;
+    UpdateCoins(tx, state, view, txundo, nHeight);
+
+    // Added
+    selection.vtx.push_back(tx);
+    selection.vTxFees.push_back(nTxFees);
+    selection.vTxSigOps.push_back(nTxSigOps);
+    selection.nBlockSize += nTxSize;
+    selection.nBlockSigOps += nTxSigOps;
+    selection.nFees += nTxFees;
+
+    for (const CBigNum bnSerial : vTxSerials)
+        vBlockSerials.emplace_back(bnSerial);
+
+    if (fPrintPriority) {
+        LogPrintf("priority %.1f fee %s txid %s\n",
+            entry.GetPriority(nHeight), feeRate.ToString(), tx.GetHash().ToString());
+    }
+    return true;
+}
+
+void SelectTransactions(CBlockTemplateSelection& selection, const CBlockIndex* pindexPrev, unsigned int nBlockMaxSize)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+    int nHeight = pindexPrev->nHeight + 1;
+
+    selection = CBlockTemplateSelection();
+    selection.pindexPrev = pindexPrev;
+    selection.nTransactionsUpdated = mempool.GetTransactionsUpdated();
+    selection.nBlockMaxSize = nBlockMaxSize;
+    selection.nTime = GetTime();
+    selection.nBlockSize = 1000;
+    selection.nBlockSigOps = 100;
+
+    CCoinsViewCache view(pcoinsTip);
+    bool fPrintPriority = GetBoolArg("-printpriority", false);
+    vector<CBigNum> vBlockSerials;
+
+    CTxMemPool::setEntries setInBlock;
+    CTxMemPool::setEntries setSkipped;
+    std::map<CTxMemPool::txiter, size_t, CTxMemPool::CompareIteratorByHash> mapMissingParents;
+    std::vector<CTxMemPool::txiter> vReady;
+    CompareTxIterByMiningScore readyCompare;
+    CompareTxMemPoolEntryByScore scoreCompare;
+
+    indexed_transaction_set::index<mining_score>::type::iterator mi = mempool.mapTx.get<mining_score>().begin();
+    while (mi != mempool.mapTx.get<mining_score>().end() || !vReady.empty()) {
+        // Take the better of the next transaction by fee rate and the best
+        // of those whose parents have all been added
+        CTxMemPool::txiter iter;
+        if (!vReady.empty() && (mi == mempool.mapTx.get<mining_score>().end() || scoreCompare(*vReady.front(), *mi))) {
+            std::pop_heap(vReady.begin(), vReady.end(), readyCompare);
+            iter = vReady.back();
+            vReady.pop_back();
         } else {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+            iter = mempool.mapTx.project<0>(mi);
+            ++mi;
+
+            size_t nMissing = 0;
+            bool fParentSkipped = false;
+            BOOST_FOREACH (const CTxMemPool::txiter& parent, mempool.GetMemPoolParents(iter)) {
+                if (setSkipped.count(parent))
+                    fParentSkipped = true;
+                else if (!setInBlock.count(parent))
+                    nMissing++;
+            }
+            if (fParentSkipped) {
+                setSkipped.insert(iter);
+                continue;
+            }
+            if (nMissing > 0) {
+                // Has to wait for dependencies
+                mapMissingParents[iter] = nMissing;
+                continue;
+            }
+        }
+
+        if (!AddToSelection(*iter, selection, view, vBlockSerials, nHeight, fPrintPriority)) {
+            setSkipped.insert(iter);
+            continue;
+        }
+        setInBlock.insert(iter);
+
+        // Transactions that depend on this one may now be added
+        BOOST_FOREACH (const CTxMemPool::txiter& child, mempool.GetMemPoolChildren(iter)) {
+            std::map<CTxMemPool::txiter, size_t, CTxMemPool::CompareIteratorByHash>::iterator it = mapMissingParents.find(child);
+            if (it != mapMissingParents.end() && --it->second == 0) {
+                mapMissingParents.erase(it);
+                vReady.push_back(child);
+                std::push_heap(vReady.begin(), vReady.end(), readyCompare);
+            }
         }
     }
-};
+}
+
+bool IsSelectionCurrent(const CBlockTemplateSelection& selection, const CBlockIndex* pindexPrev, unsigned int nBlockMaxSize)
+{
+    AssertLockHeld(mempool.cs);
+    return selection.pindexPrev == pindexPrev &&
+           selection.nTransactionsUpdated == mempool.GetTransactionsUpdated() &&
+           selection.nBlockMaxSize == nBlockMaxSize &&
+           GetTime() - selection.nTime < BLOCK_TEMPLATE_REUSE_SECONDS;
+}
 
 void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev)
 {
@@ -171,210 +309,24 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
 			return NULL;
 		}
 
-		// Collect memory pool transactions into the block
-        CCoinsViewCache view(pcoinsTip);
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-		CFeeRate ActualMinRelayTxFee(MINRELAYFEE - 1); // -1 to help mitigate rounding errors.
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
-		{
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight)){
-                continue;
-            }
-            if(GetAdjustedTime() > GetSporkValue(SPORK_16_ZEROCOIN_MAINTENANCE_MODE) && tx.ContainsZerocoins()){
-                continue;
-            }
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            bool hasZerocoinSpends = tx.HasZerocoinSpendInputs();
-            if (hasZerocoinSpends)
-                nTotalIn = tx.GetZerocoinSpent();
-            for (const CTxIn& txin : tx.vin) {
-                //zerocoinspend has special vin
-                if (hasZerocoinSpends) {
-                    nTotalIn += tx.GetZerocoinSpent();
-					break;
-                }
-
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-				dPriority += (double)nValueIn * nConf;
-
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-
-		// TODO: Remove priority calculations completely and just sort by fee.
-
-        TxPriorityCompare comparer(true); // fSortedByFee true
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        vector<CBigNum> vBlockSerials;
-        vector<CBigNum> vTxSerials;
-        while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
-
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nMaxBlockSigOps = MAX_BLOCK_SIGOPS_CURRENT;
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Skip free and too low fee transactions
-            if (!tx.HasZerocoinSpendInputs() && (feeRate < ActualMinRelayTxFee))
-                continue;
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            // double check that there are no double spent zBTC2 spends in this block or tx
-            if (tx.HasZerocoinSpendInputs()) {
-                int nHeightTx = 0;
-                if (IsTransactionInChain(tx.GetHash(), nHeightTx))
-                    continue;
-
-                bool fDoubleSerial = false;
-                for (const CTxIn txIn : tx.vin) {
-                    if (txIn.IsZerocoinSpend()) {
-                        libzerocoin::CoinSpend spend = TxInToZerocoinSpend(txIn);
-                        if (!spend.HasValidSerial(Params().Zerocoin_Params()))
-                            fDoubleSerial = true;
-                        if (count(vBlockSerials.begin(), vBlockSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (count(vTxSerials.begin(), vTxSerials.end(), spend.getCoinSerialNumber()))
-                            fDoubleSerial = true;
-                        if (fDoubleSerial)
-                            break;
-                        vTxSerials.emplace_back(spend.getCoinSerialNumber());
-                    }
-                }
-                //This zBTC2 serial has already been included in the block, do not add this tx.
-                if (fDoubleSerial)
-                    continue;
-            }
+		// Collect memory pool transactions into the block, unless those of
+		// the last template are still current
+		int64_t nTimeStart = GetTimeMicros();
+		bool fReuse = IsSelectionCurrent(lastSelection, pindexPrev, nBlockMaxSize);
+		if (!fReuse)
+			SelectTransactions(lastSelection, pindexPrev, nBlockMaxSize);
 
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+		pblock->vtx.insert(pblock->vtx.end(), lastSelection.vtx.begin(), lastSelection.vtx.end());
+		pblocktemplate->vTxFees.insert(pblocktemplate->vTxFees.end(), lastSelection.vTxFees.begin(), lastSelection.vTxFees.end());
+		pblocktemplate->vTxSigOps.insert(pblocktemplate->vTxSigOps.end(), lastSelection.vTxSigOps.begin(), lastSelection.vTxSigOps.end());
+		nFees = lastSelection.nFees;
+		uint64_t nBlockSize = lastSelection.nBlockSize;
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigOps)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, NULL, Params().Zerocoin_StartHeight()))
-                continue;
-
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            for (const CBigNum bnSerial : vTxSerials)
-                vBlockSerials.emplace_back(bnSerial);
-
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-			const uint256& hash = tx.GetHash();
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+		nLastBlockAssemblyTime = GetTimeMicros() - nTimeStart;
+		fLastBlockTemplateReused = fReuse;
+		LogPrint("bench", "CreateNewBlock(): %s %u transactions in %.2fms\n", fReuse ? "reused" : "selected", lastSelection.vtx.size(), nLastBlockAssemblyTime * 0.001);
 
-        nLastBlockTx = nBlockTx;
+        nLastBlockTx = lastSelection.vtx.size();
 		if(nLastBlockSize != nBlockSize) LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
         nLastBlockSize = nBlockSize;
 
@@ -6,7 +6,11 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include "amount.h"
+#include "primitives/transaction.h"
+
 #include <stdint.h>
+#include <vector>
 
 class CBlock;
 class CBlockHeader;
@@ -17,6 +21,39 @@ class CWallet;
 
 struct CBlockTemplate;
 
+//
+// The mempool keeps its transactions sorted by fee rate (the mining_score
+// index), so a block is filled by walking that index from the top. A
+// transaction spending another one still in the mempool waits until its
+// parent is in the block, and then competes again by its own fee rate.
+//
+// The transactions chosen are kept, and a new template on the same tip
+// takes them over unless the mempool changed in the meantime.
+//
+struct CBlockTemplateSelection {
+    const CBlockIndex* pindexPrev;
+    unsigned int nTransactionsUpdated;
+    unsigned int nBlockMaxSize;
+    int64_t nTime;
+
+    std::vector<CTransaction> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    CAmount nFees;
+    uint64_t nBlockSize;
+    int nBlockSigOps;
+
+    CBlockTemplateSelection() : pindexPrev(NULL), nTransactionsUpdated(0), nBlockMaxSize(0), nTime(0), nFees(0), nBlockSize(0), nBlockSigOps(0) {}
+};
+
+/** Choose again after this many seconds even if nothing changed, to pick up transactions that became final */
+static const int64_t BLOCK_TEMPLATE_REUSE_SECONDS = 60;
+
+/** Fill a selection with mempool transactions for a block on top of pindexPrev (requires cs_main and mempool.cs) */
+void SelectTransactions(CBlockTemplateSelection& selection, const CBlockIndex* pindexPrev, unsigned int nBlockMaxSize);
+/** Whether a selection can be used again for a block on top of pindexPrev (requires mempool.cs) */
+bool IsSelectionCurrent(const CBlockTemplateSelection& selection, const CBlockIndex* pindexPrev, unsigned int nBlockMaxSize);
+
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads);
 /** Generate a new block, without valid proof-of-work */
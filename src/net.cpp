@@ -27,6 +27,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -88,7 +92,7 @@ bool fAddressesInitialized = false;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSharedNetMsg> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -108,6 +112,21 @@ CCriticalSection cs_nLastNodeId;
 static CSemaphore* semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
 
+SocketEventsMode nSocketEventsMode = SOCKETEVENTS_SELECT;
+#ifdef HAVE_SYS_EPOLL_H
+//! The epoll instance ThreadSocketHandler waits on, with the listening sockets and those of all peers.
+static int hEpoll = -1;
+//! Most events taken from the kernel at a time; more are left for the next round.
+static const int EPOLL_MAX_EVENTS = 256;
+#endif
+//! Peers with socket events not yet fully served. Only used by ThreadSocketHandler.
+static std::set<CNode*> setNodesReady;
+
+#ifndef WIN32
+/** Most queued messages SocketSendData passes to one sendmsg() call */
+static const int MAX_SEND_IOVECS = 64;
+#endif
+
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
@@ -385,6 +404,68 @@ CNode* FindNode(const CService& addr)
     return NULL;
 }
 
+std::vector<std::string> GetSocketEventsModes()
+{
+    std::vector<std::string> vModes;
+#ifdef HAVE_SYS_EPOLL_H
+    vModes.push_back("epoll");
+#endif
+    vModes.push_back("select");
+    return vModes;
+}
+
+bool SetSocketEventsMode(const std::string& strMode)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (hEpoll != -1)
+        close(hEpoll);
+    hEpoll = -1;
+#endif
+    if (strMode == "select") {
+        nSocketEventsMode = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    if (strMode == "epoll") {
+        // Created here rather than in StartNode, so connections are sized for the mode actually used
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1) {
+            LogPrintf("epoll_create1 failed: %s, using select instead\n", NetworkErrorString(errno));
+            nSocketEventsMode = SOCKETEVENTS_SELECT;
+        } else
+            nSocketEventsMode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+int GetSocketEventsMaxConnections(int nMaxConnections, int nReserved)
+{
+    // select() can't wait on more than FD_SETSIZE sockets, epoll has no such limit
+    if (nSocketEventsMode == SOCKETEVENTS_SELECT)
+        return std::max(std::min(nMaxConnections, (int)FD_SETSIZE - nReserved), 0);
+    return nMaxConnections;
+}
+
+/** Have the socket handler hear about a new peer's socket. With epoll it is edge triggered: there is
+ *  one event when the socket becomes readable or writable, which the peer keeps in fHasRecvData and
+ *  fCanSendData until it has been served. */
+static void AddSocketEvents(CNode* pnode)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (hEpoll == -1 || pnode->hSocket == INVALID_SOCKET)
+        return;
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("epoll_ctl for peer=%d failed: %s\n", pnode->id, NetworkErrorString(errno));
+        pnode->fDisconnect = true;
+    }
+#endif
+}
+
 CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMaster)
 {
     if (pszDest == NULL) {
@@ -413,7 +494,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (nSocketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -429,6 +510,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool obfuScationMa
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
         }
+        AddSocketEvents(pnode);
 
         pnode->nTimeConnected = GetTime();
         if (obfuScationMaster) pnode->fObfuScationMaster = true;
@@ -792,23 +874,57 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode* pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    // Cleared before sending, so that an event for the socket becoming writable again can't be missed
+    pnode->fCanSendData = false;
+    bool fSendBufferFull = pnode->nSendSize >= SendBufferSize();
+
+    std::deque<CSharedNetMsg>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData& data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        assert((*it)->size() > pnode->nSendOffset);
+#ifdef WIN32
+        const CSerializeData& data = **it;
+        size_t nTrying = data.size() - pnode->nSendOffset;
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nTrying, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Hand as many queued messages as we can to the kernel in one call
+        struct iovec iov[MAX_SEND_IOVECS];
+        int nIov = 0;
+        size_t nTrying = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (std::deque<CSharedNetMsg>::iterator itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOVECS; itIov++) {
+            const CSerializeData& data = **itIov;
+            iov[nIov].iov_base = (void*)&data[nOffset];
+            iov[nIov].iov_len = data.size() - nOffset;
+            nTrying += iov[nIov].iov_len;
+            nOffset = 0;
+            nIov++;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            // Step over the messages that were sent completely
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRemaining = (*it)->size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nTrying) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -830,10 +946,373 @@ void SocketSendData(CNode* pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+
+    // The message handler stops serving a peer while its send buffer is full
+    if (fSendBufferFull && pnode->nSendSize < SendBufferSize())
+        messageHandlerCondition.notify_one();
 }
 
 static list<CNode*> vNodesDisconnected;
 
+/** Accept a connection waiting on a listening socket, if there is one */
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (nSocketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+        AddSocketEvents(pnode);
+    }
+}
+
+/** Read what a peer sent, up to 64K. Returns whether anything was read. Requires pnode->cs_vRecvMsg. */
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0) {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return true;
+    } else if (nBytes == 0) {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    } else if (nBytes < 0) {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return false;
+}
+
+/** Whether a peer's receive buffer is full, with a message waiting for the message handler. Requires pnode->cs_vRecvMsg. */
+static bool IsRecvFlooded(CNode* pnode)
+{
+    return !pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() && pnode->GetTotalRecvSize() > ReceiveFloodSize();
+}
+
+/** Disconnect peers that don't talk to us, or don't listen */
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60) {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+/** One round of the socket handler with select(): wait for any socket, then go over all of them */
+static void SocketEventsSelect()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes) {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is no (complete) message in the receive buffer,
+            //   or there is space left in the buffer, select() for receiving data.
+            // * (if neither of the above applies, there is certainly one message
+            //   in the receiver buffer ready to be processed).
+            // Together, that means that at least one of the following is always possible,
+            // so we don't deadlock:
+            // * We send some data.
+            // * We wait for data to be received (and disconnect after timeout).
+            // * We process a message in the buffer (message handler thread).
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (lockSend && !pnode->vSendMsg.empty()) {
+                    FD_SET(pnode->hSocket, &fdsetSend);
+                    continue;
+                }
+            }
+            {
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv && !IsRecvFlooded(pnode))
+                    FD_SET(pnode->hSocket, &fdsetRecv);
+            }
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+        &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(timeout.tv_usec / 1000);
+    }
+
+    //
+    // Accept new connections
+    //
+    BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            AcceptConnection(hListenSocket);
+    }
+
+    //
+    // Service each socket
+    //
+    vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        BOOST_FOREACH (CNode* pnode, vNodesCopy)
+            pnode->AddRef();
+    }
+    BOOST_FOREACH (CNode* pnode, vNodesCopy) {
+        boost::this_thread::interruption_point();
+
+        //
+        // Receive
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+                SocketRecvData(pnode);
+        }
+
+        //
+        // Send
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend)
+                SocketSendData(pnode);
+        }
+
+        //
+        // Inactivity checking
+        //
+        InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodesCopy)
+            pnode->Release();
+    }
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/**
+ * One round of the socket handler with epoll: wait for events, and serve only the peers they are for.
+ * Peer sockets are edge triggered, so a peer is kept in setNodesReady until its socket has been read
+ * dry, or its send queue emptied, as there will be no new event for what is already there.
+ */
+static void SocketEventsEpoll()
+{
+    static int64_t nLastInactivityCheck = 0;
+    static bool fMore = false;
+
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    // Don't wait if some peer may have more to read right away
+    int nEvents = epoll_wait(hEpoll, events, EPOLL_MAX_EVENTS, fMore ? 0 : 50);
+    boost::this_thread::interruption_point();
+
+    if (nEvents < 0) {
+        if (errno != EINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(50);
+        }
+        nEvents = 0;
+    }
+
+    bool fAccept = false;
+    for (int i = 0; i < nEvents; i++) {
+        CNode* pnode = (CNode*)events[i].data.ptr;
+        if (pnode == NULL) {
+            // A listening socket
+            fAccept = true;
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            pnode->fHasRecvData = true;
+        if (events[i].events & EPOLLOUT)
+            pnode->fCanSendData = true;
+        setNodesReady.insert(pnode);
+    }
+
+    //
+    // Accept new connections
+    //
+    if (fAccept) {
+        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+            if (hListenSocket.socket != INVALID_SOCKET)
+                AcceptConnection(hListenSocket);
+        }
+    }
+
+    //
+    // Service the sockets that are ready
+    //
+    vector<CNode*> vNodesReady;
+    {
+        LOCK(cs_vNodes);
+        vNodesReady.assign(setNodesReady.begin(), setNodesReady.end());
+        BOOST_FOREACH (CNode* pnode, vNodesReady)
+            pnode->AddRef();
+    }
+    fMore = false;
+    BOOST_FOREACH (CNode* pnode, vNodesReady) {
+        boost::this_thread::interruption_point();
+
+        if (pnode->hSocket == INVALID_SOCKET) {
+            setNodesReady.erase(pnode);
+            continue;
+        }
+
+        // As with select(), drain what we have to send before receiving more
+        bool fSendPending = false;
+        bool fBusy = false;
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (!lockSend) {
+                fBusy = true;
+            } else {
+                if (pnode->fCanSendData && !pnode->vSendMsg.empty())
+                    SocketSendData(pnode);
+                fSendPending = !pnode->vSendMsg.empty();
+            }
+        }
+
+        if (pnode->fHasRecvData && !fSendPending && pnode->hSocket != INVALID_SOCKET) {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (!lockRecv || IsRecvFlooded(pnode)) {
+                fBusy = true;
+            } else {
+                pnode->fHasRecvData = false;
+                if (SocketRecvData(pnode)) {
+                    // There may be more, and no new event will say so
+                    pnode->fHasRecvData = true;
+                    fMore = true;
+                }
+            }
+        }
+
+        // A peer waiting for its socket to become writable is brought back by the EPOLLOUT event
+        bool fRecvWaiting = pnode->fHasRecvData && !fSendPending && pnode->hSocket != INVALID_SOCKET;
+        bool fSendWaiting = fSendPending && pnode->fCanSendData;
+        if (!fBusy && !fRecvWaiting && !fSendWaiting)
+            setNodesReady.erase(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodesReady)
+            pnode->Release();
+    }
+
+    //
+    // Inactivity checking, which needs no event to happen
+    //
+    if (GetTime() != nLastInactivityCheck) {
+        nLastInactivityCheck = GetTime();
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            InactivityCheck(pnode);
+    }
+}
+#endif
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -884,6 +1363,7 @@ void ThreadSocketHandler()
                     }
                     if (fDelete) {
                         vNodesDisconnected.remove(pnode);
+                        setNodesReady.erase(pnode);
                         delete pnode;
                     }
                 }
@@ -899,218 +1379,13 @@ void ThreadSocketHandler()
             uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH (CNode* pnode, vNodes) {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-            &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec / 1000);
-        }
-
-        //
-        // Accept new connections
-        //
-        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
-            }
-        }
-
-        //
-        // Service each socket
-        //
-        vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH (CNode* pnode, vNodesCopy)
-                pnode->AddRef();
-        }
-        BOOST_FOREACH (CNode* pnode, vNodesCopy) {
-            boost::this_thread::interruption_point();
-
-            //
-            // Receive
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        } else if (nBytes == 0) {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        } else if (nBytes < 0) {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
-
-            //
-            // Send
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SocketSendData(pnode);
-            }
-
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60) {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0) {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL) {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                } else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90 * 60)) {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                } else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros()) {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
-            }
-        }
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH (CNode* pnode, vNodesCopy)
-                pnode->Release();
+#ifdef HAVE_SYS_EPOLL_H
+        if (nSocketEventsMode == SOCKETEVENTS_EPOLL) {
+            SocketEventsEpoll();
+            continue;
         }
+#endif
+        SocketEventsSelect();
     }
 }
 
@@ -1592,7 +1867,7 @@ bool BindListenPort(const CService& addrBind, string& strError, bool fWhiteliste
         LogPrintf("%s\n", strError);
         return false;
     }
-    if (!IsSelectableSocket(hListenSocket)) {
+    if (nSocketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hListenSocket)) {
         strError = "Error: Couldn't create a listenable socket for incoming connections";
         LogPrintf("%s\n", strError);
         return false;
@@ -1751,6 +2026,21 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Map ports with UPnP
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
 
+#ifdef HAVE_SYS_EPOLL_H
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL) {
+        // Listening sockets are level triggered, and accepted from until they have no more
+        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+            if (hListenSocket.socket == INVALID_SOCKET)
+                continue;
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = NULL;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0)
+                LogPrintf("epoll_ctl for listening socket failed: %s\n", NetworkErrorString(errno));
+        }
+    }
+#endif
+
     // Send and receive from sockets, accept connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
@@ -1810,7 +2100,13 @@ public:
             delete pnode;
         vNodes.clear();
         vNodesDisconnected.clear();
+        setNodesReady.clear();
         vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+        if (hEpoll != -1)
+            close(hEpoll);
+        hEpoll = -1;
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -1839,21 +2135,25 @@ void RelayTransaction(const CTransaction& tx)
     RelayTransaction(tx, ss);
 }
 
+void AddRelayMessage(const CInv& inv, const CSharedNetMsg& msg)
+{
+    LOCK(cs_mapRelay);
+    // Expire old relay messages
+    while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime()) {
+        mapRelay.erase(vRelayExpiration.front().second);
+        vRelayExpiration.pop_front();
+    }
+
+    if (mapRelay.insert(std::make_pair(inv, msg)).second)
+        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
+}
+
 void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 {
     CInv inv(MSG_TX, tx.GetHash());
-    {
-        LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime()) {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
-        }
+    // Save original serialized message so newer versions are preserved, and every peer asking for it gets the same bytes
+    AddRelayMessage(inv, MakeNetMessage("tx", ss));
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
-    }
     LOCK(cs_vNodes);
     BOOST_FOREACH (CNode* pnode, vNodes) {
         if (!pnode->fRelayTxes)
@@ -1869,7 +2169,7 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
 {
-    CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
+    CSharedNetMsg msg = MakeNetMessage("ix", tx);
 
     //broadcast the new lock
     LOCK(cs_vNodes);
@@ -1877,7 +2177,7 @@ void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
         if (!relayToAll && !pnode->fRelayTxes)
             continue;
 
-        pnode->PushMessage("ix", tx);
+        pnode->PushSharedMessage(msg);
     }
 }
 
@@ -2068,6 +2368,8 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fHasRecvData = false;
+    fCanSendData = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2157,6 +2459,22 @@ void CNode::AbortMessage() UNLOCK_FUNCTION(cs_vSend)
     LogPrint("net", "(aborted)\n");
 }
 
+/** Fill in the payload size and checksum of a message serialized after its header. Returns the payload size. */
+static unsigned int SetMessageSizeAndChecksum(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    memcpy((char*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+    return nSize;
+}
+
 void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
 {
     // The -*messagestest options are intentionally not documented in the help message,
@@ -2173,30 +2491,55 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     if (ssSend.size() == 0)
         return;
 
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
-
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
-
+    unsigned int nSize = SetMessageSizeAndChecksum(ssSend);
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    CSerializeData* pdata = new CSerializeData();
+    ssSend.GetAndClear(*pdata);
+    vSendMsg.push_back(CSharedNetMsg(pdata));
+    nSendSize += pdata->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
+CSharedNetMsg MakeNetMessage(const char* pszCommand, const char* pbegin, const char* pend)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(CMessageHeader::HEADER_SIZE + (pend - pbegin));
+    ss << CMessageHeader(pszCommand, 0);
+    ss.write(pbegin, pend - pbegin);
+    SetMessageSizeAndChecksum(ss);
+
+    CSerializeData* pdata = new CSerializeData();
+    ss.GetAndClear(*pdata);
+    return CSharedNetMsg(pdata);
+}
+
+CSharedNetMsg MakeNetMessage(const char* pszCommand, const CDataStream& ssPayload)
+{
+    if (ssPayload.empty())
+        return MakeNetMessage(pszCommand, NULL, NULL);
+    return MakeNetMessage(pszCommand, &ssPayload[0], &ssPayload[0] + ssPayload.size());
+}
+
+void CNode::PushSharedMessage(const CSharedNetMsg& msg)
+{
+    LOCK(cs_vSend);
+    std::string strCommand(&(*msg)[MESSAGE_START_SIZE], CMessageHeader::COMMAND_SIZE);
+    LogPrint("net", "sending: %s (%d bytes, shared) peer=%d\n", SanitizeString(strCommand.c_str()), msg->size() - CMessageHeader::HEADER_SIZE, id);
+
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
+
+    // If write queue empty, attempt "optimistic write"
+    if (vSendMsg.size() == 1)
+        SocketSendData(this);
+}
+
 //
 // CBanDB
 //
@@ -20,6 +20,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -29,6 +30,7 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
@@ -81,6 +83,37 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode* pnode);
 
+/**
+ * A complete network message, header and checksum included. It is never changed once made, so the same
+ * bytes can be queued to any number of peers, and are freed when the last of them has sent it.
+ */
+typedef boost::shared_ptr<const CSerializeData> CSharedNetMsg;
+
+CSharedNetMsg MakeNetMessage(const char* pszCommand, const char* pbegin, const char* pend);
+CSharedNetMsg MakeNetMessage(const char* pszCommand, const CDataStream& ssPayload);
+
+template <typename T>
+CSharedNetMsg MakeNetMessage(const char* pszCommand, const T& obj)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << obj;
+    return MakeNetMessage(pszCommand, ss);
+}
+
+/** How the socket handler waits for network activity */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT, // select() over all sockets, limited to FD_SETSIZE of them
+    SOCKETEVENTS_EPOLL,  // edge triggered epoll, only sockets with news are looked at
+};
+
+/** The -socketevents modes this build supports, the default first */
+std::vector<std::string> GetSocketEventsModes();
+/** False if the mode is not supported. Epoll falls back to select if it can't be set up, so the
+ *  mode is final once this returns, and connections are to be sized after it. */
+bool SetSocketEventsMode(const std::string& strMode);
+/** Most connections the socket events mode can wait on, with nReserved other descriptors */
+int GetSocketEventsMaxConnections(int nMaxConnections, int nReserved);
+
 typedef int NodeId;
 
 // Signals for message handling
@@ -128,10 +161,11 @@ extern uint64_t nLocalServices;
 extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
+extern SocketEventsMode nSocketEventsMode;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CSharedNetMsg> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -287,7 +321,7 @@ public:
     size_t nSendSize;   // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSharedNetMsg> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -316,6 +350,9 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // Set by the socket handler when the socket has data to read or room to write, until it is served
+    std::atomic<bool> fHasRecvData;
+    std::atomic<bool> fCanSendData;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in their version message that we should not relay tx invs
@@ -482,6 +519,9 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    /** Queue a message made by MakeNetMessage, without copying it */
+    void PushSharedMessage(const CSharedNetMsg& msg);
+
     void PushVersion();
 
 
@@ -739,6 +779,8 @@ void RelayTransaction(const CTransaction& tx);
 void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll = false);
 void RelayInv(CInv& inv);
+/** Keep a message for answering getdata requests for inv during the next 15 minutes */
+void AddRelayMessage(const CInv& inv, const CSharedNetMsg& msg);
 
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
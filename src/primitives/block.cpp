@@ -6,6 +6,8 @@
 
 #include "primitives/block.h"
 
+#include "crypto/quark.h"
+#include "crypto/sha256.h"
 #include "hash.h"
 #include "script/standard.h"
 #include "script/sign.h"
@@ -21,6 +23,31 @@ uint256 CBlockHeader::GetHash() const
     return Hash(BEGIN(nVersion), END(nAccumulatorCheckpoint));
 }
 
+void GetBlockHeaderHashes(const std::vector<CBlockHeader>& vHeaders, std::vector<uint256>& vHashes)
+{
+    vHashes.resize(vHeaders.size());
+
+    // The 80 bytes HashQuark takes of each older header, and where its hash goes
+    std::vector<unsigned char> vInput;
+    std::vector<size_t> vQuark;
+    for (size_t i = 0; i < vHeaders.size(); i++) {
+        const CBlockHeader& header = vHeaders[i];
+        if (header.nVersion < 4) {
+            vInput.insert(vInput.end(), BEGIN(header.nVersion), END(header.nNonce));
+            vQuark.push_back(i);
+        } else {
+            vHashes[i] = header.GetHash();
+        }
+    }
+    if (vQuark.empty())
+        return;
+
+    std::vector<unsigned char> vOutput(32 * vQuark.size());
+    Quark80(&vOutput[0], &vInput[0], vQuark.size());
+    for (size_t i = 0; i < vQuark.size(); i++)
+        memcpy(vHashes[vQuark[i]].begin(), &vOutput[32 * i], 32);
+}
+
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
 {
     /* WARNING! If you're reading this because you're learning about crypto
@@ -66,15 +93,19 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        if (nSize % 2 == 0 && vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1]) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
+        }
+        // Adjacent pairs are contiguous 64-byte inputs, hashed several at a time
+        int nOut = vMerkleTree.size();
+        vMerkleTree.resize(nOut + (nSize + 1) / 2);
+        SHA256D64(vMerkleTree[nOut].begin(), vMerkleTree[j].begin(), nSize / 2);
+        if (nSize % 2) {
+            unsigned char pair[64];
+            memcpy(pair, vMerkleTree[j+nSize-1].begin(), 32);
+            memcpy(pair + 32, vMerkleTree[j+nSize-1].begin(), 32);
+            SHA256D64(vMerkleTree.back().begin(), pair, 1);
         }
         j += nSize;
     }
@@ -83,6 +83,10 @@ public:
     }
 };
 
+/** The hashes of many headers at once, the same as GetHash of each. The Quark
+ *  hashes of version 1 to 3 headers are computed several at a time */
+void GetBlockHeaderHashes(const std::vector<CBlockHeader>& vHeaders, std::vector<uint256>& vHashes);
+
 
 class CBlock : public CBlockHeader
 {
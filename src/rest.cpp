@@ -3,7 +3,9 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "base58.h"
 #include "chain.h"
+#include "crypto/common.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
@@ -11,11 +13,13 @@
 #include "rpcserver.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 #include <boost/dynamic_bitset.hpp>
 
 #include <univalue.h>
@@ -23,6 +27,13 @@
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const unsigned int MAX_REST_ADDRESS_ROWS = 100000; //rows of an address returned at once, the X-Next-Cursor header tells where to go on
+static const size_t REST_REPLY_PART_SIZE = 64 * 1024; //bytes of a reply gathered before they are added to the output buffer
+
+//sizes of address index entries past the address, see CAddressIndexKey and CAddressUnspentKey
+static const size_t ADDRESS_DELTA_KEY_SIZE = 45;
+static const size_t ADDRESS_DELTA_VALUE_SIZE = 8;
+static const size_t ADDRESS_UNSPENT_KEY_SIZE = 36;
 
 enum RetFormat {
     RF_UNDEF,
@@ -204,7 +215,8 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
+    // The block as a "block" message, shared with the peers asking for it at the same time
+    CSharedNetMsg msgBlock;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -215,29 +227,30 @@ static bool rest_block(HTTPRequest* req,
         if (!(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex))
+        if (!GetBlockMessage(msgBlock, pblockindex))
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
-
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
+    CSerializeData::const_iterator itBlockBegin = msgBlock->begin() + CMessageHeader::HEADER_SIZE;
 
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
+        string binaryBlock(itBlockBegin, msgBlock->end());
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        string strHex = HexStr(itBlockBegin, msgBlock->end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
     }
 
     case RF_JSON: {
+        CBlock block;
+        if (!GetBlockFromMessage(block, msgBlock))
+            return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
         UniValue objBlock = blockToJSON(block, pblockindex, showTxDetails);
         string strJSON = objBlock.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
@@ -588,6 +601,259 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+enum AddressQuery {
+    ADDRESS_DELTAS,
+    ADDRESS_UTXOS,
+    ADDRESS_MEMPOOL,
+};
+
+/**
+ * Writes the rows of an address query to the reply as they come, instead of
+ * collecting them and building one big UniValue. Binary rows are the index
+ * entries as they are stored, hex encoded for .hex; JSON rows have the fields
+ * of the matching RPC.
+ */
+class CAddressReplyWriter
+{
+private:
+    HTTPRequest* req;
+    RetFormat rf;
+    std::string strAddress;
+    std::vector<unsigned char> vchAfter;
+    int nEnd;
+    unsigned int nLimit;
+    unsigned int nRows;
+    bool fMore;
+    std::vector<unsigned char> vchLast;
+    std::string strPart;
+
+    void Append(const std::string& str)
+    {
+        strPart += str;
+        if (strPart.size() >= REST_REPLY_PART_SIZE) {
+            req->WriteReplyPart(strPart.data(), strPart.size());
+            strPart.clear();
+        }
+    }
+
+    void AppendData(const char* pch, size_t nSize)
+    {
+        if (rf == RF_HEX)
+            Append(HexStr(pch, pch + nSize));
+        else
+            Append(std::string(pch, nSize));
+    }
+
+    /** Begin a row of the index with the given key; false if the limit is reached */
+    bool BeginRow(const char* pchKey, size_t nKeySize)
+    {
+        if (nRows >= nLimit) {
+            fMore = true;
+            return false;
+        }
+        if (rf == RF_JSON && nRows > 0)
+            Append(",");
+        vchLast.assign(pchKey, pchKey + nKeySize);
+        nRows++;
+        return true;
+    }
+
+    bool IsCursor(const char* pchKey, size_t nKeySize) const
+    {
+        return nKeySize == vchAfter.size() && memcmp(pchKey, &vchAfter[0], nKeySize) == 0;
+    }
+
+public:
+    CAddressReplyWriter(HTTPRequest* reqIn, RetFormat rfIn, const std::string& strAddressIn, const std::vector<unsigned char>& vchAfterIn, int nEndIn, unsigned int nLimitIn)
+        : req(reqIn), rf(rfIn), strAddress(strAddressIn), vchAfter(vchAfterIn), nEnd(nEndIn), nLimit(nLimitIn), nRows(0), fMore(false)
+    {
+        if (rf == RF_JSON)
+            strPart = "[";
+    }
+
+    bool WriteDelta(const char* pchKey, size_t nKeySize, const char* pchValue, size_t nValueSize)
+    {
+        if (nKeySize != ADDRESS_DELTA_KEY_SIZE || nValueSize != ADDRESS_DELTA_VALUE_SIZE || IsCursor(pchKey, nKeySize))
+            return true;
+        CSpanReader reader(pchKey, pchKey + nKeySize, SER_DISK, CLIENT_VERSION);
+        int nHeight = ser_readdata32be(reader);
+        if (nEnd > 0 && nHeight > nEnd)
+            return false;
+        if (!BeginRow(pchKey, nKeySize))
+            return false;
+        if (rf != RF_JSON) {
+            AppendData(pchKey, nKeySize);
+            AppendData(pchValue, nValueSize);
+            return true;
+        }
+        unsigned int nTxIndex = ser_readdata32be(reader);
+        uint256 txhash;
+        reader >> txhash;
+        unsigned int nIndex = ser_readdata32(reader);
+        Append(strprintf("{\"satoshis\":%d,\"txid\":\"%s\",\"index\":%u,\"blockindex\":%u,\"height\":%d,\"address\":\"%s\"}",
+            (int64_t)ReadLE64((const unsigned char*)pchValue), txhash.GetHex(), nIndex, nTxIndex, nHeight, strAddress));
+        return true;
+    }
+
+    bool WriteUnspent(const char* pchKey, size_t nKeySize, const char* pchValue, size_t nValueSize)
+    {
+        if (nKeySize != ADDRESS_UNSPENT_KEY_SIZE || IsCursor(pchKey, nKeySize))
+            return true;
+        CAddressUnspentValue value;
+        if (rf == RF_JSON) {
+            try {
+                CSpanReader reader(pchValue, pchValue + nValueSize, SER_DISK, CLIENT_VERSION);
+                reader >> value;
+            } catch (const std::exception&) {
+                return true;
+            }
+        }
+        if (!BeginRow(pchKey, nKeySize))
+            return false;
+        if (rf != RF_JSON) {
+            AppendData(pchKey, nKeySize);
+            AppendData(pchValue, nValueSize);
+            return true;
+        }
+        CSpanReader reader(pchKey, pchKey + nKeySize, SER_DISK, CLIENT_VERSION);
+        uint256 txhash;
+        reader >> txhash;
+        unsigned int nIndex = ser_readdata32(reader);
+        Append(strprintf("{\"address\":\"%s\",\"txid\":\"%s\",\"outputIndex\":%u,\"script\":\"%s\",\"satoshis\":%d,\"height\":%d}",
+            strAddress, txhash.GetHex(), nIndex, HexStr(value.script.begin(), value.script.end()), value.satoshis, value.blockHeight));
+        return true;
+    }
+
+    void WriteMempoolDelta(const CMempoolAddressDeltaKey& key, const CMempoolAddressDelta& delta)
+    {
+        if (rf == RF_JSON) {
+            if (nRows++ > 0)
+                Append(",");
+            std::string strPrevout;
+            if (delta.amount < 0)
+                strPrevout = strprintf(",\"prevtxid\":\"%s\",\"prevout\":%u", delta.prevhash.GetHex(), delta.prevout);
+            Append(strprintf("{\"address\":\"%s\",\"txid\":\"%s\",\"index\":%u,\"satoshis\":%d,\"timestamp\":%d%s}",
+                strAddress, key.txhash.GetHex(), key.index, delta.amount, delta.time, strPrevout));
+            return;
+        }
+        nRows++;
+        CDataStream ssRow(SER_NETWORK, PROTOCOL_VERSION);
+        ssRow << key.txhash << (uint32_t)key.index << (unsigned char)key.spending << delta.amount << delta.time << delta.prevhash << (uint32_t)delta.prevout;
+        AppendData(&ssRow[0], ssRow.size());
+    }
+
+    /** Send the reply, telling where to go on if there are more rows than the limit */
+    void Finish()
+    {
+        if (rf == RF_JSON)
+            strPart += "]\n";
+        else if (rf == RF_HEX)
+            strPart += "\n";
+        if (fMore)
+            req->WriteHeader("X-Next-Cursor", HexStr(vchLast));
+        req->WriteHeader("Content-Type", rf == RF_JSON ? "application/json" : rf == RF_HEX ? "text/plain" : "application/octet-stream");
+        req->WriteReply(HTTP_OK, strPart);
+    }
+};
+
+/** Split the query string off strURIPart into its key=value pairs */
+static void ParseQueryString(std::string& strURIPart, std::map<std::string, std::string>& mapQuery)
+{
+    size_t nQuery = strURIPart.find('?');
+    if (nQuery == std::string::npos)
+        return;
+    vector<string> vPairs;
+    std::string strQuery = strURIPart.substr(nQuery + 1);
+    boost::split(vPairs, strQuery, boost::is_any_of("&"));
+    BOOST_FOREACH (const std::string& strPair, vPairs) {
+        size_t nEquals = strPair.find('=');
+        if (nEquals != std::string::npos)
+            mapQuery[strPair.substr(0, nEquals)] = strPair.substr(nEquals + 1);
+    }
+    strURIPart.erase(nQuery);
+}
+
+static bool rest_address(HTTPRequest* req, const std::string& strURIPart, AddressQuery query)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (!fAddressIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Address index not enabled (use -addressindex)");
+
+    std::string strPath = strURIPart;
+    std::map<std::string, std::string> mapQuery;
+    ParseQueryString(strPath, mapQuery);
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strPath);
+    if (rf == RF_UNDEF)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    CBitcoinAddress address(params[0]);
+    uint160 hashBytes;
+    int type = 0;
+    if (!address.GetIndexKey(hashBytes, type))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address: " + params[0]);
+
+    int nStart = 0;
+    int nEnd = 0;
+    int nLimit = MAX_REST_ADDRESS_ROWS;
+    std::vector<unsigned char> vchAfter;
+    if (mapQuery.count("start") && (!ParseInt32(mapQuery["start"], &nStart) || nStart < 0))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid start height: " + mapQuery["start"]);
+    if (mapQuery.count("end") && (!ParseInt32(mapQuery["end"], &nEnd) || nEnd < 0 || (nEnd > 0 && nEnd < nStart)))
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid end height: " + mapQuery["end"]);
+    if (mapQuery.count("limit") && (!ParseInt32(mapQuery["limit"], &nLimit) || nLimit < 1 || nLimit > (int)MAX_REST_ADDRESS_ROWS))
+        return RESTERR(req, HTTP_BAD_REQUEST, strprintf("Invalid limit (1 to %u): %s", MAX_REST_ADDRESS_ROWS, mapQuery["limit"]));
+    if (mapQuery.count("after")) {
+        size_t nKeySize = query == ADDRESS_DELTAS ? ADDRESS_DELTA_KEY_SIZE : ADDRESS_UNSPENT_KEY_SIZE;
+        if (query == ADDRESS_MEMPOOL || !IsHex(mapQuery["after"]) || mapQuery["after"].size() != 2 * nKeySize)
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid cursor: " + mapQuery["after"]);
+        vchAfter = ParseHex(mapQuery["after"]);
+    }
+
+    CAddressReplyWriter writer(req, rf, address.ToString(), vchAfter, nEnd, nLimit);
+    switch (query) {
+    case ADDRESS_DELTAS: {
+        std::vector<unsigned char> vchStart = vchAfter;
+        if (vchStart.empty() && nStart > 0) {
+            vchStart.resize(4);
+            WriteBE32(&vchStart[0], nStart);
+        }
+        pblocktree->ScanAddressIndex(hashBytes, type, vchStart, boost::bind(&CAddressReplyWriter::WriteDelta, &writer, _1, _2, _3, _4));
+        break;
+    }
+    case ADDRESS_UTXOS:
+        pblocktree->ScanAddressUnspentIndex(hashBytes, type, vchAfter, boost::bind(&CAddressReplyWriter::WriteUnspent, &writer, _1, _2, _3, _4));
+        break;
+    case ADDRESS_MEMPOOL: {
+        // An address has few unconfirmed entries, so they are simply copied
+        std::vector<std::pair<uint160, int> > vAddresses(1, std::make_pair(hashBytes, type));
+        std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta> > vDeltas;
+        mempool.getAddressIndex(vAddresses, vDeltas);
+        for (size_t i = 0; i < vDeltas.size(); i++)
+            writer.WriteMempoolDelta(vDeltas[i].first, vDeltas[i].second);
+        break;
+    }
+    }
+    writer.Finish();
+    return true;
+}
+
+static bool rest_address_deltas(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_address(req, strURIPart, ADDRESS_DELTAS);
+}
+
+static bool rest_address_utxos(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_address(req, strURIPart, ADDRESS_UTXOS);
+}
+
+static bool rest_address_mempool(HTTPRequest* req, const std::string& strURIPart)
+{
+    return rest_address(req, strURIPart, ADDRESS_MEMPOOL);
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -600,6 +866,9 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/address/deltas/", rest_address_deltas},
+      {"/rest/address/utxos/", rest_address_utxos},
+      {"/rest/address/mempool/", rest_address_mempool},
 };
 
 bool StartREST()
@@ -0,0 +1,91 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "script/sigbatch.h"
+
+#include "pubkey.h"
+
+#include <string.h>
+
+#include <secp256k1.h>
+
+void CSignatureBatch::Start(uint32_t nCapacityIn)
+{
+    if (vEntries.size() < nCapacityIn)
+        vEntries.resize(nCapacityIn);
+    nCapacity = nCapacityIn;
+    nEntries = 0;
+    vOwners.clear();
+}
+
+uint32_t CSignatureBatch::AddOwner(uint32_t nTx, uint32_t nIn)
+{
+    vOwners.push_back(std::make_pair(nTx, nIn));
+    return vOwners.size() - 1;
+}
+
+bool CSignatureBatch::Add(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& hash, uint32_t nOwner)
+{
+    if (vchSig.size() < 8 || vchSig.size() > MAX_BATCH_SIGNATURE_SIZE || !pubkey.IsValid())
+        return false;
+
+    // Once the batch is full the counter keeps growing, which is harmless: size() is capped
+    uint32_t nEntry = nEntries++;
+    if (nEntry >= nCapacity)
+        return false;
+
+    CSignatureBatchEntry& entry = vEntries[nEntry];
+    entry.hash = hash;
+    memcpy(entry.vchSig, &vchSig[0], vchSig.size());
+    entry.nSigSize = vchSig.size();
+    memcpy(entry.vchPubKey, pubkey.begin(), pubkey.size());
+    entry.nPubKeySize = pubkey.size();
+    entry.fValid = true;
+    entry.nOwner = nOwner;
+    return true;
+}
+
+void CSignatureBatch::Verify(uint32_t nBegin, uint32_t nEnd)
+{
+    for (uint32_t i = nBegin; i < nEnd; i++) {
+        CSignatureBatchEntry& entry = vEntries[i];
+        entry.fValid = secp256k1_ecdsa_verify(entry.hash.begin(), 32, entry.vchSig, entry.nSigSize, entry.vchPubKey, entry.nPubKeySize) == 1;
+    }
+}
+
+void CSignatureBatch::GetFailedOwners(std::vector<uint32_t>& vFailed) const
+{
+    vFailed.clear();
+    for (uint32_t i = 0; i < size(); i++) {
+        if (!vEntries[i].fValid)
+            vFailed.push_back(vEntries[i].nOwner);
+    }
+    std::sort(vFailed.begin(), vFailed.end());
+    vFailed.erase(std::unique(vFailed.begin(), vFailed.end()), vFailed.end());
+}
+
+bool BatchingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    if (IsCached(vchSig, pubkey, sighash))
+        return true;
+
+    if (pbatch->Add(vchSig, pubkey, sighash, nOwner))
+        return true;
+
+    return TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash);
+}
+
+uint32_t GetSignatureBatchChunkSize(uint32_t nEntries, int nThreads)
+{
+    // About eight ranges per thread, so threads that finish early can take more, but
+    // not so small that queue overhead shows next to the ~100us of a verification
+    uint32_t nChunk = nEntries / (8 * (uint32_t)std::max(nThreads, 1));
+    return std::max((uint32_t)8, std::min((uint32_t)128, nChunk));
+}
+
+void InitSignatureBatch()
+{
+    // The signing context is started by key.cpp; this adds the verification tables
+    secp256k1_start(SECP256K1_START_VERIFY);
+}
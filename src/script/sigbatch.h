@@ -0,0 +1,130 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SCRIPT_SIGBATCH_H
+#define BITCOIN_SCRIPT_SIGBATCH_H
+
+#include "script/sigcache.h"
+#include "uint256.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+class CPubKey;
+
+//! Default for -sigbatch
+static const bool DEFAULT_SIGNATURE_BATCH = true;
+//! Deferred signature checks a block's batch has room for per transaction input
+static const unsigned int SIGNATURE_BATCH_ENTRIES_PER_INPUT = 2;
+//! Largest strict DER signature, without the hash type byte
+static const unsigned int MAX_BATCH_SIGNATURE_SIZE = 72;
+
+/** A signature check put off until the scripts of the whole block have run */
+struct CSignatureBatchEntry {
+    uint256 hash;
+    unsigned char vchSig[MAX_BATCH_SIGNATURE_SIZE];
+    unsigned char vchPubKey[65];
+    unsigned char nSigSize;
+    unsigned char nPubKeySize;
+    //! false once verification failed; only written by the worker verifying the entry
+    bool fValid;
+    //! the script check that deferred it
+    uint32_t nOwner;
+};
+
+/**
+ * The signature checks deferred by the scripts of one block.
+ *
+ * Script check threads add entries without taking a lock; the entry storage
+ * is only ever grown, so blocks after the largest one seen allocate nothing.
+ * Start() and AddOwner() are called by the thread connecting the block, and
+ * only while no script checks are running.
+ */
+class CSignatureBatch
+{
+private:
+    std::vector<CSignatureBatchEntry> vEntries;
+    std::atomic<uint32_t> nEntries;
+    uint32_t nCapacity;
+    //! (transaction index in the block, input index) of every script check
+    std::vector<std::pair<uint32_t, uint32_t> > vOwners;
+
+public:
+    CSignatureBatch() : nEntries(0), nCapacity(0) {}
+
+    /** Empty the batch and make room for nCapacityIn entries */
+    void Start(uint32_t nCapacityIn);
+    /** Register a script check of the block; returns the owner id its entries are tagged with */
+    uint32_t AddOwner(uint32_t nTx, uint32_t nIn);
+    /** Defer the check of vchSig; false if it cannot be deferred and has to be verified now */
+    bool Add(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& hash, uint32_t nOwner);
+
+    uint32_t size() const { return std::min(nEntries.load(), nCapacity); }
+    const std::pair<uint32_t, uint32_t>& GetOwner(uint32_t nOwner) const { return vOwners[nOwner]; }
+
+    /** Verify entries [nBegin, nEnd), marking the ones that fail */
+    void Verify(uint32_t nBegin, uint32_t nEnd);
+    /** Owners of the entries that failed, in ascending order and without duplicates */
+    void GetFailedOwners(std::vector<uint32_t>& vFailed) const;
+};
+
+/** Closure verifying a range of a CSignatureBatch, for CCheckQueue */
+class CSignatureBatchCheck
+{
+private:
+    CSignatureBatch* pbatch;
+    uint32_t nBegin;
+    uint32_t nEnd;
+
+public:
+    CSignatureBatchCheck() : pbatch(NULL), nBegin(0), nEnd(0) {}
+    CSignatureBatchCheck(CSignatureBatch* pbatchIn, uint32_t nBeginIn, uint32_t nEndIn) : pbatch(pbatchIn), nBegin(nBeginIn), nEnd(nEndIn) {}
+
+    //! Failures are recorded in the batch, so the queue always carries on with the other ranges
+    bool operator()()
+    {
+        pbatch->Verify(nBegin, nEnd);
+        return true;
+    }
+
+    void swap(CSignatureBatchCheck& check)
+    {
+        std::swap(pbatch, check.pbatch);
+        std::swap(nBegin, check.nBegin);
+        std::swap(nEnd, check.nEnd);
+    }
+};
+
+/**
+ * Signature checker that takes every signature missing from the signature
+ * cache as valid and defers it to a CSignatureBatch. A script that passes this
+ * way is valid only if all of its deferred signatures verify; the caller has to
+ * run it again with a real checker otherwise.
+ *
+ * Only for scripts checked with SCRIPT_VERIFY_DERSIG: libsecp256k1 agrees with
+ * OpenSSL on strict DER signatures only. With storeIn set, cache hits are kept
+ * like in CachingTransactionSignatureChecker; deferred signatures are not added.
+ */
+class BatchingTransactionSignatureChecker : public CachingTransactionSignatureChecker
+{
+private:
+    CSignatureBatch* pbatch;
+    uint32_t nOwner;
+
+public:
+    BatchingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, CSignatureBatch* pbatchIn, uint32_t nOwnerIn, bool storeIn) : CachingTransactionSignatureChecker(txToIn, nInIn, storeIn), pbatch(pbatchIn), nOwner(nOwnerIn) {}
+
+    bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+};
+
+/** Number of entries each CSignatureBatchCheck takes, so that nEntries spread evenly over nThreads */
+uint32_t GetSignatureBatchChunkSize(uint32_t nEntries, int nThreads);
+
+/** Set up libsecp256k1 for verification; call before any batch is verified */
+void InitSignatureBatch();
+
+#endif // BITCOIN_SCRIPT_SIGBATCH_H
@@ -5,13 +5,14 @@
 
 #include "sigcache.h"
 
+#include "crypto/sha256.h"
+#include "cuckoocache.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
+#include <atomic>
 
 namespace {
 
@@ -23,68 +24,104 @@ namespace {
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    //! Entries are SHA256(nonce || nonce || signature hash || public key || signature):
+    //! a per-process salt keeps would-be DoS attackers from predicting where entries land
+    CSHA256 saltedHasher;
+    CCuckooCache setValid;
+
+    std::atomic<uint64_t> nHits;
+    std::atomic<uint64_t> nMisses;
+    std::atomic<uint64_t> nInserts;
+    size_t nBytes;
+    size_t nEntries;
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CSignatureCache() : nHits(0), nMisses(0), nInserts(0), nBytes(0), nEntries(0)
+    {
+        uint256 nonce = GetRandHash();
+        saltedHasher.Write(nonce.begin(), 32);
+        saltedHasher.Write(nonce.begin(), 32);
+    }
+
+    void ComputeEntry(uint256& entry, const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+    {
+        CSHA256(saltedHasher).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(vchSig.empty() ? NULL : &vchSig[0], vchSig.size()).Finalize(entry.begin());
+    }
+
+    void Setup(size_t nBytesIn)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        nBytes = nBytesIn;
+        nEntries = nBytes > 0 ? setValid.Setup(nBytes) : 0;
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
+    bool Get(const uint256& entry, bool fErase)
+    {
+        if (setValid.Contains(entry, fErase)) {
+            nHits++;
             return true;
+        }
+        nMisses++;
         return false;
     }
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    void Set(const uint256& entry)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
+        if (nEntries == 0)
+            return;
+        setValid.Insert(entry);
+        nInserts++;
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    void GetStats(CSignatureCacheStats& stats) const
+    {
+        stats.nBytes = nBytes;
+        stats.nEntries = nEntries;
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        stats.nInserts = nInserts;
     }
 };
 
+/* In previous versions of this code, signatureCache was a local static variable
+ * in CachingTransactionSignatureChecker::VerifySignature. It now needs to be set up
+ * with its size from InitSignatureCache() before the script check threads start. */
+CSignatureCache signatureCache;
+
+}
+
+void InitSignatureCache()
+{
+    // -maxsigcachesize is in MiB; a value of 0 disables the cache
+    int64_t nMaxCacheSize = std::max((int64_t)0, std::min(GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE), MAX_MAX_SIG_CACHE_SIZE));
+    signatureCache.Setup((size_t)nMaxCacheSize << 20);
+    LogPrintf("Using %d MiB for the signature cache\n", nMaxCacheSize);
+}
+
+void GetSignatureCacheStats(CSignatureCacheStats& stats)
+{
+    signatureCache.GetStats(stats);
+}
+
+bool CachingTransactionSignatureChecker::IsCached(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
+    return signatureCache.Get(entry, !store);
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    uint256 entry;
+    signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    // Signatures checked while connecting a block are not needed again
+    if (signatureCache.Get(entry, !store))
         return true;
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store)
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Set(entry);
     return true;
 }
@@ -12,15 +12,36 @@
 
 class CPubKey;
 
+//! Default for -maxsigcachesize, in MiB
+static const int64_t DEFAULT_MAX_SIG_CACHE_SIZE = 32;
+//! Maximum for -maxsigcachesize, in MiB; larger values are refused at startup
+static const int64_t MAX_MAX_SIG_CACHE_SIZE = 1024;
+
+struct CSignatureCacheStats {
+    size_t nBytes;
+    size_t nEntries;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+};
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
 
+protected:
+    /** Whether the signature is in the cache; a hit is dropped from the cache if this checker does not store */
+    bool IsCached(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
+
 public:
     CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
 
+/** Size the signature cache from -maxsigcachesize; call before any script is checked */
+void InitSignatureCache();
+void GetSignatureCacheStats(CSignatureCacheStats& stats);
+
 #endif // BITCOIN_SCRIPT_SIGCACHE_H
@@ -580,4 +580,52 @@ public:
     }
 };
 
+/** Deserializes from memory it does not own, such as a mapped file, without copying it first.
+ *  The memory must outlive the reader.
+ */
+class CSpanReader
+{
+private:
+    const char* pcur;
+    const char* pend;
+    int nType;
+    int nVersion;
+
+public:
+    CSpanReader(const char* pbegin, const char* pendIn, int nTypeIn, int nVersionIn) : pcur(pbegin), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    int GetType() { return nType; }
+    int GetVersion() { return nVersion; }
+
+    //! Bytes left to read
+    size_t size() const { return pend - pcur; }
+    //! Where the next read starts
+    const char* data() const { return pcur; }
+
+    CSpanReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    CSpanReader& ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore : end of data");
+        pcur += nSize;
+        return (*this);
+    }
+
+    template <typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 #endif // BITCOIN_STREAMS_H
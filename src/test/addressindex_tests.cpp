@@ -0,0 +1,95 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/common.h"
+#include "main.h"
+#include "streams.h"
+#include "txdb.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+struct RawEntry {
+    std::string strKey;
+    std::string strValue;
+};
+
+static bool CollectEntry(const char* pchKey, size_t nKeySize, const char* pchValue, size_t nValueSize, std::vector<RawEntry>& vEntries, size_t nMax)
+{
+    RawEntry entry;
+    entry.strKey.assign(pchKey, nKeySize);
+    entry.strValue.assign(pchValue, nValueSize);
+    vEntries.push_back(entry);
+    return vEntries.size() < nMax;
+}
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+BOOST_AUTO_TEST_CASE(addressindex_scan)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 hashA(1), hashB(2);
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vIndex;
+    for (int nHeight = 10; nHeight > 0; nHeight--)
+        vIndex.push_back(std::make_pair(CAddressIndexKey(1, hashA, nHeight, 1, uint256(nHeight), 0, false), nHeight * 100));
+    vIndex.push_back(std::make_pair(CAddressIndexKey(1, hashB, 5, 1, uint256(99), 0, true), -7));
+    vIndex.push_back(std::make_pair(CAddressIndexKey(2, hashA, 5, 1, uint256(98), 0, true), -8));
+    BOOST_REQUIRE(db.WriteAddressIndex(vIndex));
+
+    // Only the entries of the address, by height, as they are stored
+    std::vector<RawEntry> vEntries;
+    BOOST_CHECK(db.ScanAddressIndex(hashA, 1, std::vector<unsigned char>(), boost::bind(&CollectEntry, _1, _2, _3, _4, boost::ref(vEntries), (size_t)-1)));
+    BOOST_REQUIRE_EQUAL(vEntries.size(), 10U);
+    for (size_t i = 0; i < vEntries.size(); i++) {
+        BOOST_REQUIRE_EQUAL(vEntries[i].strKey.size(), 45U);
+        BOOST_REQUIRE_EQUAL(vEntries[i].strValue.size(), 8U);
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey << (unsigned char)1 << hashA;
+        ssKey.write(vEntries[i].strKey.data(), vEntries[i].strKey.size());
+        CAddressIndexKey key;
+        ssKey >> key;
+        BOOST_CHECK_EQUAL(key.blockHeight, (int)i + 1);
+        BOOST_CHECK(key.txhash == uint256(i + 1));
+        BOOST_CHECK_EQUAL((int64_t)ReadLE64((const unsigned char*)vEntries[i].strValue.data()), (int64_t)(i + 1) * 100);
+    }
+
+    // Starting at a height, and stopping early
+    std::vector<unsigned char> vchStart(4);
+    WriteBE32(&vchStart[0], 7);
+    vEntries.clear();
+    BOOST_CHECK(db.ScanAddressIndex(hashA, 1, vchStart, boost::bind(&CollectEntry, _1, _2, _3, _4, boost::ref(vEntries), 2)));
+    BOOST_REQUIRE_EQUAL(vEntries.size(), 2U);
+    BOOST_CHECK_EQUAL(ReadBE32((const unsigned char*)vEntries[0].strKey.data()), 7U);
+    BOOST_CHECK_EQUAL(ReadBE32((const unsigned char*)vEntries[1].strKey.data()), 8U);
+
+    // Starting at a key seen before goes on from there
+    std::vector<unsigned char> vchCursor(vEntries[1].strKey.begin(), vEntries[1].strKey.end());
+    vEntries.clear();
+    BOOST_CHECK(db.ScanAddressIndex(hashA, 1, vchCursor, boost::bind(&CollectEntry, _1, _2, _3, _4, boost::ref(vEntries), (size_t)-1)));
+    BOOST_CHECK_EQUAL(vEntries.size(), 3U);
+
+    // Nothing for an unknown address
+    vEntries.clear();
+    BOOST_CHECK(db.ScanAddressIndex(uint160(3), 1, std::vector<unsigned char>(), boost::bind(&CollectEntry, _1, _2, _3, _4, boost::ref(vEntries), (size_t)-1)));
+    BOOST_CHECK(vEntries.empty());
+
+    // Unspent outputs have a key of their outpoint
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    vUnspent.push_back(std::make_pair(CAddressUnspentKey(1, hashA, uint256(5), 3), CAddressUnspentValue(500, CScript() << OP_TRUE, 5)));
+    BOOST_REQUIRE(db.UpdateAddressUnspentIndex(vUnspent));
+    vEntries.clear();
+    BOOST_CHECK(db.ScanAddressUnspentIndex(hashA, 1, std::vector<unsigned char>(), boost::bind(&CollectEntry, _1, _2, _3, _4, boost::ref(vEntries), (size_t)-1)));
+    BOOST_REQUIRE_EQUAL(vEntries.size(), 1U);
+    BOOST_CHECK_EQUAL(vEntries[0].strKey.size(), 36U);
+    CDataStream ssValue(vEntries[0].strValue.data(), vEntries[0].strValue.data() + vEntries[0].strValue.size(), SER_DISK, CLIENT_VERSION);
+    CAddressUnspentValue value;
+    ssValue >> value;
+    BOOST_CHECK_EQUAL(value.satoshis, 500);
+    BOOST_CHECK_EQUAL(value.blockHeight, 5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
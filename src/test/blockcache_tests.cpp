@@ -0,0 +1,81 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "primitives/block.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+static CSharedNetMsg MakePaddedMessage(size_t nPayload)
+{
+    return MakeNetMessage("block", std::vector<unsigned char>(nPayload));
+}
+
+BOOST_AUTO_TEST_SUITE(blockcache_tests)
+
+BOOST_AUTO_TEST_CASE(blockcache_lru)
+{
+    // Room for three of the messages below
+    CSharedNetMsg msg = MakePaddedMessage(1000);
+    CBlockMessageCache cache(3 * msg->size() + 10);
+
+    for (unsigned int i = 1; i <= 3; i++)
+        cache.Insert(uint256(i), MakePaddedMessage(1000));
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+    BOOST_CHECK_EQUAL(cache.GetTotalBytes(), 3 * msg->size());
+
+    // Using 1 makes 2 the least recently used
+    CSharedNetMsg msgOut;
+    BOOST_CHECK(cache.Get(uint256(1), msgOut));
+    cache.Insert(uint256(4), MakePaddedMessage(1000));
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+    BOOST_CHECK(!cache.Get(uint256(2), msgOut));
+    BOOST_CHECK(cache.Get(uint256(1), msgOut));
+    BOOST_CHECK(cache.Get(uint256(3), msgOut));
+    BOOST_CHECK(cache.Get(uint256(4), msgOut));
+    BOOST_CHECK_EQUAL(cache.GetHits(), 4U);
+    BOOST_CHECK_EQUAL(cache.GetMisses(), 1U);
+
+    // A message bigger than the whole cache is not kept, and does not push others out
+    cache.Insert(uint256(5), MakePaddedMessage(10000));
+    BOOST_CHECK(!cache.Get(uint256(5), msgOut));
+    BOOST_CHECK_EQUAL(cache.size(), 3U);
+
+    // Shrinking drops the least recently used first
+    cache.SetMaxBytes(msg->size());
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+    BOOST_CHECK(cache.Get(uint256(4), msgOut));
+
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.size(), 0U);
+    BOOST_CHECK_EQUAL(cache.GetTotalBytes(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_block_from_message)
+{
+    CBlock block;
+    block.nVersion = 3;
+    block.nTime = 1234567;
+    block.nBits = 0x1e0ffff0;
+    block.nNonce = 42;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 50;
+    block.vtx.push_back(tx);
+
+    CSharedNetMsg msg = MakeNetMessage("block", block);
+    CBlock blockOut;
+    BOOST_CHECK(GetBlockFromMessage(blockOut, msg));
+    BOOST_CHECK(blockOut.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(blockOut.vtx.size(), 1U);
+    BOOST_CHECK(blockOut.vtx[0].GetHash() == block.vtx[0].GetHash());
+
+    BOOST_CHECK(!GetBlockFromMessage(blockOut, CSharedNetMsg()));
+    BOOST_CHECK(!GetBlockFromMessage(blockOut, MakePaddedMessage(0)));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
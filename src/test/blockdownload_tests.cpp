@@ -0,0 +1,152 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockdownload.h"
+#include "chain.h"
+#include "main.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+/** A block of a little over 1000 bytes */
+static CBlock MakePaddedBlock()
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(1000, 1);
+    tx.vout.resize(1);
+    CBlock block;
+    block.vtx.push_back(tx);
+    return block;
+}
+
+BOOST_AUTO_TEST_SUITE(blockdownload_tests)
+
+BOOST_AUTO_TEST_CASE(blocks_in_flight_limit)
+{
+    // Until a peer delivered a block, it gets the default
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(0), DEFAULT_BLOCKS_IN_TRANSIT_PER_PEER);
+    // then what it delivers in BLOCKS_IN_TRANSIT_SECONDS, 4s of 100ms blocks
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(100000), 40);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(10000), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetBlocksInFlightLimit(5000000), MIN_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // The average follows new samples by an eighth of the difference
+    BOOST_CHECK_EQUAL(UpdateBlockTimeAvg(0, 80000), 80000);
+    BOOST_CHECK_EQUAL(UpdateBlockTimeAvg(80000, 160000), 90000);
+    BOOST_CHECK_EQUAL(UpdateBlockTimeAvg(0, 0), 1);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_stalling)
+{
+    int64_t nNow = 1000000000;
+
+    // Nothing is stalled unless it stalls the window
+    BOOST_CHECK(!IsBlockDownloadStalled(0, nNow, 16, 100000));
+
+    // An unmeasured peer gets BLOCK_STALLING_TIMEOUT
+    BOOST_CHECK_EQUAL(GetBlockStallingTimeout(16, 0), 1000000LL * BLOCK_STALLING_TIMEOUT);
+    BOOST_CHECK(!IsBlockDownloadStalled(nNow - 1900000, nNow, 16, 0));
+    BOOST_CHECK(IsBlockDownloadStalled(nNow - 2100000, nNow, 16, 0));
+
+    // A busy peer gets twice what its queue takes: 32 blocks of 100ms in 6.4s
+    BOOST_CHECK_EQUAL(GetBlockStallingTimeout(32, 100000), 6400000);
+    BOOST_CHECK(!IsBlockDownloadStalled(nNow - 6000000, nNow, 32, 100000));
+    BOOST_CHECK(IsBlockDownloadStalled(nNow - 6500000, nNow, 32, 100000));
+
+    // but never more than MAX_BLOCK_STALLING_TIMEOUT, however slow it is
+    BOOST_CHECK_EQUAL(GetBlockStallingTimeout(256, 1000000), 1000000LL * MAX_BLOCK_STALLING_TIMEOUT);
+}
+
+BOOST_AUTO_TEST_CASE(block_download_window)
+{
+    std::vector<int64_t> vBlockTimeAvg;
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(vBlockTimeAvg), (int)BLOCK_DOWNLOAD_WINDOW);
+
+    // Peers not measured yet, or slow ones, leave the window at its minimum
+    vBlockTimeAvg.push_back(0);
+    vBlockTimeAvg.push_back(10000000);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(vBlockTimeAvg), (int)BLOCK_DOWNLOAD_WINDOW);
+
+    // 30s of two peers at 100 blocks/s each, plus the slow one's 0.1 blocks/s
+    vBlockTimeAvg.push_back(10000);
+    vBlockTimeAvg.push_back(10000);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(vBlockTimeAvg), 6003);
+
+    vBlockTimeAvg.push_back(1000);
+    BOOST_CHECK_EQUAL(GetBlockDownloadWindow(vBlockTimeAvg), (int)MAX_BLOCK_DOWNLOAD_WINDOW);
+}
+
+BOOST_AUTO_TEST_CASE(pending_blocks_children)
+{
+    // 0 <- 1 <- 2a, and 1 <- 2b
+    std::vector<CBlockIndex> vIndex(4);
+    for (unsigned int i = 1; i < vIndex.size(); i++) {
+        vIndex[i].nHeight = std::min(i, 2U);
+        vIndex[i].pprev = &vIndex[std::min(i - 1, 1U)];
+    }
+    CBlock block = MakePaddedBlock();
+    CPendingBlocks pending(1000000, 60);
+
+    BOOST_CHECK(pending.Add(&vIndex[2], block, 7, 0));
+    BOOST_CHECK(pending.Add(&vIndex[3], block, 8, 0));
+    BOOST_CHECK(!pending.Add(&vIndex[3], block, 9, 0));
+    BOOST_CHECK(pending.Contains(&vIndex[2]));
+    BOOST_CHECK_EQUAL(pending.size(), 2U);
+    BOOST_CHECK_EQUAL(pending.GetSize(), 2 * ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+
+    std::vector<CPendingBlocks::CEntry> vChildren;
+    pending.TakeChildren(&vIndex[0], vChildren);
+    BOOST_CHECK(vChildren.empty());
+
+    // Both children of 1 come out with the peer that sent them
+    pending.TakeChildren(&vIndex[1], vChildren);
+    BOOST_CHECK_EQUAL(vChildren.size(), 2U);
+    for (unsigned int i = 0; i < vChildren.size(); i++) {
+        BOOST_CHECK(vChildren[i].pindex->pprev == &vIndex[1]);
+        BOOST_CHECK_EQUAL(vChildren[i].nodeid, vChildren[i].pindex == &vIndex[2] ? 7 : 8);
+    }
+    BOOST_CHECK(!pending.Contains(&vIndex[2]));
+    BOOST_CHECK_EQUAL(pending.size(), 0U);
+    BOOST_CHECK_EQUAL(pending.GetSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(pending_blocks_full)
+{
+    std::vector<CBlockIndex> vIndex(10);
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = i > 0 ? &vIndex[i - 1] : NULL;
+    }
+    CBlock block = MakePaddedBlock();
+    size_t nBlockSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+
+    // Room for two blocks
+    CPendingBlocks pending(2 * nBlockSize, 60);
+    BOOST_CHECK(pending.Add(&vIndex[5], block, 0, 100));
+    BOOST_CHECK(!pending.IsFull());
+    BOOST_CHECK(pending.Add(&vIndex[6], block, 0, 100));
+    BOOST_CHECK(pending.IsFull());
+
+    // A block further ahead than all of them is not kept
+    BOOST_CHECK(!pending.Add(&vIndex[7], block, 0, 110));
+    BOOST_CHECK(!pending.Contains(&vIndex[7]));
+
+    // One closer takes the place of the furthest
+    BOOST_CHECK(pending.Add(&vIndex[3], block, 0, 110));
+    BOOST_CHECK(pending.Contains(&vIndex[3]));
+    BOOST_CHECK(pending.Contains(&vIndex[5]));
+    BOOST_CHECK(!pending.Contains(&vIndex[6]));
+
+    // Blocks waiting longer than the expiry give way to any block
+    BOOST_CHECK(pending.Add(&vIndex[9], block, 0, 165));
+    BOOST_CHECK(!pending.Contains(&vIndex[5]));
+    BOOST_CHECK(pending.Contains(&vIndex[3]));
+    BOOST_CHECK(pending.Contains(&vIndex[9]));
+    BOOST_CHECK_EQUAL(pending.size(), 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,174 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/** Puts blockFileMap back the way the test setup left it, however a test ends */
+struct BlockFileMapGuard {
+    int nLastFile;
+
+    BlockFileMapGuard(int nLastFileIn) : nLastFile(nLastFileIn) {}
+    ~BlockFileMapGuard()
+    {
+        blockFileMap.SetLastBlockFile(nLastFile);
+        blockFileMap.SetEnabled(false);
+    }
+};
+}
+
+BOOST_AUTO_TEST_SUITE(blockfilemap_tests)
+
+BOOST_AUTO_TEST_CASE(span_reader)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    std::vector<unsigned char> vch(300, 0x5a);
+    ss << 12345 << std::string("span") << vch << uint256(7);
+
+    CSpanReader reader(&ss[0], &ss[0] + ss.size(), SER_DISK, CLIENT_VERSION);
+    int n;
+    std::string str;
+    std::vector<unsigned char> vchOut;
+    uint256 hash;
+    reader >> n >> str >> vchOut;
+    BOOST_CHECK_EQUAL(n, 12345);
+    BOOST_CHECK_EQUAL(str, "span");
+    BOOST_CHECK(vchOut == vch);
+    BOOST_CHECK_EQUAL(reader.size(), 32U);
+    BOOST_CHECK(reader.data() == &ss[0] + ss.size() - 32);
+    reader >> hash;
+    BOOST_CHECK(hash == uint256(7));
+    BOOST_CHECK_EQUAL(reader.size(), 0U);
+
+    // Nothing is read past the end
+    BOOST_CHECK_THROW(reader >> n, std::ios_base::failure);
+    CSpanReader reader2(&ss[0], &ss[0] + 3, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_THROW(reader2 >> n, std::ios_base::failure);
+    BOOST_CHECK_THROW(reader2.ignore(4), std::ios_base::failure);
+    reader2.ignore(3);
+    BOOST_CHECK_EQUAL(reader2.size(), 0U);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(mapped_file)
+{
+    boost::filesystem::path path = GetDataDir() / "mapped_file_test.dat";
+    std::vector<char> vch(10000);
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = (char)(i * 7);
+    FILE* file = fopen(path.string().c_str(), "wb");
+    BOOST_REQUIRE(file);
+    fwrite(&vch[0], 1, vch.size(), file);
+    fclose(file);
+
+    {
+        CMappedFile mapped;
+        BOOST_CHECK(mapped.Open(path));
+        BOOST_CHECK_EQUAL(mapped.size(), vch.size());
+        BOOST_CHECK(memcmp(mapped.data(), &vch[0], vch.size()) == 0);
+        // Already open
+        BOOST_CHECK(!mapped.Open(path));
+    }
+
+    CMappedFile missing;
+    BOOST_CHECK(!missing.Open(GetDataDir() / "no_such_file.dat"));
+    BOOST_CHECK(missing.data() == NULL);
+
+    file = fopen(path.string().c_str(), "wb");
+    fclose(file);
+    CMappedFile empty;
+    BOOST_CHECK(!empty.Open(path));
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(mapped_block_read)
+{
+    CBlockIndex* pindex = chainActive.Genesis();
+    BOOST_REQUIRE(pindex);
+    CBlock blockFile;
+    BOOST_REQUIRE(ReadBlockFromDisk(blockFile, pindex));
+    CDataStream ssFile(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_REQUIRE(ReadRawBlockFromDisk(ssFile, pindex->GetBlockPos()));
+
+    // The file being written to is never mapped
+    BlockFileMapGuard guard(pindex->GetBlockPos().nFile);
+    blockFileMap.SetEnabled(true);
+    BOOST_CHECK(!blockFileMap.Get(pindex->GetBlockPos(), "blk", 0));
+
+    // Once it no longer is, blocks come from the mapping
+    blockFileMap.SetLastBlockFile(pindex->GetBlockPos().nFile + 1);
+    CMappedFileRef pfile = blockFileMap.Get(pindex->GetBlockPos(), "blk", ssFile.size());
+    BOOST_REQUIRE(pfile);
+    BOOST_CHECK(memcmp(pfile->data() + pindex->GetBlockPos().nPos, &ssFile[0], ssFile.size()) == 0);
+    BOOST_CHECK(blockFileMap.Get(pindex->GetBlockPos(), "blk", 0) == pfile);
+
+    CBlock blockMapped;
+    BOOST_CHECK(ReadBlockFromDisk(blockMapped, pindex));
+    BOOST_CHECK(blockMapped.GetHash() == blockFile.GetHash());
+    BOOST_CHECK_EQUAL(blockMapped.vtx.size(), blockFile.vtx.size());
+    CDataStream ssMapped(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(ReadRawBlockFromDisk(ssMapped, pindex->GetBlockPos()));
+    BOOST_CHECK(ssMapped.str() == ssFile.str());
+
+    // Nothing past the end of the file
+    CDiskBlockPos posEnd(pindex->GetBlockPos().nFile, pfile->size() - 10);
+    BOOST_CHECK(!blockFileMap.Get(posEnd, "blk", 11));
+
+    // Going back to writing the file drops its mapping
+    blockFileMap.SetLastBlockFile(pindex->GetBlockPos().nFile);
+    BOOST_CHECK(!blockFileMap.Get(pindex->GetBlockPos(), "blk", 0));
+}
+
+BOOST_AUTO_TEST_CASE(mapped_block_read_corrupt)
+{
+    // A block file whose records claim more bytes than a block can have, or than the file has
+    CDiskBlockPos pos(9999, MESSAGE_START_SIZE + sizeof(unsigned int));
+    boost::filesystem::path path = GetBlockPosFilename(pos, "blk");
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << FLATDATA(Params().MessageStart()) << (unsigned int)0xfffffff0;
+    ss << std::vector<unsigned char>(1000, 0x01);
+    FILE* file = fopen(path.string().c_str(), "wb");
+    BOOST_REQUIRE(file);
+    fwrite(&ss[0], 1, ss.size(), file);
+    fclose(file);
+
+    BlockFileMapGuard guard(chainActive.Genesis()->GetBlockPos().nFile);
+    blockFileMap.SetEnabled(true);
+    blockFileMap.SetLastBlockFile(pos.nFile + 1);
+    BOOST_REQUIRE(blockFileMap.Get(pos, "blk", 0));
+
+    // Each is a read error, not a read past the mapping
+    CBlock block;
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK(!ReadBlockFromDisk(block, pos));
+    BOOST_CHECK(!ReadRawBlockFromDisk(ssBlock, pos));
+
+    file = fopen(path.string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    fseek(file, MESSAGE_START_SIZE, SEEK_SET);
+    unsigned char pchSize[4] = {0x00, 0x10, 0x00, 0x00};
+    fwrite(pchSize, 1, sizeof(pchSize), file);
+    fclose(file);
+    blockFileMap.Clear();
+    BOOST_CHECK(!ReadBlockFromDisk(block, pos));
+    BOOST_CHECK(!ReadRawBlockFromDisk(ssBlock, pos));
+
+    blockFileMap.Clear();
+    boost::filesystem::remove(path);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
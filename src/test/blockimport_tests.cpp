@@ -0,0 +1,118 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockimport.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+struct ImportedBlock {
+    uint256 hash;
+    unsigned int nPos;
+    bool fChecked;
+};
+
+static bool CheckEvenNonce(const CBlock& block)
+{
+    return block.nNonce % 2 == 0;
+}
+
+static bool RecordBlock(CBlock& block, unsigned int nPos, bool fChecked, std::vector<ImportedBlock>& vImported, size_t nStopAfter)
+{
+    ImportedBlock imported;
+    imported.hash = block.GetHash();
+    imported.nPos = nPos;
+    imported.fChecked = fChecked;
+    vImported.push_back(imported);
+    return vImported.size() < nStopAfter;
+}
+
+/** Write blocks the way the block store does, with junk in between, and return them with their positions */
+static FILE* WriteBlockFile(const boost::filesystem::path& path, std::vector<ImportedBlock>& vWritten)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    for (unsigned int i = 0; i < 40; i++) {
+        // Junk, including a stray first byte of the message start
+        ss << (unsigned char)0x17 << (unsigned char)Params().MessageStart()[0] << (unsigned int)i;
+
+        CBlock block;
+        block.nVersion = 3;
+        block.nTime = 1600000000 + i;
+        block.nNonce = i;
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vout.resize(1 + i % 3);
+        block.vtx.push_back(tx);
+
+        unsigned int nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        ss << FLATDATA(Params().MessageStart()) << nSize;
+        ImportedBlock written;
+        written.hash = block.GetHash();
+        written.nPos = ss.size();
+        written.fChecked = i % 2 == 0;
+        vWritten.push_back(written);
+        ss << block;
+    }
+    // A block cut short by the end of the file is not imported
+    ss << FLATDATA(Params().MessageStart()) << (unsigned int)1000 << (unsigned int)0;
+
+    FILE* file = fopen(path.string().c_str(), "wb+");
+    BOOST_REQUIRE(file);
+    fwrite(&ss[0], 1, ss.size(), file);
+    rewind(file);
+    return file;
+}
+
+BOOST_AUTO_TEST_SUITE(blockimport_tests)
+
+BOOST_AUTO_TEST_CASE(blockimport_order)
+{
+    boost::filesystem::path path = GetDataDir() / "blockimport_test.dat";
+    std::vector<ImportedBlock> vWritten;
+    FILE* file = WriteBlockFile(path, vWritten);
+
+    // Few threads with a small window still deliver every block in file order
+    CBlockImporter importer(2);
+    std::vector<ImportedBlock> vImported;
+    BOOST_CHECK(importer.Import(file, CheckEvenNonce, boost::bind(&RecordBlock, _1, _2, _3, boost::ref(vImported), (size_t)-1)));
+    BOOST_REQUIRE_EQUAL(vImported.size(), vWritten.size());
+    for (size_t i = 0; i < vWritten.size(); i++) {
+        BOOST_CHECK(vImported[i].hash == vWritten[i].hash);
+        BOOST_CHECK_EQUAL(vImported[i].nPos, vWritten[i].nPos);
+        BOOST_CHECK_EQUAL(vImported[i].fChecked, vWritten[i].fChecked);
+    }
+    BOOST_CHECK_EQUAL(importer.GetReadStats().nBlocks, vWritten.size());
+    BOOST_CHECK_EQUAL(importer.GetCheckStats().nBlocks, vWritten.size());
+    BOOST_CHECK_EQUAL(importer.GetConnectStats().nBlocks, vWritten.size());
+    BOOST_CHECK_EQUAL(importer.GetReadStats().nBytes, importer.GetConnectStats().nBytes);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(blockimport_stop)
+{
+    boost::filesystem::path path = GetDataDir() / "blockimport_test.dat";
+    std::vector<ImportedBlock> vWritten;
+    FILE* file = WriteBlockFile(path, vWritten);
+
+    // The connect function stops the import, and nothing after it is connected
+    CBlockImporter importer(4);
+    std::vector<ImportedBlock> vImported;
+    BOOST_CHECK(!importer.Import(file, CBlockImporter::CheckFunction(), boost::bind(&RecordBlock, _1, _2, _3, boost::ref(vImported), 5)));
+    BOOST_REQUIRE_EQUAL(vImported.size(), 5U);
+    for (size_t i = 0; i < vImported.size(); i++) {
+        BOOST_CHECK(vImported[i].hash == vWritten[i].hash);
+        BOOST_CHECK(vImported[i].fChecked);
+    }
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,79 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockscanner.h"
+#include "chain.h"
+#include "main.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/** Record the height of each block processed, and move the tip back to pindexReorg at nReorgHeight */
+bool RecordBlock(const CBlock& block, CBlockIndex* pindex, std::vector<int>* pvHeights, int nReorgHeight, CBlockIndex* pindexReorg)
+{
+    BOOST_CHECK(block.GetHash() == pindex->GetBlockHash());
+    pvHeights->push_back(pindex->nHeight);
+    if (pindex->nHeight == nReorgHeight)
+        chainActive.SetTip(pindexReorg);
+    return true;
+}
+
+void CountProgress(const CBlockIndex* pindex, int* pnCalls)
+{
+    (*pnCalls)++;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(blockscanner_tests)
+
+BOOST_AUTO_TEST_CASE(blockscanner_order)
+{
+    // A chain of 40 blocks on top of the genesis block, all read from where the genesis block is
+    // stored, except block 20, whose file doesn't exist
+    CBlockIndex* pindexGenesis = chainActive.Genesis();
+    uint256 hashGenesis = pindexGenesis->GetBlockHash();
+    std::vector<CBlockIndex> vIndex(40, *pindexGenesis);
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        vIndex[i].phashBlock = &hashGenesis;
+        vIndex[i].pprev = i > 0 ? &vIndex[i - 1] : pindexGenesis;
+        vIndex[i].nHeight = i + 1;
+    }
+    vIndex[19].nFile = 9999;
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(&vIndex.back());
+    }
+
+    // Blocks come back in height order whatever order the workers read them in
+    std::vector<int> vHeights;
+    int nProgress = 0;
+    CBlockScanner scanner(4);
+    BOOST_CHECK(scanner.Scan(&vIndex[0], NULL, CBlockScanner::MatchFunction(),
+        boost::bind(&RecordBlock, _1, _2, &vHeights, -1, (CBlockIndex*)NULL), boost::bind(&CountProgress, _1, &nProgress)));
+    BOOST_CHECK_EQUAL(vHeights.size(), 39U);
+    for (unsigned int i = 0; i < vHeights.size(); i++)
+        BOOST_CHECK_EQUAL(vHeights[i], (int)(i < 19 ? i + 1 : i + 2));
+    BOOST_CHECK_EQUAL(nProgress, 40);
+    BOOST_CHECK_EQUAL(scanner.GetBlocksRead(), 40);
+    BOOST_CHECK_EQUAL(scanner.GetBlocksMatched(), 39);
+
+    // Blocks that leave the chain while the scan runs are not processed
+    vHeights.clear();
+    CBlockScanner scannerReorg(4);
+    BOOST_CHECK(scannerReorg.Scan(&vIndex[0], NULL, CBlockScanner::MatchFunction(),
+        boost::bind(&RecordBlock, _1, _2, &vHeights, 10, &vIndex[14])));
+    BOOST_CHECK_EQUAL(vHeights.size(), 15U);
+    BOOST_CHECK_EQUAL(vHeights.back(), 15);
+
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(pindexGenesis);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
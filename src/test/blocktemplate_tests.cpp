@@ -0,0 +1,202 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coins.h"
+#include "main.h"
+#include "miner.h"
+#include "txmempool.h"
+#include "utiltime.h"
+
+#include <list>
+#include <vector>
+
+#include <boost/foreach.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/** Put an unspent output of 10 coins on the tip, for the transactions of a test to spend */
+uint256 AddFundingCoins(int nSalt)
+{
+    uint256 hash(0x24000 + nSalt);
+    CCoinsModifier coins = pcoinsTip->ModifyCoins(hash);
+    coins->vout.resize(1);
+    coins->vout[0].nValue = 10 * COIN;
+    coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+    coins->nHeight = Params().Zerocoin_StartHeight();
+    return hash;
+}
+
+/** The block to select for: outputs below the zerocoin start height can't be spent by the miner */
+CBlockIndex MakePrevIndex()
+{
+    CBlockIndex index;
+    index.nHeight = Params().Zerocoin_StartHeight();
+    return index;
+}
+
+/** A transaction spending the first output of hashPrev, paying nFee */
+CMutableTransaction MakeTx(const uint256& hashPrev, CAmount nValueIn, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(hashPrev, 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValueIn - nFee;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+void AddToMempool(const CMutableTransaction& tx, CAmount nFee)
+{
+    CTransaction txAdd(tx);
+    mempool.addUnchecked(txAdd.GetHash(), CTxMemPoolEntry(txAdd, nFee, GetTime(), 0.0, 1));
+}
+
+/** Clears the mempool and spends the funding coins again when a test is done */
+class FundingCoinsGuard
+{
+public:
+    std::vector<uint256> vHashes;
+
+    ~FundingCoinsGuard()
+    {
+        mempool.clear();
+        BOOST_FOREACH (const uint256& hash, vHashes)
+            pcoinsTip->ModifyCoins(hash)->Clear();
+        SetMockTime(0);
+    }
+};
+}
+
+BOOST_AUTO_TEST_SUITE(blocktemplate_tests)
+
+BOOST_AUTO_TEST_CASE(select_by_fee_rate)
+{
+    LOCK2(cs_main, mempool.cs);
+    FundingCoinsGuard guard;
+    CBlockIndex indexPrev = MakePrevIndex();
+    for (int i = 0; i < 6; i++)
+        guard.vHashes.push_back(AddFundingCoins(i));
+
+    // All of these have the same size, so the fee decides the order
+    CMutableTransaction txA = MakeTx(guard.vHashes[0], 10 * COIN, 1000);
+    CMutableTransaction txB = MakeTx(guard.vHashes[1], 10 * COIN, 3000);
+    CMutableTransaction txC = MakeTx(guard.vHashes[2], 10 * COIN, 2000);
+    AddToMempool(txA, 1000);
+    AddToMempool(txB, 3000);
+    AddToMempool(txC, 2000);
+
+    // A child paying more than everything else still comes after its parent
+    CMutableTransaction txParent = MakeTx(guard.vHashes[3], 10 * COIN, 1500);
+    CMutableTransaction txChild = MakeTx(txParent.GetHash(), txParent.vout[0].nValue, 5000);
+    AddToMempool(txParent, 1500);
+    AddToMempool(txChild, 5000);
+
+    // A parent below the relay fee keeps its child out too
+    CMutableTransaction txLowParent = MakeTx(guard.vHashes[4], 10 * COIN, 10);
+    CMutableTransaction txLowChild = MakeTx(txLowParent.GetHash(), txLowParent.vout[0].nValue, 6000);
+    AddToMempool(txLowParent, 10);
+    AddToMempool(txLowChild, 6000);
+
+    CBlockTemplateSelection selection;
+    SelectTransactions(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE);
+
+    BOOST_CHECK_EQUAL(selection.vtx.size(), 5U);
+    BOOST_CHECK(selection.vtx[0].GetHash() == txB.GetHash());
+    BOOST_CHECK(selection.vtx[1].GetHash() == txC.GetHash());
+    BOOST_CHECK(selection.vtx[2].GetHash() == txParent.GetHash());
+    BOOST_CHECK(selection.vtx[3].GetHash() == txChild.GetHash());
+    BOOST_CHECK(selection.vtx[4].GetHash() == txA.GetHash());
+
+    BOOST_CHECK_EQUAL(selection.nFees, 12500);
+    BOOST_CHECK_EQUAL(selection.vTxFees.size(), 5U);
+    BOOST_CHECK_EQUAL(selection.vTxFees[3], 5000);
+    BOOST_CHECK_EQUAL(selection.nBlockSize, 1000 + 5 * ::GetSerializeSize(txA, SER_NETWORK, PROTOCOL_VERSION));
+}
+
+BOOST_AUTO_TEST_CASE(select_within_limits)
+{
+    LOCK2(cs_main, mempool.cs);
+    FundingCoinsGuard guard;
+    CBlockIndex indexPrev = MakePrevIndex();
+    for (int i = 0; i < 4; i++)
+        guard.vHashes.push_back(AddFundingCoins(10 + i));
+
+    CMutableTransaction txA = MakeTx(guard.vHashes[0], 10 * COIN, 1000);
+    CMutableTransaction txB = MakeTx(guard.vHashes[1], 10 * COIN, 2000);
+    CMutableTransaction txC = MakeTx(guard.vHashes[2], 10 * COIN, 3000);
+    AddToMempool(txA, 1000);
+    AddToMempool(txB, 2000);
+    AddToMempool(txC, 3000);
+
+    // Legacy sigop counting takes every CHECKMULTISIG for 20, so this one is
+    // over the block limit on its own
+    CMutableTransaction txSigOps = MakeTx(guard.vHashes[3], 10 * COIN, 500000);
+    for (unsigned int i = 0; i <= MAX_BLOCK_SIGOPS_CURRENT / 20; i++)
+        txSigOps.vout[0].scriptPubKey << OP_CHECKMULTISIG;
+    AddToMempool(txSigOps, 500000);
+
+    CBlockTemplateSelection selection;
+    SelectTransactions(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE);
+    BOOST_CHECK_EQUAL(selection.vtx.size(), 3U);
+    BOOST_CHECK_EQUAL(selection.nBlockSigOps, 100);
+    BOOST_FOREACH (const CTransaction& tx, selection.vtx)
+        BOOST_CHECK(tx.GetHash() != txSigOps.GetHash());
+
+    // Room for exactly two of them: the best two are taken
+    unsigned int nTxSize = ::GetSerializeSize(txA, SER_NETWORK, PROTOCOL_VERSION);
+    SelectTransactions(selection, &indexPrev, 1000 + 2 * nTxSize + 1);
+    BOOST_CHECK_EQUAL(selection.vtx.size(), 2U);
+    BOOST_CHECK(selection.vtx[0].GetHash() == txC.GetHash());
+    BOOST_CHECK(selection.vtx[1].GetHash() == txB.GetHash());
+    BOOST_CHECK_EQUAL(selection.nBlockSize, 1000 + 2 * nTxSize);
+}
+
+BOOST_AUTO_TEST_CASE(selection_reuse)
+{
+    LOCK2(cs_main, mempool.cs);
+    FundingCoinsGuard guard;
+    CBlockIndex indexPrev = MakePrevIndex();
+    guard.vHashes.push_back(AddFundingCoins(20));
+    guard.vHashes.push_back(AddFundingCoins(21));
+    CMutableTransaction txA = MakeTx(guard.vHashes[0], 10 * COIN, 1000);
+    AddToMempool(txA, 1000);
+
+    int64_t nStart = GetTime();
+    SetMockTime(nStart);
+    CBlockTemplateSelection selection;
+    SelectTransactions(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE);
+    BOOST_CHECK_EQUAL(selection.vtx.size(), 1U);
+    BOOST_CHECK(IsSelectionCurrent(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE));
+
+    // Not for another tip or another -blockmaxsize
+    CBlockIndex indexOther = MakePrevIndex();
+    BOOST_CHECK(!IsSelectionCurrent(selection, &indexOther, DEFAULT_BLOCK_MAX_SIZE));
+    BOOST_CHECK(!IsSelectionCurrent(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE - 1));
+
+    // Nor once it is old
+    SetMockTime(nStart + BLOCK_TEMPLATE_REUSE_SECONDS - 1);
+    BOOST_CHECK(IsSelectionCurrent(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE));
+    SetMockTime(nStart + BLOCK_TEMPLATE_REUSE_SECONDS);
+    BOOST_CHECK(!IsSelectionCurrent(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE));
+
+    // Nor once the mempool changed, by a transaction coming in
+    SetMockTime(nStart);
+    CMutableTransaction txB = MakeTx(guard.vHashes[1], 10 * COIN, 2000);
+    AddToMempool(txB, 2000);
+    BOOST_CHECK(!IsSelectionCurrent(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE));
+    SelectTransactions(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE);
+    BOOST_CHECK_EQUAL(selection.vtx.size(), 2U);
+    BOOST_CHECK(IsSelectionCurrent(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE));
+
+    // or going
+    std::list<CTransaction> removed;
+    mempool.remove(txA, removed);
+    BOOST_CHECK(!IsSelectionCurrent(selection, &indexPrev, DEFAULT_BLOCK_MAX_SIZE));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
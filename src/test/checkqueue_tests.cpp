@@ -0,0 +1,335 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "utiltime.h"
+
+#include <atomic>
+#include <iostream>
+#include <stdlib.h>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/** Counts how often checks ran, and fails those it is told to */
+struct CountingCheck {
+    std::atomic<unsigned int>* pnRuns;
+    bool fOk;
+    unsigned int nWork;
+
+    CountingCheck() : pnRuns(NULL), fOk(true), nWork(0) {}
+    CountingCheck(std::atomic<unsigned int>* pnRunsIn, bool fOkIn, unsigned int nWorkIn = 0) : pnRuns(pnRunsIn), fOk(fOkIn), nWork(nWorkIn) {}
+
+    bool operator()()
+    {
+        volatile unsigned int x = 0;
+        for (unsigned int i = 0; i < nWork; i++)
+            x += i * i;
+        if (pnRuns)
+            (*pnRuns)++;
+        return fOk;
+    }
+
+    void swap(CountingCheck& check)
+    {
+        std::swap(pnRuns, check.pnRuns);
+        std::swap(fOk, check.fOk);
+        std::swap(nWork, check.nWork);
+    }
+};
+
+/** A check with a heap allocated payload, which a leak checker would see if it were not released */
+struct PayloadCheck {
+    std::vector<unsigned char> vPayload;
+
+    bool operator()() { return vPayload.size() == 100; }
+    void swap(PayloadCheck& check) { vPayload.swap(check.vPayload); }
+};
+
+/** The check queue as it was before CCheckPool: one mutex, shared by the master and all workers */
+template <typename T>
+class CMutexCheckQueue
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condMaster;
+    std::vector<T> queue;
+    int nIdle;
+    int nTotal;
+    bool fAllOk;
+    unsigned int nTodo;
+    unsigned int nBatchSize;
+
+    bool Loop(bool fMaster = false)
+    {
+        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        unsigned int nNow = 0;
+        bool fOk = true;
+        do {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (nNow) {
+                    fAllOk &= fOk;
+                    nTodo -= nNow;
+                    if (nTodo == 0 && !fMaster)
+                        condMaster.notify_one();
+                } else {
+                    nTotal++;
+                }
+                while (queue.empty()) {
+                    if (fMaster && nTodo == 0) {
+                        nTotal--;
+                        bool fRet = fAllOk;
+                        fAllOk = true;
+                        return fRet;
+                    }
+                    nIdle++;
+                    cond.wait(lock);
+                    nIdle--;
+                }
+                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
+                vChecks.resize(nNow);
+                for (unsigned int i = 0; i < nNow; i++) {
+                    vChecks[i].swap(queue.back());
+                    queue.pop_back();
+                }
+                fOk = fAllOk;
+            }
+            BOOST_FOREACH (T& check, vChecks)
+                if (fOk)
+                    fOk = check();
+            vChecks.clear();
+        } while (true);
+    }
+
+public:
+    CMutexCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
+
+    void Thread() { Loop(); }
+    bool Wait() { return Loop(true); }
+
+    void Add(std::vector<T>& vChecks)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        BOOST_FOREACH (T& check, vChecks) {
+            queue.push_back(T());
+            check.swap(queue.back());
+        }
+        nTodo += vChecks.size();
+        if (vChecks.size() == 1)
+            condWorker.notify_one();
+        else if (vChecks.size() > 1)
+            condWorker.notify_all();
+    }
+};
+
+//! Checks per simulated block, added a transaction of two inputs at a time
+static const unsigned int BENCH_CHECKS = 4000;
+static const unsigned int BENCH_BLOCKS = 10;
+//! Loop iterations per check, about a microsecond of work
+static const unsigned int BENCH_WORK = 250;
+
+template <typename Queue>
+int64_t BenchBlocks(Queue& queue)
+{
+    std::atomic<unsigned int> nRuns(0);
+    int64_t nStart = GetTimeMicros();
+    for (unsigned int b = 0; b < BENCH_BLOCKS; b++) {
+        for (unsigned int i = 0; i < BENCH_CHECKS; i += 2) {
+            std::vector<CountingCheck> vChecks;
+            vChecks.push_back(CountingCheck(&nRuns, true, BENCH_WORK));
+            vChecks.push_back(CountingCheck(&nRuns, true, BENCH_WORK));
+            queue.Add(vChecks);
+        }
+        BOOST_CHECK(queue.Wait());
+    }
+    BOOST_CHECK_EQUAL(nRuns.load(), BENCH_CHECKS * BENCH_BLOCKS);
+    return GetTimeMicros() - nStart;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_no_workers)
+{
+    // Without pool threads the master runs everything in Wait
+    CCheckPool pool;
+    CCheckQueue<CountingCheck> queue(pool, 16);
+    std::atomic<unsigned int> nRuns(0);
+
+    std::vector<CountingCheck> vChecks;
+    for (int i = 0; i < 1000; i++)
+        vChecks.push_back(CountingCheck(&nRuns, true));
+    {
+        CCheckQueueControl<CountingCheck> control(&queue);
+        control.Add(vChecks);
+        BOOST_CHECK_EQUAL(nRuns.load(), 0U);
+        BOOST_CHECK(control.Wait());
+    }
+    BOOST_CHECK_EQUAL(nRuns.load(), 1000U);
+    BOOST_CHECK(queue.IsIdle());
+
+    // Nothing added
+    CCheckQueueControl<CountingCheck> control(&queue);
+    BOOST_CHECK(control.Wait());
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_checks_run)
+{
+    CCheckPool pool;
+    CCheckQueue<CountingCheck> queue(pool, 128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 7; i++)
+        threadGroup.create_thread(boost::bind(&CCheckPool::Thread, &pool));
+
+    for (unsigned int nRound = 0; nRound < 50; nRound++) {
+        std::atomic<unsigned int> nRuns(0);
+        unsigned int nTotal = 0;
+        CCheckQueueControl<CountingCheck> control(&queue);
+        for (unsigned int i = 0; i < 20 + nRound; i++) {
+            // batches of varying size, some empty
+            std::vector<CountingCheck> vChecks;
+            for (unsigned int j = 0; j < (i * 7 + nRound) % 13; j++)
+                vChecks.push_back(CountingCheck(&nRuns, true, j));
+            nTotal += vChecks.size();
+            control.Add(vChecks);
+        }
+        BOOST_CHECK(control.Wait());
+        BOOST_CHECK_EQUAL(nRuns.load(), nTotal);
+    }
+
+    pool.Stop();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    CCheckPool pool;
+    CCheckQueue<CountingCheck> queue(pool, 128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckPool::Thread, &pool));
+
+    for (unsigned int nFail = 0; nFail < 300; nFail += 37) {
+        std::atomic<unsigned int> nRuns(0);
+        std::vector<CountingCheck> vChecks;
+        for (unsigned int i = 0; i < 300; i++)
+            vChecks.push_back(CountingCheck(&nRuns, i != nFail));
+        CCheckQueueControl<CountingCheck> control(&queue);
+        control.Add(vChecks);
+        BOOST_CHECK(!control.Wait());
+    }
+
+    // The failure does not carry over to the next round
+    std::atomic<unsigned int> nRuns(0);
+    std::vector<CountingCheck> vChecks(100, CountingCheck(&nRuns, true));
+    CCheckQueueControl<CountingCheck> control(&queue);
+    control.Add(vChecks);
+    BOOST_CHECK(control.Wait());
+    BOOST_CHECK_EQUAL(nRuns.load(), 100U);
+
+    pool.Stop();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_releases_checks)
+{
+    CCheckPool pool;
+    CCheckQueue<PayloadCheck> queue(pool, 8);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckPool::Thread, &pool));
+
+    std::vector<PayloadCheck> vChecks(5000);
+    BOOST_FOREACH (PayloadCheck& check, vChecks)
+        check.vPayload.resize(100);
+    {
+        CCheckQueueControl<PayloadCheck> control(&queue);
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+    }
+    // The queue took the payloads, and ran and dropped them
+    BOOST_FOREACH (PayloadCheck& check, vChecks)
+        BOOST_CHECK(check.vPayload.empty());
+
+    pool.Stop();
+    threadGroup.join_all();
+}
+
+static void RunRounds(CCheckQueue<CountingCheck>* pqueue, unsigned int nChecks, bool* pfOk)
+{
+    for (int nRound = 0; nRound < 100; nRound++) {
+        std::atomic<unsigned int> nRuns(0);
+        std::vector<CountingCheck> vChecks(nChecks, CountingCheck(&nRuns, true, 10));
+        CCheckQueueControl<CountingCheck> control(pqueue);
+        control.Add(vChecks);
+        if (!control.Wait() || nRuns.load() != nChecks)
+            *pfOk = false;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_shared_pool)
+{
+    // Two queues with their own masters, run by the same workers at the same time
+    CCheckPool pool;
+    CCheckQueue<CountingCheck> queue1(pool, 128);
+    CCheckQueue<CountingCheck> queue2(pool, 1);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 4; i++)
+        threadGroup.create_thread(boost::bind(&CCheckPool::Thread, &pool));
+
+    bool fOk1 = true, fOk2 = true;
+    boost::thread master1(boost::bind(&RunRounds, &queue1, 1000, &fOk1));
+    boost::thread master2(boost::bind(&RunRounds, &queue2, 10, &fOk2));
+    master1.join();
+    master2.join();
+    BOOST_CHECK(fOk1);
+    BOOST_CHECK(fOk2);
+
+    pool.Stop();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_benchmark)
+{
+    // Only timings, and up to 64 threads: run with BITCOIN2_TEST_BENCH=1 set
+    if (!getenv("BITCOIN2_TEST_BENCH"))
+        return;
+
+    // Compare with the single mutex queue, for 1 to 64 threads including the master
+    std::cout << "checkqueue_benchmark: " << BENCH_BLOCKS << " blocks of " << BENCH_CHECKS << " checks" << std::endl;
+    for (unsigned int nThreads = 1; nThreads <= CHECK_POOL_MAX_WORKERS; nThreads *= 2) {
+        int64_t nTimeMutex, nTimePool;
+        {
+            CMutexCheckQueue<CountingCheck> queue(128);
+            boost::thread_group threadGroup;
+            for (unsigned int i = 0; i < nThreads - 1; i++)
+                threadGroup.create_thread(boost::bind(&CMutexCheckQueue<CountingCheck>::Thread, &queue));
+            nTimeMutex = BenchBlocks(queue);
+            threadGroup.interrupt_all();
+            threadGroup.join_all();
+        }
+        {
+            CCheckPool pool;
+            CCheckQueue<CountingCheck> queue(pool, 128);
+            boost::thread_group threadGroup;
+            for (unsigned int i = 0; i < nThreads - 1; i++)
+                threadGroup.create_thread(boost::bind(&CCheckPool::Thread, &pool));
+            nTimePool = BenchBlocks(queue);
+            pool.Stop();
+            threadGroup.join_all();
+        }
+        std::cout << "  " << nThreads << " threads: mutex queue " << nTimeMutex / 1000.0 << "ms, work-stealing queue " << nTimePool / 1000.0 << "ms" << std::endl;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
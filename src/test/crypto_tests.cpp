@@ -9,9 +9,15 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/quark.h"
+#include "hash.h"
 #include "random.h"
 #include "utilstrencodings.h"
+#include "utiltime.h"
 
+#include <iostream>
+#include <limits>
+#include <stdlib.h>
 #include <vector>
 
 #include <boost/assign/list_of.hpp>
@@ -131,6 +137,70 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Every batch size, so that each of the 8, 4 and 1 lane paths is taken with every remainder
+    for (int i = 0; i <= 32; ++i) {
+        unsigned char in[64 * 32];
+        unsigned char out1[32 * 32], out2[32 * 32];
+        for (int j = 0; j < 64 * i; ++j)
+            in[j] = insecure_rand() & 0xff;
+        for (int j = 0; j < i; ++j)
+            CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+        SHA256D64(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(quark80)
+{
+    // Every batch size up to 33, so that the 4 lane path is taken with every remainder,
+    // and enough inputs for each branch of the hash to be taken in mixed lanes
+    for (int i = 0; i <= 33; ++i) {
+        unsigned char in[80 * 33];
+        unsigned char out1[32 * 33], out2[32 * 33];
+        for (int j = 0; j < 80 * i; ++j)
+            in[j] = insecure_rand() & 0xff;
+        for (int j = 0; j < i; ++j) {
+            uint256 hash = HashQuark(in + 80 * j, in + 80 * (j + 1));
+            memcpy(out1 + 32 * j, hash.begin(), 32);
+        }
+        Quark80(out2, in, i);
+        BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(quark80_benchmark)
+{
+    // Only timings: run with BITCOIN2_TEST_BENCH=1 set
+    if (!getenv("BITCOIN2_TEST_BENCH"))
+        return;
+
+    // Compare with HashQuark, one header at a time through the sph code; the best of a few runs
+    static const int BENCH_HEADERS = 4000;
+    std::vector<unsigned char> vIn(80 * BENCH_HEADERS), vOut(32 * BENCH_HEADERS), vOutBatch(32 * BENCH_HEADERS);
+    for (unsigned int i = 0; i < vIn.size(); ++i)
+        vIn[i] = insecure_rand() & 0xff;
+
+    int64_t nTimeSph = std::numeric_limits<int64_t>::max(), nTimeBatch = std::numeric_limits<int64_t>::max();
+    for (int nRun = 0; nRun < 5; ++nRun) {
+        int64_t nStart = GetTimeMicros();
+        for (int i = 0; i < BENCH_HEADERS; ++i) {
+            uint256 hash = HashQuark(&vIn[80 * i], &vIn[80 * (i + 1)]);
+            memcpy(&vOut[32 * i], hash.begin(), 32);
+        }
+        nTimeSph = std::min(nTimeSph, GetTimeMicros() - nStart);
+
+        nStart = GetTimeMicros();
+        Quark80(&vOutBatch[0], &vIn[0], BENCH_HEADERS);
+        nTimeBatch = std::min(nTimeBatch, GetTimeMicros() - nStart);
+    }
+
+    BOOST_CHECK(vOut == vOutBatch);
+    std::cout << "quark80_benchmark: " << BENCH_HEADERS << " headers, HashQuark " << nTimeSph / 1000.0
+              << "ms, Quark80 " << nTimeBatch / 1000.0 << "ms" << std::endl;
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -0,0 +1,96 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(cuckoocache_tests)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_empty)
+{
+    CCuckooCache cache;
+    BOOST_CHECK(!cache.Contains(GetRandHash(), false));
+    cache.Insert(GetRandHash()); // no table yet, ignored
+
+    BOOST_CHECK_EQUAL(cache.Setup(1 << 16), (size_t)(1 << 16) / 64 * CCuckooCache::SLOTS_PER_BUCKET);
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(!cache.Contains(GetRandHash(), false));
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_insert_erase)
+{
+    CCuckooCache cache;
+    cache.Setup(1 << 16);
+
+    std::vector<uint256> vKeys;
+    for (int i = 0; i < 100; i++) {
+        vKeys.push_back(GetRandHash());
+        cache.Insert(vKeys.back());
+    }
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(cache.Contains(vKeys[i], false));
+
+    // Erased keys are gone, the others stay
+    for (int i = 0; i < 100; i += 2)
+        BOOST_CHECK(cache.Contains(vKeys[i], true));
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK_EQUAL(cache.Contains(vKeys[i], false), i % 2 == 1);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_fill)
+{
+    // Twice as many keys as slots: the cache must stay mostly full
+    CCuckooCache cache;
+    size_t nSlots = cache.Setup(1 << 14);
+
+    std::vector<uint256> vKeys;
+    for (size_t i = 0; i < nSlots * 2; i++) {
+        vKeys.push_back(GetRandHash());
+        cache.Insert(vKeys.back());
+    }
+
+    size_t nFound = 0;
+    for (size_t i = 0; i < vKeys.size(); i++)
+        nFound += cache.Contains(vKeys[i], false);
+    BOOST_CHECK(nFound <= nSlots);
+    BOOST_CHECK(nFound > nSlots * 8 / 10);
+}
+
+static void InsertKeys(CCuckooCache* cache, const std::vector<uint256>* vKeys, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++)
+        cache->Insert((*vKeys)[i]);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_concurrent)
+{
+    CCuckooCache cache;
+    cache.Setup(1 << 20);
+
+    std::vector<uint256> vKeys;
+    for (int i = 0; i < 4000; i++)
+        vKeys.push_back(GetRandHash());
+
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&InsertKeys, &cache, &vKeys, i * 1000, (i + 1) * 1000));
+
+    // Lookups of unknown keys while inserting must never hit
+    for (int i = 0; i < 10000; i++)
+        BOOST_CHECK(!cache.Contains(GetRandHash(), false));
+    threads.join_all();
+
+    size_t nFound = 0;
+    for (size_t i = 0; i < vKeys.size(); i++)
+        nFound += cache.Contains(vKeys[i], false);
+    BOOST_CHECK(nFound > vKeys.size() * 99 / 100);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
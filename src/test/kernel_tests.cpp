@@ -0,0 +1,33 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "hash.h"
+#include "kernel.h"
+#include "random.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+BOOST_AUTO_TEST_CASE(stake_kernel_midstate)
+{
+    for (int i = 0; i < 16; i++) {
+        uint256 nStakeModifierV2 = GetRandHash();
+        uint64_t nStakeModifier = i == 0 ? 0 : ((uint64_t)insecure_rand() << 32) | insecure_rand();
+        COutPoint prevout(GetRandHash(), i == 1 ? 0xffffffff : insecure_rand() % 100);
+
+        CSHA256 midstate;
+        StakeKernelMidstateV3(midstate, nStakeModifierV2, nStakeModifier, prevout);
+
+        // One midstate serves every candidate time, and gives the hash of the whole kernel
+        for (int j = 0; j < 4; j++) {
+            unsigned int nTime = j == 0 ? 0 : insecure_rand();
+            CHashWriter ss(SER_GETHASH, 0);
+            ss << nStakeModifierV2 << prevout.hash << nStakeModifier << prevout.n << nTime;
+            BOOST_CHECK(StakeKernelHashV3(midstate, nTime) == ss.GetHash());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -196,6 +196,57 @@ Test_ParamGen()
 	return result;
 }
 
+bool
+Test_Exponentiation()
+{
+	// The precomputed tables must give exactly what CBigNum::pow_mod gives,
+	// for negative exponents and exponents larger than the tables too
+	try {
+		const IntegerGroupParams* groups[] = {&g_Params->coinCommitmentGroup, &g_Params->serialNumberSoKCommitmentGroup,
+		                                      &g_Params->accumulatorParams.accumulatorPoKCommitmentGroup};
+		for (uint32_t i = 0; i < 3; i++) {
+			const IntegerGroupParams* group = groups[i];
+			for (uint32_t j = 0; j < 20; j++) {
+				CBigNum e = CBigNum::randBignum(CBigNum(2).pow(group->modulus.bitSize() + 64));
+				if (j % 2)
+					e = -e;
+				if (group->powG(e) != group->g.pow_mod(e, group->modulus) ||
+				        group->powH(e) != group->h.pow_mod(e, group->modulus)) {
+					cout << "Fixed-base exponentiation does not match" << endl;
+					return false;
+				}
+			}
+		}
+
+		const IntegerGroupParams& qrn = g_Params->accumulatorParams.accumulatorQRNCommitmentGroup;
+		const CBigNum& N = g_Params->accumulatorParams.accumulatorModulus;
+		for (uint32_t j = 0; j < 20; j++) {
+			CBigNum e = CBigNum::randBignum(CBigNum(2).pow(N.bitSize() * 2));
+			if (j % 2)
+				e = -e;
+			if (qrn.powG(e) != qrn.g.pow_mod(e, N) || qrn.powH(e) != qrn.h.pow_mod(e, N)) {
+				cout << "QRN exponentiation does not match" << endl;
+				return false;
+			}
+
+			vector<CBigNum> vBases, vExps;
+			vBases.push_back(qrn.g);
+			vExps.push_back(e);
+			vBases.push_back(CBigNum::randBignum(N) + N);
+			vExps.push_back(CBigNum::randBignum(N));
+			if (qrn.multi_pow_mod(vBases, vExps) != vBases[0].pow_mod(vExps[0], N).mul_mod(vBases[1].pow_mod(vExps[1], N), N)) {
+				cout << "Multi-exponentiation does not match" << endl;
+				return false;
+			}
+		}
+	} catch (runtime_error e) {
+		cout << e.what() << endl;
+		return false;
+	}
+
+	return true;
+}
+
 bool
 Test_Accumulator()
 {
@@ -458,6 +509,7 @@ Test_RunAllTests()
 	LogTestResult("parameter sizes are correct", Test_CalcParamSizes);
 	LogTestResult("group/field parameters can be generated", Test_GenerateGroupParams);
 	LogTestResult("parameter generation is correct", Test_ParamGen);
+	LogTestResult("precomputed exponentiation is correct", Test_Exponentiation);
 	LogTestResult("coins can be minted", Test_MintCoin);
 	LogTestResult("invalid coins will be rejected", Test_InvalidCoin);
 	LogTestResult("the accumulator works", Test_Accumulator);
@@ -5,7 +5,9 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "primitives/transaction.h"
+#include "clientversion.h"
 #include "main.h"
+#include "streams.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -48,4 +50,94 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 4109975100000000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(block_index_record_test)
+{
+    CBlock block;
+    block.nVersion = 4;
+    block.nTime = 1500000000;
+    block.nBits = 0x1e0ffff0;
+    block.nNonce = 42;
+    uint256 hash = block.GetHash();
+    CBlockIndex index(block);
+    index.phashBlock = &hash;
+
+    // The hash is the key to write under, but not part of the record, which the loader finds by its key
+    CDiskBlockIndex diskindexWrite(&index);
+    BOOST_CHECK(diskindexWrite.hashBlock == hash);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << diskindexWrite;
+
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(diskindex.hashBlock.IsNull());
+    BOOST_CHECK(diskindex.GetBlockHash() == hash);
+    BOOST_CHECK(diskindex.nTime == block.nTime);
+}
+
+BOOST_AUTO_TEST_CASE(zerocoin_supply_test)
+{
+    // Stored exactly like the std::map it replaced
+    std::map<libzerocoin::CoinDenomination, int64_t> mapSupply;
+    CZerocoinSupply supply;
+    for (unsigned int i = 0; i < libzerocoin::ZEROCOIN_DENOMINATION_COUNT; i++) {
+        mapSupply[libzerocoin::zerocoinDenomList[i]] = 1000 * i + 7;
+        supply.at(libzerocoin::zerocoinDenomList[i]) = 1000 * i + 7;
+    }
+    CDataStream ssMap(SER_DISK, CLIENT_VERSION);
+    ssMap << mapSupply;
+    CDataStream ssSupply(SER_DISK, CLIENT_VERSION);
+    ssSupply << supply;
+    BOOST_CHECK(ssMap.str() == ssSupply.str());
+
+    CZerocoinSupply supplyRead;
+    ssMap >> supplyRead;
+    for (unsigned int i = 0; i < libzerocoin::ZEROCOIN_DENOMINATION_COUNT; i++)
+        BOOST_CHECK_EQUAL(supplyRead.at(libzerocoin::zerocoinDenomList[i]), (int64_t)(1000 * i + 7));
+    BOOST_CHECK_THROW(supply.at(libzerocoin::ZQ_ERROR), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_CASE(block_index_arena_test)
+{
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vIndex;
+    for (int i = 0; i < 10000; i++) {
+        vIndex.push_back(arena.New());
+        if (i > 0)
+            vIndex[i]->pprev = vIndex[i - 1];
+        vIndex[i]->nHeight = i;
+        vIndex[i]->BuildSkip();
+    }
+    BOOST_CHECK_EQUAL(arena.Size(), 10000U);
+    BOOST_CHECK(vIndex[1] == vIndex[0] + 1);
+    for (int i = 0; i < 10000; i += 99) {
+        BOOST_CHECK(vIndex[9999]->GetAncestor(i) == vIndex[i]);
+        BOOST_CHECK(vIndex[i]->mapZerocoinSupply.at(libzerocoin::ZQ_ONE) == 0);
+    }
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.Size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(block_header_hashes_test)
+{
+    // Quark and SHA256 hashed headers mixed, in runs longer and shorter than the Quark batches
+    std::vector<CBlockHeader> vHeaders;
+    for (int i = 0; i < 50; i++) {
+        CBlockHeader header;
+        header.nVersion = (i % 11 < 7) ? 3 : 4;
+        header.nTime = 1500000000 + i;
+        header.nBits = 0x1e0ffff0;
+        header.nNonce = i * 7919;
+        vHeaders.push_back(header);
+    }
+    std::vector<uint256> vHashes;
+    GetBlockHeaderHashes(vHeaders, vHashes);
+    BOOST_CHECK_EQUAL(vHashes.size(), vHeaders.size());
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+        BOOST_CHECK(vHashes[i] == vHeaders[i].GetHash());
+
+    GetBlockHeaderHashes(std::vector<CBlockHeader>(), vHashes);
+    BOOST_CHECK(vHashes.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,13 +2,29 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "core_memusage.h"
 #include "main.h"
 #include "txmempool.h"
 #include "util.h"
+#include "utiltime.h"
 
 #include <boost/test/unit_test.hpp>
 #include <list>
 
+/** A transaction with one input and one output, spending the first output of prevTx if given */
+static CMutableTransaction MakeTestTx(const CMutableTransaction* prevTx, int nSalt)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << nSalt;
+    tx.vin[0].prevout.hash = prevTx ? prevTx->GetHash() : uint256(nSalt);
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 10 * COIN;
+    return tx;
+}
+
 BOOST_AUTO_TEST_SUITE(mempool_tests)
 
 BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
@@ -99,4 +115,206 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolUsageTest)
+{
+    // Scripts longer than a prevector's inline storage are allocated on the heap
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    tx.vin[1].scriptSig = CScript() << OP_11;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx.vout[0].nValue = 11000LL;
+
+    CTxMemPoolEntry entry(tx, 0, 0, 0.0, 1);
+    BOOST_CHECK_EQUAL(entry.DynamicMemoryUsage(), RecursiveDynamicUsage(CTransaction(tx)));
+    BOOST_CHECK(entry.DynamicMemoryUsage() >= memusage::MallocUsage(2 * sizeof(CTxIn)) + memusage::MallocUsage(107));
+
+    CTxMemPool testPool(CFeeRate(0));
+    BOOST_CHECK_EQUAL(testPool.DynamicMemoryUsage(), 0U);
+
+    // The entry and the map nodes holding it and its spent outpoints are counted
+    testPool.addUnchecked(tx.GetHash(), entry);
+    size_t nUsage = testPool.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > entry.DynamicMemoryUsage() + memusage::DynamicUsage(testPool.mapNextTx));
+
+    // and nothing is left once it is gone
+    std::list<CTransaction> removed;
+    testPool.remove(tx, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(testPool.DynamicMemoryUsage(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolDescendantsTest)
+{
+    CTxMemPool testPool(CFeeRate(0));
+    CMutableTransaction txParent = MakeTestTx(NULL, 1);
+    CMutableTransaction txChild = MakeTestTx(&txParent, 2);
+    CMutableTransaction txGrandChild = MakeTestTx(&txChild, 3);
+    unsigned int nSize = ::GetSerializeSize(txParent, SER_NETWORK, PROTOCOL_VERSION);
+
+    testPool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000, 0, 0.0, 1));
+    testPool.addUnchecked(txChild.GetHash(), CTxMemPoolEntry(txChild, 2000, 0, 0.0, 1));
+    testPool.addUnchecked(txGrandChild.GetHash(), CTxMemPoolEntry(txGrandChild, 4000, 0, 0.0, 1));
+
+    // Every entry carries the totals of itself and what spends it
+    CTxMemPool::txiter it = testPool.mapTx.find(txParent.GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), 3U);
+    BOOST_CHECK_EQUAL(it->GetSizeWithDescendants(), 3U * nSize);
+    BOOST_CHECK_EQUAL(it->GetFeesWithDescendants(), 7000);
+    it = testPool.mapTx.find(txChild.GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), 2U);
+    BOOST_CHECK_EQUAL(it->GetFeesWithDescendants(), 6000);
+    BOOST_CHECK_EQUAL(testPool.GetMemPoolChildren(testPool.mapTx.find(txParent.GetHash())).size(), 1U);
+
+    // Removing the grandchild takes it off the totals of its ancestors
+    std::list<CTransaction> removed;
+    testPool.remove(txGrandChild, removed, false);
+    it = testPool.mapTx.find(txParent.GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), 2U);
+    BOOST_CHECK_EQUAL(it->GetSizeWithDescendants(), 2U * nSize);
+    BOOST_CHECK_EQUAL(it->GetFeesWithDescendants(), 3000);
+
+    // Ancestor limits count the transaction itself
+    CTxMemPoolEntry entry(txGrandChild, 4000, 0, 0.0, 1);
+    CTxMemPool::setEntries setAncestors;
+    std::string errString;
+    BOOST_CHECK(testPool.CalculateMemPoolAncestors(entry, setAncestors, 3, 3 * nSize, 3, 3 * nSize, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 2U);
+    setAncestors.clear();
+    BOOST_CHECK(!testPool.CalculateMemPoolAncestors(entry, setAncestors, 2, 3 * nSize, 3, 3 * nSize, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!testPool.CalculateMemPoolAncestors(entry, setAncestors, 3, 3 * nSize, 2, 3 * nSize, errString));
+
+    // Removing the parent recursively takes the rest
+    testPool.remove(txParent, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 3U);
+    BOOST_CHECK_EQUAL(testPool.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    SetMockTime(42);
+    CTxMemPool testPool(CFeeRate(1000));
+    CMutableTransaction tx1 = MakeTestTx(NULL, 1);
+    CMutableTransaction tx2 = MakeTestTx(NULL, 2);
+    CMutableTransaction tx3 = MakeTestTx(NULL, 3);
+    CMutableTransaction tx4 = MakeTestTx(&tx3, 4);
+    unsigned int nSize = ::GetSerializeSize(tx1, SER_NETWORK, PROTOCOL_VERSION);
+
+    // tx3 pays nothing, but its child pays enough for both
+    testPool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 50000, 0, 0.0, 1));
+    testPool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 100000, 0, 0.0, 1));
+    testPool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 0, 0, 0.0, 1));
+    testPool.addUnchecked(tx4.GetHash(), CTxMemPoolEntry(tx4, 300000, 0, 0.0, 1));
+    BOOST_CHECK_EQUAL(testPool.GetMinFee(1).GetFeePerK(), 0);
+
+    // Nothing goes while the pool fits
+    testPool.TrimToSize(testPool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(testPool.size(), 4U);
+
+    // The lowest fee rate goes first, and sets the minimum fee above its own
+    testPool.TrimToSize(testPool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(testPool.size(), 3U);
+    BOOST_CHECK(!testPool.exists(tx1.GetHash()));
+    BOOST_CHECK_EQUAL(testPool.GetMinFee(1).GetFeePerK(), CFeeRate(50000, nSize).GetFeePerK() + 1000);
+
+    // A parent paid for by its child is scored by the package
+    testPool.TrimToSize(testPool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(!testPool.exists(tx2.GetHash()));
+    BOOST_CHECK(testPool.exists(tx3.GetHash()));
+    BOOST_CHECK(testPool.exists(tx4.GetHash()));
+
+    // and the whole package goes together
+    testPool.TrimToSize(testPool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(testPool.size(), 0U);
+    CAmount nMinFee = CFeeRate(300000, 2 * nSize).GetFeePerK() + 1000;
+    BOOST_CHECK_EQUAL(testPool.GetMinFee(1).GetFeePerK(), nMinFee);
+
+    // The minimum only decays once a block has been found, faster when the pool is empty
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(testPool.GetMinFee(1).GetFeePerK(), nMinFee);
+    std::list<CTransaction> conflicts;
+    testPool.removeForBlock(std::vector<CTransaction>(), 1, conflicts);
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE + CTxMemPool::ROLLING_FEE_HALFLIFE / 4);
+    BOOST_CHECK_EQUAL(testPool.GetMinFee(4).GetFeePerK(), nMinFee / 2);
+
+    // and is dropped once it is close to the relay fee
+    SetMockTime(42 + 10 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(testPool.GetMinFee(4).GetFeePerK(), 0);
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolExpireTest)
+{
+    CTxMemPool testPool(CFeeRate(0));
+    CMutableTransaction tx1 = MakeTestTx(NULL, 1);
+    CMutableTransaction tx2 = MakeTestTx(NULL, 2);
+    CMutableTransaction tx3 = MakeTestTx(&tx1, 3);
+    testPool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 1000, 100, 0.0, 1));
+    testPool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 1000, 200, 0.0, 1));
+    testPool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 1000, 300, 0.0, 1));
+
+    // An expired transaction takes its descendants with it, however recent
+    BOOST_CHECK_EQUAL(testPool.Expire(100), 0);
+    BOOST_CHECK_EQUAL(testPool.Expire(150), 2);
+    BOOST_CHECK_EQUAL(testPool.size(), 1U);
+    BOOST_CHECK(testPool.exists(tx2.GetHash()));
+    BOOST_CHECK_EQUAL(testPool.Expire(250), 1);
+    BOOST_CHECK_EQUAL(testPool.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolQueryEntriesTest)
+{
+    CTxMemPool testPool(CFeeRate(0));
+    CMutableTransaction tx1 = MakeTestTx(NULL, 1);
+    CMutableTransaction tx2 = MakeTestTx(&tx1, 2);
+    CMutableTransaction tx3 = MakeTestTx(NULL, 3);
+
+    // A parent coming back from a disconnected block enters after its child
+    testPool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 1000, 300, 0.0, 1));
+    testPool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 1000, 100, 0.0, 1));
+    testPool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 1000, 200, 0.0, 1));
+    testPool.UpdateTransactionsFromBlock(std::vector<uint256>(1, tx1.GetHash()));
+
+    // but is still listed first, so the entries can be accepted again in order
+    std::vector<CTxMemPoolEntry> vEntries;
+    testPool.queryEntries(vEntries);
+    BOOST_REQUIRE_EQUAL(vEntries.size(), 3U);
+    BOOST_CHECK(vEntries[0].GetTx().GetHash() == tx1.GetHash());
+    BOOST_CHECK(vEntries[1].GetTx().GetHash() == tx2.GetHash());
+    BOOST_CHECK(vEntries[2].GetTx().GetHash() == tx3.GetHash());
+    BOOST_CHECK_EQUAL(vEntries[1].GetTime(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolMiningScoreTest)
+{
+    CTxMemPool testPool(CFeeRate(0));
+    CMutableTransaction tx1 = MakeTestTx(NULL, 1);
+    CMutableTransaction tx2 = MakeTestTx(NULL, 2);
+    CMutableTransaction tx3 = MakeTestTx(NULL, 3);
+
+    // A delta set before the transaction arrives applies once it does
+    testPool.PrioritiseTransaction(tx3.GetHash(), tx3.GetHash().ToString(), 0.0, 5000);
+    testPool.addUnchecked(tx1.GetHash(), CTxMemPoolEntry(tx1, 1000, 0, 0.0, 1));
+    testPool.addUnchecked(tx2.GetHash(), CTxMemPoolEntry(tx2, 2000, 0, 0.0, 1));
+    testPool.addUnchecked(tx3.GetHash(), CTxMemPoolEntry(tx3, 0, 0, 0.0, 1));
+
+    indexed_transaction_set::index<mining_score>::type::iterator it = testPool.mapTx.get<mining_score>().begin();
+    BOOST_CHECK(it->GetTx().GetHash() == tx3.GetHash());
+    BOOST_CHECK_EQUAL(it->GetModifiedFee(), 5000);
+    BOOST_CHECK((++it)->GetTx().GetHash() == tx2.GetHash());
+    BOOST_CHECK((++it)->GetTx().GetHash() == tx1.GetHash());
+
+    // Prioritising a transaction in the pool moves it, and marks the pool changed
+    unsigned int nTransactionsUpdated = testPool.GetTransactionsUpdated();
+    testPool.PrioritiseTransaction(tx1.GetHash(), tx1.GetHash().ToString(), 0.0, 9000);
+    BOOST_CHECK(testPool.GetTransactionsUpdated() != nTransactionsUpdated);
+    BOOST_CHECK(testPool.mapTx.get<mining_score>().begin()->GetTx().GetHash() == tx1.GetHash());
+    BOOST_CHECK_EQUAL(testPool.mapTx.get<mining_score>().begin()->GetModifiedFee(), 10000);
+
+    // but eviction still goes by the fee actually paid
+    BOOST_CHECK(testPool.mapTx.get<descendant_score>().begin()->GetTx().GetHash() == tx3.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
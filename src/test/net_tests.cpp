@@ -0,0 +1,144 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin2-config.h"
+#endif
+
+#include "net.h"
+#include "serialize.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/** Read exactly nBytes from a socket, or fewer if it is closed */
+static std::vector<char> ReadBytes(int fd, size_t nBytes)
+{
+    std::vector<char> vch(nBytes);
+    size_t nRead = 0;
+    while (nRead < nBytes) {
+        ssize_t n = recv(fd, &vch[nRead], nBytes - nRead, 0);
+        if (n <= 0)
+            break;
+        nRead += n;
+    }
+    vch.resize(nRead);
+    return vch;
+}
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+BOOST_AUTO_TEST_CASE(shared_message_matches_pushmessage)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CNode node(fds[0], CAddress(), "", true);
+
+    std::vector<unsigned char> vPayload(1000, 0x42);
+    node.PushMessage("test", vPayload);
+    std::vector<char> vPushed = ReadBytes(fds[1], CMessageHeader::HEADER_SIZE + 3 + vPayload.size());
+
+    CSharedNetMsg msg = MakeNetMessage("test", vPayload);
+    BOOST_CHECK_EQUAL(msg->size(), vPushed.size());
+    node.PushSharedMessage(msg);
+    std::vector<char> vShared = ReadBytes(fds[1], msg->size());
+    BOOST_CHECK(vShared == vPushed);
+    BOOST_CHECK(std::vector<char>(msg->begin(), msg->end()) == vPushed);
+
+    // A message from a stream is the same as one from the object
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << vPayload;
+    CSharedNetMsg msgFromStream = MakeNetMessage("test", ss);
+    BOOST_CHECK(*msgFromStream == *msg);
+
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(vectored_send_keeps_order)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CNode node(fds[0], CAddress(), "", true);
+
+    // Far more than the socket buffer holds, so most of it is queued and sent in pieces
+    std::vector<char> vExpected;
+    CSharedNetMsg msgShared = MakeNetMessage("shared", std::vector<unsigned char>(7000, 0x11));
+    for (int i = 0; i < 300; i++) {
+        if (i % 3 == 0) {
+            node.PushSharedMessage(msgShared);
+            vExpected.insert(vExpected.end(), msgShared->begin(), msgShared->end());
+        } else {
+            std::vector<unsigned char> vPayload(1 + (i * 37) % 5000, (unsigned char)i);
+            CSharedNetMsg msg = MakeNetMessage("own", vPayload);
+            node.PushMessage("own", vPayload);
+            vExpected.insert(vExpected.end(), msg->begin(), msg->end());
+        }
+    }
+    BOOST_CHECK(!node.vSendMsg.empty());
+
+    // Take what has arrived, then let the node send more
+    std::vector<char> vReceived;
+    char buf[50000];
+    for (int nRounds = 0; vReceived.size() < vExpected.size() && nRounds < 100000; nRounds++) {
+        ssize_t n = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0)
+            vReceived.insert(vReceived.end(), buf, buf + n);
+        LOCK(node.cs_vSend);
+        SocketSendData(&node);
+    }
+    BOOST_CHECK(vReceived == vExpected);
+    BOOST_CHECK(node.vSendMsg.empty());
+    BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+    BOOST_CHECK_EQUAL(node.nSendBytes, vExpected.size());
+
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(socket_events_mode)
+{
+    BOOST_CHECK(!SetSocketEventsMode("poll"));
+    BOOST_CHECK(GetSocketEventsModes().back() == "select");
+
+    // select() takes at most FD_SETSIZE sockets, the reserved ones included
+    BOOST_CHECK(SetSocketEventsMode("select"));
+    BOOST_CHECK_EQUAL(nSocketEventsMode, SOCKETEVENTS_SELECT);
+    BOOST_CHECK_EQUAL(GetSocketEventsMaxConnections(125, 151), 125);
+    BOOST_CHECK_EQUAL(GetSocketEventsMaxConnections(100000, 151), (int)FD_SETSIZE - 151);
+    BOOST_CHECK_EQUAL(GetSocketEventsMaxConnections(125, FD_SETSIZE + 1), 0);
+
+#ifdef HAVE_SYS_EPOLL_H
+    BOOST_CHECK(GetSocketEventsModes().front() == "epoll");
+    BOOST_CHECK(SetSocketEventsMode("epoll"));
+    BOOST_CHECK_EQUAL(nSocketEventsMode, SOCKETEVENTS_EPOLL);
+    BOOST_CHECK_EQUAL(GetSocketEventsMaxConnections(100000, 151), 100000);
+
+    // Out of descriptors, epoll can't be set up: select is used, and capped like it
+    int fd = open("/dev/null", O_RDONLY);
+    BOOST_REQUIRE(fd >= 0);
+    close(fd);
+    struct rlimit limit;
+    BOOST_REQUIRE(getrlimit(RLIMIT_NOFILE, &limit) == 0);
+    struct rlimit limitLow = limit;
+    limitLow.rlim_cur = fd;
+    BOOST_REQUIRE(setrlimit(RLIMIT_NOFILE, &limitLow) == 0);
+    bool fSet = SetSocketEventsMode("epoll");
+    BOOST_REQUIRE(setrlimit(RLIMIT_NOFILE, &limit) == 0);
+    BOOST_CHECK(fSet);
+    BOOST_CHECK_EQUAL(nSocketEventsMode, SOCKETEVENTS_SELECT);
+    BOOST_CHECK_EQUAL(GetSocketEventsMaxConnections(100000, 151), (int)FD_SETSIZE - 151);
+#endif
+
+    BOOST_CHECK(SetSocketEventsMode("select"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+#endif
@@ -0,0 +1,114 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "script/sigbatch.h"
+
+#include "script/sigcache.h"
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(sigbatch_tests)
+
+BOOST_AUTO_TEST_CASE(sigbatch_verify)
+{
+    InitSignatureBatch();
+
+    CSignatureBatch batch;
+    batch.Start(8);
+
+    CKey key;
+    key.MakeNewKey(true);
+    CKey keyUncompressed;
+    keyUncompressed.MakeNewKey(false);
+
+    std::vector<uint256> vHashes;
+    for (unsigned int i = 0; i < 6; i++) {
+        uint256 hash = GetRandHash();
+        const CKey& keySign = i % 2 ? keyUncompressed : key;
+        std::vector<unsigned char> vchSig;
+        BOOST_CHECK(keySign.Sign(hash, vchSig));
+        BOOST_CHECK(keySign.GetPubKey().Verify(hash, vchSig));
+
+        uint32_t nOwner = batch.AddOwner(1, i);
+        // owner 4 signs something other than what is checked
+        BOOST_CHECK(batch.Add(vchSig, keySign.GetPubKey(), i == 4 ? GetRandHash() : hash, nOwner));
+    }
+    BOOST_CHECK_EQUAL(batch.size(), 6U);
+
+    batch.Verify(0, 3);
+    batch.Verify(3, batch.size());
+    std::vector<uint32_t> vFailed;
+    batch.GetFailedOwners(vFailed);
+    BOOST_CHECK_EQUAL(vFailed.size(), 1U);
+    BOOST_CHECK_EQUAL(vFailed[0], 4U);
+    BOOST_CHECK(batch.GetOwner(4) == std::make_pair(1U, 4U));
+}
+
+BOOST_AUTO_TEST_CASE(sigbatch_capacity)
+{
+    CSignatureBatch batch;
+    batch.Start(2);
+
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    uint32_t nOwner = batch.AddOwner(1, 0);
+    BOOST_CHECK(batch.Add(vchSig, key.GetPubKey(), hash, nOwner));
+    BOOST_CHECK(batch.Add(vchSig, key.GetPubKey(), hash, nOwner));
+    // full: the caller verifies on its own
+    BOOST_CHECK(!batch.Add(vchSig, key.GetPubKey(), hash, nOwner));
+    BOOST_CHECK_EQUAL(batch.size(), 2U);
+
+    // too short to be a DER signature
+    batch.Start(2);
+    BOOST_CHECK(!batch.Add(std::vector<unsigned char>(4, 0x30), key.GetPubKey(), hash, nOwner));
+    BOOST_CHECK_EQUAL(batch.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(sigbatch_cache_store)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    CTransaction tx;
+    CSignatureBatch batch;
+    batch.Start(8);
+    uint32_t nOwner = batch.AddOwner(1, 0);
+    BOOST_CHECK(CachingTransactionSignatureChecker(&tx, 0, true).VerifySignature(vchSig, key.GetPubKey(), hash));
+
+    // A checker that stores, as for a block that is only tested, keeps the hit
+    BOOST_CHECK(BatchingTransactionSignatureChecker(&tx, 0, &batch, nOwner, true).VerifySignature(vchSig, key.GetPubKey(), hash));
+    BOOST_CHECK(BatchingTransactionSignatureChecker(&tx, 0, &batch, nOwner, true).VerifySignature(vchSig, key.GetPubKey(), hash));
+    BOOST_CHECK_EQUAL(batch.size(), 0U);
+
+    // One connecting a block drops it, so the next check defers it to the batch
+    BOOST_CHECK(BatchingTransactionSignatureChecker(&tx, 0, &batch, nOwner, false).VerifySignature(vchSig, key.GetPubKey(), hash));
+    BOOST_CHECK_EQUAL(batch.size(), 0U);
+    BOOST_CHECK(BatchingTransactionSignatureChecker(&tx, 0, &batch, nOwner, false).VerifySignature(vchSig, key.GetPubKey(), hash));
+    BOOST_CHECK_EQUAL(batch.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(sigbatch_chunk_size)
+{
+    BOOST_CHECK_EQUAL(GetSignatureBatchChunkSize(0, 4), 8U);
+    BOOST_CHECK_EQUAL(GetSignatureBatchChunkSize(1000, 4), 31U);
+    BOOST_CHECK_EQUAL(GetSignatureBatchChunkSize(100000, 4), 128U);
+    BOOST_CHECK_EQUAL(GetSignatureBatchChunkSize(1000, 0), 125U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,8 +4,11 @@
 
 #define BOOST_TEST_MODULE Bitcoin2 Test Suite
 
+#include "crypto/quark.h"
+#include "crypto/sha256.h"
 #include "main.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -31,6 +34,8 @@ struct TestingSetup {
 
     TestingSetup() {
         SetupEnvironment();
+        SHA256AutoDetect();
+        QuarkAutoDetect();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(CBaseChainParams::UNITTEST);
@@ -51,6 +56,7 @@ struct TestingSetup {
         pwalletMain->LoadWallet(fFirstRun);
         RegisterValidationInterface(pwalletMain);
 #endif
+        InitSignatureCache();
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
@@ -0,0 +1,184 @@
+// Copyright (c) 2021 The Bitcoin 2 developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "coins.h"
+#include "main.h"
+#include "txdb.h"
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+/** A coin database whose writes can be made to fail */
+class CFailingCoinsViewDB : public CCoinsViewDB
+{
+public:
+    bool fFail;
+
+    CFailingCoinsViewDB(bool fBackgroundWrites) : CCoinsViewDB(1 << 20, true, true, fBackgroundWrites), fFail(false) {}
+    // The writer thread calls WriteCoins, so it has to be done before this class is gone
+    ~CFailingCoinsViewDB() { WaitForWrites(); }
+
+protected:
+    bool WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock, bool fSync)
+    {
+        if (fFail)
+            return false;
+        return CCoinsViewDB::WriteCoins(mapCoins, hashBlock, fSync);
+    }
+};
+
+void AddCoins(CCoinsViewCache& cache, const uint256& txid, CAmount nValue)
+{
+    CCoinsModifier coins = cache.ModifyCoins(txid);
+    coins->vout.resize(1);
+    coins->vout[0].nValue = nValue;
+    coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+    coins->nHeight = 1;
+}
+}
+
+BOOST_AUTO_TEST_SUITE(txdb_tests)
+
+BOOST_AUTO_TEST_CASE(coinsdb_background_writes)
+{
+    for (int i = 0; i < 2; i++) {
+        bool fBackgroundWrites = i == 1;
+        CCoinsViewDB db(1 << 20, true, true, fBackgroundWrites);
+        CCoinsViewCache cache(&db);
+        uint256 txid1(1), txid2(2);
+        {
+            CCoinsModifier coins = cache.ModifyCoins(txid1);
+            coins->vout.resize(1);
+            coins->vout[0].nValue = 100;
+            coins->vout[0].scriptPubKey = CScript() << OP_TRUE;
+            coins->nHeight = 1;
+        }
+        {
+            CCoinsModifier coins = cache.ModifyCoins(txid2);
+            coins->vout.resize(2);
+            coins->vout[1].nValue = 200;
+            coins->vout[1].scriptPubKey = CScript() << OP_TRUE;
+            coins->nHeight = 1;
+        }
+        cache.SetBestBlock(uint256(10));
+        BOOST_CHECK(cache.Flush());
+
+        // What was flushed is there right away, written yet or not
+        CCoins coins;
+        BOOST_CHECK(db.GetCoins(txid1, coins));
+        BOOST_CHECK_EQUAL(coins.vout[0].nValue, 100);
+        BOOST_CHECK(db.GetBestBlock() == uint256(10));
+
+        // and so is what was spent since, once flushed
+        cache.ModifyCoins(txid1)->vout[0].SetNull();
+        cache.SetBestBlock(uint256(11));
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(!db.HaveCoins(txid1));
+        BOOST_CHECK(db.HaveCoins(txid2));
+        BOOST_CHECK(db.GetBestBlock() == uint256(11));
+
+        // Once written, the database has the same
+        BOOST_CHECK(db.WaitForWrites());
+        BOOST_CHECK(!db.GetCoins(txid1, coins));
+        BOOST_CHECK(db.GetCoins(txid2, coins));
+        BOOST_CHECK_EQUAL(coins.vout[1].nValue, 200);
+        BOOST_CHECK(db.GetBestBlock() == uint256(11));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coinsdb_background_write_failure)
+{
+    CFailingCoinsViewDB db(true);
+    CCoinsViewCache cache(&db);
+    uint256 txid1(1), txid2(2);
+    AddCoins(cache, txid1, 100);
+    cache.SetBestBlock(uint256(10));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(db.WaitForWrites());
+
+    // The next write fails after the flush has handed its entries over
+    db.fFail = true;
+    cache.ModifyCoins(txid1)->vout[0].SetNull();
+    AddCoins(cache, txid2, 200);
+    cache.SetBestBlock(uint256(11));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!db.WaitForWrites());
+
+    // Reading coins fails, rather than answering from the database, which is still at block 10
+    CCoins coins;
+    BOOST_CHECK_THROW(db.GetCoins(txid1, coins), std::runtime_error);
+    BOOST_CHECK_THROW(db.GetCoins(txid2, coins), std::runtime_error);
+    BOOST_CHECK_THROW(db.HaveCoins(txid2), std::runtime_error);
+    BOOST_CHECK(db.GetBestBlock() == uint256(11));
+
+    // and so does every flush after it
+    CCoinsMap mapCoins;
+    BOOST_CHECK(!db.BatchWrite(mapCoins, uint256(12)));
+    BOOST_CHECK(!db.WaitForWrites());
+}
+
+BOOST_AUTO_TEST_CASE(blocktree_write_batch)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CBlockFileInfo info;
+    info.nBlocks = 3;
+    info.nSize = 1000;
+    std::vector<std::pair<int, const CBlockFileInfo*> > vFiles(1, std::make_pair(2, &info));
+
+    uint256 hash(7);
+    CBlockIndex index;
+    index.phashBlock = &hash;
+    index.nHeight = 5;
+    std::vector<const CBlockIndex*> vBlocks(1, &index);
+
+    BOOST_CHECK(db.WriteBatchSync(vFiles, 2, vBlocks));
+
+    CBlockFileInfo infoRead;
+    BOOST_CHECK(db.ReadBlockFileInfo(2, infoRead));
+    BOOST_CHECK_EQUAL(infoRead.nBlocks, 3U);
+    BOOST_CHECK_EQUAL(infoRead.nSize, 1000U);
+    int nLastFile = 0;
+    BOOST_CHECK(db.ReadLastBlockFile(nLastFile));
+    BOOST_CHECK_EQUAL(nLastFile, 2);
+
+    // Block index entries are stored under 'b' and their hash
+    CDiskBlockIndex diskindex;
+    BOOST_CHECK(db.Read(std::make_pair('b', hash), diskindex));
+    BOOST_CHECK_EQUAL(diskindex.nHeight, 5);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_index)
+{
+    CBlockTreeDB db(1 << 20, true);
+    CAddressIndexIteratorKey keyUnpaid(1, uint160(1)), keyPaid(2, uint160(2)), keyOther(1, uint160(3));
+    std::vector<std::pair<CAddressIndexIteratorKey, int> > vWrite;
+    vWrite.push_back(std::make_pair(keyUnpaid, 0));
+    vWrite.push_back(std::make_pair(keyPaid, 700000));
+    BOOST_CHECK(db.WriteSnapshotIndex(vWrite));
+
+    // Only addresses paid in the snapshot range have a record
+    int nHeightSeen = -1;
+    BOOST_CHECK(db.ReadSnapshotIndex(keyUnpaid, nHeightSeen));
+    BOOST_CHECK_EQUAL(nHeightSeen, 0);
+    BOOST_CHECK(db.ReadSnapshotIndex(keyPaid, nHeightSeen));
+    BOOST_CHECK_EQUAL(nHeightSeen, 700000);
+    BOOST_CHECK(!db.ReadSnapshotIndex(keyOther, nHeightSeen));
+
+    // A payment in the tip is not counted, the same as the HasTX scan up to the tip
+    BOOST_CHECK(IsSnapshotAddressUnpaid(0, 700000));
+    BOOST_CHECK(IsSnapshotAddressUnpaid(700000, 700000));
+    BOOST_CHECK(!IsSnapshotAddressUnpaid(700000, 700001));
+
+    BOOST_CHECK(db.EraseSnapshotIndex());
+    BOOST_CHECK(!db.ReadSnapshotIndex(keyUnpaid, nHeightSeen));
+    BOOST_CHECK(!db.ReadSnapshotIndex(keyPaid, nHeightSeen));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
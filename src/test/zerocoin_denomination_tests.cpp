@@ -494,4 +494,26 @@ BOOST_AUTO_TEST_CASE(zerocoin_spend_test99)
     nValueTarget += OneCoinAmount;
 }
 
+BOOST_AUTO_TEST_CASE(block_index_mint_count_test)
+{
+    cout << "Running block_index_mint_count_test...\n";
+
+    CBlockIndex indexes[3];
+    indexes[1].pprev = &indexes[0];
+    indexes[2].pprev = &indexes[1];
+
+    indexes[0].vMintDenominationsInBlock = {ZQ_ONE};
+    indexes[1].vMintDenominationsInBlock = {};
+    indexes[2].vMintDenominationsInBlock = {ZQ_ONE, ZQ_FIVE, ZQ_ONE};
+    for (CBlockIndex& index : indexes)
+        index.BuildZerocoinMintCount();
+
+    BOOST_CHECK_EQUAL(indexes[0].GetZerocoinMintCount(ZQ_ONE), 1);
+    BOOST_CHECK_EQUAL(indexes[1].GetZerocoinMintCount(ZQ_ONE), 1);
+    BOOST_CHECK_EQUAL(indexes[2].GetZerocoinMintCount(ZQ_ONE), 3);
+    BOOST_CHECK_EQUAL(indexes[2].GetZerocoinMintCount(ZQ_FIVE), 1);
+    BOOST_CHECK_EQUAL(indexes[2].GetZerocoinMintCount(ZQ_TWO_THOUSAND), 0);
+    BOOST_CHECK_EQUAL(indexes[2].GetZerocoinMintCount(ZQ_ERROR), 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
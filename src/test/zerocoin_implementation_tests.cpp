@@ -263,6 +263,68 @@ BOOST_AUTO_TEST_CASE(checkzerocoinspend_test)
     BOOST_CHECK_MESSAGE(strError == "Transaction spend more than was redeemed in zerocoins", str);
 }
 
+BOOST_AUTO_TEST_CASE(zerocoinspend_cache_test)
+{
+    CBigNum bnpubcoin;
+    BOOST_CHECK(bnpubcoin.SetHexBool(rawTxpub1));
+    PublicCoin pubCoin(Params().Zerocoin_Params(), bnpubcoin, CoinDenomination::ZQ_FIVECENTS);
+
+    Accumulator accumulator(Params().Zerocoin_Params(), CoinDenomination::ZQ_FIVECENTS);
+    Accumulator accumulatorEmpty(Params().Zerocoin_Params(), CoinDenomination::ZQ_FIVECENTS);
+    AccumulatorWitness witness(Params().Zerocoin_Params(), accumulator, pubCoin);
+    CValidationState state;
+    for (pair<string, string> raw : vecRawMints) {
+        CTransaction tx;
+        BOOST_CHECK(DecodeHexTx(tx, raw.first));
+        for (const CTxOut out : tx.vout) {
+            if (!out.scriptPubKey.empty() && out.scriptPubKey.IsZerocoinMint()) {
+                PublicCoin publicCoin(Params().Zerocoin_Params());
+                BOOST_CHECK(TxOutToPublicCoin(out, publicCoin, state));
+                accumulator += publicCoin;
+                witness += publicCoin;
+            }
+        }
+    }
+
+    PrivateCoin privateCoin(Params().Zerocoin_Params(), pubCoin.getDenomination());
+    privateCoin.setPublicCoin(pubCoin);
+    privateCoin.setRandomness(CBigNum(rawTxRand1));
+    privateCoin.setSerialNumber(CBigNum(rawTxSerial1));
+
+    // A spend of the coin, signing the outputs of its transaction
+    CMutableTransaction txNew;
+    txNew.vout.push_back(CTxOut(1 * COIN, CScript()));
+    uint32_t nChecksum = GetChecksum(accumulator.getValue());
+    CoinSpend coinSpend(Params().Zerocoin_Params(), privateCoin, accumulator, nChecksum, witness, txNew.GetHash());
+    CDataStream ssSpend(SER_NETWORK, PROTOCOL_VERSION);
+    ssSpend << coinSpend;
+    std::vector<unsigned char> data(ssSpend.begin(), ssSpend.end());
+    CTxIn txin;
+    txin.nSequence = coinSpend.getDenomination();
+    txin.scriptSig = CScript() << OP_ZEROCOINSPEND << data.size();
+    txin.scriptSig.insert(txin.scriptSig.end(), data.begin(), data.end());
+    txNew.vin.push_back(txin);
+    CTransaction tx(txNew);
+
+    zerocoinDB = new CZerocoinDB(0, true);
+    BOOST_CHECK(zerocoinDB->WriteAccumulatorValue(nChecksum, accumulator.getValue()));
+
+    // The proof is left to the caller, and only verifies against the accumulator it was made with
+    std::vector<CZerocoinSpendCheck> vChecks;
+    BOOST_CHECK(CheckZerocoinSpend(tx, true, state, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+    BOOST_CHECK(!CZerocoinSpendCheck(tx.vin[0], accumulatorEmpty.getValue(), uint256())());
+    BOOST_CHECK(vChecks[0]());
+
+    // Once it verified, it is not checked again
+    std::vector<CZerocoinSpendCheck> vChecksCached;
+    BOOST_CHECK(CheckZerocoinSpend(tx, true, state, &vChecksCached));
+    BOOST_CHECK(vChecksCached.empty());
+
+    delete zerocoinDB;
+    zerocoinDB = NULL;
+}
+
 
 BOOST_AUTO_TEST_CASE(setup_exceptions_test)
 {
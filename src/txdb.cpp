@@ -27,40 +27,89 @@ static const char DB_ADDRESSUNSPENTINDEX = 'u';
 static const char DB_TIMESTAMPINDEX = 'S';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_SNAPSHOTINDEX = 'a';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe, bool fBackgroundWritesIn) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe),
+                                                                                                   fBackgroundWrites(fBackgroundWritesIn), fPending(false), fWriteFailed(false), fStopWriter(false)
 {
+    if (fBackgroundWrites)
+        threadWriter = boost::thread(boost::bind(&CCoinsViewDB::ThreadWriteCoins, this));
+}
+
+CCoinsViewDB::~CCoinsViewDB()
+{
+    if (!fBackgroundWrites)
+        return;
+    // The writer finishes what is pending before it stops
+    {
+        boost::unique_lock<boost::mutex> lock(csPending);
+        fStopWriter = true;
+    }
+    condPending.notify_all();
+    threadWriter.join();
+    if (fWriteFailed)
+        LogPrintf("%s: the coin database is behind the last flush, as writing it failed\n", __func__);
+}
+
+void CCoinsViewDB::CheckWritten() const
+{
+    // The database is behind what was flushed to it, so any answer read from it may be wrong
+    if (fWriteFailed)
+        throw std::runtime_error("the coin database could not be written, it is not up to date");
 }
 
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
+    if (fBackgroundWrites) {
+        boost::unique_lock<boost::mutex> lock(csPending);
+        CheckWritten();
+        CCoinsMap::const_iterator it = mapPending.find(txid);
+        if (it != mapPending.end()) {
+            if (it->second.coins.IsPruned())
+                return false;
+            coins = it->second.coins;
+            return true;
+        }
+    }
     return db.Read(make_pair(DB_COINS, txid), coins);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
+    if (fBackgroundWrites) {
+        boost::unique_lock<boost::mutex> lock(csPending);
+        CheckWritten();
+        CCoinsMap::const_iterator it = mapPending.find(txid);
+        if (it != mapPending.end())
+            return !it->second.coins.IsPruned();
+    }
     return db.Exists(make_pair(DB_COINS, txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
 {
+    if (fBackgroundWrites) {
+        boost::unique_lock<boost::mutex> lock(csPending);
+        if ((fPending || fWriteFailed) && hashPending != uint256(0))
+            return hashPending;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256(0);
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+bool CCoinsViewDB::WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock, bool fSync)
 {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             if (it->second.coins.IsPruned())
                 batch.Erase(make_pair(DB_COINS, it->first));
@@ -69,14 +118,84 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
     }
     if (hashBlock != uint256(0))
          batch.Write(DB_BEST_BLOCK, hashBlock);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    return db.WriteBatch(batch, fSync);
+}
+
+bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    if (!fBackgroundWrites) {
+        bool fOk = WriteCoins(mapCoins, hashBlock, false);
+        mapCoins.clear();
+        return fOk;
+    }
+
+    boost::unique_lock<boost::mutex> lock(csPending);
+    while (fPending)
+        condPending.wait(lock);
+    if (fWriteFailed)
+        return false;
+    mapPending.swap(mapCoins);
+    mapCoins.clear();
+    hashPending = hashBlock;
+    fPending = true;
+    condPending.notify_all();
+    return true;
+}
+
+bool CCoinsViewDB::WaitForWrites() const
+{
+    if (!fBackgroundWrites)
+        return true;
+    boost::unique_lock<boost::mutex> lock(csPending);
+    while (fPending)
+        condPending.wait(lock);
+    return !fWriteFailed;
+}
+
+void CCoinsViewDB::ThreadWriteCoins()
+{
+    RenameThread("btc2-coinswriter");
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(csPending);
+            while (!fPending && !fStopWriter)
+                condPending.wait(lock);
+            if (!fPending)
+                return;
+        }
+
+        // Readers only look up mapPending, and nothing else changes it while
+        // fPending is set, so it is written without holding the lock. The
+        // write is synced, as it is off the path of validation anyway.
+        int64_t nStart = GetTimeMicros();
+        bool fOk = false;
+        try {
+            fOk = WriteCoins(mapPending, hashPending, true);
+        } catch (const std::exception& e) {
+            LogPrintf("%s: %s\n", __func__, e.what());
+        }
+        if (!fOk)
+            LogPrintf("%s: failed to write to coin database\n", __func__);
+        LogPrint("bench", "- Background coin write: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+
+        {
+            boost::unique_lock<boost::mutex> lock(csPending);
+            // A failed write keeps its entries, and reading coins throws from now on, which
+            // CCoinsViewErrorCatcher turns into an abort before anything is validated against
+            // what the database has. The next flush or WaitForWrites() fails as well.
+            if (fOk)
+                CCoinsMap().swap(mapPending);
+            else
+                fWriteFailed = true;
+            fPending = false;
+        }
+        condPending.notify_all();
+    }
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
@@ -85,7 +204,21 @@ CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWra
 
 bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
 {
-    return Write(make_pair(DB_BLOCK_INDEX, blockindex.GetBlockHash()), blockindex);
+    return Write(make_pair(DB_BLOCK_INDEX, blockindex.hashBlock.IsNull() ? blockindex.GetBlockHash() : blockindex.hashBlock), blockindex);
+}
+
+bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo)
+{
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it = fileInfo.begin(); it != fileInfo.end(); it++) {
+        batch.Write(make_pair(DB_BLOCK_FILES, it->first), *it->second);
+    }
+    batch.Write(DB_LAST_BLOCK, nLastFile);
+    for (std::vector<const CBlockIndex*>::const_iterator it = blockinfo.begin(); it != blockinfo.end(); it++) {
+        CDiskBlockIndex blockindex(*it);
+        batch.Write(make_pair(DB_BLOCK_INDEX, blockindex.hashBlock.IsNull() ? blockindex.GetBlockHash() : blockindex.hashBlock), blockindex);
+    }
+    return WriteBatch(batch, true);
 }
 
 bool CBlockTreeDB::WriteBlockFileInfo(int nFile, const CBlockFileInfo& info)
@@ -123,6 +256,10 @@ bool CBlockTreeDB::ReadLastBlockFile(int& nFile)
 }
 
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
+    // The statistics are of what is on disk
+    if (!WaitForWrites())
+        return false;
+
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
@@ -286,6 +423,41 @@ bool CBlockTreeDB::ReadAddressIndex(uint160 addressHash, int type, std::vector<s
     return true;
 }
 
+static bool ScanAddressEntries(CBlockTreeDB& db, char chIndex, uint160 addressHash, int type, const std::vector<unsigned char>& vchStart, const AddressIndexVisitor& visit)
+{
+    CDataStream ssSeek(SER_DISK, CLIENT_VERSION);
+    ssSeek << chIndex << CAddressIndexIteratorKey(type, addressHash);
+    const size_t nPrefixSize = ssSeek.size();
+    ssSeek.insert(ssSeek.end(), (const char*)begin_ptr(vchStart), (const char*)end_ptr(vchStart));
+
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(CFlatData(&ssSeek[0], &ssSeek[0] + ssSeek.size()));
+
+    // The entries are read in place, without deserializing them
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        const char* pchKey = pcursor->GetKeyData();
+        size_t nKeySize = pcursor->GetKeySize();
+        if (nKeySize < nPrefixSize || memcmp(pchKey, &ssSeek[0], nPrefixSize) != 0)
+            break;
+        if (!visit(pchKey + nPrefixSize, nKeySize - nPrefixSize, pcursor->GetValueData(), pcursor->GetValueSize()))
+            break;
+        pcursor->Next();
+    }
+
+    return true;
+}
+
+bool CBlockTreeDB::ScanAddressIndex(uint160 addressHash, int type, const std::vector<unsigned char>& vchStart, const AddressIndexVisitor& visit)
+{
+    return ScanAddressEntries(*this, DB_ADDRESSINDEX, addressHash, type, vchStart, visit);
+}
+
+bool CBlockTreeDB::ScanAddressUnspentIndex(uint160 addressHash, int type, const std::vector<unsigned char>& vchStart, const AddressIndexVisitor& visit)
+{
+    return ScanAddressEntries(*this, DB_ADDRESSUNSPENTINDEX, addressHash, type, vchStart, visit);
+}
+
 bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey& timestampIndex)
 {
     CDBBatch batch(*this);
@@ -313,6 +485,43 @@ bool CBlockTreeDB::ReadTimestampIndex(const unsigned int &high, const unsigned i
     return true;
 }
 
+/**
+ * The snapshot index holds one record per address paid in the snapshot range. The value is
+ * the first height at or after the fork at which the address was paid again, or 0 if never.
+ */
+bool CBlockTreeDB::WriteSnapshotIndex(const std::vector<std::pair<CAddressIndexIteratorKey, int> >& vect)
+{
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CAddressIndexIteratorKey, int> >::const_iterator it = vect.begin(); it != vect.end(); it++)
+        batch.Write(make_pair(DB_SNAPSHOTINDEX, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadSnapshotIndex(const CAddressIndexIteratorKey& key, int& nHeightSeen)
+{
+    return Read(make_pair(DB_SNAPSHOTINDEX, key), nHeightSeen);
+}
+
+bool CBlockTreeDB::EraseSnapshotIndex()
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_SNAPSHOTINDEX, CAddressIndexIteratorKey()));
+
+    CDBBatch batch(*this);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexIteratorKey> key;
+        if (pcursor->GetKey(key) && key.first == DB_SNAPSHOTINDEX) {
+            batch.Erase(key);
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    return WriteBatch(batch);
+}
 
 bool CBlockTreeDB::WriteFlag(const std::string& name, bool fValue)
 {
@@ -353,8 +562,10 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
             if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
                 CDiskBlockIndex diskindex;
                 if (pcursor->GetValue(diskindex)) {
+                    // The key is the block hash. Hashing every header again here made startup time grow
+                    // with the chain; ThreadCheckBlockIndexHashes does it in the background instead.
                     // Construct block index object
-                    CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
+                    CBlockIndex* pindexNew = InsertBlockIndex(key.second);
                     pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
                     pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
                     pindexNew->nHeight = diskindex.nHeight;
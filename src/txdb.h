@@ -16,30 +16,77 @@
 #include <utility>
 #include <vector>
 
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
 class CCoins;
 class uint256;
 
+/**
+ * Visitor of address index entries as they are stored: the key past the
+ * address, and the value. Returns false to stop.
+ */
+typedef boost::function<bool(const char* pchKey, size_t nKeySize, const char* pchValue, size_t nValueSize)> AddressIndexVisitor;
+
 //! -dbcache default (MiB)
 static const int64_t nDefaultDbCache = 100;
 //! max. -dbcache in (MiB)
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
-
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+//! -asyncflush default
+static const bool DEFAULT_ASYNC_FLUSH = false;
+
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/)
+ *
+ * With background writes, BatchWrite() only takes over the flushed entries
+ * and a thread of its own writes them. Until it is done they are served from
+ * memory, so validation goes on reading what it flushed. The entries and the
+ * best block are written in one batch, so after a crash the database is at
+ * the best block it records, and the blocks after it are connected again.
+ * A flush waits for the one before it to be written. If writing fails, the
+ * entries stay in memory but reading coins throws, as the database is behind.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
 
+    /** Write the dirty entries of mapCoins and the best block in one batch; virtual so that tests can fail it */
+    virtual bool WriteCoins(const CCoinsMap& mapCoins, const uint256& hashBlock, bool fSync);
+
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, bool fBackgroundWrites = false);
+    ~CCoinsViewDB();
 
     bool GetCoins(const uint256& txid, CCoins& coins) const;
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+
+    /** Wait until the entries handed to BatchWrite() are in the database. Returns false if writing them failed. */
+    bool WaitForWrites() const;
+
+private:
+    CCoinsViewDB(const CCoinsViewDB&);
+    void operator=(const CCoinsViewDB&);
+
+    /** Throw if a background write failed; requires csPending */
+    void CheckWritten() const;
+    void ThreadWriteCoins();
+
+    bool fBackgroundWrites;
+    mutable boost::mutex csPending;
+    mutable boost::condition_variable condPending;
+    //! Entries taken over by BatchWrite() and not written yet, protected by csPending
+    CCoinsMap mapPending;
+    uint256 hashPending;
+    bool fPending;
+    bool fWriteFailed;
+    bool fStopWriter;
+    boost::thread threadWriter;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -54,6 +101,8 @@ private:
 
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    /** Write block file information, the last block file and block index entries in one synced batch */
+    bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo& fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo& fileinfo);
     bool ReadLastBlockFile(int& nFile);
@@ -70,8 +119,14 @@ public:
     bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount>>& vect);
     bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount>>& vect);
     bool ReadAddressIndex(uint160 addressHash, int type, std::vector<std::pair<CAddressIndexKey, CAmount>>& addressIndex, int start = 0, int end = 0);
+    /** Visit the entries of an address in key order, from the first key past the address that is not less than vchStart */
+    bool ScanAddressIndex(uint160 addressHash, int type, const std::vector<unsigned char>& vchStart, const AddressIndexVisitor& visit);
+    bool ScanAddressUnspentIndex(uint160 addressHash, int type, const std::vector<unsigned char>& vchStart, const AddressIndexVisitor& visit);
     bool WriteTimestampIndex(const CTimestampIndexKey& timestampIndex);
     bool ReadTimestampIndex(const unsigned int &high, const unsigned int &low, std::vector<uint256> &vect);
+    bool WriteSnapshotIndex(const std::vector<std::pair<CAddressIndexIteratorKey, int> >& vect);
+    bool ReadSnapshotIndex(const CAddressIndexIteratorKey& key, int& nHeightSeen);
+    bool EraseSnapshotIndex();
 
     bool WriteFlag(const std::string& name, bool fValue);
     bool ReadFlag(const std::string& name, bool& fValue);
@@ -8,6 +8,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "addressindex.h"
 #include "amount.h"
@@ -16,6 +17,10 @@
 #include "spentindex.h"
 #include "sync.h"
 
+#include <boost/multi_index/identity.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index_container.hpp>
+
 
 class CAutoFile;
 
@@ -37,6 +42,11 @@ static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
 /**
  * CTxMemPool stores these:
+ *
+ * Each entry also tracks the in-mempool transactions that spend it, directly
+ * or indirectly. Evicting a transaction evicts those descendants with it, so
+ * the count, size and fees of the whole package are kept up to date here, and
+ * the package fee rate decides which transactions go first.
  */
 class CTxMemPoolEntry
 {
@@ -45,9 +55,15 @@ private:
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
+    size_t nUsageSize;    //! ... and total memory usage
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount feeDelta;     //! Fee added by prioritisetransaction, for mining only
+
+    uint64_t nCountWithDescendants; //! number of descendant transactions, including this one
+    uint64_t nSizeWithDescendants;  //! ... and their total size
+    CAmount nFeesWithDescendants;   //! ... and their total fees
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
@@ -58,10 +74,152 @@ public:
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
+    size_t DynamicMemoryUsage() const { return nUsageSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    CAmount GetModifiedFee() const { return nFee + feeDelta; }
+
+    /** Set the fee added by prioritisetransaction */
+    void UpdateFeeDelta(CAmount newFeeDelta) { feeDelta = newFeeDelta; }
+
+    /** Adjust the descendant state by the given deltas */
+    void UpdateState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetFeesWithDescendants() const { return nFeesWithDescendants; }
+};
+
+/** Helper for boost::multi_index_container::modify to change the descendant state of an entry */
+struct update_descendant_state {
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) : modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {
+    }
+
+    void operator()(CTxMemPoolEntry& e)
+    {
+        e.UpdateState(modifySize, modifyFee, modifyCount);
+    }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+/** Helper for boost::multi_index_container::modify to change the fee delta of an entry */
+struct update_fee_delta {
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) {}
+
+    void operator()(CTxMemPoolEntry& e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
+};
+
+/** Extracts a transaction hash from a CTxMemPoolEntry, to index the mempool by txid */
+struct mempoolentry_txid {
+    typedef uint256 result_type;
+    result_type operator()(const CTxMemPoolEntry& entry) const
+    {
+        return entry.GetTx().GetHash();
+    }
+};
+
+/**
+ * Sort an entry by the higher of its own fee rate and the fee rate of the
+ * package of it and its descendants, lowest first, so that the front of the
+ * index is what to evict first. Low fee children don't drag down a parent
+ * paying a high fee, while a child paying for its parent keeps the parent.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aFees = fUseADescendants ? a.GetFeesWithDescendants() : a.GetFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+        double bFees = fUseBDescendants ? b.GetFeesWithDescendants() : b.GetFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+
+        if (f1 == f2) {
+            // Of equal fee rates, evict the newer transaction first
+            return a.GetTime() > b.GetTime();
+        }
+        return f1 < f2;
+    }
+
+    /** Whether the package fee rate of an entry is higher than its own (avoiding division) */
+    bool UseDescendantScore(const CTxMemPoolEntry& a) const
+    {
+        double f1 = (double)a.GetFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+/** Sort an entry by its fee rate including prioritisetransaction deltas, highest first, to fill blocks */
+class CompareTxMemPoolEntryByScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double f1 = (double)a.GetModifiedFee() * b.GetTxSize();
+        double f2 = (double)b.GetModifiedFee() * a.GetTxSize();
+        if (f1 == f2) {
+            return b.GetTx().GetHash() < a.GetTx().GetHash();
+        }
+        return f1 > f2;
+    }
 };
 
+class CompareTxMemPoolEntryByEntryTime
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        return a.GetTime() < b.GetTime();
+    }
+};
+
+// Multi_index tags
+struct descendant_score {};
+struct mining_score {};
+struct entry_time {};
+
+/**
+ * The mempool entries, by txid, by descendant score for eviction, by mining
+ * score for block assembly and by entry time for expiry
+ */
+typedef boost::multi_index_container<
+    CTxMemPoolEntry,
+    boost::multi_index::indexed_by<
+        // sorted by txid
+        boost::multi_index::ordered_unique<mempoolentry_txid>,
+        // sorted by fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<descendant_score>,
+            boost::multi_index::identity<CTxMemPoolEntry>,
+            CompareTxMemPoolEntryByDescendantScore>,
+        // sorted by fee rate including prioritisation
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<mining_score>,
+            boost::multi_index::identity<CTxMemPoolEntry>,
+            CompareTxMemPoolEntryByScore>,
+        // sorted by entry time
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<entry_time>,
+            boost::multi_index::identity<CTxMemPoolEntry>,
+            CompareTxMemPoolEntryByEntryTime> > >
+    indexed_transaction_set;
+
 class CMinerPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -94,6 +252,16 @@ public:
  * are added to the pool: if a new transaction double-spends
  * an input of a transaction in the pool, it is dropped,
  * as are non-standard transactions.
+ *
+ * The pool is bounded in memory: TrimToSize() evicts the packages with the
+ * lowest descendant score until DynamicMemoryUsage() fits the limit, and
+ * raises a rolling minimum fee rate (see GetMinFee()) so that what was just
+ * evicted cannot come straight back. The minimum decays with a half life of
+ * ROLLING_FEE_HALFLIFE once a block has been connected since the last bump.
+ * Expire() drops transactions that have been waiting too long.
+ *
+ * mapLinks holds the in-mempool parents and children of every entry, so
+ * descendants are found by walking the links instead of mapNextTx.
  */
 class CTxMemPool
 {
@@ -104,14 +272,43 @@ private:
 
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
+    uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee rate in satoshis per 1000 bytes to get into the pool
 
 public:
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12; // public only for testing
+
     mutable CCriticalSection cs;
-    std::map<uint256, CTxMemPoolEntry> mapTx;
+    indexed_transaction_set mapTx;
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+    struct CompareIteratorByHash {
+        bool operator()(const txiter& a, const txiter& b) const
+        {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
 private:
+    typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
+
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+
     typedef std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> addressDeltaMap;
     addressDeltaMap mapAddress;
 
@@ -137,7 +334,13 @@ public:
     void check(const CCoinsViewCache* pcoins) const;
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
+    /**
+     * Add to the pool without checking anything. The first form looks up the
+     * in-mempool ancestors itself; the second takes those already found by
+     * CalculateMemPoolAncestors().
+     */
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
+    bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry, setEntries& setAncestors);
 
     void addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
     bool getAddressIndex(std::vector<std::pair<uint160, int> > &addresses,
@@ -154,6 +357,44 @@ public:
     void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
+    /** Copy every entry, oldest first but each after its in-mempool parents, so they can be accepted again in order */
+    void queryEntries(std::vector<CTxMemPoolEntry>& vEntries) const;
+
+    /**
+     * When transactions of a disconnected block come back into the pool,
+     * entries already in it may spend them. Link those children to them and
+     * count them as their descendants. vHashesToUpdate are the transactions
+     * of the block that were added back, in block order.
+     */
+    void UpdateTransactionsFromBlock(const std::vector<uint256>& vHashesToUpdate);
+
+    /**
+     * Find all in-mempool ancestors of entry, and check them against the
+     * limits. Returns false with errString set if a limit would be exceeded.
+     * If fSearchForParents is false, entry must be in the pool already.
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry& entry, setEntries& setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string& errString, bool fSearchForParents = true);
+
+    /** Add the given entry and all its in-mempool descendants to setDescendants */
+    void CalculateDescendants(txiter it, setEntries& setDescendants);
+
+    /** Remove a set of entries, which must contain all their in-mempool descendants */
+    void RemoveStaged(setEntries& stage);
+
+    /**
+     * The minimum fee rate to get into the pool, which may be above the
+     * relay fee if transactions were evicted to keep it under sizelimit.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /** Evict the lowest scoring packages until the pool takes at most sizelimit bytes */
+    void TrimToSize(size_t sizelimit);
+
+    /** Remove transactions that entered the pool before time, and their descendants. Returns the number removed. */
+    int Expire(int64_t time);
+
+    const setEntries& GetMemPoolParents(txiter entry) const;
+    const setEntries& GetMemPoolChildren(txiter entry) const;
     void pruneSpent(const uint256& hash, CCoins& coins);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
@@ -174,6 +415,8 @@ public:
         return totalTxSize;
     }
 
+    size_t DynamicMemoryUsage() const;
+
     bool exists(uint256 hash)
     {
         LOCK(cs);
@@ -182,6 +425,19 @@ public:
 
     bool lookup(uint256 hash, CTransaction& result) const;
 
+private:
+    /** Add or remove an entry from the descendant state of its ancestors, and link or unlink it from its parents */
+    void UpdateAncestorsOf(bool add, txiter hash, setEntries& setAncestors);
+    /** Count the in-mempool descendants of updateIt that are not in setExclude in its descendant state */
+    void UpdateForDescendants(txiter updateIt, cacheMap& cachedDescendants, const std::set<uint256>& setExclude);
+    /** Take the entries about to be removed out of the state of their ancestors and children */
+    void UpdateForRemoveFromMempool(const setEntries& entriesToRemove);
+    void UpdateChildrenForRemoval(txiter entry);
+    void removeUnchecked(txiter entry);
+    void trackPackageRemoved(const CFeeRate& rate);
+
+public:
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
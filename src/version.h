@@ -14,7 +14,7 @@ const int REWARDFORK_BLOCK = 1141660; // Introduced for protocol 70914
  * network protocol versioning
  */
 
-const int PROTOCOL_VERSION = 70914;
+const int PROTOCOL_VERSION = 70915;
 
 //! initial proto version, to be increased after version/verack negotiation
 const int INIT_PROTO_VERSION = 209;
@@ -22,6 +22,9 @@ const int INIT_PROTO_VERSION = 209;
 //! In this version, 'getheaders' was introduced.
 const int GETHEADERS_VERSION = 70077;
 
+//! In this version, 'getheaders' is answered with 'headers', and blocks are downloaded headers first
+const int HEADERS_FIRST_VERSION = 70915;
+
 //! disconnect from peers older than this proto version
 const int MIN_PEER_PROTO_VERSION_BEFORE_ENFORCEMENT = 70913;
 const int MIN_PEER_PROTO_VERSION_AFTER_ENFORCEMENT = 70914;
@@ -10,6 +10,7 @@
 
 #include "accumulators.h"
 #include "base58.h"
+#include "blockscanner.h"
 #include "checkpoints.h"
 #include "coincontrol.h"
 #include "kernel.h"
@@ -29,6 +30,7 @@
 #include <assert.h>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/filesystem/operations.hpp>
 
@@ -738,6 +740,89 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
     }
 }
 
+void CWallet::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    // Validation doesn't wait for the witnesses, ThreadZerocoinWitnesses picks this up
+    fZerocoinWitnessesStale = true;
+}
+
+void CWallet::UpdateZerocoinWitnessesIfStale()
+{
+    if (fZerocoinWitnessesStale.exchange(false))
+        UpdateZerocoinWitnesses();
+}
+
+/**
+ * Advance the cached witnesses of the unspent zerocoin mints to the new tip, so spends only add the last blocks.
+ * Mints whose witness was left where the tip needs it are not read again, and the witnesses that changed
+ * are written in one wallet transaction.
+ */
+void CWallet::UpdateZerocoinWitnesses()
+{
+    if (!fFileBacked)
+        return;
+
+    CWalletDB walletdb(strWalletFile);
+    list<CZerocoinMint> listMints = walletdb.ListMintedCoins(true, false, false);
+    std::map<CBigNum, std::pair<int, uint256> > mapTips;
+    std::vector<std::pair<CBigNum, CAccumulatorWitnessCache> > vChanged;
+    for (const CZerocoinMint& mint : listMints) {
+        boost::this_thread::interruption_point();
+        std::map<CBigNum, std::pair<int, uint256> >::const_iterator it = mapZerocoinWitnessTips.find(mint.GetValue());
+        if (it != mapZerocoinWitnessTips.end()) {
+            LOCK(cs_main);
+            if (IsAccumulatorWitnessCacheCurrent(it->second.first, it->second.second)) {
+                mapTips.insert(*it);
+                continue;
+            }
+        }
+
+        libzerocoin::PublicCoin pubcoin(Params().Zerocoin_Params(), mint.GetValue(), mint.GetDenomination());
+        CAccumulatorWitnessCache witnessCache;
+        walletdb.ReadZerocoinWitness(mint.GetValue(), witnessCache);
+
+        bool fChanged;
+        {
+            LOCK(cs_main);
+            fChanged = UpdateAccumulatorWitnessCache(pubcoin, witnessCache);
+        }
+        if (!witnessCache.IsNull())
+            mapTips[mint.GetValue()] = std::make_pair(witnessCache.state.nHeight, witnessCache.hashBlockLast);
+        if (fChanged)
+            vChanged.push_back(std::make_pair(mint.GetValue(), witnessCache));
+    }
+
+    bool fOk = true;
+    if (!vChanged.empty()) {
+        fOk = walletdb.TxnBegin();
+        for (unsigned int i = 0; fOk && i < vChanged.size(); i++) {
+            if (vChanged[i].second.IsNull())
+                walletdb.EraseZerocoinWitness(vChanged[i].first);
+            else
+                fOk = walletdb.WriteZerocoinWitness(vChanged[i].first, vChanged[i].second);
+        }
+        if (fOk)
+            fOk = walletdb.TxnCommit();
+        else
+            walletdb.TxnAbort();
+    }
+    if (!fOk) {
+        LogPrintf("%s : failed to write the witnesses of %u mints\n", __func__, vChanged.size());
+        // Nothing is known to be current then, so every mint is read again on the next tip
+        mapTips.clear();
+    }
+    mapZerocoinWitnessTips.swap(mapTips);
+}
+
+void ThreadZerocoinWitnesses(CWallet* pwallet)
+{
+    RenameThread("bitcoin2-zcwitness");
+    while (true) {
+        MilliSleep(1000);
+        pwallet->UpdateZerocoinWitnessesIfStale();
+    }
+}
+
 void CWallet::EraseFromWallet(const uint256& hash)
 {
     if (!fFileBacked)
@@ -1456,6 +1541,8 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
     int ret = 0;
     int64_t nNow = GetTime();
+    double dProgressStart;
+    double dProgressTip;
 
     CBlockIndex* pindex = pindexStart;
     {
@@ -1467,29 +1554,40 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
             pindex = chainActive.Next(pindex);
 
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
-        while (pindex) {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH (CTransaction& tx, block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
-            }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
-            }
-        }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        dProgressStart = Checkpoints::GuessVerificationProgress(pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainActive.Tip(), false);
     }
+
+    // Blocks are read and deserialized in parallel; cs_main and cs_wallet are only
+    // taken while each block's transactions are added, in height order.
+    CBlockScanner scanner;
+    scanner.Scan(pindex, NULL, CBlockScanner::MatchFunction(),
+        boost::bind(&CWallet::ScanBlockForWalletTransactions, this, _1, _2, fUpdate, dProgressStart, dProgressTip, boost::ref(ret), boost::ref(nNow)));
+
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
+bool CWallet::ScanBlockForWalletTransactions(const CBlock& block, CBlockIndex* pindex, bool fUpdate, double dProgressStart, double dProgressTip, int& nFound, int64_t& nNow)
+{
+    if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+        ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+    {
+        LOCK2(cs_main, cs_wallet);
+        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+            if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                nFound++;
+        }
+    }
+
+    if (GetTime() >= nNow + 60) {
+        nNow = GetTime();
+        LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(pindex));
+    }
+    return true;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     LOCK2(cs_main, cs_wallet);
@@ -2990,111 +3088,115 @@ CAmount CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits,
 
 	unsigned int StartTime = GetTime();
 
-    BOOST_FOREACH (PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setStakeCoins)
+	// Collect the kernel inputs of every coin under a single cs_main lock
+	std::vector<pair<const CWalletTx*, unsigned int> > vStakeCoins;
+	std::vector<CStakeCandidate> vCandidates;
+	uint256 nStakeModifierV2;
 	{
-		// Make sure a new block has not come in and shutdown hasn't been requested
-		CBlockIndex* pindex = NULL;
-		{
-			LOCK(cs_main);
-			if (ShutdownRequested() || CurrentHeight != chainActive.Height())
-				return 0;
+		LOCK(cs_main);
+		if (ShutdownRequested() || CurrentHeight != chainActive.Height())
+			return 0;
+		nStakeModifierV2 = pCurrentIndex->nStakeModifierV2;
 
+		vStakeCoins.reserve(setStakeCoins.size());
+		vCandidates.reserve(setStakeCoins.size());
+		BOOST_FOREACH (PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setStakeCoins)
+		{
 			BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
-			if (it != mapBlockIndex.end())
-				pindex = it->second;
-			else {
+			if (it == mapBlockIndex.end()) {
 				if (fDebug)
 					LogPrintf("CreateCoinStake() failed to find block index \n");
 				continue;
 			}
+			vStakeCoins.push_back(pcoin);
+			vCandidates.push_back(CStakeCandidate(COutPoint(pcoin.first->GetHash(), pcoin.second), pcoin.first->vout[pcoin.second].nValue, it->second->nTime));
 		}
+	}
 
-        bool fKernelFound = false;
-        uint256 hashProofOfStake = 0;
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetTime();
-
-		fKernelFound = CheckStakeKernelHashV3(nBits, chainActive.Tip()->nStakeModifierV2, nStakeModifier, pindex->nTime, pcoin.first->vout[prevoutStake.n].nValue, prevoutStake, nTxNewTime, false, hashProofOfStake);
+	// Hash all coins in parallel; stops early if a new block comes in
+	std::vector<CStakeKernel> vKernels;
+	CStakeKernelSearch search(nBits, nStakeModifierV2, nStakeModifier, CurrentHeight, pCurrentIndex->nTime);
+	if (!search.Search(vCandidates, StartTime, vKernels))
+		return 0;
 
-		if (fKernelFound) {
-			fKernelFound = false; // Set it back to false for now in case error checks fail.
+	BOOST_FOREACH (const CStakeKernel& kernel, vKernels)
+	{
+		PAIRTYPE(const CWalletTx*, unsigned int) pcoin = vStakeCoins[kernel.nCandidate];
+		nTxNewTime = kernel.nTime;
 
-            //Double check that this will pass time requirements
-            if (nTxNewTime < pCurrentIndex->nTime) {
-                LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
-                continue;
-            }
+		//Double check that this will pass time requirements
+		if (nTxNewTime < pCurrentIndex->nTime) {
+			LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
+			continue;
+		}
 
 
-			// Can accept at most 3 blocks with the same time stamp.
-			CBlockIndex* aBlockIndex = pCurrentIndex;
-			bool TooManyBlocksWithSameTimeStamp = true;
-			for (int i = 0; i < 3; ++i)
+		// Can accept at most 3 blocks with the same time stamp.
+		CBlockIndex* aBlockIndex = pCurrentIndex;
+		bool TooManyBlocksWithSameTimeStamp = true;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (aBlockIndex->nTime < nTxNewTime)
 			{
-				if (aBlockIndex->nTime < nTxNewTime)
-				{
-					TooManyBlocksWithSameTimeStamp = false;
-					break;
-				}
-				aBlockIndex = aBlockIndex->pprev;
-				if (!aBlockIndex) break;
+				TooManyBlocksWithSameTimeStamp = false;
+				break;
 			}
+			aBlockIndex = aBlockIndex->pprev;
+			if (!aBlockIndex) break;
+		}
 
-			if (TooManyBlocksWithSameTimeStamp) continue;
+		if (TooManyBlocksWithSameTimeStamp) continue;
 
-            vector<valtype> vSolutions;
-            txnouttype whichType;
-            CScript scriptPubKeyOut;
-            scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-            if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
-                LogPrintf("CreateCoinStake : failed to parse kernel\n");
-				continue;
-            }
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
-            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
-                if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
-				continue; // only support pay to public key and pay to address
-            }
-            if (whichType == TX_PUBKEYHASH) // pay to address type
-            {
-                //convert to pay to public key type
-                CKey key;
-                if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-					continue; // unable to find corresponding public key
-                }
+		vector<valtype> vSolutions;
+		txnouttype whichType;
+		CScript scriptPubKeyOut;
+		scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
+		if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
+			LogPrintf("CreateCoinStake : failed to parse kernel\n");
+			continue;
+		}
+		if (fDebug && GetBoolArg("-printcoinstake", false))
+			LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
+		if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
+			if (fDebug && GetBoolArg("-printcoinstake", false))
+				LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
+			continue; // only support pay to public key and pay to address
+		}
+		if (whichType == TX_PUBKEYHASH) // pay to address type
+		{
+			//convert to pay to public key type
+			CKey key;
+			if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
+				if (fDebug && GetBoolArg("-printcoinstake", false))
+					LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+				continue; // unable to find corresponding public key
+			}
 
-                scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-            }
-			else scriptPubKeyOut = scriptPubKeyKernel;
+			scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+		}
+		else scriptPubKeyOut = scriptPubKeyKernel;
 
-            txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-            nCredit = pcoin.first->vout[pcoin.second].nValue;
-            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+		txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
+		nCredit = pcoin.first->vout[pcoin.second].nValue;
+		txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
 
-            //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
-            uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + (GetBlockValue(UpcomingHeight) / 4 * 3);
+		//presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
+		uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + (GetBlockValue(UpcomingHeight) / 4 * 3);
 
-			std::string RewardCutsAddress = GetArg("-sendrewardcutsto", "");
-			if (!RewardCutsAddress.empty())
-			{
-				// Used by the bitc2.org web wallet.
-				CBitcoinAddress anAddress(RewardCutsAddress);
-				
-				CScript aScriptPubKey = GetScriptForDestination(anAddress.Get());
-				txNew.vout.push_back(CTxOut(0, aScriptPubKey));
-			}
-            else if (nTotalSize / 2 > nStakeSplitThreshold * COIN) txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+		std::string RewardCutsAddress = GetArg("-sendrewardcutsto", "");
+		if (!RewardCutsAddress.empty())
+		{
+			// Used by the bitc2.org web wallet.
+			CBitcoinAddress anAddress(RewardCutsAddress);
 
+			CScript aScriptPubKey = GetScriptForDestination(anAddress.Get());
+			txNew.vout.push_back(CTxOut(0, aScriptPubKey));
+		}
+		else if (nTotalSize / 2 > nStakeSplitThreshold * COIN) txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
 
-            fKernelFound = true;
-            break;
-        }
-        if (fKernelFound) break; // if kernel is found stop searching
-    }
+
+		break; // kernel is found, stop searching
+	}
 
 	LastHashedBlockHeight = CurrentHeight;
 	// store a timestamp of the max attempted hash's timestamp on this block.
@@ -4667,7 +4769,10 @@ bool CWallet::MintToTxIn(CZerocoinMint zerocoinSelected, int nSecurityLevel, con
     libzerocoin::AccumulatorWitness witness(Params().Zerocoin_Params(), accumulator, pubCoinSelected);
     string strFailReason = "";
     int nMintsAdded = 0;
-    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason)) {
+    CAccumulatorWitnessCache witnessCache;
+    if (fFileBacked)
+        CWalletDB(strWalletFile).ReadZerocoinWitness(pubCoinSelected.getValue(), witnessCache);
+    if (!GenerateAccumulatorWitness(pubCoinSelected, accumulator, witness, nSecurityLevel, nMintsAdded, strFailReason, &witnessCache)) {
         receipt.SetStatus(_("Try to spend with a higher security level to include more coins"), ZBTC2_FAILED_ACCUMULATOR_INITIALIZATION);
         LogPrintf("%s : %s \n", __func__, receipt.GetStatusMessage());
         return false;
@@ -26,6 +26,7 @@
 #include "walletdb.h"
 
 #include <algorithm>
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -187,6 +188,11 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    //! Set on a new tip, until the witness thread has brought the cached zerocoin witnesses up to it
+    std::atomic<bool> fZerocoinWitnessesStale;
+    //! Where the cached witness of each unspent mint was last left, used by the witness thread only
+    std::map<CBigNum, std::pair<int, uint256> > mapZerocoinWitnessTips;
+
 public:
     bool MintableCoins();
     bool SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, CAmount nTargetAmount) const;
@@ -283,6 +289,7 @@ public:
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
         fBackupMints = false;
+        fZerocoinWitnessesStale = false;
 
         // Stake Settings
         nStakeSplitThreshold = 2000;
@@ -437,9 +444,14 @@ public:
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet = false);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+    /** Bring the cached zerocoin witnesses up to the tip if it changed; run by ThreadZerocoinWitnesses */
+    void UpdateZerocoinWitnessesIfStale();
+    void UpdateZerocoinWitnesses();
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    bool ScanBlockForWalletTransactions(const CBlock& block, CBlockIndex* pindex, bool fUpdate, double dProgressStart, double dProgressTip, int& nFound, int64_t& nNow);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
     CAmount GetBalance() const;
@@ -645,6 +657,9 @@ public:
 };
 
 
+/** Keep the cached zerocoin witnesses of pwallet up to the tip, off the validation path */
+void ThreadZerocoinWitnesses(CWallet* pwallet);
+
 /** A key allocated from the key pool. */
 class CReserveKey
 {
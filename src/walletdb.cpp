@@ -8,6 +8,7 @@
 
 #include "walletdb.h"
 
+#include "accumulators.h"
 #include "base58.h"
 #include "protocol.h"
 #include "serialize.h"
@@ -1048,12 +1049,43 @@ bool CWalletDB::ReadZerocoinSpendSerialEntry(const CBigNum& bnSerial)
     return Read(make_pair(string("zcserial"), bnSerial), spend);
 }
 
+bool CWalletDB::WriteZerocoinWitness(const CBigNum& bnPubcoin, const CAccumulatorWitnessCache& witnessCache)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnPubcoin;
+    uint256 hash = Hash(ss.begin(), ss.end());
+
+    return Write(make_pair(string("zcwitness"), hash), witnessCache, true);
+}
+
+bool CWalletDB::ReadZerocoinWitness(const CBigNum& bnPubcoin, CAccumulatorWitnessCache& witnessCache)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnPubcoin;
+    uint256 hash = Hash(ss.begin(), ss.end());
+
+    return Read(make_pair(string("zcwitness"), hash), witnessCache);
+}
+
+bool CWalletDB::EraseZerocoinWitness(const CBigNum& bnPubcoin)
+{
+    CDataStream ss(SER_GETHASH, 0);
+    ss << bnPubcoin;
+    uint256 hash = Hash(ss.begin(), ss.end());
+
+    return Erase(make_pair(string("zcwitness"), hash));
+}
+
 bool CWalletDB::WriteZerocoinMint(const CZerocoinMint& zerocoinMint)
 {
     CDataStream ss(SER_GETHASH, 0);
     ss << zerocoinMint.GetValue();
     uint256 hash = Hash(ss.begin(), ss.end());
 
+    // a spent mint will not need its witness again
+    if (zerocoinMint.IsUsed())
+        Erase(make_pair(string("zcwitness"), hash));
+
     Erase(make_pair(string("zerocoin"), hash));
     return Write(make_pair(string("zerocoin"), hash), zerocoinMint, true);
 }
@@ -1073,6 +1105,7 @@ bool CWalletDB::EraseZerocoinMint(const CZerocoinMint& zerocoinMint)
     ss << zerocoinMint.GetValue();
     uint256 hash = Hash(ss.begin(), ss.end());
 
+    Erase(make_pair(string("zcwitness"), hash));
     return Erase(make_pair(string("zerocoin"), hash));
 }
 
@@ -1091,6 +1124,7 @@ bool CWalletDB::ArchiveMintOrphan(const CZerocoinMint& zerocoinMint)
         LogPrintf("%s : failed to erase orphaned zerocoin mint\n", __func__);
         return false;
     }
+    Erase(make_pair(string("zcwitness"), hash));
 
     return true;
 }
@@ -1192,14 +1226,11 @@ std::list<CZerocoinMint> CWalletDB::ListMintedCoins(bool fUnusedOnly, bool fMatu
                 if (chainActive.Height() < mint.GetHeight() + 1)
                     continue;
 
-                CBlockIndex *pindex = chainActive[mint.GetHeight() + 1];
+                int nHeightLast = chainActive.Height() - 31; // 30 just to make sure that its at least 2 checkpoints from the top block
                 int nMintsAdded = 0;
-                while(pindex->nHeight < chainActive.Height() - 30) { // 30 just to make sure that its at least 2 checkpoints from the top block
-                    nMintsAdded += count(pindex->vMintDenominationsInBlock.begin(), pindex->vMintDenominationsInBlock.end(), mint.GetDenomination());
-                    if(nMintsAdded >= Params().Zerocoin_RequiredAccumulation())
-                        break;
-                    pindex = chainActive[pindex->nHeight + 1];
-                }
+                if (nHeightLast > mint.GetHeight())
+                    nMintsAdded = chainActive[nHeightLast]->GetZerocoinMintCount(mint.GetDenomination()) -
+                                  chainActive[mint.GetHeight()]->GetZerocoinMintCount(mint.GetDenomination());
 
                 if(nMintsAdded < Params().Zerocoin_RequiredAccumulation())
                     continue;
@@ -29,6 +29,7 @@ class CMasterKey;
 class CScript;
 class CWallet;
 class CWalletTx;
+class CAccumulatorWitnessCache;
 class CZerocoinMint;
 class CZerocoinSpend;
 class uint160;
@@ -164,6 +165,9 @@ public:
     bool WriteZerocoinSpendSerialEntry(const CZerocoinSpend& zerocoinSpend);
     bool EraseZerocoinSpendSerialEntry(const CBigNum& serialEntry);
     bool ReadZerocoinSpendSerialEntry(const CBigNum& bnSerial);
+    bool WriteZerocoinWitness(const CBigNum& bnPubcoin, const CAccumulatorWitnessCache& witnessCache);
+    bool ReadZerocoinWitness(const CBigNum& bnPubcoin, CAccumulatorWitnessCache& witnessCache);
+    bool EraseZerocoinWitness(const CBigNum& bnPubcoin);
 
 private:
     CWalletDB(const CWalletDB&);